@@ -0,0 +1,581 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* End-to-end benchmark of Thorenc and Thordec over the config presets.
+
+   Synthetic 4:2:0 sequences are generated for each resolution, encoded with every
+   config_*_{low,medium,high}*.txt preset in the current directory and decoded again.
+   For each run the tool reports encoder and decoder fps, per-frame latency percentiles,
+   peak RSS, bitrate and PSNR, and checks that the decoder output is identical to the
+   encoder reconstruction. Results can be written as CSV or JSON, and a previous CSV
+   can be given as a baseline to flag speed regressions. */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "global.h"
+#include "simd.h"
+#include "snr.h"
+#include "timer.h"
+
+#define E2E_MAX_CONFIGS 64
+#define E2E_MAX_SIZES 8
+#define E2E_MAX_FRAMES 1024
+#define E2E_MAX_RESULTS (E2E_MAX_CONFIGS * E2E_MAX_SIZES)
+#define E2E_MAX_ARGS 32
+
+typedef struct
+{
+  double fps;
+  double latency[4];        //Per-frame latency in ms: median, 90th and 99th percentile and maximum
+  long rss;                 //Peak resident set size in kB
+} e2e_timing_t;
+
+typedef struct
+{
+  char config[256];
+  int width;
+  int height;
+  int frames;
+  e2e_timing_t enc;
+  e2e_timing_t dec;
+  double kbps;
+  double psnr[3];
+  int mismatch;             //First frame where the decoder output differs from the reconstruction, or -1
+  int failed;
+  int regression;
+} e2e_result_t;
+
+typedef struct
+{
+  const char *encoder;
+  const char *decoder;
+  const char *dir;
+  const char *filter;
+  const char *csv;
+  const char *json;
+  const char *baseline;
+  int width[E2E_MAX_SIZES];
+  int height[E2E_MAX_SIZES];
+  int num_sizes;
+  int frames;
+  int qp;
+  int runs;
+  int keep;
+  double frame_rate;
+  double tolerance;         //Allowed fps drop against the baseline in percent
+} e2e_options_t;
+
+static void fatal(const char *msg, const char *arg)
+{
+  fprintf(stderr, "%s%s\n", msg, arg ? arg : "");
+  exit(2);
+}
+
+/* Synthetic content: a panning textured background, moving objects with sharp edges
+   and a small amount of noise, so that both motion search and intra coding get work */
+static void generate_sequence(const char *path, int width, int height, int frames)
+{
+  FILE *f = fopen(path, "wb");
+  int cw = width / 2, ch = height / 2;
+  unsigned char *buf = malloc(width * height * 3 / 2);
+  uint32_t seed = 0x12345678;
+
+  if (!f || !buf)
+    fatal("Could not create ", path);
+  for (int t = 0; t < frames; t++) {
+    unsigned char *y = buf, *u = buf + width * height, *v = u + cw * ch;
+    for (int i = 0; i < height; i++) {
+      for (int j = 0; j < width; j++) {
+        double bg = 110 + 40 * sin((j + 3 * t) / 11.0) * cos((i + t) / 17.0) + 30.0 * i / height;
+        int val = (int)bg;
+        for (int k = 0; k < 3; k++) {
+          int ox = (width / 4 + k * width / 4 + (k + 1) * 5 * t) % width;
+          int oy = (height / 3 + k * height / 5 + (2 - k) * 2 * t) % height;
+          if (j >= ox && j < ox + width / 8 && i >= oy && i < oy + height / 8)
+            val = ((j - ox) / 4 + (i - oy) / 4) & 1 ? 40 + 60 * k : 200 - 30 * k;
+        }
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        val += (int)(seed & 3) - 1;
+        y[i * width + j] = val < 0 ? 0 : val > 255 ? 255 : val;
+      }
+    }
+    for (int i = 0; i < ch; i++) {
+      for (int j = 0; j < cw; j++) {
+        u[i * cw + j] = 128 + (int)(20 * sin((j + t) / 23.0));
+        v[i * cw + j] = 128 + (int)(20 * cos((i - t) / 19.0));
+      }
+    }
+    if (fwrite(buf, 1, width * height * 3 / 2, f) != (size_t)(width * height * 3 / 2))
+      fatal("Problem writing ", path);
+  }
+  free(buf);
+  fclose(f);
+}
+
+static int compare_double(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Nearest rank percentiles of the per-frame latencies */
+static void latency_percentiles(double *times, int n, double latency[4])
+{
+  static const double p[3] = { 0.5, 0.9, 0.99 };
+  memset(latency, 0, 4 * sizeof(double));
+  if (n == 0)
+    return;
+  qsort(times, n, sizeof(double), compare_double);
+  for (int i = 0; i < 3; i++) {
+    int rank = (int)ceil(p[i] * n) - 1;
+    latency[i] = 1000 * times[rank < 0 ? 0 : rank];
+  }
+  latency[3] = 1000 * times[n - 1];
+}
+
+/* Run a program with its output written to a log file. Lines that start with the frame
+   marker are timestamped, and the time between consecutive ones is the latency of that frame.
+   Returns the exit status, or -1 if the program could not be run. */
+static int run_program(char *const argv[], const char *logpath, int encoder, double *frame_times, int *num_frames, double *elapsed, long *rss)
+{
+  int fd[2];
+  FILE *log = fopen(logpath, "w");
+  if (!log || pipe(fd))
+    return -1;
+
+  double start = get_wall_time();
+  pid_t pid = fork();
+  if (pid < 0)
+    return -1;
+  if (pid == 0) {
+    dup2(fd[1], STDOUT_FILENO);
+    dup2(fd[1], STDERR_FILENO);
+    close(fd[0]);
+    close(fd[1]);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  close(fd[1]);
+
+  char line[4096];
+  int len = 0, n = 0;
+  double last = start;
+  char c;
+  ssize_t r;
+  char chunk[4096];
+  while ((r = read(fd[0], chunk, sizeof(chunk))) > 0) {
+    double now = get_wall_time();
+    for (ssize_t k = 0; k < r; k++) {
+      c = chunk[k];
+      if (len < (int)sizeof(line) - 1)
+        line[len++] = c;
+      if (c != '\n')
+        continue;
+      line[len] = 0;
+      fputs(line, log);
+      /* Encoder lines are "<frame> <I|P|B> ...", decoder lines are "decode_frame_num=..." */
+      int frame_num;
+      char type;
+      int is_frame = encoder ? sscanf(line, "%d %c", &frame_num, &type) == 2 && (type == 'I' || type == 'P' || type == 'B')
+                             : !strncmp(line, "decode_frame_num=", 17);
+      if (is_frame && n < E2E_MAX_FRAMES) {
+        frame_times[n++] = now - last;
+        last = now;
+      }
+      len = 0;
+    }
+  }
+  close(fd[0]);
+  fclose(log);
+
+  int status;
+  struct rusage usage;
+  if (wait4(pid, &status, 0, &usage) != pid)
+    return -1;
+  *elapsed = get_wall_time() - start;
+  *rss = usage.ru_maxrss;
+  *num_frames = n;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static long file_size(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  long size = -1;
+  if (f) {
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fclose(f);
+  }
+  return size;
+}
+
+static double plane_psnr(const unsigned char *a, const unsigned char *b, int width, int height)
+{
+  double sse = (double)sse_plane_lbd(a, width, 0, b, width, 0, width, height, 8);
+  return sse > 0 ? 10 * log10(255.0 * 255.0 * width * height / sse) : 99.99;
+}
+
+/* Average PSNR of the decoded frames against the source, and the first frame where the decoder
+   output differs from the encoder reconstruction */
+static void check_output(const char *src, const char *rec, const char *dec, int width, int height, int frames, e2e_result_t *res)
+{
+  const int ysize = width * height, csize = ysize / 4, fsize = ysize + 2 * csize;
+  FILE *fs = fopen(src, "rb"), *fr = fopen(rec, "rb"), *fd = fopen(dec, "rb");
+  unsigned char *s = malloc(fsize), *r = malloc(fsize), *d = malloc(fsize);
+  int n = 0;
+
+  res->mismatch = -1;
+  res->psnr[0] = res->psnr[1] = res->psnr[2] = 0;
+  if (!fs || !fr || !fd || !s || !r || !d) {
+    res->mismatch = 0;
+  } else {
+    for (n = 0; n < frames; n++) {
+      size_t ns = fread(s, 1, fsize, fs), nr = fread(r, 1, fsize, fr), nd = fread(d, 1, fsize, fd);
+      if (ns != (size_t)fsize)
+        break;
+      if (res->mismatch < 0 && (nr != (size_t)fsize || nd != (size_t)fsize || memcmp(r, d, fsize)))
+        res->mismatch = n;
+      if (nd != (size_t)fsize)
+        break;
+      res->psnr[0] += plane_psnr(s, d, width, height);
+      res->psnr[1] += plane_psnr(s + ysize, d + ysize, width / 2, height / 2);
+      res->psnr[2] += plane_psnr(s + ysize + csize, d + ysize + csize, width / 2, height / 2);
+    }
+    if (n < frames && res->mismatch < 0)
+      res->mismatch = n;
+    for (int i = 0; i < 3; i++)
+      res->psnr[i] = n ? res->psnr[i] / n : 0;
+  }
+  if (fs) fclose(fs);
+  if (fr) fclose(fr);
+  if (fd) fclose(fd);
+  free(s);
+  free(r);
+  free(d);
+}
+
+static void run_config(e2e_options_t *opt, const char *config, const char *src, int width, int height, e2e_result_t *res)
+{
+  char bit[1024], rec[1024], dec[1024], enc_log[1024], dec_log[1024];
+  char ws[16], hs[16], ns[16], qs[16], fs[32];
+  double times[E2E_MAX_FRAMES];
+  double elapsed, best = 0;
+  int n;
+  long rss;
+
+  memset(res, 0, sizeof(*res));
+  snprintf(res->config, sizeof(res->config), "%s", config);
+  res->width = width;
+  res->height = height;
+  res->frames = opt->frames;
+  snprintf(bit, sizeof(bit), "%s/e2e_%dx%d_%s.bit", opt->dir, width, height, config);
+  snprintf(rec, sizeof(rec), "%s/e2e_%dx%d_%s.rec.yuv", opt->dir, width, height, config);
+  snprintf(dec, sizeof(dec), "%s/e2e_%dx%d_%s.dec.yuv", opt->dir, width, height, config);
+  snprintf(enc_log, sizeof(enc_log), "%s/e2e_%dx%d_%s.enc.log", opt->dir, width, height, config);
+  snprintf(dec_log, sizeof(dec_log), "%s/e2e_%dx%d_%s.dec.log", opt->dir, width, height, config);
+  snprintf(ws, sizeof(ws), "%d", width);
+  snprintf(hs, sizeof(hs), "%d", height);
+  snprintf(ns, sizeof(ns), "%d", opt->frames);
+  snprintf(qs, sizeof(qs), "%d", opt->qp);
+  snprintf(fs, sizeof(fs), "%g", opt->frame_rate);
+
+  char *enc_argv[E2E_MAX_ARGS] = { (char *)opt->encoder, "-cf", (char *)config, "-if", (char *)src,
+                                   "-width", ws, "-height", hs, "-n", ns, "-qp", qs, "-f", fs,
+                                   "-of", bit, "-rf", rec, NULL };
+  char *dec_argv[E2E_MAX_ARGS] = { (char *)opt->decoder, bit, dec, NULL };
+
+  /* The fastest of the runs is reported */
+  for (int run = 0; run < opt->runs; run++) {
+    if (run_program(enc_argv, enc_log, 1, times, &n, &elapsed, &rss) != 0) {
+      fprintf(stderr, "Encoder failed for %s at %dx%d, see %s\n", config, width, height, enc_log);
+      res->failed = 1;
+      return;
+    }
+    if (run == 0 || elapsed < best) {
+      best = elapsed;
+      res->enc.fps = n / elapsed;
+      res->enc.rss = rss;
+      latency_percentiles(times, n, res->enc.latency);
+    }
+  }
+
+  for (int run = 0; run < opt->runs; run++) {
+    if (run_program(dec_argv, dec_log, 0, times, &n, &elapsed, &rss) != 0) {
+      fprintf(stderr, "Decoder failed for %s at %dx%d, see %s\n", config, width, height, dec_log);
+      res->failed = 1;
+      return;
+    }
+    if (run == 0 || elapsed < best) {
+      best = elapsed;
+      res->dec.fps = n / elapsed;
+      res->dec.rss = rss;
+      latency_percentiles(times, n, res->dec.latency);
+    }
+  }
+
+  res->kbps = 8e-3 * file_size(bit) * opt->frame_rate / opt->frames;
+  check_output(src, rec, dec, width, height, opt->frames, res);
+
+  /* The logs are kept for failed runs */
+  if (!opt->keep) {
+    remove(bit);
+    remove(rec);
+    remove(dec);
+    if (res->mismatch < 0) {
+      remove(enc_log);
+      remove(dec_log);
+    }
+  }
+}
+
+static int find_configs(char configs[E2E_MAX_CONFIGS][256], const char *filter)
+{
+  DIR *dir = opendir(".");
+  struct dirent *entry;
+  int n = 0;
+  if (!dir)
+    return 0;
+  while ((entry = readdir(dir)) && n < E2E_MAX_CONFIGS) {
+    const char *name = entry->d_name;
+    size_t len = strlen(name);
+    if (strncmp(name, "config_", 7) || len < 4 || strcmp(name + len - 4, ".txt"))
+      continue;
+    if (!strstr(name, "_low") && !strstr(name, "_medium") && !strstr(name, "_high"))
+      continue;
+    if (filter && !strstr(name, filter))
+      continue;
+    snprintf(configs[n++], 256, "%s", name);
+  }
+  closedir(dir);
+  qsort(configs, n, 256, (int (*)(const void *, const void *))strcmp);
+  return n;
+}
+
+static const char *csv_header =
+  "config,width,height,frames,enc_fps,enc_p50_ms,enc_p90_ms,enc_p99_ms,enc_max_ms,enc_rss_kb,"
+  "dec_fps,dec_p50_ms,dec_p90_ms,dec_p99_ms,dec_max_ms,dec_rss_kb,kbps,psnr_y,psnr_u,psnr_v,mismatch_frame,status\n";
+
+static const char *status_string(e2e_result_t *res)
+{
+  return res->failed ? "FAILED" : res->mismatch >= 0 ? "MISMATCH" : res->regression ? "SLOWER" : "OK";
+}
+
+static void write_csv(const char *path, e2e_result_t *res, int n)
+{
+  FILE *f = fopen(path, "w");
+  if (!f)
+    fatal("Could not create ", path);
+  fputs(csv_header, f);
+  for (int i = 0; i < n; i++, res++) {
+    fprintf(f, "%s,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%ld,%.3f,%.3f,%.3f,%.3f,%.3f,%ld,%.3f,%.4f,%.4f,%.4f,%d,%s\n",
+            res->config, res->width, res->height, res->frames,
+            res->enc.fps, res->enc.latency[0], res->enc.latency[1], res->enc.latency[2], res->enc.latency[3], res->enc.rss,
+            res->dec.fps, res->dec.latency[0], res->dec.latency[1], res->dec.latency[2], res->dec.latency[3], res->dec.rss,
+            res->kbps, res->psnr[0], res->psnr[1], res->psnr[2], res->mismatch, status_string(res));
+  }
+  fclose(f);
+}
+
+static void write_timing_json(FILE *f, const char *name, e2e_timing_t *t)
+{
+  fprintf(f, "\"%s\": {\"fps\": %.3f, \"latency_ms\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f}, \"peak_rss_kb\": %ld}",
+          name, t->fps, t->latency[0], t->latency[1], t->latency[2], t->latency[3], t->rss);
+}
+
+static void write_json(const char *path, e2e_result_t *res, int n)
+{
+  FILE *f = fopen(path, "w");
+  if (!f)
+    fatal("Could not create ", path);
+  fprintf(f, "[\n");
+  for (int i = 0; i < n; i++, res++) {
+    fprintf(f, "  {\"config\": \"%s\", \"width\": %d, \"height\": %d, \"frames\": %d, ", res->config, res->width, res->height, res->frames);
+    write_timing_json(f, "encoder", &res->enc);
+    fprintf(f, ", ");
+    write_timing_json(f, "decoder", &res->dec);
+    fprintf(f, ", \"kbps\": %.3f, \"psnr\": {\"y\": %.4f, \"u\": %.4f, \"v\": %.4f}, \"mismatch_frame\": %d, \"status\": \"%s\"}%s\n",
+            res->kbps, res->psnr[0], res->psnr[1], res->psnr[2], res->mismatch, status_string(res), i < n - 1 ? "," : "");
+  }
+  fprintf(f, "]\n");
+  fclose(f);
+}
+
+/* Compare with a CSV written by an earlier run. Returns the number of speed regressions. */
+static int compare_baseline(e2e_options_t *opt, e2e_result_t *res, int n)
+{
+  FILE *f = fopen(opt->baseline, "r");
+  char line[2048];
+  int regressions = 0;
+
+  if (!f)
+    fatal("Could not open baseline ", opt->baseline);
+  printf("\n%-40s %-10s %9s %9s %9s %9s %8s %8s\n", "config", "size", "enc_fps", "base", "dec_fps", "base", "kbps%", "dPSNR");
+  while (fgets(line, sizeof(line), f)) {
+    char config[256];
+    int width, height, frames;
+    double v[19];
+    if (sscanf(line, "%255[^,],%d,%d,%d,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf,%lf",
+               config, &width, &height, &frames, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5],
+               &v[6], &v[7], &v[8], &v[9], &v[10], &v[11], &v[12], &v[13], &v[14], &v[15]) != 20)
+      continue;
+    for (int i = 0; i < n; i++) {
+      e2e_result_t *r = &res[i];
+      if (strcmp(r->config, config) || r->width != width || r->height != height || r->failed)
+        continue;
+      double enc_fps = v[0], dec_fps = v[6], kbps = v[12], psnr_y = v[13];
+      r->regression = r->enc.fps < enc_fps * (1 - opt->tolerance / 100) || r->dec.fps < dec_fps * (1 - opt->tolerance / 100);
+      regressions += r->regression;
+      printf("%-40s %4dx%-5d %9.2f %9.2f %9.2f %9.2f %+8.2f %+8.3f%s\n", config, width, height,
+             r->enc.fps, enc_fps, r->dec.fps, dec_fps, kbps > 0 ? 100 * (r->kbps - kbps) / kbps : 0, r->psnr[0] - psnr_y,
+             r->regression ? "  SLOWER" : "");
+    }
+  }
+  fclose(f);
+  return regressions;
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr,
+          "usage: %s [options]\n"
+          "  -enc <path>        Encoder binary (build/Thorenc)\n"
+          "  -dec <path>        Decoder binary (build/Thordec)\n"
+          "  -sizes <WxH,...>   Resolutions of the synthetic sequences (352x288,640x360)\n"
+          "  -n <frames>        Number of frames (10)\n"
+          "  -qp <qp>           Quantizer (32)\n"
+          "  -f <fps>           Frame rate used for the bitrate (30)\n"
+          "  -filter <text>     Only use the config files whose name contains text\n"
+          "  -runs <n>          Report the fastest of n runs (1)\n"
+          "  -dir <path>        Directory for sequences, bitstreams and logs (.)\n"
+          "  -keep              Keep the bitstreams and reconstructed files\n"
+          "  -csv <file>        Write the results as CSV\n"
+          "  -json <file>       Write the results as JSON\n"
+          "  -baseline <file>   Compare with the CSV of an earlier run\n"
+          "  -tolerance <pct>   Allowed fps drop against the baseline (5)\n"
+          "The config files are taken from the current directory.\n"
+          "Exits with 1 if a run failed, the decoder output mismatched or a run was slower than the baseline.\n",
+          prog);
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  e2e_options_t opt = { "build/Thorenc", "build/Thordec", ".", NULL, NULL, NULL, NULL,
+                        { 352, 640 }, { 288, 360 }, 2, 10, 32, 1, 0, 30.0, 5.0 };
+  static char configs[E2E_MAX_CONFIGS][256];
+  static e2e_result_t results[E2E_MAX_RESULTS];
+  int num_results = 0, failures = 0;
+
+  init_use_simd();
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+    if (!strcmp(arg, "-keep")) {
+      opt.keep = 1;
+      continue;
+    }
+    if (!val)
+      usage(argv[0]);
+    i++;
+    if (!strcmp(arg, "-enc")) opt.encoder = val;
+    else if (!strcmp(arg, "-dec")) opt.decoder = val;
+    else if (!strcmp(arg, "-dir")) opt.dir = val;
+    else if (!strcmp(arg, "-filter")) opt.filter = val;
+    else if (!strcmp(arg, "-csv")) opt.csv = val;
+    else if (!strcmp(arg, "-json")) opt.json = val;
+    else if (!strcmp(arg, "-baseline")) opt.baseline = val;
+    else if (!strcmp(arg, "-n")) opt.frames = atoi(val);
+    else if (!strcmp(arg, "-qp")) opt.qp = atoi(val);
+    else if (!strcmp(arg, "-f")) opt.frame_rate = atof(val);
+    else if (!strcmp(arg, "-runs")) opt.runs = atoi(val);
+    else if (!strcmp(arg, "-tolerance")) opt.tolerance = atof(val);
+    else if (!strcmp(arg, "-sizes")) {
+      const char *p = val;
+      opt.num_sizes = 0;
+      while (*p && opt.num_sizes < E2E_MAX_SIZES) {
+        int w, h, len;
+        if (sscanf(p, "%dx%d%n", &w, &h, &len) != 2 || w <= 0 || h <= 0 || (w | h) & 7)
+          fatal("Resolutions must be WxH with sizes divisible by 8: ", val);
+        opt.width[opt.num_sizes] = w;
+        opt.height[opt.num_sizes++] = h;
+        p += len;
+        if (*p == ',')
+          p++;
+      }
+    }
+    else usage(argv[0]);
+  }
+  if (opt.frames < 1 || opt.frames > E2E_MAX_FRAMES || opt.runs < 1)
+    fatal("Invalid number of frames or runs", NULL);
+
+  int num_configs = find_configs(configs, opt.filter);
+  if (!num_configs)
+    fatal("No config files found in the current directory", NULL);
+
+  printf("%-40s %-10s %8s %8s %8s %8s %8s %8s %8s %8s %9s %8s %s\n", "config", "size",
+         "enc_fps", "p50_ms", "p99_ms", "rss_MB", "dec_fps", "p50_ms", "p99_ms", "rss_MB", "kbps", "PSNR_Y", "status");
+  for (int s = 0; s < opt.num_sizes; s++) {
+    char src[1024];
+    snprintf(src, sizeof(src), "%s/e2e_%dx%d.yuv", opt.dir, opt.width[s], opt.height[s]);
+    generate_sequence(src, opt.width[s], opt.height[s], opt.frames);
+    for (int c = 0; c < num_configs; c++) {
+      e2e_result_t *res = &results[num_results++];
+      run_config(&opt, configs[c], src, opt.width[s], opt.height[s], res);
+      printf("%-40s %4dx%-5d %8.2f %8.2f %8.2f %8.1f %8.2f %8.2f %8.2f %8.1f %9.2f %8.3f %s\n",
+             res->config, res->width, res->height,
+             res->enc.fps, res->enc.latency[0], res->enc.latency[2], res->enc.rss / 1024.0,
+             res->dec.fps, res->dec.latency[0], res->dec.latency[2], res->dec.rss / 1024.0,
+             res->kbps, res->psnr[0], status_string(res));
+      fflush(stdout);
+      failures += res->failed || res->mismatch >= 0;
+    }
+    if (!opt.keep)
+      remove(src);
+  }
+
+  if (opt.baseline)
+    failures += compare_baseline(&opt, results, num_results);
+  if (opt.csv)
+    write_csv(opt.csv, results, num_results);
+  if (opt.json)
+    write_json(opt.json, results, num_results);
+  return failures != 0;
+}
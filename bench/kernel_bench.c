@@ -0,0 +1,1114 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Microbenchmark of the SIMD kernels with checks for bit-exact agreement with the C code.
+   The C reference is the codec function with use_simd cleared. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "simd.h"
+#include "timer.h"
+#include "common_block.h"
+#include "common_frame.h"
+#include "common_kernels.h"
+#include "inter_prediction.h"
+#include "snr.h"
+#include "temporal_interp.h"
+#include "transform.h"
+#include "../enc/encode_block.h"
+#include "../enc/enc_kernels.h"
+#include "kernel_bench.h"
+
+#define BENCH_STRIDE 512         //Stride of the sample buffers
+#define BENCH_MARGIN 192         //Room around the blocks for motion vectors and filter taps
+#define BENCH_SAMPLES (1 << 21)  //Number of samples processed per timed configuration
+#define BENCH_TRIALS 12          //Number of random inputs per checked configuration
+#define BENCH_PARAMS 16          //Number of parameter sets cycled through when timing
+#define BENCH_STRIDE16 32        //Stride of the CDEF input buffer
+
+typedef struct
+{
+  SAMPLE *src0;
+  SAMPLE *src1;
+  SAMPLE *dst_c;
+  SAMPLE *dst_s;
+  int16_t *block;
+  int16_t *coeff_c;
+  int16_t *coeff_s;
+  uint16_t *in16;
+} bench_buffers_t;
+
+static uint32_t rnd_state;
+
+static uint32_t rnd(void)
+{
+  uint32_t x = rnd_state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return rnd_state = x;
+}
+
+/* Random value in the range [lo, hi] */
+static int rnd_range(int lo, int hi)
+{
+  return lo + (int)(rnd() % (uint32_t)(hi - lo + 1));
+}
+
+/* Fill a buffer with uniform noise, extreme values or a smooth random walk */
+static void fill(SAMPLE *buf, int size, int bitdepth, int mode)
+{
+  const int maxval = (1 << bitdepth) - 1;
+  int v = rnd_range(0, maxval);
+  for (int i = 0; i < size; i++) {
+    if (mode == 0)
+      buf[i] = rnd_range(0, maxval);
+    else if (mode == 1)
+      buf[i] = rnd() & 1 ? maxval : 0;
+    else {
+      int step = rnd_range(-4, 4) * (1 << (bitdepth - 8));
+      v = clip(v + step, 0, maxval);
+      buf[i] = v;
+    }
+  }
+}
+
+static void fill_sources(bench_buffers_t *buf, int bitdepth, int trial)
+{
+  fill(buf->src0, BENCH_STRIDE * BENCH_STRIDE, bitdepth, trial % 3);
+  fill(buf->src1, BENCH_STRIDE * BENCH_STRIDE, bitdepth, trial % 3);
+}
+
+/* Sample (y, x) relative to the top-left sample after the margin */
+static SAMPLE *at(SAMPLE *buf, int y, int x)
+{
+  return buf + (BENCH_MARGIN + y) * BENCH_STRIDE + BENCH_MARGIN + x;
+}
+
+static int skip(bench_options_t *opt, const char *kernel)
+{
+  return opt->filter && !strstr(kernel, opt->filter);
+}
+
+static int iterations(bench_options_t *opt, int samples)
+{
+  return opt->check_only ? 0 : max(8, (int)(opt->scale * BENCH_SAMPLES / samples));
+}
+
+static int equal_blocks(const SAMPLE *a, const SAMPLE *b, int stride, int width, int height)
+{
+  for (int i = 0; i < height; i++)
+    if (memcmp(a + i * stride, b + i * stride, width * sizeof(SAMPLE)))
+      return 0;
+  return 1;
+}
+
+/* Block sizes with widths from minw to maxw and heights of half, equal or twice the width */
+static int block_sizes(int minw, int maxw, int minh, int maxh, int width[], int height[])
+{
+  int n = 0;
+  for (int w = minw; w <= maxw; w *= 2) {
+    for (int k = -1; k <= 1; k++) {
+      int h = k < 0 ? w / 2 : w << k;
+      if (h >= minh && h <= maxh) {
+        width[n] = w;
+        height[n++] = h;
+      }
+    }
+  }
+  return n;
+}
+
+/* Random offsets of a reference block with the horizontal offset a multiple of align */
+static void random_offsets(int off[BENCH_PARAMS], int range, int align)
+{
+  for (int i = 0; i < BENCH_PARAMS; i++)
+    off[i] = rnd_range(-range, range) * BENCH_STRIDE + rnd_range(-range / align, range / align) * align;
+}
+
+/* Time the calls of stmt for the C code and the SIMD code where p cycles through the parameter sets */
+#define BENCH_TIME(simd, stmt) do {                             \
+    int iterations_ = bench_iterations;                         \
+    use_simd = simd;                                            \
+    uint64_t c0_ = bench_cycles();                              \
+    double t0_ = get_wall_time();                               \
+    for (int it_ = 0; it_ < iterations_; it_++) {               \
+      int p = it_ % BENCH_PARAMS;                               \
+      (void)p;                                                  \
+      stmt;                                                     \
+    }                                                           \
+    bench_time[simd] = get_wall_time() - t0_;                   \
+    bench_cyc[simd] = bench_cycles() - c0_;                     \
+    use_simd = 1;                                               \
+  } while (0)
+
+#define BENCH_REPORT(kernel, config, ok, samples)               \
+  bench_report(opt, kernel, bitdepth, config, ok, samples, bench_iterations, \
+               bench_time[0], bench_cyc[0], bench_time[1], bench_cyc[1])
+
+static volatile uint64_t sink;
+
+/* sad_calc_simd, sad_calc_simd_unaligned, ssd_calc_simd and widesad_calc_simd */
+static void bench_sad(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  static const char *names[] = { "sad_calc_simd", "sad_calc_simd_unaligned", "ssd_calc_simd", "widesad_calc_simd" };
+  int width[32], height[32];
+  int n = block_sizes(8, 128, 4, 128, width, height);
+  int off[BENCH_PARAMS];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  for (int kernel = 0; kernel < 4; kernel++) {
+    if (skip(opt, names[kernel]))
+      continue;
+    for (int s = 0; s < n; s++) {
+      const int w = width[s], h = height[s];
+      const int aoff = kernel == 1; // Misaligned original for the unaligned version
+      char config[32];
+      int x;
+      if ((kernel == 2 && w != h) || (kernel == 3 && (w != 16 || h != 16)))
+        continue;
+      random_offsets(off, 16, kernel == 2 ? 16 : 1); // The SSD reference block is aligned
+
+      int ok = 1;
+      for (int t = 0; t < BENCH_TRIALS; t++) {
+        SAMPLE *a = at(buf->src0, 0, aoff);
+        SAMPLE *b = at(buf->src1, 0, 0) + off[t % BENCH_PARAMS];
+        uint64_t rc, rs;
+        int xc = 0, xs = 0;
+        fill_sources(buf, bitdepth, t);
+        use_simd = 0;
+        rc = kernel == 2 ? TEMPLATE(ssd_calc)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h) :
+          kernel == 3 ? TEMPLATE(widesad_calc)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h, &xc) :
+          TEMPLATE(sad_calc)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h);
+        use_simd = 1;
+        rs = kernel == 0 ? (uint64_t)TEMPLATE(sad_calc_simd)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h) :
+          kernel == 1 ? (uint64_t)TEMPLATE(sad_calc_simd_unaligned)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h) :
+          kernel == 2 ? TEMPLATE(ssd_calc_simd)(a, b, BENCH_STRIDE, BENCH_STRIDE, w) :
+          TEMPLATE(widesad_calc_simd)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h, &xs);
+        ok &= rc == rs && xc == xs;
+      }
+
+      const int bench_iterations = iterations(opt, w * h);
+      SAMPLE *a = at(buf->src0, 0, aoff);
+      SAMPLE *b = at(buf->src1, 0, 0);
+      if (kernel == 2) {
+        BENCH_TIME(0, sink += TEMPLATE(ssd_calc)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h));
+        BENCH_TIME(1, sink += TEMPLATE(ssd_calc_simd)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w));
+      } else if (kernel == 3) {
+        BENCH_TIME(0, sink += TEMPLATE(widesad_calc)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h, &x));
+        BENCH_TIME(1, sink += TEMPLATE(widesad_calc_simd)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h, &x));
+      } else {
+        BENCH_TIME(0, sink += TEMPLATE(sad_calc)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h));
+        if (kernel == 0)
+          BENCH_TIME(1, sink += TEMPLATE(sad_calc_simd)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h));
+        else
+          BENCH_TIME(1, sink += TEMPLATE(sad_calc_simd_unaligned)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h));
+      }
+      sprintf(config, "%dx%d", w, h);
+      BENCH_REPORT(names[kernel], config, ok, w * h);
+    }
+  }
+}
+
+/* sad_calc_fasthalf_simd and sad_calc_fastquarter_simd */
+static void bench_fast_subpel(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  static const char *names[] = { "sad_calc_fasthalf_simd", "sad_calc_fastquarter_simd" };
+  int width[32], height[32];
+  int n = block_sizes(8, 128, 4, 128, width, height);
+  int off[BENCH_PARAMS];
+  int half[BENCH_PARAMS][2];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  for (int kernel = 0; kernel < 2; kernel++) {
+    if (skip(opt, names[kernel]))
+      continue;
+    for (int s = 0; s < n; s++) {
+      const int w = width[s], h = height[s];
+      char config[32];
+      random_offsets(off, 16, 1);
+      for (int i = 0; i < BENCH_PARAMS; i++) {
+        // The quarter-pel search starts from the best half-pel position
+        half[i][0] = rnd_range(-1, 1) * 2;
+        half[i][1] = rnd_range(-1, 1) * 2;
+      }
+
+      int ok = 1;
+      for (int t = 0; t < BENCH_TRIALS; t++) {
+        SAMPLE *a = at(buf->src0, 0, 0);
+        SAMPLE *b = at(buf->src1, 0, 0) + off[t % BENCH_PARAMS];
+        int xc = half[t % BENCH_PARAMS][0], yc = half[t % BENCH_PARAMS][1];
+        int xs = xc, ys = yc;
+        unsigned int rc, rs;
+        fill_sources(buf, bitdepth, t);
+        if (kernel) {
+          rc = TEMPLATE(sad_calc_fastquarter)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h, &xc, &yc);
+          rs = TEMPLATE(sad_calc_fastquarter_simd)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h, &xs, &ys);
+        } else {
+          rc = TEMPLATE(sad_calc_fasthalf)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h, &xc, &yc);
+          rs = TEMPLATE(sad_calc_fasthalf_simd)(a, b, BENCH_STRIDE, BENCH_STRIDE, w, h, &xs, &ys);
+        }
+        ok &= rc == rs && xc == xs && yc == ys;
+      }
+
+      const int bench_iterations = iterations(opt, w * h);
+      SAMPLE *a = at(buf->src0, 0, 0);
+      SAMPLE *b = at(buf->src1, 0, 0);
+      int x, y;
+      if (kernel) {
+        BENCH_TIME(0, x = half[p][0]; y = half[p][1]; sink += TEMPLATE(sad_calc_fastquarter)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h, &x, &y));
+        BENCH_TIME(1, x = half[p][0]; y = half[p][1]; sink += TEMPLATE(sad_calc_fastquarter_simd)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h, &x, &y));
+      } else {
+        BENCH_TIME(0, sink += TEMPLATE(sad_calc_fasthalf)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h, &x, &y));
+        BENCH_TIME(1, sink += TEMPLATE(sad_calc_fasthalf_simd)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, w, h, &x, &y));
+      }
+      sprintf(config, "%dx%d", w, h);
+      BENCH_REPORT(names[kernel], config, ok, w * h);
+    }
+  }
+}
+
+/* get_inter_prediction_luma_simd and get_inter_prediction_chroma_simd for all fractional positions */
+static void bench_inter_prediction(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  static const char *names[] = { "get_inter_prediction_luma_simd", "get_inter_prediction_chroma_simd" };
+  int width[32], height[32];
+  int off[BENCH_PARAMS];
+  mv_t mv[BENCH_PARAMS];
+  int bipred[BENCH_PARAMS];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  for (int chroma = 0; chroma < 2; chroma++) {
+    if (skip(opt, names[chroma]))
+      continue;
+    const int frac_bits = chroma ? 3 : 2;
+    const int num_frac = 1 << (2 * frac_bits);
+    int n = chroma ? block_sizes(4, MAX_SB_SIZE / 2, 2, MAX_SB_SIZE / 2, width, height) : block_sizes(4, MAX_SB_SIZE, 4, MAX_SB_SIZE, width, height);
+    for (int s = 0; s < n; s++) {
+      const int w = width[s], h = height[s];
+      char config[32];
+      random_offsets(off, 64, 1);
+      for (int i = 0; i < BENCH_PARAMS; i++) {
+        int frac = rnd_range(1, num_frac - 1);
+        mv[i].x = frac & ((1 << frac_bits) - 1);
+        mv[i].y = frac >> frac_bits;
+        bipred[i] = rnd_range(0, 2);
+      }
+
+      /* Check every fractional position and all bipred filter variants */
+      int ok = 1;
+      for (int t = 0; t < BENCH_TRIALS; t++) {
+        fill_sources(buf, bitdepth, t);
+        SAMPLE *ref = at(buf->src0, 0, 0) + off[t % BENCH_PARAMS];
+        for (int frac = 1; frac < num_frac; frac++) {
+          for (int bi = 0; bi < (chroma ? 1 : 3); bi++) {
+            mv_t m;
+            m.x = frac & ((1 << frac_bits) - 1);
+            m.y = frac >> frac_bits;
+            use_simd = 0;
+            if (chroma)
+              TEMPLATE(get_inter_prediction_chroma)(buf->dst_c, ref, w, h, BENCH_STRIDE, MAX_SB_SIZE, &m, 0, BENCH_STRIDE, BENCH_STRIDE, 0, 0, bitdepth);
+            else
+              TEMPLATE(get_inter_prediction_luma)(buf->dst_c, ref, w, h, BENCH_STRIDE, MAX_SB_SIZE, &m, 0, bi, BENCH_STRIDE, BENCH_STRIDE, 0, 0, bitdepth);
+            use_simd = 1;
+            if (chroma)
+              TEMPLATE(get_inter_prediction_chroma_simd)(w, h, m.x, m.y, buf->dst_s, MAX_SB_SIZE, ref, BENCH_STRIDE, bitdepth);
+            else
+              TEMPLATE(get_inter_prediction_luma_simd)(w, h, m.x, m.y, buf->dst_s, MAX_SB_SIZE, ref, BENCH_STRIDE, bi, bitdepth);
+            ok &= equal_blocks(buf->dst_c, buf->dst_s, MAX_SB_SIZE, w, h);
+          }
+        }
+      }
+
+      const int bench_iterations = iterations(opt, w * h);
+      SAMPLE *ref = at(buf->src0, 0, 0);
+      if (chroma) {
+        BENCH_TIME(0, TEMPLATE(get_inter_prediction_chroma)(buf->dst_c, ref + off[p], w, h, BENCH_STRIDE, MAX_SB_SIZE, &mv[p], 0, BENCH_STRIDE, BENCH_STRIDE, 0, 0, bitdepth));
+        BENCH_TIME(1, TEMPLATE(get_inter_prediction_chroma_simd)(w, h, mv[p].x, mv[p].y, buf->dst_s, MAX_SB_SIZE, ref + off[p], BENCH_STRIDE, bitdepth));
+      } else {
+        BENCH_TIME(0, TEMPLATE(get_inter_prediction_luma)(buf->dst_c, ref + off[p], w, h, BENCH_STRIDE, MAX_SB_SIZE, &mv[p], 0, bipred[p], BENCH_STRIDE, BENCH_STRIDE, 0, 0, bitdepth));
+        BENCH_TIME(1, TEMPLATE(get_inter_prediction_luma_simd)(w, h, mv[p].x, mv[p].y, buf->dst_s, MAX_SB_SIZE, ref + off[p], BENCH_STRIDE, bipred[p], bitdepth));
+      }
+      sprintf(config, "%dx%d", w, h);
+      BENCH_REPORT(names[chroma], config, ok, w * h);
+    }
+  }
+}
+
+/* transform_simd and inverse_transform_simd */
+static void bench_transform(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  static const char *names[] = { "transform_simd", "inverse_transform_simd" };
+  const int maxval = (1 << bitdepth) - 1;
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  for (int inverse = 0; inverse < 2; inverse++) {
+    if (skip(opt, names[inverse]))
+      continue;
+    for (int size = 4; size <= (inverse ? 32 : 64); size *= 2) {
+      for (int fast = 0; fast < 2 - inverse; fast++) {
+        char config[32];
+        int ok = 1;
+        for (int t = 0; t < BENCH_TRIALS; t++) {
+          // Residuals of uniform noise, extreme values or a smooth signal
+          int v = 0;
+          for (int i = 0; i < size * size; i++) {
+            int mode = t % 3;
+            int step = rnd_range(-4, 4);
+            v = clip(v + step, -maxval, maxval);
+            buf->block[i] = mode == 0 ? rnd_range(-maxval, maxval) : mode == 1 ? (rnd() & 1 ? maxval : -maxval) : v;
+          }
+          if (inverse) {
+            // Coefficients of a realistic residual
+            use_simd = 0;
+            transform(buf->block, buf->block, size, 0, bitdepth);
+            inverse_transform(buf->block, buf->coeff_c, size, bitdepth);
+            use_simd = 1;
+            inverse_transform_simd(buf->block, buf->coeff_s, size, bitdepth);
+          } else {
+            use_simd = 0;
+            transform(buf->block, buf->coeff_c, size, fast, bitdepth);
+            use_simd = 1;
+            transform_simd(buf->block, buf->coeff_s, size, fast, bitdepth);
+          }
+          if (inverse)
+            ok &= !memcmp(buf->coeff_c, buf->coeff_s, size * size * sizeof(int16_t));
+          else {
+            // Only the low frequency coefficients that can be quantised are computed
+            const int qsize = min(size, MAX_QUANT_SIZE);
+            for (int i = 0; i < qsize; i++)
+              ok &= !memcmp(buf->coeff_c + i * size, buf->coeff_s + i * size, qsize * sizeof(int16_t));
+          }
+        }
+
+        const int bench_iterations = iterations(opt, size * size);
+        if (inverse) {
+          BENCH_TIME(0, inverse_transform(buf->block, buf->coeff_c, size, bitdepth));
+          BENCH_TIME(1, inverse_transform_simd(buf->block, buf->coeff_s, size, bitdepth));
+          sprintf(config, "%dx%d", size, size);
+        } else {
+          BENCH_TIME(0, transform(buf->block, buf->coeff_c, size, fast, bitdepth));
+          BENCH_TIME(1, transform_simd(buf->block, buf->coeff_s, size, fast, bitdepth));
+          sprintf(config, "%dx%d%s", size, size, fast ? " fast" : "");
+        }
+        BENCH_REPORT(names[inverse], config, ok, size * size);
+      }
+    }
+  }
+}
+
+/* calc_cbp_simd */
+static void bench_cbp(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  const int maxval = (1 << bitdepth) - 1;
+  int threshold[BENCH_PARAMS];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  if (skip(opt, "calc_cbp_simd"))
+    return;
+  for (int size = 4; size <= 16; size *= 2) {
+    char config[32];
+    int ok = 1;
+    for (int i = 0; i < BENCH_PARAMS; i++)
+      threshold[i] = rnd_range(0, 4 * maxval);
+    for (int t = 0; t < BENCH_TRIALS * 4; t++) {
+      for (int i = 0; i < size * size; i++)
+        buf->block[i] = rnd_range(-maxval, maxval) >> (t % 4);
+      ok &= calc_cbp(buf->block, size, threshold[t % BENCH_PARAMS]) == calc_cbp_simd(buf->block, size, threshold[t % BENCH_PARAMS]);
+    }
+
+    const int bench_iterations = iterations(opt, size * size);
+    BENCH_TIME(0, sink += calc_cbp(buf->block, size, threshold[p]));
+    BENCH_TIME(1, sink += calc_cbp_simd(buf->block, size, threshold[p]));
+    sprintf(config, "%dx%d", size, size);
+    BENCH_REPORT("calc_cbp_simd", config, ok, size * size);
+  }
+}
+
+/* clpf_block4, clpf_block8 and their noclip variants */
+static void bench_clpf(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  static const char *names[] = { "clpf_block4", "clpf_block8", "clpf_block4_noclip", "clpf_block8_noclip" };
+  const int shift = bitdepth - 8;
+  unsigned int strength[BENCH_PARAMS], damping[BENCH_PARAMS];
+  int bt[BENCH_PARAMS];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  for (int kernel = 0; kernel < 4; kernel++) {
+    if (skip(opt, names[kernel]))
+      continue;
+    const int sizex = kernel & 1 ? 8 : 4;
+    const int noclip = kernel >= 2;
+    for (int sizey = 4; sizey <= 8; sizey += 4) {
+      char config[32];
+      for (int i = 0; i < BENCH_PARAMS; i++) {
+        strength[i] = 1 << (rnd_range(0, 2) + shift);
+        damping[i] = rnd_range(bitdepth - 5, bitdepth - 1);
+        bt[i] = noclip ? 0 : rnd_range(0, 15);
+      }
+
+      /* The block is placed away from the buffer edges so that the unclipped taps are valid */
+      const SAMPLE *src = at(buf->src0, 0, 0);
+      const int x0 = 16, y0 = 16;
+      int ok = 1;
+      for (int t = 0; t < BENCH_TRIALS * 4; t++) {
+        int b = noclip ? 0 : t % 16;
+        unsigned int s = 1 << (t % 3 + shift);
+        unsigned int d = bitdepth - 5 + t % 5;
+        fill_sources(buf, bitdepth, t);
+        memset(buf->dst_c, 0, MAX_SB_SIZE * MAX_SB_SIZE * sizeof(SAMPLE));
+        memset(buf->dst_s, 0, MAX_SB_SIZE * MAX_SB_SIZE * sizeof(SAMPLE));
+        TEMPLATE(clpf_block)(src, buf->dst_c, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizex, sizey, b, s, d);
+        switch (kernel) {
+        case 0: TEMPLATE(clpf_block4)(src, buf->dst_s, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizey, b, s, d); break;
+        case 1: TEMPLATE(clpf_block8)(src, buf->dst_s, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizey, b, s, d); break;
+        case 2: TEMPLATE(clpf_block4_noclip)(src, buf->dst_s, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizey, s, d); break;
+        default: TEMPLATE(clpf_block8_noclip)(src, buf->dst_s, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizey, s, d); break;
+        }
+        ok &= equal_blocks(buf->dst_c, buf->dst_s, MAX_SB_SIZE, MAX_SB_SIZE, MAX_SB_SIZE);
+      }
+
+      const int bench_iterations = iterations(opt, sizex * sizey);
+      BENCH_TIME(0, TEMPLATE(clpf_block)(src, buf->dst_c, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizex, sizey, bt[p], strength[p], damping[p]));
+      switch (kernel) {
+      case 0: BENCH_TIME(1, TEMPLATE(clpf_block4)(src, buf->dst_s, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizey, bt[p], strength[p], damping[p])); break;
+      case 1: BENCH_TIME(1, TEMPLATE(clpf_block8)(src, buf->dst_s, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizey, bt[p], strength[p], damping[p])); break;
+      case 2: BENCH_TIME(1, TEMPLATE(clpf_block4_noclip)(src, buf->dst_s, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizey, strength[p], damping[p])); break;
+      default: BENCH_TIME(1, TEMPLATE(clpf_block8_noclip)(src, buf->dst_s, BENCH_STRIDE, MAX_SB_SIZE, x0, y0, sizey, strength[p], damping[p])); break;
+      }
+      sprintf(config, "%dx%d", sizex, sizey);
+      BENCH_REPORT(names[kernel], config, ok, sizex * sizey);
+    }
+  }
+}
+
+/* detect_clpf_simd and detect_multi_clpf_simd over the 8x8 blocks of a 64x64 frame */
+static void bench_detect_clpf(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  static const char *names[] = { "detect_clpf_simd", "detect_multi_clpf_simd" };
+  const int shift = bitdepth - 8;
+  const int size = 8, fsize = 64;
+  int pos[BENCH_PARAMS][2];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  for (int multi = 0; multi < 2; multi++) {
+    if (skip(opt, names[multi]))
+      continue;
+    const SAMPLE *rec = at(buf->src0, 0, 0);
+    const SAMPLE *org = at(buf->src1, 0, 0);
+    for (int i = 0; i < BENCH_PARAMS; i++) {
+      pos[i][0] = rnd_range(0, fsize / size - 1) * size;
+      pos[i][1] = rnd_range(0, fsize / size - 1) * size;
+    }
+
+    int ok = 1;
+    for (int t = 0; t < BENCH_TRIALS; t++) {
+      unsigned int d = bitdepth - 5 + t % 5;
+      fill_sources(buf, bitdepth, t);
+      for (int y0 = 0; y0 < fsize; y0 += size) {
+        for (int x0 = 0; x0 < fsize; x0 += size) {
+          int sc[4] = { 0 }, ss[4] = { 0 };
+          if (multi) {
+            TEMPLATE(detect_multi_clpf)(rec, org, x0, y0, fsize, fsize, BENCH_STRIDE, BENCH_STRIDE, sc, shift, size, d);
+            TEMPLATE(detect_multi_clpf_simd)(rec, org, x0, y0, fsize, fsize, BENCH_STRIDE, BENCH_STRIDE, ss, shift, size, d);
+          } else {
+            unsigned int s = 1 << (t % 3 + shift);
+            TEMPLATE(detect_clpf)(rec, org, x0, y0, fsize, fsize, BENCH_STRIDE, BENCH_STRIDE, sc, sc + 1, s, shift, size, d);
+            TEMPLATE(detect_clpf_simd)(rec, org, x0, y0, fsize, fsize, BENCH_STRIDE, BENCH_STRIDE, ss, ss + 1, s, shift, size, d);
+          }
+          ok &= !memcmp(sc, ss, sizeof(sc));
+        }
+      }
+    }
+
+    const int bench_iterations = iterations(opt, size * size);
+    int sum[4] = { 0 };
+    if (multi) {
+      BENCH_TIME(0, TEMPLATE(detect_multi_clpf)(rec, org, pos[p][1], pos[p][0], fsize, fsize, BENCH_STRIDE, BENCH_STRIDE, sum, shift, size, bitdepth - 4));
+      BENCH_TIME(1, TEMPLATE(detect_multi_clpf_simd)(rec, org, pos[p][1], pos[p][0], fsize, fsize, BENCH_STRIDE, BENCH_STRIDE, sum, shift, size, bitdepth - 4));
+    } else {
+      BENCH_TIME(0, TEMPLATE(detect_clpf)(rec, org, pos[p][1], pos[p][0], fsize, fsize, BENCH_STRIDE, BENCH_STRIDE, sum, sum + 1, 1 << shift, shift, size, bitdepth - 4));
+      BENCH_TIME(1, TEMPLATE(detect_clpf_simd)(rec, org, pos[p][1], pos[p][0], fsize, fsize, BENCH_STRIDE, BENCH_STRIDE, sum, sum + 1, 1 << shift, shift, size, bitdepth - 4));
+    }
+    sink += sum[0];
+    BENCH_REPORT(names[multi], "8x8", ok, size * size);
+  }
+}
+
+#if CDEF
+/* cdef_filter_block_simd and cdef_find_dir_simd */
+static void bench_cdef(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  const int coeff_shift = bitdepth - 8;
+  const int maxval = (1 << bitdepth) - 1;
+  int cdef_directions[8][2 + CDEF_FULL];
+  int pri[BENCH_PARAMS], sec[BENCH_PARAMS], dir[BENCH_PARAMS], pri_damping[BENCH_PARAMS], sec_damping[BENCH_PARAMS];
+  uint16_t *in = buf->in16 + 2 * BENCH_STRIDE16 + 16;
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+  char config[32];
+
+  cdef_init(BENCH_STRIDE16, cdef_directions);
+  for (int bsize = 4; bsize <= 8 && !skip(opt, "cdef_filter_block_simd"); bsize += 4) {
+    for (int i = 0; i < BENCH_PARAMS; i++) {
+      int damping = rnd_range(3, 6);
+      int strength = rnd_range(0, CDEF_PRI_STRENGTHS - 1);
+      pri[i] = strength << coeff_shift;
+      sec[i] = (rnd_range(0, 3) == 3 ? 4 : rnd_range(0, 2)) << coeff_shift;
+      dir[i] = rnd_range(0, 7);
+      pri_damping[i] = (strength ? max(log2i(strength), damping) : damping) + coeff_shift;
+      sec_damping[i] = damping + coeff_shift;
+    }
+
+    int ok = 1;
+    for (int t = 0; t < BENCH_TRIALS * 8; t++) {
+      int p = t % BENCH_PARAMS;
+      /* Frame edges are marked as very large values in the rows and columns outside the block */
+      int edges = rnd_range(0, 15);
+      for (int i = -2; i < bsize + 2; i++) {
+        for (int j = -2; j < bsize + 2; j++) {
+          int outside = (i < 0 && (edges & 1)) || (i >= bsize && (edges & 2)) || (j < 0 && (edges & 4)) || (j >= bsize && (edges & 8));
+          in[i * BENCH_STRIDE16 + j] = outside ? CDEF_VERY_LARGE : t % 3 == 1 ? (rnd() & 1) * maxval : rnd_range(0, maxval);
+        }
+      }
+#ifdef HBD
+      cdef_filter_block(NULL, (uint16_t *)buf->dst_c, MAX_SB_SIZE, in, BENCH_STRIDE16, pri[p], sec[p], dir[p], pri_damping[p], sec_damping[p], bsize, cdef_directions, coeff_shift);
+      cdef_filter_block_simd(NULL, (uint16_t *)buf->dst_s, MAX_SB_SIZE, in, BENCH_STRIDE16, pri[p], sec[p], dir[p], pri_damping[p], sec_damping[p], bsize, cdef_directions, coeff_shift);
+#else
+      cdef_filter_block((uint8_t *)buf->dst_c, NULL, MAX_SB_SIZE, in, BENCH_STRIDE16, pri[p], sec[p], dir[p], pri_damping[p], sec_damping[p], bsize, cdef_directions, coeff_shift);
+      cdef_filter_block_simd((uint8_t *)buf->dst_s, NULL, MAX_SB_SIZE, in, BENCH_STRIDE16, pri[p], sec[p], dir[p], pri_damping[p], sec_damping[p], bsize, cdef_directions, coeff_shift);
+#endif
+      ok &= equal_blocks(buf->dst_c, buf->dst_s, MAX_SB_SIZE, bsize, bsize);
+    }
+
+    const int bench_iterations = iterations(opt, bsize * bsize);
+#ifdef HBD
+    BENCH_TIME(0, cdef_filter_block(NULL, (uint16_t *)buf->dst_c, MAX_SB_SIZE, in, BENCH_STRIDE16, pri[p], sec[p], dir[p], pri_damping[p], sec_damping[p], bsize, cdef_directions, coeff_shift));
+    BENCH_TIME(1, cdef_filter_block_simd(NULL, (uint16_t *)buf->dst_s, MAX_SB_SIZE, in, BENCH_STRIDE16, pri[p], sec[p], dir[p], pri_damping[p], sec_damping[p], bsize, cdef_directions, coeff_shift));
+#else
+    BENCH_TIME(0, cdef_filter_block((uint8_t *)buf->dst_c, NULL, MAX_SB_SIZE, in, BENCH_STRIDE16, pri[p], sec[p], dir[p], pri_damping[p], sec_damping[p], bsize, cdef_directions, coeff_shift));
+    BENCH_TIME(1, cdef_filter_block_simd((uint8_t *)buf->dst_s, NULL, MAX_SB_SIZE, in, BENCH_STRIDE16, pri[p], sec[p], dir[p], pri_damping[p], sec_damping[p], bsize, cdef_directions, coeff_shift));
+#endif
+    sprintf(config, "%dx%d", bsize, bsize);
+    BENCH_REPORT("cdef_filter_block_simd", config, ok, bsize * bsize);
+  }
+
+  if (!skip(opt, "cdef_find_dir_simd")) {
+    int off[BENCH_PARAMS];
+    int ok = 1;
+    random_offsets(off, 64, 1);
+    for (int t = 0; t < BENCH_TRIALS * 8; t++) {
+      const SAMPLE *img = at(buf->src0, 0, 0) + off[t % BENCH_PARAMS];
+      int32_t var_c, var_s;
+      if (t % BENCH_TRIALS == 0)
+        fill_sources(buf, bitdepth, t / BENCH_TRIALS);
+      int dir_c = TEMPLATE(cdef_find_dir)(img, BENCH_STRIDE, &var_c, coeff_shift);
+      int dir_s = TEMPLATE(cdef_find_dir_simd)(img, BENCH_STRIDE, &var_s, coeff_shift);
+      ok &= dir_c == dir_s && var_c == var_s;
+    }
+
+    const int bench_iterations = iterations(opt, 64);
+    const SAMPLE *img = at(buf->src0, 0, 0);
+    int32_t var;
+    BENCH_TIME(0, sink += TEMPLATE(cdef_find_dir)(img + off[p], BENCH_STRIDE, &var, coeff_shift));
+    BENCH_TIME(1, sink += TEMPLATE(cdef_find_dir_simd)(img + off[p], BENCH_STRIDE, &var, coeff_shift));
+    BENCH_REPORT("cdef_find_dir_simd", "8x8", ok, 64);
+  }
+}
+
+/* Sums of src, dst, src^2, dst^2 and src*dst as in dist_8x8() of the CDEF search */
+static void dist_8x8_sums(const SAMPLE *dst, int dstride, const SAMPLE *src, int sstride, uint64_t sums[5])
+{
+  memset(sums, 0, 5 * sizeof(*sums));
+  for (int i = 0; i < 8; i++)
+    for (int j = 0; j < 8; j++) {
+      int s = src[i * sstride + j], d = dst[i * dstride + j];
+      sums[0] += s;
+      sums[1] += d;
+      sums[2] += s * s;
+      sums[3] += d * d;
+      sums[4] += s * d;
+    }
+}
+
+static uint64_t cdef_sse(const SAMPLE *a, int astride, const SAMPLE *b, int bstride, int width, int height)
+{
+  uint64_t sse = 0;
+  for (int i = 0; i < height; i++)
+    for (int j = 0; j < width; j++)
+      sse += (a[i * astride + j] - b[i * bstride + j]) * (a[i * astride + j] - b[i * bstride + j]);
+  return sse;
+}
+
+/* cdef_sse_simd and dist_8x8_sums_simd, the distortion of the CDEF search */
+static void bench_cdef_dist(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  static const int sizes[][2] = { { 4, 4 }, { 4, 2 }, { 8, 8 }, { 8, 3 } };
+  int off[BENCH_PARAMS];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+  char config[32];
+
+  for (int s = 0; s < 4 && !skip(opt, "cdef_sse_simd"); s++) {
+    const int w = sizes[s][0], h = sizes[s][1];
+    int ok = 1;
+    random_offsets(off, 32, 4);
+    for (int t = 0; t < BENCH_TRIALS; t++) {
+      SAMPLE *org = at(buf->src1, 0, 0) + off[t % BENCH_PARAMS];
+      fill_sources(buf, bitdepth, t);
+      ok &= cdef_sse(at(buf->src0, 0, 0), w, org, BENCH_STRIDE, w, h) ==
+        TEMPLATE(cdef_sse_simd)(at(buf->src0, 0, 0), w, org, BENCH_STRIDE, w, h);
+    }
+
+    const int bench_iterations = iterations(opt, w * h);
+    SAMPLE *org = at(buf->src1, 0, 0);
+    BENCH_TIME(0, sink += cdef_sse(at(buf->src0, 0, 0), w, org + off[p], BENCH_STRIDE, w, h));
+    BENCH_TIME(1, sink += TEMPLATE(cdef_sse_simd)(at(buf->src0, 0, 0), w, org + off[p], BENCH_STRIDE, w, h));
+    sprintf(config, "%dx%d", w, h);
+    BENCH_REPORT("cdef_sse_simd", config, ok, w * h);
+  }
+
+  if (skip(opt, "dist_8x8_sums_simd"))
+    return;
+  int ok = 1;
+  uint64_t sums_c[5], sums_s[5];
+  random_offsets(off, 32, 8);
+  for (int t = 0; t < BENCH_TRIALS; t++) {
+    SAMPLE *org = at(buf->src1, 0, 0) + off[t % BENCH_PARAMS];
+    fill_sources(buf, bitdepth, t);
+    dist_8x8_sums(at(buf->src0, 0, 0), 8, org, BENCH_STRIDE, sums_c);
+    TEMPLATE(dist_8x8_sums_simd)(at(buf->src0, 0, 0), 8, org, BENCH_STRIDE, sums_s);
+    ok &= !memcmp(sums_c, sums_s, sizeof(sums_c));
+  }
+
+  const int bench_iterations = iterations(opt, 64);
+  SAMPLE *org = at(buf->src1, 0, 0);
+  BENCH_TIME(0, dist_8x8_sums(at(buf->src0, 0, 0), 8, org + off[p], BENCH_STRIDE, sums_c); sink += sums_c[4]);
+  BENCH_TIME(1, TEMPLATE(dist_8x8_sums_simd)(at(buf->src0, 0, 0), 8, org + off[p], BENCH_STRIDE, sums_s); sink += sums_s[4]);
+  BENCH_REPORT("dist_8x8_sums_simd", "8x8", ok, 64);
+}
+#endif
+
+/* block_avg_simd */
+static void bench_block_avg(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  int off0[BENCH_PARAMS], off1[BENCH_PARAMS];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  if (skip(opt, "block_avg_simd"))
+    return;
+  for (int size = 4; size <= 64; size *= 2) {
+    char config[32];
+    int ok = 1;
+    random_offsets(off0, 32, 1);
+    random_offsets(off1, 32, 1);
+    for (int t = 0; t < BENCH_TRIALS; t++) {
+      SAMPLE *r0 = at(buf->src0, 0, 0) + off0[t % BENCH_PARAMS];
+      SAMPLE *r1 = at(buf->src1, 0, 0) + off1[t % BENCH_PARAMS];
+      fill_sources(buf, bitdepth, t);
+      TEMPLATE(block_avg)(buf->dst_c, r0, r1, MAX_SB_SIZE, BENCH_STRIDE, BENCH_STRIDE, size, size);
+      TEMPLATE(block_avg_simd)(buf->dst_s, r0, r1, MAX_SB_SIZE, BENCH_STRIDE, BENCH_STRIDE, size, size);
+      ok &= equal_blocks(buf->dst_c, buf->dst_s, MAX_SB_SIZE, size, size);
+    }
+
+    const int bench_iterations = iterations(opt, size * size);
+    SAMPLE *r0 = at(buf->src0, 0, 0);
+    SAMPLE *r1 = at(buf->src1, 0, 0);
+    BENCH_TIME(0, TEMPLATE(block_avg)(buf->dst_c, r0 + off0[p], r1 + off1[p], MAX_SB_SIZE, BENCH_STRIDE, BENCH_STRIDE, size, size));
+    BENCH_TIME(1, TEMPLATE(block_avg_simd)(buf->dst_s, r0 + off0[p], r1 + off1[p], MAX_SB_SIZE, BENCH_STRIDE, BENCH_STRIDE, size, size));
+    sprintf(config, "%dx%d", size, size);
+    BENCH_REPORT("block_avg_simd", config, ok, size * size);
+  }
+}
+
+/* sad_calc_thr_simd. The threshold is varied around the SAD in the checks,
+   and is that of an average difference of 16 (8 bit) in the timing. */
+static void bench_sad_thr(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  int off[BENCH_PARAMS];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  if (skip(opt, "sad_calc_thr_simd"))
+    return;
+  for (int size = 8; size <= 16; size *= 2) {
+    char config[32];
+    int ok = 1;
+    random_offsets(off, 32, 1);
+    for (int t = 0; t < BENCH_TRIALS; t++) {
+      SAMPLE *a = at(buf->src0, 0, 1);
+      SAMPLE *b = at(buf->src1, 0, 0) + off[t % BENCH_PARAMS];
+      fill_sources(buf, bitdepth, t);
+      use_simd = 0;
+      unsigned int rc = TEMPLATE(sad_calc)(a, b, BENCH_STRIDE, BENCH_STRIDE, size, size);
+      use_simd = 1;
+      unsigned int thr[] = { 0, rc / 4, rc, rc + 1, 0xffffffff };
+      for (int i = 0; i < 5; i++) {
+        unsigned int rs = TEMPLATE(sad_calc_thr_simd)(a, b, BENCH_STRIDE, BENCH_STRIDE, size, size, thr[i]);
+        ok &= rc < thr[i] ? rs == rc : rs >= thr[i] && rs <= rc;
+      }
+    }
+
+    const int bench_iterations = iterations(opt, size * size);
+    const unsigned int thr = size * size * (16 << (bitdepth - 8));
+    SAMPLE *a = at(buf->src0, 0, 1);
+    SAMPLE *b = at(buf->src1, 0, 0);
+    BENCH_TIME(0, sink += TEMPLATE(sad_calc)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, size, size));
+    BENCH_TIME(1, sink += TEMPLATE(sad_calc_thr_simd)(a, b + off[p], BENCH_STRIDE, BENCH_STRIDE, size, size, thr));
+    sprintf(config, "%dx%d", size, size);
+    BENCH_REPORT("sad_calc_thr_simd", config, ok, size * size);
+  }
+}
+
+/* sse_plane_simd and ssim_sums_8x8_simd, the quality metrics, at the
+   bitdepth of the samples and for high bitdepth also scaled to 8 bits */
+static void bench_snr(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  static const int sizes[][2] = { { 8, 8 }, { 37, 11 }, { 64, 64 }, { 176, 144 } };
+  int off[BENCH_PARAMS];
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+  char config[32];
+
+  for (int i = 0; i < 1 + (bitdepth > 8); i++) {
+    const int shift = i ? bitdepth - 8 : 0;
+    const int metric_bitdepth = bitdepth - shift;
+    for (int s = 0; s < 4 && !skip(opt, "sse_plane_simd"); s++) {
+      const int w = sizes[s][0], h = sizes[s][1];
+      int ok = 1;
+      random_offsets(off, 16, 1);
+      for (int t = 0; t < BENCH_TRIALS; t++) {
+        SAMPLE *a = at(buf->src0, 0, 0);
+        SAMPLE *b = at(buf->src1, 0, 0) + off[t % BENCH_PARAMS];
+        fill_sources(buf, bitdepth, t);
+        use_simd = 0;
+        uint64_t rc = TEMPLATE(sse_plane)(a, BENCH_STRIDE, shift, b, BENCH_STRIDE, shift, w, h, metric_bitdepth);
+        use_simd = 1;
+        ok &= rc == TEMPLATE(sse_plane_simd)(a, BENCH_STRIDE, b, BENCH_STRIDE, w, h, shift, metric_bitdepth);
+      }
+
+      const int bench_iterations = iterations(opt, w * h);
+      SAMPLE *a = at(buf->src0, 0, 0);
+      SAMPLE *b = at(buf->src1, 0, 0);
+      BENCH_TIME(0, sink += TEMPLATE(sse_plane)(a, BENCH_STRIDE, shift, b + off[p], BENCH_STRIDE, shift, w, h, metric_bitdepth));
+      BENCH_TIME(1, sink += TEMPLATE(sse_plane_simd)(a, BENCH_STRIDE, b + off[p], BENCH_STRIDE, w, h, shift, metric_bitdepth));
+      sprintf(config, "%dx%d>>%d", w, h, shift);
+      BENCH_REPORT("sse_plane_simd", config, ok, w * h);
+    }
+
+    if (!skip(opt, "ssim_sums_8x8_simd")) {
+      uint64_t sums_c[5], sums_s[5];
+      int ok = 1;
+      random_offsets(off, 16, 1);
+      for (int t = 0; t < BENCH_TRIALS; t++) {
+        SAMPLE *a = at(buf->src0, 0, 0);
+        SAMPLE *b = at(buf->src1, 0, 0) + off[t % BENCH_PARAMS];
+        fill_sources(buf, bitdepth, t);
+        use_simd = 0;
+        TEMPLATE(ssim_sums_8x8)(a, BENCH_STRIDE, shift, b, BENCH_STRIDE, shift, metric_bitdepth, sums_c);
+        use_simd = 1;
+        TEMPLATE(ssim_sums_8x8_simd)(a, BENCH_STRIDE, b, BENCH_STRIDE, shift, metric_bitdepth, sums_s);
+        ok &= !memcmp(sums_c, sums_s, sizeof(sums_c));
+      }
+
+      const int bench_iterations = iterations(opt, 64);
+      SAMPLE *a = at(buf->src0, 0, 0);
+      SAMPLE *b = at(buf->src1, 0, 0);
+      BENCH_TIME(0, TEMPLATE(ssim_sums_8x8)(a, BENCH_STRIDE, shift, b + off[p], BENCH_STRIDE, shift, metric_bitdepth, sums_c); sink += sums_c[4]);
+      BENCH_TIME(1, TEMPLATE(ssim_sums_8x8_simd)(a, BENCH_STRIDE, b + off[p], BENCH_STRIDE, shift, metric_bitdepth, sums_s); sink += sums_s[4]);
+      sprintf(config, "8x8>>%d", shift);
+      BENCH_REPORT("ssim_sums_8x8_simd", config, ok, 64);
+    }
+  }
+}
+
+/* improve_uv_prediction_simd for chroma blocks from 4x4. In odd trials the chroma prediction follows
+   the luma prediction so that the linear model is applied, and every fourth
+   trial has a perfect luma prediction. */
+static void bench_cfl(bench_options_t *opt, bench_buffers_t *buf, int bitdepth)
+{
+  const int maxval = (1 << bitdepth) - 1;
+  const int plane = 2 * MAX_SB_SIZE * MAX_SB_SIZE;
+  SAMPLE *cfl = bench_alloc(5 * plane * sizeof(SAMPLE));
+  SAMPLE *y = cfl, *u = cfl + plane, *v = cfl + 2 * plane, *u_c = cfl + 3 * plane, *u_s = cfl + 4 * plane;
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  if (skip(opt, "improve_uv_prediction_simd")) {
+    bench_free(cfl);
+    return;
+  }
+  for (int sub = 1; sub >= 0; sub--) {
+    for (int n = 4 << sub; n <= MAX_SB_SIZE; n *= 2) {
+      for (int cstride = n; cstride <= min(2 * n, MAX_SB_SIZE); cstride *= 2) {
+        const int nc = n >> sub, cs = cstride >> sub;
+        SAMPLE *ry = at(buf->src0, 0, 0);
+        char config[48];
+        int ok = 1;
+        for (int t = 0; t < BENCH_TRIALS; t++) {
+          fill_sources(buf, bitdepth, t);
+          fill(y, n * cstride, bitdepth, t % 3);
+          fill(u, nc * cs, bitdepth, t % 3);
+          fill(v, nc * cs, bitdepth, (t + 1) % 3);
+          if (t & 1) {
+            for (int i = 0; i < nc; i++)
+              for (int j = 0; j < nc; j++) {
+                int ys = sub ? y[(2 * i) * n + 2 * j] : y[i * cstride + j];
+                int noise = rnd_range(-(maxval >> 4), maxval >> 4);
+                u[i * cs + j] = clip(ys / 2 + noise, 0, maxval);
+                v[i * cs + j] = clip(maxval - ys - noise, 0, maxval);
+              }
+          }
+          if (t % 4 == 3)
+            for (int i = 0; i < n; i++)
+              memcpy(ry + i * BENCH_STRIDE, y + i * n, n * sizeof(SAMPLE));
+          /* u and v are compared as one block of 2 * nc rows */
+          memcpy(u_c, u, nc * cs * sizeof(SAMPLE));
+          memcpy(u_c + nc * cs, v, nc * cs * sizeof(SAMPLE));
+          memcpy(u_s, u_c, 2 * nc * cs * sizeof(SAMPLE));
+          use_simd = 0;
+          TEMPLATE(improve_uv_prediction)(y, u_c, u_c + nc * cs, ry, n, cstride, BENCH_STRIDE, sub, bitdepth);
+          use_simd = 1;
+          TEMPLATE(improve_uv_prediction_simd)(y, u_s, u_s + nc * cs, ry, n, cstride, BENCH_STRIDE, sub, bitdepth);
+          ok &= equal_blocks(u_c, u_s, cs, nc, 2 * nc);
+        }
+
+        const int bench_iterations = iterations(opt, n * n);
+        BENCH_TIME(0, TEMPLATE(improve_uv_prediction)(y, u_c, u_c + nc * cs, ry, n, cstride, BENCH_STRIDE, sub, bitdepth));
+        BENCH_TIME(1, TEMPLATE(improve_uv_prediction_simd)(y, u_s, u_s + nc * cs, ry, n, cstride, BENCH_STRIDE, sub, bitdepth));
+        if (cstride == n)
+          sprintf(config, "%s %dx%d", sub ? "420" : "444", n, n);
+        else
+          sprintf(config, "%s %dx%d/%d", sub ? "420" : "444", n, n, cstride);
+        BENCH_REPORT("improve_uv_prediction_simd", config, ok, n * n);
+      }
+    }
+  }
+  bench_free(cfl);
+}
+
+/* scale_frame_down2x2_simd. Only luma is compared since the SIMD version skips
+   chroma unless TEMP_INTERP_USE_CHROMA is set. */
+static void bench_scale_frame(bench_options_t *opt, int bitdepth)
+{
+  static const int sizes[][2] = { { 176, 144 }, { 352, 288 }, { 640, 360 }, { 1280, 720 } };
+  double bench_time[2];
+  uint64_t bench_cyc[2];
+
+  if (skip(opt, "scale_frame_down2x2_simd"))
+    return;
+  for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    const int w = sizes[s][0], h = sizes[s][1];
+    yuv_frame_t in, out_c, out_s;
+    char config[32];
+    TEMPLATE(create_yuv_frame)(&in, w, h, 420, 32, 32, bitdepth, bitdepth);
+    TEMPLATE(create_yuv_frame)(&out_c, w / 2, h / 2, 420, 32, 32, bitdepth, bitdepth);
+    TEMPLATE(create_yuv_frame)(&out_s, w / 2, h / 2, 420, 32, 32, bitdepth, bitdepth);
+
+    int ok = 1;
+    for (int t = 0; t < 3; t++) {
+      for (int i = 0; i < h; i++)
+        fill((SAMPLE *)in.y + i * in.stride_y, w, bitdepth, t);
+      for (int i = 0; i < h / 2; i++)
+        fill((SAMPLE *)in.u + i * in.stride_c, w / 2, bitdepth, t);
+      for (int i = 0; i < h / 2; i++)
+        fill((SAMPLE *)in.v + i * in.stride_c, w / 2, bitdepth, t);
+      TEMPLATE(scale_frame_down2x2)(&in, &out_c);
+      TEMPLATE(scale_frame_down2x2_simd)(&in, &out_s);
+      ok &= equal_blocks((SAMPLE *)out_c.y, (SAMPLE *)out_s.y, out_c.stride_y, w / 2, h / 2);
+    }
+
+    const int bench_iterations = max(opt->check_only ? 0 : 2, iterations(opt, w * h));
+    BENCH_TIME(0, TEMPLATE(scale_frame_down2x2)(&in, &out_c));
+    BENCH_TIME(1, TEMPLATE(scale_frame_down2x2_simd)(&in, &out_s));
+    sprintf(config, "%dx%d", w, h);
+    BENCH_REPORT("scale_frame_down2x2_simd", config, ok, w * h);
+
+    TEMPLATE(close_yuv_frame)(&in);
+    TEMPLATE(close_yuv_frame)(&out_c);
+    TEMPLATE(close_yuv_frame)(&out_s);
+  }
+}
+
+int TEMPLATE(bench_kernels)(bench_options_t *opt, int bitdepth)
+{
+  bench_buffers_t buf;
+  int failures = opt->failures;
+
+  rnd_state = opt->seed ? opt->seed : 1;
+  buf.src0 = bench_alloc(BENCH_STRIDE * BENCH_STRIDE * sizeof(SAMPLE));
+  buf.src1 = bench_alloc(BENCH_STRIDE * BENCH_STRIDE * sizeof(SAMPLE));
+  buf.dst_c = bench_alloc(MAX_SB_SIZE * MAX_SB_SIZE * sizeof(SAMPLE));
+  buf.dst_s = bench_alloc(MAX_SB_SIZE * MAX_SB_SIZE * sizeof(SAMPLE));
+  buf.block = bench_alloc(MAX_TR_SIZE * MAX_TR_SIZE * sizeof(int16_t));
+  buf.coeff_c = bench_alloc(MAX_TR_SIZE * MAX_TR_SIZE * sizeof(int16_t));
+  buf.coeff_s = bench_alloc(MAX_TR_SIZE * MAX_TR_SIZE * sizeof(int16_t));
+  buf.in16 = bench_alloc(BENCH_STRIDE16 * 16 * sizeof(uint16_t));
+
+  bench_sad(opt, &buf, bitdepth);
+  bench_fast_subpel(opt, &buf, bitdepth);
+  bench_inter_prediction(opt, &buf, bitdepth);
+  bench_transform(opt, &buf, bitdepth);
+  bench_cbp(opt, &buf, bitdepth);
+  bench_clpf(opt, &buf, bitdepth);
+  bench_detect_clpf(opt, &buf, bitdepth);
+#if CDEF
+  bench_cdef(opt, &buf, bitdepth);
+  bench_cdef_dist(opt, &buf, bitdepth);
+#endif
+  bench_block_avg(opt, &buf, bitdepth);
+  bench_sad_thr(opt, &buf, bitdepth);
+  bench_cfl(opt, &buf, bitdepth);
+  bench_snr(opt, &buf, bitdepth);
+  bench_scale_frame(opt, bitdepth);
+
+  bench_free(buf.src0);
+  bench_free(buf.src1);
+  bench_free(buf.dst_c);
+  bench_free(buf.dst_s);
+  bench_free(buf.block);
+  bench_free(buf.coeff_c);
+  bench_free(buf.coeff_s);
+  bench_free(buf.in16);
+  return opt->failures - failures;
+}
+
+#ifndef HBD
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Time stamp counter, or 0 where none is available */
+uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+void *bench_alloc(size_t size)
+{
+  void *m = malloc(size + sizeof(void*) + 64);
+  if (!m)
+    fatalerror("Memory allocation failed\n");
+  void **r = (void**)((((uintptr_t)m) + sizeof(void*) + 63) & ~(uintptr_t)63);
+  r[-1] = m;
+  return r;
+}
+
+void bench_free(void *p)
+{
+  free(((void**)p)[-1]);
+}
+
+void bench_report(bench_options_t *opt, const char *kernel, int bitdepth, const char *config, int ok, int samples,
+                  int iterations, double c_time, uint64_t c_cycles, double simd_time, uint64_t simd_cycles)
+{
+  double n = iterations ? iterations : 1;
+  double c_ns = 1e9 * c_time / n;
+  double simd_ns = 1e9 * simd_time / n;
+  double speedup = simd_time > 0 ? c_time / simd_time : 0;
+  double msamples = simd_time > 0 ? samples * n / simd_time * 1e-6 : 0;
+
+  if (!ok)
+    opt->failures++;
+  if (opt->csv)
+    printf("%s,%d,%s,%s,%.1f,%.1f,%.1f,%.1f,%.2f,%.1f\n", kernel, bitdepth, config, ok ? "OK" : "MISMATCH",
+           c_ns, c_cycles / n, simd_ns, simd_cycles / n, speedup, msamples);
+  else if (opt->check_only)
+    printf("%-32s %2d %-10s %s\n", kernel, bitdepth, config, ok ? "OK" : "MISMATCH");
+  else
+    printf("%-32s %2d %-10s %-8s %10.1f %10.1f %10.1f %10.1f %7.2f %10.1f\n", kernel, bitdepth, config, ok ? "OK" : "MISMATCH",
+           c_ns, c_cycles / n, simd_ns, simd_cycles / n, speedup, msamples);
+  fflush(stdout);
+}
+
+static void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-filter <kernel>] [-bitdepth <8|10|12>] [-scale <x>] [-seed <n>] [-check] [-csv]\n", prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  bench_options_t opt = { NULL, 1.0, 0, 0, 1, 0 };
+  int bitdepth = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-filter") && i + 1 < argc)
+      opt.filter = argv[++i];
+    else if (!strcmp(argv[i], "-bitdepth") && i + 1 < argc)
+      bitdepth = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-scale") && i + 1 < argc)
+      opt.scale = atof(argv[++i]);
+    else if (!strcmp(argv[i], "-seed") && i + 1 < argc)
+      opt.seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+    else if (!strcmp(argv[i], "-check"))
+      opt.check_only = 1;
+    else if (!strcmp(argv[i], "-csv"))
+      opt.csv = 1;
+    else
+      usage(argv[0]);
+  }
+
+  init_use_simd();
+  if (!use_simd)
+    fprintf(stderr, "No SIMD support, comparing with the generic vector implementation\n");
+  use_simd = 1;
+
+  if (opt.csv)
+    printf("kernel,bitdepth,config,status,c_ns,c_cycles,simd_ns,simd_cycles,speedup,simd_msamples_per_s\n");
+  else if (opt.check_only)
+    printf("%-32s %2s %-10s %s\n", "kernel", "bd", "config", "status");
+  else
+    printf("%-32s %2s %-10s %-8s %10s %10s %10s %10s %7s %10s\n", "kernel", "bd", "config", "status",
+           "c_ns", "c_cycles", "simd_ns", "simd_cyc", "speedup", "simd_MS/s");
+
+  if (!bitdepth || bitdepth == 8)
+    bench_kernels_lbd(&opt, 8);
+  if (!bitdepth || bitdepth == 10)
+    bench_kernels_hbd(&opt, 10);
+  if (!bitdepth || bitdepth == 12)
+    bench_kernels_hbd(&opt, 12);
+
+  if (opt.failures)
+    fprintf(stderr, "%d configurations where the SIMD kernel differs from the C code\n", opt.failures);
+  return opt.failures != 0;
+}
+#endif
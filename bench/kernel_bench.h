@@ -0,0 +1,52 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _KERNEL_BENCH_H_
+#define _KERNEL_BENCH_H_
+
+#include <stdint.h>
+
+/* Options shared by the lbd and hbd kernel benchmarks */
+typedef struct
+{
+  const char *filter;          //Only run kernels whose name contains this string
+  double scale;                //Multiplier of the number of timed calls
+  int check_only;              //Skip the timing
+  int csv;                     //Print comma separated values
+  uint32_t seed;
+  int failures;                //Number of configurations with a C/SIMD mismatch
+} bench_options_t;
+
+void bench_report(bench_options_t *opt, const char *kernel, int bitdepth, const char *config, int ok, int samples,
+                  int iterations, double c_time, uint64_t c_cycles, double simd_time, uint64_t simd_cycles);
+uint64_t bench_cycles(void);
+void *bench_alloc(size_t size);
+void bench_free(void *p);
+
+int bench_kernels_lbd(bench_options_t *opt, int bitdepth);
+int bench_kernels_hbd(bench_options_t *opt, int bitdepth);
+
+#endif
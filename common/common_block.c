@@ -34,6 +34,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "global.h"
 #include "common_block.h"
+#include "simd.h"
+#include "common_kernels.h"
 
 extern const int zigzag16[16];
 extern const int zigzag64[64];
@@ -349,6 +351,11 @@ void TEMPLATE(improve_uv_prediction)(SAMPLE *y, SAMPLE *u, SAMPLE *v, SAMPLE *ry
   int nc = n >> sub;
   int lognc = log2i(nc);
 
+  if (use_simd && sub <= 1 && nc >= 4) {
+    TEMPLATE(improve_uv_prediction_simd)(y, u, v, ry, n, cstride, stride, sub, bitdepth);
+    return;
+  }
+
   // Compute squared residual
   int64_t squared_residual = 0;
   for (int i = 0; i < n; i++)
@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "common_block.h"
 #include "common_frame.h"
 #include "common_kernels.h"
+#include "thread.h"
 
 static const SAMPLE beta_table[52] = {
      0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
@@ -456,6 +457,8 @@ void TEMPLATE(create_yuv_frame)(yuv_frame_t  *frame, int width, int height, int
   frame->y += align;
   frame->bitdepth = bitdepth;
   frame->input_bitdepth = input_bitdepth;
+  memset(frame->down, 0, sizeof(frame->down));
+  frame->num_down = 0;
 
   if (frame->subsample == 400)
     return;
@@ -470,13 +473,20 @@ void TEMPLATE(create_yuv_frame)(yuv_frame_t  *frame, int width, int height, int
 
 void TEMPLATE(close_yuv_frame)(yuv_frame_t  *frame)
 {
+  for (int i = 0; i < MAX_PYRAMID_LEVELS && frame->down[i]; i++) {
+    TEMPLATE(close_yuv_frame)(frame->down[i]);
+    free(frame->down[i]);
+  }
   free(frame->y-frame->offset_y);
   if (frame->subsample != 400)
     free(frame->u-frame->offset_c);
 }
 
-void TEMPLATE(read_yuv_frame)(yuv_frame_t *frame, FILE *infile)
+/* Read a frame stored as in a raw input file: planar Y, U and V, two bytes
+   per sample if input_bitdepth > 8. Returns a pointer past the frame. */
+const uint8_t *TEMPLATE(read_yuv_frame)(yuv_frame_t *frame, const uint8_t *buf)
 {
+  int bytes = 1 + (frame->input_bitdepth > 8);
   int sub = frame->sub;
   int wsub = sub || frame->subsample == 422;
   int width = frame->width;
@@ -485,8 +495,8 @@ void TEMPLATE(read_yuv_frame)(yuv_frame_t *frame, FILE *infile)
   int round = frame->bitdepth > frame->input_bitdepth-1 ? 1 << (frame->bitdepth-frame->input_bitdepth-1) : 0;
 
   for (int i=0; i<height; ++i) {
-    if (fread(&frame->y[i*frame->stride_y], 1 + (frame->input_bitdepth > 8), width, infile) != width)
-      fatalerror("Error reading Y from file");
+    memcpy(&frame->y[i*frame->stride_y], buf, width*bytes);
+    buf += width*bytes;
 
     if (frame->input_bitdepth != frame->bitdepth || (frame_bitdepth == 16 && frame->bitdepth == 8)) {
       for (int j = width-1; j >= 0; j--) {
@@ -500,11 +510,11 @@ void TEMPLATE(read_yuv_frame)(yuv_frame_t *frame, FILE *infile)
   }
 
   if (frame->subsample == 400)
-    return;
+    return buf;
 
   for (int i=0; i<height>>sub; ++i) {
-    if (fread(&frame->u[i*frame->stride_c], 1 + (frame->input_bitdepth > 8), width>>wsub, infile) != width>>wsub)
-      fatalerror("Error reading U from file");
+    memcpy(&frame->u[i*frame->stride_c], buf, (width>>wsub)*bytes);
+    buf += (width>>wsub)*bytes;
     if (frame->subsample == 422) {
       SAMPLE *u = frame->u + i*frame->stride_c;
       for (int j = width-1; j >= 0; j--)
@@ -523,8 +533,8 @@ void TEMPLATE(read_yuv_frame)(yuv_frame_t *frame, FILE *infile)
   }
 
   for (int i=0; i<height>>sub; ++i) {
-    if (fread(&frame->v[i*frame->stride_c], 1 + (frame->input_bitdepth > 8), width>>wsub, infile) != width>>wsub)
-      fatalerror("Error reading V from file");
+    memcpy(&frame->v[i*frame->stride_c], buf, (width>>wsub)*bytes);
+    buf += (width>>wsub)*bytes;
     if (frame->subsample == 422) {
       SAMPLE *v = frame->v + i*frame->stride_c;
       for (int j = width-1; j >= 0; j--)
@@ -541,6 +551,7 @@ void TEMPLATE(read_yuv_frame)(yuv_frame_t *frame, FILE *infile)
       }
     }
   }
+  return buf;
 }
 
 void TEMPLATE(write_yuv_frame)(yuv_frame_t *frame, FILE *outfile)
@@ -655,6 +666,14 @@ void TEMPLATE(write_yuv_frame)(yuv_frame_t *frame, FILE *outfile)
 
 
 void TEMPLATE(pad_yuv_frame)(yuv_frame_t * f)
+{
+  TEMPLATE(pad_yuv_frame_rows)(f, 0, f->height);
+}
+
+/* Pad the luma rows ystart to yend-1 (and the chroma rows they cover) to
+   the left and right, and extend the frame vertically if the range
+   includes the first or the last row */
+void TEMPLATE(pad_yuv_frame_rows)(yuv_frame_t * f, int ystart, int yend)
 {
   int sy = f->stride_y;
   int sc = f->stride_c;
@@ -666,7 +685,7 @@ void TEMPLATE(pad_yuv_frame)(yuv_frame_t * f)
 
   /* Y */
   /* Left and right */
-  for (i=0;i<h;i++)
+  for (i=ystart;i<yend;i++)
   {
     val=f->y[i*sy];
     if (frame_bitdepth == 8)
@@ -682,14 +701,16 @@ void TEMPLATE(pad_yuv_frame)(yuv_frame_t * f)
         f->y[i*sy+w+j] = val;
   }
   /* Top and bottom */
-  for (i=-f->pad_ver_y;i<0;i++)
-  {
-    memcpy(&f->y[i*sy-f->pad_hor_y], &f->y[-f->pad_hor_y], (w+2*f->pad_hor_y)*frame_bitdepth / 8);
-  }
-  for (i=h;i<h+f->pad_ver_y;i++)
-  {
-    memcpy(&f->y[i*sy-f->pad_hor_y], &f->y[(h-1)*sy-f->pad_hor_y], (w+2*f->pad_hor_y)*frame_bitdepth / 8);
-  }
+  if (ystart == 0)
+    for (i=-f->pad_ver_y;i<0;i++)
+    {
+      memcpy(&f->y[i*sy-f->pad_hor_y], &f->y[-f->pad_hor_y], (w+2*f->pad_hor_y)*frame_bitdepth / 8);
+    }
+  if (yend == h)
+    for (i=h;i<h+f->pad_ver_y;i++)
+    {
+      memcpy(&f->y[i*sy-f->pad_hor_y], &f->y[(h-1)*sy-f->pad_hor_y], (w+2*f->pad_hor_y)*frame_bitdepth / 8);
+    }
 
   if (f->subsample == 400)
     return;
@@ -699,7 +720,9 @@ void TEMPLATE(pad_yuv_frame)(yuv_frame_t * f)
   /* Left and right */
   w >>= f->sub;
   h >>= f->sub;
-  for (i=0;i<h;i++)
+  ystart >>= f->sub;
+  yend = yend == f->height ? h : yend >> f->sub;
+  for (i=ystart;i<yend;i++)
   {
     val=f->u[i*sc];
     if (frame_bitdepth == 8)
@@ -730,21 +753,24 @@ void TEMPLATE(pad_yuv_frame)(yuv_frame_t * f)
   }
 
   /* Top and bottom */
-  for (i=-f->pad_ver_c;i<0;i++)
-  {
-    memcpy(&f->u[i*sc-f->pad_hor_c], &f->u[-f->pad_hor_c], (w+2*f->pad_hor_c)*frame_bitdepth / 8);
-    memcpy(&f->v[i*sc-f->pad_hor_c], &f->v[-f->pad_hor_c], (w+2*f->pad_hor_c)*frame_bitdepth / 8);
-  }
-  for (i=h;i<h+f->pad_ver_c;i++)
-  {
-    memcpy(&f->u[i*sc-f->pad_hor_c], &f->u[(h-1)*sc-f->pad_hor_c], (w+2*f->pad_hor_c)*frame_bitdepth / 8);
-    memcpy(&f->v[i*sc-f->pad_hor_c], &f->v[(h-1)*sc-f->pad_hor_c], (w+2*f->pad_hor_c)*frame_bitdepth / 8);
-  }
+  if (ystart == 0)
+    for (i=-f->pad_ver_c;i<0;i++)
+    {
+      memcpy(&f->u[i*sc-f->pad_hor_c], &f->u[-f->pad_hor_c], (w+2*f->pad_hor_c)*frame_bitdepth / 8);
+      memcpy(&f->v[i*sc-f->pad_hor_c], &f->v[-f->pad_hor_c], (w+2*f->pad_hor_c)*frame_bitdepth / 8);
+    }
+  if (yend == h)
+    for (i=h;i<h+f->pad_ver_c;i++)
+    {
+      memcpy(&f->u[i*sc-f->pad_hor_c], &f->u[(h-1)*sc-f->pad_hor_c], (w+2*f->pad_hor_c)*frame_bitdepth / 8);
+      memcpy(&f->v[i*sc-f->pad_hor_c], &f->v[(h-1)*sc-f->pad_hor_c], (w+2*f->pad_hor_c)*frame_bitdepth / 8);
+    }
 }
 
 void TEMPLATE(create_reference_frame)(yuv_frame_t  *ref,yuv_frame_t  *rec)
 {
   ref->frame_num = rec->frame_num;
+  ref->num_down = 0;
   int height = rec->height;
   int width = rec->width;  
   int i;
@@ -823,7 +849,10 @@ int cdef_allskip(int xoff, int yoff, int width, int height, deblock_data_t *debl
 }
 #endif
 
-void TEMPLATE(cdef_frame)(cdef_strengths *cdef_strengths, const yuv_frame_t *frame, const yuv_frame_t *org, deblock_data_t *deblock_data, void *stream, int cdef_bits, int bitdepth, unsigned int plane) {
+/* Filter one plane in place. The luma directions and variances are found
+   in the plane 0 pass if find_dir is set, otherwise they must be in
+   cdef_strengths already. */
+void TEMPLATE(cdef_frame)(cdef_strengths *cdef_strengths, const yuv_frame_t *frame, const yuv_frame_t *org, deblock_data_t *deblock_data, void *stream, int cdef_bits, int bitdepth, int find_dir, unsigned int plane) {
 
   int c, k, l;
   const int fb_size_log2 = 6;
@@ -896,7 +925,7 @@ void TEMPLATE(cdef_frame)(cdef_strengths *cdef_strengths, const yuv_frame_t *fra
             sizey = min((height >> sub) - ypos, bs);
             index = ((yoff + m * 8) / MIN_PB_SIZE) * (width/MIN_PB_SIZE) + ((xoff + n * 8) / MIN_PB_SIZE);
 
-            if (plane == 0)
+            if (plane == 0 && find_dir)
               cdef_strengths[ci].dir[m * (bs << sub) + n] = (use_simd ? TEMPLATE(cdef_find_dir_simd) : TEMPLATE(cdef_find_dir))(src_buffer + ypos * sstride + xpos, sstride, &cdef_strengths[ci].var[m * bs + n], coeff_shift);
 
             if (deblock_data[index].mode != MODE_SKIP) {
@@ -1002,40 +1031,88 @@ void TEMPLATE(cdef_frame)(cdef_strengths *cdef_strengths, const yuv_frame_t *fra
 }
 #endif
 
+/* State shared by the filter block rows of clpf_frame() */
+typedef struct {
+  const deblock_data_t *deblock_data;
+  const SAMPLE *src;   // Unfiltered copy of the plane
+  SAMPLE *dst;
+  const uint8_t *fb_filter;
+  int width;
+  int height;
+  int stride;
+  int sub;
+  int fb_size_log2;
+  int num_fb_hor;
+  unsigned int strength;
+  int damping;
+} clpf_filter_t;
+
+/* Filter the selected filter blocks of filter block row k */
+static void clpf_filter_job(void *arg, int k, int thread) {
+  const clpf_filter_t *f = arg;
+  const int sub = f->sub;
+  const int bs = sub ? 4 : 8;
+  const int bslog = log2i(bs);
+  const int width = f->width;
+  const int height = f->height;
+  const int fb_size_log2 = f->fb_size_log2;
+
+  for (int l = 0; l < f->num_fb_hor; l++) {
+    if (!f->fb_filter[k * f->num_fb_hor + l])
+      continue;
+    const int xoff = l << fb_size_log2;
+    const int yoff = k << fb_size_log2;
+    const int h = min(height - yoff, 1 << fb_size_log2);
+    const int w = min(width - xoff, 1 << fb_size_log2);
+
+    // Iterate over all smaller blocks inside the filter block
+    for (int m = 0; m < ((h + bs - 1) >> bslog); m++) {
+      for (int n = 0; n < ((w + bs - 1) >> bslog); n++) {
+        const int xpos = xoff + n * bs;
+        const int ypos = yoff + m * bs;
+        const int sizex = min(width - xpos, bs);
+        const int sizey = min(height - ypos, bs);
+        const int index = ((ypos<<sub)/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + ((xpos<<sub)/MIN_PB_SIZE);
+        if (f->deblock_data[index].mode != MODE_SKIP) {
+          boundary_type bt =
+            (TILE_LEFT_BOUNDARY & -!xpos) |
+            (TILE_ABOVE_BOUNDARY & -!ypos) |
+            (TILE_RIGHT_BOUNDARY & -(xpos == width - sizex)) |
+            (TILE_BOTTOM_BOUNDARY & -(ypos == height - sizey));
+
+          // Apply the filter
+          (use_simd ? TEMPLATE(clpf_block_simd) : TEMPLATE(clpf_block))
+            (f->src, f->dst, f->stride, f->stride, xpos,
+             ypos, sizex, sizey, bt, f->strength, f->damping);
+        }
+      }
+    }
+  }
+}
+
+/* The filter block decisions are made (and signalled) in raster order first,
+   then the filter block rows are filtered in parallel from a copy of the
+   unfiltered plane. */
 void TEMPLATE(clpf_frame)(const yuv_frame_t *frame, const yuv_frame_t *org, const deblock_data_t *deblock_data, void *stream, int enable_fb_flag, unsigned int strength, unsigned int fb_size_log2, int bitdepth, unsigned int plane, int qp,
-                          int(*decision)(int, int, const yuv_frame_t *, const yuv_frame_t *, const deblock_data_t *, int, int, int, void *, unsigned int, unsigned int, unsigned int, unsigned int, int)) {
+                          int(*decision)(int, int, const yuv_frame_t *, const yuv_frame_t *, const deblock_data_t *, int, int, int, void *, unsigned int, unsigned int, unsigned int, unsigned int, int),
+                          struct thor_workers *workers) {
 
   /* Constrained low-pass filter (CLPF) */
-  int c, k, l, m, n;
+  int k, l, m, n;
   const int sub = plane != PLANE_Y && frame->sub;
   const int bs = sub ? 4 : 8;
-  const int bslog = log2i(bs);
   int width = frame->width >> sub;
   int height = frame->height >> sub;
   int xpos, ypos;
   const int sstride = plane != PLANE_Y ? frame->stride_c : frame->stride_y;
-  int dstride = bs;
   const int num_fb_hor = (width + (1 << fb_size_log2) - 1) >> fb_size_log2;
   const int num_fb_ver = (height + (1 << fb_size_log2) - 1) >> fb_size_log2;
-  SAMPLE *cache = NULL;
-  SAMPLE **cache_ptr = NULL;
-  SAMPLE **cache_dst = NULL;
-  int cache_idx = 0;
-  const int cache_size = num_fb_hor << (2 * fb_size_log2);
-  const int cache_blocks = cache_size / (bs * bs);
   SAMPLE *src_buffer = plane != PLANE_Y ? (plane == PLANE_U ? frame->u : frame->v) : frame->y;
-  SAMPLE *dst_buffer;
-  int damping = bitdepth - 4 - (plane != PLANE_Y) + (qp >> 4);
-
-  // Make buffer space for in-place filtering
-  cache = thor_alloc(cache_size * sizeof(SAMPLE), 32);
-  dst_buffer = cache;
-  cache_ptr = thor_alloc(cache_blocks * sizeof(*cache_ptr), 32);
-  cache_dst = thor_alloc(cache_blocks * sizeof(*cache_dst), 32);
-  memset(cache_ptr, 0, cache_blocks * sizeof(*cache_dst));
+  uint8_t *fb_filter = thor_alloc(num_fb_hor * num_fb_ver, 16);
+  clpf_filter_t f;
 
   strength <<= bitdepth - 8;
-  // Iterate over all filter blocks
+  // Decide which filter blocks to filter
   for (k = 0; k < num_fb_ver; k++) {
     for (l = 0; l < num_fb_hor; l++) {
       int h, w;
@@ -1058,100 +1135,32 @@ void TEMPLATE(clpf_frame)(const yuv_frame_t *frame, const yuv_frame_t *org, cons
       w = min(width, (l + 1) << fb_size_log2) & ((1 << fb_size_log2) - 1);
       h += !h << fb_size_log2;
       w += !w << fb_size_log2;
-      if (!allskip &&  // Do not filter the block if all is skip encoded
-          (!enable_fb_flag ||
-           // Only called if fb_flag enabled (luma only)
-           decision(k, l, frame, org, deblock_data, bs, w / bs, h / bs, stream, strength,
-                    fb_size_log2, bitdepth-8, bs, qp))) {
-        // Iterate over all smaller blocks inside the filter block
-        for (m = 0; m < ((h + bs - 1) >> bslog); m++) {
-          for (n = 0; n < ((w + bs - 1) >> bslog); n++) {
-            int sizex, sizey;
-            xpos = xoff + n * bs;
-            ypos = yoff + m * bs;
-            sizex = min(width - xpos, bs);
-            sizey = min(height - ypos, bs);
-            int index = ((ypos<<sub)/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + ((xpos<<sub)/MIN_PB_SIZE);
-            if (deblock_data[index].mode != MODE_SKIP) {
-              // Temporary buffering needed for in-place filtering
-              if (cache_ptr[cache_idx]) {
-                // Copy filtered block back into the frame
-                if (sizeof(SAMPLE) == 2) {
-                  if (sizex == 8) {
-                    for (c = 0; c < sizey; c++) {
-                      *(uint64_t *)(cache_dst[cache_idx] + c * sstride) =
-                          *(uint64_t *)(cache_ptr[cache_idx] + c * bs);
-                      *(uint64_t *)(cache_dst[cache_idx] + c * sstride + 4) =
-                          *(uint64_t *)(cache_ptr[cache_idx] + c * bs + 4);
-                    }
-                  } else if (sizex == 4) {
-                    for (c = 0; c < sizey; c++)
-                      *(uint64_t *)(cache_dst[cache_idx] + c * sstride) =
-                          *(uint64_t *)(cache_ptr[cache_idx] + c * bs);
-                  } else {
-                    for (c = 0; c < sizey; c++)
-                      memcpy(cache_dst[cache_idx] + c * sstride, cache_ptr[cache_idx] + c * bs * 2,
-                             sizex);
-                  }
-                } else {
-                  if (sizex == 8)
-                    for (c = 0; c < sizey; c++)
-                      *(uint64_t *)(cache_dst[cache_idx] + c * sstride) =
-                          *(uint64_t *)(cache_ptr[cache_idx] + c * bs);
-                  else if (sizex == 4)
-                    for (c = 0; c < sizey; c++)
-                      *(uint32_t *)(cache_dst[cache_idx] + c * sstride) =
-                          *(uint32_t *)(cache_ptr[cache_idx] + c * bs);
-                  else
-                    for (c = 0; c < sizey; c++)
-                      memcpy(cache_dst[cache_idx] + c * sstride,
-                             cache_ptr[cache_idx] + c * bs, sizex);
-                }
-              }
-              cache_ptr[cache_idx] = cache + cache_idx * bs * bs;
-              dst_buffer = cache_ptr[cache_idx] - ypos * bs - xpos;
-              cache_dst[cache_idx] = src_buffer + ypos * sstride + xpos;
-              if (++cache_idx >= cache_blocks) cache_idx = 0;
-
-              boundary_type bt =
-                (TILE_LEFT_BOUNDARY & -!xpos) |
-                (TILE_ABOVE_BOUNDARY & -!ypos) |
-                (TILE_RIGHT_BOUNDARY & -(xpos == width - sizex)) |
-                (TILE_BOTTOM_BOUNDARY & -(ypos == height - sizey));
-
-              // Apply the filter
-              (use_simd ? TEMPLATE(clpf_block_simd) : TEMPLATE(clpf_block))
-                (src_buffer, dst_buffer, sstride, dstride, xpos,
-                 ypos, sizex, sizey, bt, strength, damping);
-            }
-          }
-        }
-      }
+      fb_filter[k * num_fb_hor + l] =
+        !allskip &&  // Do not filter the block if all is skip encoded
+        (!enable_fb_flag ||
+         // Only called if fb_flag enabled (luma only)
+         decision(k, l, frame, org, deblock_data, bs, w / bs, h / bs, stream, strength,
+                  fb_size_log2, bitdepth-8, bs, qp));
     }
   }
 
-  // Copy remaining blocks into the frame
-  for (cache_idx = 0; cache_idx < cache_blocks && cache_ptr[cache_idx];
-       cache_idx++) {
-    if (sizeof(SAMPLE) == 2) {
-      for (c = 0; c < bs; c++) {
-        *(uint64_t *)(cache_dst[cache_idx] + c * sstride) =
-            *(uint64_t *)(cache_ptr[cache_idx] + c * bs);
-        if (bs == 8)
-          *(uint64_t *)(cache_dst[cache_idx] + c * sstride + 4) =
-              *(uint64_t *)(cache_ptr[cache_idx] + c * bs + 4);
-      }
-    } else {
-      for (c = 0; c < bs; c++)
-        if (bs == 4)
-          *(uint32_t *)(cache_dst[cache_idx] + c * sstride) =
-              *(uint32_t *)(cache_ptr[cache_idx] + c * bs);
-        else
-          *(uint64_t *)(cache_dst[cache_idx] + c * sstride) =
-              *(uint64_t *)(cache_ptr[cache_idx] + c * bs);
-    }
-  }
-  thor_free(cache);
-  thor_free(cache_ptr);
-  thor_free(cache_dst);
+  // The filter reads up to two lines into the neighbouring filter block rows
+  SAMPLE *src_copy = malloc(height * sstride * sizeof(SAMPLE));
+  memcpy(src_copy, src_buffer, height * sstride * sizeof(SAMPLE));
+  f.src = src_copy;
+  f.deblock_data = deblock_data;
+  f.dst = src_buffer;
+  f.fb_filter = fb_filter;
+  f.width = width;
+  f.height = height;
+  f.stride = sstride;
+  f.sub = sub;
+  f.fb_size_log2 = fb_size_log2;
+  f.num_fb_hor = num_fb_hor;
+  f.strength = strength;
+  f.damping = bitdepth - 4 - (plane != PLANE_Y) + (qp >> 4);
+  thor_workers_run(workers, clpf_filter_job, &f, num_fb_ver);
+
+  free(src_copy);
+  thor_free(fb_filter);
 }
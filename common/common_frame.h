@@ -31,16 +31,20 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "simd.h"
 #endif
 
+struct thor_workers;
+
 void create_yuv_frame_lbd(yuv_frame_t  *frame, int width, int height, int sub, int pad_hor, int pad_ver, int bitdepth, int input_bitdepth);
 void create_yuv_frame_hbd(yuv_frame_t  *frame, int width, int height, int sub, int pad_hor, int pad_ver, int bitdepth, int input_bitdepth);
 void close_yuv_frame_lbd(yuv_frame_t  *frame);
 void close_yuv_frame_hbd(yuv_frame_t  *frame);
-void read_yuv_frame_lbd(yuv_frame_t  *frame, FILE *infile);
-void read_yuv_frame_hbd(yuv_frame_t  *frame, FILE *infile);
+const uint8_t *read_yuv_frame_lbd(yuv_frame_t  *frame, const uint8_t *buf);
+const uint8_t *read_yuv_frame_hbd(yuv_frame_t  *frame, const uint8_t *buf);
 void write_yuv_frame_lbd(yuv_frame_t  *frame, FILE *outfile);
 void write_yuv_frame_hbd(yuv_frame_t  *frame, FILE *outfile);
 void pad_yuv_frame_lbd(yuv_frame_t* f);
 void pad_yuv_frame_hbd(yuv_frame_t* f);
+void pad_yuv_frame_rows_lbd(yuv_frame_t* f, int ystart, int yend);
+void pad_yuv_frame_rows_hbd(yuv_frame_t* f, int ystart, int yend);
 void deblock_frame_y_lbd(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp, int bitdepth);
 void deblock_frame_y_hbd(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp, int bitdepth);
 void deblock_frame_uv_lbd(yuv_frame_t  *rec, deblock_data_t *deblock_data, int width, int height, uint8_t qp, int bitdepth);
@@ -48,12 +52,14 @@ void deblock_frame_uv_hbd(yuv_frame_t  *rec, deblock_data_t *deblock_data, int w
 void create_reference_frame_lbd(yuv_frame_t  *ref,yuv_frame_t  *rec);
 void create_reference_frame_hbd(yuv_frame_t  *ref,yuv_frame_t  *rec);
 void clpf_frame_lbd(const yuv_frame_t *frame, const yuv_frame_t *org, const deblock_data_t *deblock_data, void *stream,int enable_sb_flag, unsigned int strength, unsigned int fb_size_log2, int bitdepth, plane_t plane, int qp,
-                    int(*decision)(int, int, const yuv_frame_t *, const yuv_frame_t *, const deblock_data_t *, int, int, int, void *, unsigned int, unsigned int, unsigned int, unsigned int, int));
+                    int(*decision)(int, int, const yuv_frame_t *, const yuv_frame_t *, const deblock_data_t *, int, int, int, void *, unsigned int, unsigned int, unsigned int, unsigned int, int),
+                    struct thor_workers *workers);
 void clpf_frame_hbd(const yuv_frame_t *frame, const yuv_frame_t *org, const deblock_data_t *deblock_data, void *stream,int enable_sb_flag, unsigned int strength, unsigned int fb_size_log2, int bitdepth, plane_t plane, int qp,
-                    int(*decision)(int, int, const yuv_frame_t *, const yuv_frame_t *, const deblock_data_t *, int, int, int, void *, unsigned int, unsigned int, unsigned int, unsigned int, int));
+                    int(*decision)(int, int, const yuv_frame_t *, const yuv_frame_t *, const deblock_data_t *, int, int, int, void *, unsigned int, unsigned int, unsigned int, unsigned int, int),
+                    struct thor_workers *workers);
 #if CDEF
-void cdef_frame_lbd(cdef_strengths *cdef_strengths, const yuv_frame_t *frame, const yuv_frame_t *org, deblock_data_t *deblock_data, void *stream, int cdef_bits, int bitdepth, unsigned int plane);
-void cdef_frame_hbd(cdef_strengths *cdef_strengths, const yuv_frame_t *frame, const yuv_frame_t *org, deblock_data_t *deblock_data, void *stream, int cdef_bits, int bitdepth, unsigned int plane);
+void cdef_frame_lbd(cdef_strengths *cdef_strengths, const yuv_frame_t *frame, const yuv_frame_t *org, deblock_data_t *deblock_data, void *stream, int cdef_bits, int bitdepth, int find_dir, unsigned int plane);
+void cdef_frame_hbd(cdef_strengths *cdef_strengths, const yuv_frame_t *frame, const yuv_frame_t *org, deblock_data_t *deblock_data, void *stream, int cdef_bits, int bitdepth, int find_dir, unsigned int plane);
 int cdef_allskip(int xoff, int yoff, int width, int height, deblock_data_t *deblock_data, int fb_size_log2);
 void cdef_prepare_input_lbd(int sizex, int sizey, int xpos, int ypos, boundary_type bt, int padding, uint16_t *src16, int stride16, uint8_t *src_buffer, int sstride);
 void cdef_prepare_input_hbd(int sizex, int sizey, int xpos, int ypos, boundary_type bt, int padding, uint16_t *src16, int stride16, uint16_t *src_buffer, int sstride);
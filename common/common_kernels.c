@@ -101,20 +101,56 @@ int TEMPLATE(sad_calc_simd_unaligned)(SAMPLE *a, SAMPLE *b, int astride, int bst
     default:
       {
         sad128_internal s = v128_sad_u8_init();
-        for (i = 0; i < height; i+=4)
+        for (i = 0; i < height; i+=4) {
           for (j = 0; j < width; j += 16) {
             s = v128_sad_u8(s, v128_load_unaligned(a + 0*astride + j), v128_load_unaligned(b + 0*bstride + j));
             s = v128_sad_u8(s, v128_load_unaligned(a + 1*astride + j), v128_load_unaligned(b + 1*bstride + j));
             s = v128_sad_u8(s, v128_load_unaligned(a + 2*astride + j), v128_load_unaligned(b + 2*bstride + j));
             s = v128_sad_u8(s, v128_load_unaligned(a + 3*astride + j), v128_load_unaligned(b + 3*bstride + j));
-            a += 4*astride;
-            b += 4*bstride;
           }
+          a += 4*astride;
+          b += 4*bstride;
+        }
         return v128_sad_u8_sum(s);
       }
   };
 }
 
+/* SAD of a block of width 8 or 16 and height divisible by 4, as
+   sad_calc_simd_unaligned(), except that the rows are summed in groups of four
+   and the sum so far is returned as soon as it reaches thr. A result below
+   thr is the exact SAD. */
+int TEMPLATE(sad_calc_thr_simd)(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height, unsigned int thr)
+{
+  int i;
+  unsigned int sum = 0;
+
+  if (width == 8) {
+    sad64_internal s = v64_sad_u8_init();
+    for (i = 0; i < height && sum < thr; i += 4) {
+      s = v64_sad_u8(s, v64_load_unaligned(a + 0*astride), v64_load_unaligned(b + 0*bstride));
+      s = v64_sad_u8(s, v64_load_unaligned(a + 1*astride), v64_load_unaligned(b + 1*bstride));
+      s = v64_sad_u8(s, v64_load_unaligned(a + 2*astride), v64_load_unaligned(b + 2*bstride));
+      s = v64_sad_u8(s, v64_load_unaligned(a + 3*astride), v64_load_unaligned(b + 3*bstride));
+      a += 4*astride;
+      b += 4*bstride;
+      sum = v64_sad_u8_sum(s);
+    }
+  } else {
+    sad128_internal s = v128_sad_u8_init();
+    for (i = 0; i < height && sum < thr; i += 4) {
+      s = v128_sad_u8(s, v128_load_unaligned(a + 0*astride), v128_load_unaligned(b + 0*bstride));
+      s = v128_sad_u8(s, v128_load_unaligned(a + 1*astride), v128_load_unaligned(b + 1*bstride));
+      s = v128_sad_u8(s, v128_load_unaligned(a + 2*astride), v128_load_unaligned(b + 2*bstride));
+      s = v128_sad_u8(s, v128_load_unaligned(a + 3*astride), v128_load_unaligned(b + 3*bstride));
+      a += 4*astride;
+      b += 4*bstride;
+      sum = v128_sad_u8_sum(s);
+    }
+  }
+  return sum;
+}
+
 #ifndef HBD
 
 enum {
@@ -3247,3 +3283,283 @@ void cdef_filter_block_simd(uint8_t *dst8, uint16_t *dst16, int dstride,
 
 #endif
 #endif
+
+#ifndef HBD
+/* Chroma from luma, see improve_uv_prediction() in common_block.c. The
+   samples are widened to 16 bit, so the low and high bitdepth versions share
+   the code below specialised by the constant hbd argument. Rows of 4 samples
+   are handled two rows at a time with the first row in the low half. */
+
+SIMD_INLINE const void *cfl_ptr(const void *p, int idx, int hbd) {
+  return hbd ? (const void *)((const uint16_t *)p + idx) : (const void *)((const uint8_t *)p + idx);
+}
+
+// 8 samples of row i from column j, or 4 from rows i and i+1 if width is 4
+SIMD_INLINE v128 cfl_load(const void *p, int stride, int i, int j, int width, int hbd) {
+  if (width >= 8)
+    return hbd ? v128_load_unaligned(cfl_ptr(p, i*stride + j, hbd)) :
+      v128_unpack_u8_s16(v64_load_unaligned(cfl_ptr(p, i*stride + j, hbd)));
+  const void *p0 = cfl_ptr(p, i*stride, hbd);
+  const void *p1 = cfl_ptr(p, (i+1)*stride, hbd);
+  return hbd ? v128_from_v64(v64_load_unaligned(p1), v64_load_unaligned(p0)) :
+    v128_unpack_u8_s16(v64_from_32(u32_load_unaligned(p1), u32_load_unaligned(p0)));
+}
+
+SIMD_INLINE void cfl_store(void *p, int stride, int i, int j, int width, v128 a, int hbd) {
+  if (hbd) {
+    if (width >= 8)
+      v128_store_unaligned((uint16_t *)p + i*stride + j, a);
+    else {
+      v64_store_unaligned((uint16_t *)p + i*stride, v128_low_v64(a));
+      v64_store_unaligned((uint16_t *)p + (i+1)*stride, v128_high_v64(a));
+    }
+  } else {
+    v64 b = v128_low_v64(v128_pack_s16_u8(a, a));
+    if (width >= 8)
+      v64_store_unaligned((uint8_t *)p + i*stride + j, b);
+    else {
+      u32_store_unaligned((uint8_t *)p + i*stride, v64_low_u32(b));
+      u32_store_unaligned((uint8_t *)p + (i+1)*stride, v64_high_u32(b));
+    }
+  }
+}
+
+// (a0 + a1 + 2) >> 2 of horizontally adjacent pairs, where lo and hi hold
+// the vertical sums of 16 samples
+SIMD_INLINE v128 cfl_down(v128 hi, v128 lo) {
+  return v128_shr_n_s16(v128_add_16(v128_add_16(v128_unziplo_16(hi, lo), v128_unziphi_16(hi, lo)), v128_dup_16(2)), 2);
+}
+
+// Sum of the 32 bit lanes
+SIMD_INLINE int64_t cfl_hsum(v128 a) {
+  return v128_dotp_s32(a, v128_dup_32(1));
+}
+
+// Vertical sums of 16 samples of the 2x2 blocks for chroma row i, column j
+SIMD_INLINE v128 cfl_down_luma(const void *y, int n, int i, int j, int nc, int hbd) {
+  if (nc >= 8)
+    return cfl_down(v128_add_16(cfl_load(y, n, 2*i, 2*j + 8, 8, hbd), cfl_load(y, n, 2*i + 1, 2*j + 8, 8, hbd)),
+                    v128_add_16(cfl_load(y, n, 2*i, 2*j, 8, hbd), cfl_load(y, n, 2*i + 1, 2*j, 8, hbd)));
+  return cfl_down(v128_add_16(cfl_load(y, n, 2*i + 2, 0, 8, hbd), cfl_load(y, n, 2*i + 3, 0, 8, hbd)),
+                  v128_add_16(cfl_load(y, n, 2*i, 0, 8, hbd), cfl_load(y, n, 2*i + 1, 0, 8, hbd)));
+}
+
+// saturate((a*r + b) >> 16) of 8 samples
+SIMD_INLINE v128 cfl_map(v128 r, v128 a, v128 b, v128 max) {
+  v128 lo = v128_shr_n_s32(v128_add_32(v128_mullo_s32(v128_unpacklo_s16_s32(r), a), b), 16);
+  v128 hi = v128_shr_n_s32(v128_add_32(v128_mullo_s32(v128_unpackhi_s16_s32(r), a), b), 16);
+  lo = v128_min_s32(v128_max_s32(lo, v128_zero()), max);
+  hi = v128_min_s32(v128_max_s32(hi, v128_zero()), max);
+  return v128_pack_s32_s16(hi, lo);
+}
+
+// Map reconstructed luma to new predicted chroma
+SIMD_INLINE void cfl_predict(void *c, const void *ry, int cs, int stride, int nc, int sub, int32_t a, int32_t b, int bitdepth, int hbd) {
+  v128 va = v128_dup_32(a);
+  v128 vb = v128_dup_32(b);
+  v128 max = v128_dup_32((1 << bitdepth) - 1);
+  int rows = nc >= 8 ? 1 : 2;
+
+  for (int i = 0; i < nc; i += rows)
+    for (int j = 0; j < nc; j += 8) {
+      v128 p;
+      if (!sub)
+        p = cfl_map(cfl_load(ry, stride, i, j, nc, hbd), va, vb, max);
+      else if (nc >= 8)
+        p = cfl_down(v128_add_16(cfl_map(cfl_load(ry, stride, 2*i, 2*j + 8, 8, hbd), va, vb, max),
+                                 cfl_map(cfl_load(ry, stride, 2*i + 1, 2*j + 8, 8, hbd), va, vb, max)),
+                     v128_add_16(cfl_map(cfl_load(ry, stride, 2*i, 2*j, 8, hbd), va, vb, max),
+                                 cfl_map(cfl_load(ry, stride, 2*i + 1, 2*j, 8, hbd), va, vb, max)));
+      else
+        p = cfl_down(v128_add_16(cfl_map(cfl_load(ry, stride, 2*i + 2, 0, 8, hbd), va, vb, max),
+                                 cfl_map(cfl_load(ry, stride, 2*i + 3, 0, 8, hbd), va, vb, max)),
+                     v128_add_16(cfl_map(cfl_load(ry, stride, 2*i, 0, 8, hbd), va, vb, max),
+                                 cfl_map(cfl_load(ry, stride, 2*i + 1, 0, 8, hbd), va, vb, max)));
+      cfl_store(c, cs, i, j, nc, p, hbd);
+    }
+}
+
+SIMD_INLINE void improve_uv_prediction_simd(const void *y, void *u, void *v, const void *ry, int n, int cstride, int stride, int sub, int bitdepth, int hbd)
+{
+  int nc = n >> sub;
+  int lognc = log2i(nc);
+  int cs = cstride >> sub;
+  const v128 ones = v128_dup_16(1);
+
+  // Compute squared residual, summing the 32 bit products one row at a time
+  int64_t squared_residual = 0;
+  for (int i = 0; i < n; i += n >= 8 ? 1 : 2) {
+    v128 acc = v128_zero();
+    for (int j = 0; j < n; j += 8) {
+      v128 d = v128_sub_16(cfl_load(ry, stride, i, j, n, hbd), cfl_load(y, n, i, j, n, hbd));
+      acc = v128_add_32(acc, v128_madd_s16(d, d));
+    }
+    squared_residual += cfl_hsum(acc);
+  }
+
+  // If the luma prediction is good, we change nothing
+  if ((squared_residual >> (log2i(n) + log2i(n))) <= (64 << 2 * (bitdepth - 8)))
+    return;
+
+  // Compute linear fit between predicted chroma and predicted luma in one
+  // pass with the downsampling. The sums of up to 64 samples of a row fit in
+  // 16 bits and the products of a row in 32 bits.
+  int64_t yysum = 0, yusum = 0, yvsum = 0, uusum = 0, vvsum = 0;
+  v128 ysum32 = v128_zero(), usum32 = v128_zero(), vsum32 = v128_zero();
+  for (int i = 0; i < nc; i += nc >= 8 ? 1 : 2) {
+    v128 yy = v128_zero(), yu = v128_zero(), yv = v128_zero(), uu = v128_zero(), vv = v128_zero();
+    for (int j0 = 0; j0 < nc; j0 += 64) {
+      v128 ysum16 = v128_zero(), usum16 = v128_zero(), vsum16 = v128_zero();
+      for (int j = j0; j < nc && j < j0 + 64; j += 8) {
+        v128 ys = sub ? cfl_down_luma(y, n, i, j, nc, hbd) : cfl_load(y, cstride, i, j, nc, hbd);
+        v128 us = cfl_load(u, cs, i, j, nc, hbd);
+        v128 vs = cfl_load(v, cs, i, j, nc, hbd);
+        ysum16 = v128_add_16(ysum16, ys);
+        usum16 = v128_add_16(usum16, us);
+        vsum16 = v128_add_16(vsum16, vs);
+        yy = v128_add_32(yy, v128_madd_s16(ys, ys));
+        yu = v128_add_32(yu, v128_madd_s16(ys, us));
+        yv = v128_add_32(yv, v128_madd_s16(ys, vs));
+        uu = v128_add_32(uu, v128_madd_s16(us, us));
+        vv = v128_add_32(vv, v128_madd_s16(vs, vs));
+      }
+      ysum32 = v128_add_32(ysum32, v128_madd_s16(ysum16, ones));
+      usum32 = v128_add_32(usum32, v128_madd_s16(usum16, ones));
+      vsum32 = v128_add_32(vsum32, v128_madd_s16(vsum16, ones));
+    }
+    yysum += cfl_hsum(yy);
+    yusum += cfl_hsum(yu);
+    yvsum += cfl_hsum(yv);
+    uusum += cfl_hsum(uu);
+    vvsum += cfl_hsum(vv);
+  }
+  int64_t ysum = cfl_hsum(ysum32);
+  int64_t usum = cfl_hsum(usum32);
+  int64_t vsum = cfl_hsum(vsum32);
+
+  int64_t ssyy = yysum - (ysum*ysum >> lognc * 2);
+  int64_t ssuu = uusum - (usum*usum >> lognc * 2);
+  int64_t ssvv = vvsum - (vsum*vsum >> lognc * 2);
+  int64_t ssyu = yusum - (ysum*usum >> lognc * 2);
+  int64_t ssyv = yvsum - (ysum*vsum >> lognc * 2);
+
+  // Require a correlation above a threshold
+  if (ssyy) {
+    if (ssyu * ssyu * 2 > ssyy * ssuu) {
+      int64_t a64 = (ssyu << 16) / ssyy;
+      int64_t b64 = ((usum << 16) - a64 * ysum) >> lognc * 2;
+      int32_t a = (int32_t)clip(a64, -(1 << (31 - bitdepth)), 1 << (31 - bitdepth));
+      int32_t b = (int32_t)clip(b64 + (1 << 15), -(1LL << 31), (1U << 31) - 1);
+      cfl_predict(u, ry, cs, stride, nc, sub, a, b, bitdepth, hbd);
+    }
+    if (ssyv * ssyv * 2 > ssyy * ssvv) {
+      int64_t a64 = (ssyv << 16) / ssyy;
+      int64_t b64 = ((vsum << 16) - a64 * ysum) >> lognc * 2;
+      int32_t a = (int32_t)clip(a64, -(1 << (31 - bitdepth)), 1 << (31 - bitdepth));
+      int32_t b = (int32_t)clip(b64 + (1 << 15), -(1LL << 31), (1U << 31) - 1);
+      cfl_predict(v, ry, cs, stride, nc, sub, a, b, bitdepth, hbd);
+    }
+  }
+}
+
+void improve_uv_prediction_simd_lbd(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *ry, int n, int cstride, int stride, int sub, int bitdepth)
+{
+  improve_uv_prediction_simd(y, u, v, ry, n, cstride, stride, sub, bitdepth, 0);
+}
+
+void improve_uv_prediction_simd_hbd(uint16_t *y, uint16_t *u, uint16_t *v, uint16_t *ry, int n, int cstride, int stride, int sub, int bitdepth)
+{
+  improve_uv_prediction_simd(y, u, v, ry, n, cstride, stride, sub, bitdepth, 1);
+}
+#endif
+
+#ifndef HBD
+/* Quality metrics, see snr.c. The samples of both planes are scaled to the
+   output bitdepth by (x + round) >> shift with saturation, and widened to
+   16 bit, so the low and high bitdepth versions share the code below
+   specialised by the constant hbd argument. */
+
+SIMD_INLINE const void *metric_ptr(const void *p, int idx, int hbd) {
+  return hbd ? (const void *)((const uint16_t *)p + idx) : (const void *)((const uint8_t *)p + idx);
+}
+
+SIMD_INLINE int metric_sample(const void *p, int idx, int shift, int bitdepth, int hbd) {
+  int x = hbd ? ((const uint16_t *)p)[idx] : ((const uint8_t *)p)[idx];
+  return shift ? min((x + (1 << (shift - 1))) >> shift, (1 << bitdepth) - 1) : x;
+}
+
+// 8 scaled samples
+SIMD_INLINE v128 metric_load(const void *p, int idx, int shift, v128 round, v128 maxval, int hbd) {
+  v128 x = hbd ? v128_load_unaligned(metric_ptr(p, idx, hbd)) : v128_unpack_u8_s16(v64_load_unaligned(metric_ptr(p, idx, hbd)));
+  return shift ? v128_min_s16(v128_shr_s16(v128_add_16(x, round), shift), maxval) : x;
+}
+
+SIMD_INLINE uint64_t sse_plane_simd(const void *a, int astride, const void *b, int bstride, int width, int height, int shift, int bitdepth, int hbd) {
+  const v128 round = v128_dup_16(shift ? 1 << (shift - 1) : 0);
+  const v128 maxval = v128_dup_16((1 << bitdepth) - 1);
+  uint64_t sum = 0;
+
+  for (int i = 0; i < height; i++) {
+    int j = 0;
+    while (j + 8 <= width) {
+      // Up to 32 vectors of 12 bit differences fit in the 32 bit lanes
+      const int end = min(width & ~7, j + 256);
+      v128 sse = v128_zero();
+      for (; j < end; j += 8) {
+        v128 d = v128_sub_16(metric_load(a, i*astride + j, shift, round, maxval, hbd),
+                             metric_load(b, i*bstride + j, shift, round, maxval, hbd));
+        sse = v128_add_32(sse, v128_madd_s16(d, d));
+      }
+      sum += v128_dotp_s32(sse, v128_dup_32(1));
+    }
+    for (; j < width; j++) {
+      int d = metric_sample(a, i*astride + j, shift, bitdepth, hbd) - metric_sample(b, i*bstride + j, shift, bitdepth, hbd);
+      sum += d * d;
+    }
+  }
+  return sum;
+}
+
+SIMD_INLINE void ssim_sums_8x8_simd(const void *a, int astride, const void *b, int bstride, int shift, int bitdepth, uint64_t sums[5], int hbd) {
+  const v128 round = v128_dup_16(shift ? 1 << (shift - 1) : 0);
+  const v128 maxval = v128_dup_16((1 << bitdepth) - 1);
+  const v128 ones = v128_dup_16(1);
+  v128 sum_a = v128_zero(), sum_b = v128_zero();
+  v128 sum_a2 = v128_zero(), sum_b2 = v128_zero(), sum_ab = v128_zero();
+
+  for (int i = 0; i < 8; i++) {
+    v128 x = metric_load(a, i*astride, shift, round, maxval, hbd);
+    v128 y = metric_load(b, i*bstride, shift, round, maxval, hbd);
+    sum_a = v128_add_16(sum_a, x);
+    sum_b = v128_add_16(sum_b, y);
+    sum_a2 = v128_add_32(sum_a2, v128_madd_s16(x, x));
+    sum_b2 = v128_add_32(sum_b2, v128_madd_s16(y, y));
+    sum_ab = v128_add_32(sum_ab, v128_madd_s16(x, y));
+  }
+  sums[0] = (uint32_t)v128_dotp_s16(sum_a, ones);
+  sums[1] = (uint32_t)v128_dotp_s16(sum_b, ones);
+  sums[2] = (uint32_t)v128_dotp_s32(sum_a2, v128_dup_32(1));
+  sums[3] = (uint32_t)v128_dotp_s32(sum_b2, v128_dup_32(1));
+  sums[4] = (uint32_t)v128_dotp_s32(sum_ab, v128_dup_32(1));
+}
+
+uint64_t sse_plane_simd_lbd(const uint8_t *a, int astride, const uint8_t *b, int bstride, int width, int height, int shift, int bitdepth)
+{
+  return sse_plane_simd(a, astride, b, bstride, width, height, shift, bitdepth, 0);
+}
+
+uint64_t sse_plane_simd_hbd(const uint16_t *a, int astride, const uint16_t *b, int bstride, int width, int height, int shift, int bitdepth)
+{
+  return sse_plane_simd(a, astride, b, bstride, width, height, shift, bitdepth, 1);
+}
+
+void ssim_sums_8x8_simd_lbd(const uint8_t *a, int astride, const uint8_t *b, int bstride, int shift, int bitdepth, uint64_t sums[5])
+{
+  ssim_sums_8x8_simd(a, astride, b, bstride, shift, bitdepth, sums, 0);
+}
+
+void ssim_sums_8x8_simd_hbd(const uint16_t *a, int astride, const uint16_t *b, int bstride, int shift, int bitdepth, uint64_t sums[5])
+{
+  ssim_sums_8x8_simd(a, astride, b, bstride, shift, bitdepth, sums, 1);
+}
+#endif
@@ -101,20 +101,56 @@ int TEMPLATE(sad_calc_simd_unaligned)(SAMPLE *a, SAMPLE *b, int astride, int bst
     default:
       {
         sad256_internal_u16 s = v256_sad_u16_init();
-        for (i = 0; i < height; i+=4)
+        for (i = 0; i < height; i+=4) {
           for (j = 0; j < width; j += 16) {
             s = v256_sad_u16(s, v256_load_unaligned(a + 0*astride + j), v256_load_unaligned(b + 0*bstride + j));
             s = v256_sad_u16(s, v256_load_unaligned(a + 1*astride + j), v256_load_unaligned(b + 1*bstride + j));
             s = v256_sad_u16(s, v256_load_unaligned(a + 2*astride + j), v256_load_unaligned(b + 2*bstride + j));
             s = v256_sad_u16(s, v256_load_unaligned(a + 3*astride + j), v256_load_unaligned(b + 3*bstride + j));
-            a += 4*astride;
-            b += 4*bstride;
           }
+          a += 4*astride;
+          b += 4*bstride;
+        }
         return v256_sad_u16_sum(s);
       }
   };
 }
 
+/* SAD of a block of width 8 or 16 and height divisible by 4, as
+   sad_calc_simd_unaligned(), except that the rows are summed in groups of four
+   and the sum so far is returned as soon as it reaches thr. A result below
+   thr is the exact SAD. */
+int TEMPLATE(sad_calc_thr_simd)(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height, unsigned int thr)
+{
+  int i;
+  unsigned int sum = 0;
+
+  if (width == 8) {
+    sad128_internal_u16 s = v128_sad_u16_init();
+    for (i = 0; i < height && sum < thr; i += 4) {
+      s = v128_sad_u16(s, v128_load_unaligned(a + 0*astride), v128_load_unaligned(b + 0*bstride));
+      s = v128_sad_u16(s, v128_load_unaligned(a + 1*astride), v128_load_unaligned(b + 1*bstride));
+      s = v128_sad_u16(s, v128_load_unaligned(a + 2*astride), v128_load_unaligned(b + 2*bstride));
+      s = v128_sad_u16(s, v128_load_unaligned(a + 3*astride), v128_load_unaligned(b + 3*bstride));
+      a += 4*astride;
+      b += 4*bstride;
+      sum = v128_sad_u16_sum(s);
+    }
+  } else {
+    sad256_internal_u16 s = v256_sad_u16_init();
+    for (i = 0; i < height && sum < thr; i += 4) {
+      s = v256_sad_u16(s, v256_load_unaligned(a + 0*astride), v256_load_unaligned(b + 0*bstride));
+      s = v256_sad_u16(s, v256_load_unaligned(a + 1*astride), v256_load_unaligned(b + 1*bstride));
+      s = v256_sad_u16(s, v256_load_unaligned(a + 2*astride), v256_load_unaligned(b + 2*bstride));
+      s = v256_sad_u16(s, v256_load_unaligned(a + 3*astride), v256_load_unaligned(b + 3*bstride));
+      a += 4*astride;
+      b += 4*bstride;
+      sum = v256_sad_u16_sum(s);
+    }
+  }
+  return sum;
+}
+
 #ifndef HBD
 
 enum {
@@ -3247,3 +3283,283 @@ void cdef_filter_block_simd(uint8_t *dst8, uint32_t *dst16, int dstride,
 
 #endif
 #endif
+
+#ifndef HBD
+/* Chroma from luma, see improve_uv_prediction() in common_block.c. The
+   samples are widened to 16 bit, so the low and high bitdepth versions share
+   the code below specialised by the constant hbd argument. Rows of 4 samples
+   are handled two rows at a time with the first row in the low half. */
+
+SIMD_INLINE const void *cfl_ptr(const void *p, int idx, int hbd) {
+  return hbd ? (const void *)((const uint32_t *)p + idx) : (const void *)((const uint8_t *)p + idx);
+}
+
+// 8 samples of row i from column j, or 4 from rows i and i+1 if width is 4
+SIMD_INLINE v256 cfl_load(const void *p, int stride, int i, int j, int width, int hbd) {
+  if (width >= 8)
+    return hbd ? v256_load_unaligned(cfl_ptr(p, i*stride + j, hbd)) :
+      v256_unpack_u16_s32(v128_load_unaligned(cfl_ptr(p, i*stride + j, hbd)));
+  const void *p0 = cfl_ptr(p, i*stride, hbd);
+  const void *p1 = cfl_ptr(p, (i+1)*stride, hbd);
+  return hbd ? v256_from_v128(v128_load_unaligned(p1), v128_load_unaligned(p0)) :
+    v256_unpack_u16_s32(v128_from_v64(v64_load_unaligned(p1), v64_load_unaligned(p0)));
+}
+
+SIMD_INLINE void cfl_store(void *p, int stride, int i, int j, int width, v256 a, int hbd) {
+  if (hbd) {
+    if (width >= 8)
+      v256_store_unaligned((uint32_t *)p + i*stride + j, a);
+    else {
+      v128_store_unaligned((uint32_t *)p + i*stride, v256_low_v128(a));
+      v128_store_unaligned((uint32_t *)p + (i+1)*stride, v256_high_v128(a));
+    }
+  } else {
+    v128 b = v256_low_v128(v256_pack_s32_u16(a, a));
+    if (width >= 8)
+      v128_store_unaligned((uint8_t *)p + i*stride + j, b);
+    else {
+      v64_store_unaligned((uint8_t *)p + i*stride, v128_low_v64(b));
+      v64_store_unaligned((uint8_t *)p + (i+1)*stride, v128_high_v64(b));
+    }
+  }
+}
+
+// (a0 + a1 + 2) >> 2 of horizontally adjacent pairs, where lo and hi hold
+// the vertical sums of 16 samples
+SIMD_INLINE v256 cfl_down(v256 hi, v256 lo) {
+  return v256_shr_n_s32(v256_add_32(v256_add_32(v256_unziplo_32(hi, lo), v256_unziphi_32(hi, lo)), v256_dup_32(2)), 2);
+}
+
+// Sum of the 32 bit lanes
+SIMD_INLINE int64_t cfl_hsum(v256 a) {
+  return v128_dotp_s32(a, v256_dup_64(1));
+}
+
+// Vertical sums of 16 samples of the 2x2 blocks for chroma row i, column j
+SIMD_INLINE v256 cfl_down_luma(const void *y, int n, int i, int j, int nc, int hbd) {
+  if (nc >= 8)
+    return cfl_down(v256_add_32(cfl_load(y, n, 2*i, 2*j + 8, 8, hbd), cfl_load(y, n, 2*i + 1, 2*j + 8, 8, hbd)),
+                    v256_add_32(cfl_load(y, n, 2*i, 2*j, 8, hbd), cfl_load(y, n, 2*i + 1, 2*j, 8, hbd)));
+  return cfl_down(v256_add_32(cfl_load(y, n, 2*i + 2, 0, 8, hbd), cfl_load(y, n, 2*i + 3, 0, 8, hbd)),
+                  v256_add_32(cfl_load(y, n, 2*i, 0, 8, hbd), cfl_load(y, n, 2*i + 1, 0, 8, hbd)));
+}
+
+// saturate((a*r + b) >> 16) of 8 samples
+SIMD_INLINE v256 cfl_map(v256 r, v256 a, v256 b, v256 max) {
+  v256 lo = v256_shr_n_s64(v256_add_64(v256_mullo_s64(v256_unpacklo_s32_s64(r), a), b), 16);
+  v256 hi = v256_shr_n_s64(v256_add_64(v256_mullo_s64(v256_unpackhi_s32_s64(r), a), b), 16);
+  lo = v128_min_s32(v128_max_s32(lo, v256_zero()), max);
+  hi = v128_min_s32(v128_max_s32(hi, v256_zero()), max);
+  return v256_pack_s64_s32(hi, lo);
+}
+
+// Map reconstructed luma to new predicted chroma
+SIMD_INLINE void cfl_predict(void *c, const void *ry, int cs, int stride, int nc, int sub, int32_t a, int32_t b, int bitdepth, int hbd) {
+  v256 va = v256_dup_64(a);
+  v256 vb = v256_dup_64(b);
+  v256 max = v256_dup_64((1 << bitdepth) - 1);
+  int rows = nc >= 8 ? 1 : 2;
+
+  for (int i = 0; i < nc; i += rows)
+    for (int j = 0; j < nc; j += 8) {
+      v256 p;
+      if (!sub)
+        p = cfl_map(cfl_load(ry, stride, i, j, nc, hbd), va, vb, max);
+      else if (nc >= 8)
+        p = cfl_down(v256_add_32(cfl_map(cfl_load(ry, stride, 2*i, 2*j + 8, 8, hbd), va, vb, max),
+                                 cfl_map(cfl_load(ry, stride, 2*i + 1, 2*j + 8, 8, hbd), va, vb, max)),
+                     v256_add_32(cfl_map(cfl_load(ry, stride, 2*i, 2*j, 8, hbd), va, vb, max),
+                                 cfl_map(cfl_load(ry, stride, 2*i + 1, 2*j, 8, hbd), va, vb, max)));
+      else
+        p = cfl_down(v256_add_32(cfl_map(cfl_load(ry, stride, 2*i + 2, 0, 8, hbd), va, vb, max),
+                                 cfl_map(cfl_load(ry, stride, 2*i + 3, 0, 8, hbd), va, vb, max)),
+                     v256_add_32(cfl_map(cfl_load(ry, stride, 2*i, 0, 8, hbd), va, vb, max),
+                                 cfl_map(cfl_load(ry, stride, 2*i + 1, 0, 8, hbd), va, vb, max)));
+      cfl_store(c, cs, i, j, nc, p, hbd);
+    }
+}
+
+SIMD_INLINE void improve_uv_prediction_simd(const void *y, void *u, void *v, const void *ry, int n, int cstride, int stride, int sub, int bitdepth, int hbd)
+{
+  int nc = n >> sub;
+  int lognc = log2i(nc);
+  int cs = cstride >> sub;
+  const v256 ones = v256_dup_32(1);
+
+  // Compute squared residual, summing the 32 bit products one row at a time
+  int64_t squared_residual = 0;
+  for (int i = 0; i < n; i += n >= 8 ? 1 : 2) {
+    v256 acc = v256_zero();
+    for (int j = 0; j < n; j += 8) {
+      v256 d = v256_sub_32(cfl_load(ry, stride, i, j, n, hbd), cfl_load(y, n, i, j, n, hbd));
+      acc = v256_add_64(acc, v256_madd_s32(d, d));
+    }
+    squared_residual += cfl_hsum(acc);
+  }
+
+  // If the luma prediction is good, we change nothing
+  if ((squared_residual >> (log2i(n) + log2i(n))) <= (64 << 2 * (bitdepth - 8)))
+    return;
+
+  // Compute linear fit between predicted chroma and predicted luma in one
+  // pass with the downsampling. The sums of up to 64 samples of a row fit in
+  // 16 bits and the products of a row in 32 bits.
+  int64_t yysum = 0, yusum = 0, yvsum = 0, uusum = 0, vvsum = 0;
+  v256 ysum32 = v256_zero(), usum32 = v256_zero(), vsum32 = v256_zero();
+  for (int i = 0; i < nc; i += nc >= 8 ? 1 : 2) {
+    v256 yy = v256_zero(), yu = v256_zero(), yv = v256_zero(), uu = v256_zero(), vv = v256_zero();
+    for (int j0 = 0; j0 < nc; j0 += 64) {
+      v256 ysum16 = v256_zero(), usum16 = v256_zero(), vsum16 = v256_zero();
+      for (int j = j0; j < nc && j < j0 + 64; j += 8) {
+        v256 ys = sub ? cfl_down_luma(y, n, i, j, nc, hbd) : cfl_load(y, cstride, i, j, nc, hbd);
+        v256 us = cfl_load(u, cs, i, j, nc, hbd);
+        v256 vs = cfl_load(v, cs, i, j, nc, hbd);
+        ysum16 = v256_add_32(ysum16, ys);
+        usum16 = v256_add_32(usum16, us);
+        vsum16 = v256_add_32(vsum16, vs);
+        yy = v256_add_64(yy, v256_madd_s32(ys, ys));
+        yu = v256_add_64(yu, v256_madd_s32(ys, us));
+        yv = v256_add_64(yv, v256_madd_s32(ys, vs));
+        uu = v256_add_64(uu, v256_madd_s32(us, us));
+        vv = v256_add_64(vv, v256_madd_s32(vs, vs));
+      }
+      ysum32 = v256_add_64(ysum32, v256_madd_s32(ysum16, ones));
+      usum32 = v256_add_64(usum32, v256_madd_s32(usum16, ones));
+      vsum32 = v256_add_64(vsum32, v256_madd_s32(vsum16, ones));
+    }
+    yysum += cfl_hsum(yy);
+    yusum += cfl_hsum(yu);
+    yvsum += cfl_hsum(yv);
+    uusum += cfl_hsum(uu);
+    vvsum += cfl_hsum(vv);
+  }
+  int64_t ysum = cfl_hsum(ysum32);
+  int64_t usum = cfl_hsum(usum32);
+  int64_t vsum = cfl_hsum(vsum32);
+
+  int64_t ssyy = yysum - (ysum*ysum >> lognc * 2);
+  int64_t ssuu = uusum - (usum*usum >> lognc * 2);
+  int64_t ssvv = vvsum - (vsum*vsum >> lognc * 2);
+  int64_t ssyu = yusum - (ysum*usum >> lognc * 2);
+  int64_t ssyv = yvsum - (ysum*vsum >> lognc * 2);
+
+  // Require a correlation above a threshold
+  if (ssyy) {
+    if (ssyu * ssyu * 2 > ssyy * ssuu) {
+      int64_t a64 = (ssyu << 16) / ssyy;
+      int64_t b64 = ((usum << 16) - a64 * ysum) >> lognc * 2;
+      int32_t a = (int32_t)clip(a64, -(1 << (31 - bitdepth)), 1 << (31 - bitdepth));
+      int32_t b = (int32_t)clip(b64 + (1 << 15), -(1LL << 31), (1U << 31) - 1);
+      cfl_predict(u, ry, cs, stride, nc, sub, a, b, bitdepth, hbd);
+    }
+    if (ssyv * ssyv * 2 > ssyy * ssvv) {
+      int64_t a64 = (ssyv << 16) / ssyy;
+      int64_t b64 = ((vsum << 16) - a64 * ysum) >> lognc * 2;
+      int32_t a = (int32_t)clip(a64, -(1 << (31 - bitdepth)), 1 << (31 - bitdepth));
+      int32_t b = (int32_t)clip(b64 + (1 << 15), -(1LL << 31), (1U << 31) - 1);
+      cfl_predict(v, ry, cs, stride, nc, sub, a, b, bitdepth, hbd);
+    }
+  }
+}
+
+void improve_uv_prediction_simd_lbd(uint8_t *y, uint8_t *u, uint8_t *v, uint8_t *ry, int n, int cstride, int stride, int sub, int bitdepth)
+{
+  improve_uv_prediction_simd(y, u, v, ry, n, cstride, stride, sub, bitdepth, 0);
+}
+
+void improve_uv_prediction_simd_hbd(uint32_t *y, uint32_t *u, uint32_t *v, uint32_t *ry, int n, int cstride, int stride, int sub, int bitdepth)
+{
+  improve_uv_prediction_simd(y, u, v, ry, n, cstride, stride, sub, bitdepth, 1);
+}
+#endif
+
+#ifndef HBD
+/* Quality metrics, see snr.c. The samples of both planes are scaled to the
+   output bitdepth by (x + round) >> shift with saturation, and widened to
+   16 bit, so the low and high bitdepth versions share the code below
+   specialised by the constant hbd argument. */
+
+SIMD_INLINE const void *metric_ptr(const void *p, int idx, int hbd) {
+  return hbd ? (const void *)((const uint32_t *)p + idx) : (const void *)((const uint8_t *)p + idx);
+}
+
+SIMD_INLINE int metric_sample(const void *p, int idx, int shift, int bitdepth, int hbd) {
+  int x = hbd ? ((const uint32_t *)p)[idx] : ((const uint8_t *)p)[idx];
+  return shift ? min((x + (1 << (shift - 1))) >> shift, (1 << bitdepth) - 1) : x;
+}
+
+// 8 scaled samples
+SIMD_INLINE v256 metric_load(const void *p, int idx, int shift, v256 round, v256 maxval, int hbd) {
+  v256 x = hbd ? v256_load_unaligned(metric_ptr(p, idx, hbd)) : v256_unpack_u16_s32(v128_load_unaligned(metric_ptr(p, idx, hbd)));
+  return shift ? v256_min_s32(v256_shr_s32(v256_add_32(x, round), shift), maxval) : x;
+}
+
+SIMD_INLINE uint64_t sse_plane_simd(const void *a, int astride, const void *b, int bstride, int width, int height, int shift, int bitdepth, int hbd) {
+  const v256 round = v256_dup_32(shift ? 1 << (shift - 1) : 0);
+  const v256 maxval = v256_dup_32((1 << bitdepth) - 1);
+  uint64_t sum = 0;
+
+  for (int i = 0; i < height; i++) {
+    int j = 0;
+    while (j + 8 <= width) {
+      // Up to 32 vectors of 12 bit differences fit in the 32 bit lanes
+      const int end = min(width & ~7, j + 256);
+      v256 sse = v256_zero();
+      for (; j < end; j += 8) {
+        v256 d = v256_sub_32(metric_load(a, i*astride + j, shift, round, maxval, hbd),
+                             metric_load(b, i*bstride + j, shift, round, maxval, hbd));
+        sse = v256_add_64(sse, v256_madd_s32(d, d));
+      }
+      sum += v128_dotp_s32(sse, v256_dup_64(1));
+    }
+    for (; j < width; j++) {
+      int d = metric_sample(a, i*astride + j, shift, bitdepth, hbd) - metric_sample(b, i*bstride + j, shift, bitdepth, hbd);
+      sum += d * d;
+    }
+  }
+  return sum;
+}
+
+SIMD_INLINE void ssim_sums_8x8_simd(const void *a, int astride, const void *b, int bstride, int shift, int bitdepth, uint64_t sums[5], int hbd) {
+  const v256 round = v256_dup_32(shift ? 1 << (shift - 1) : 0);
+  const v256 maxval = v256_dup_32((1 << bitdepth) - 1);
+  const v256 ones = v256_dup_32(1);
+  v256 sum_a = v256_zero(), sum_b = v256_zero();
+  v256 sum_a2 = v256_zero(), sum_b2 = v256_zero(), sum_ab = v256_zero();
+
+  for (int i = 0; i < 8; i++) {
+    v256 x = metric_load(a, i*astride, shift, round, maxval, hbd);
+    v256 y = metric_load(b, i*bstride, shift, round, maxval, hbd);
+    sum_a = v256_add_32(sum_a, x);
+    sum_b = v256_add_32(sum_b, y);
+    sum_a2 = v256_add_64(sum_a2, v256_madd_s32(x, x));
+    sum_b2 = v256_add_64(sum_b2, v256_madd_s32(y, y));
+    sum_ab = v256_add_64(sum_ab, v256_madd_s32(x, y));
+  }
+  sums[0] = (v64)v256_dotp_s32(sum_a, ones);
+  sums[1] = (v64)v256_dotp_s32(sum_b, ones);
+  sums[2] = (v64)v128_dotp_s32(sum_a2, v256_dup_64(1));
+  sums[3] = (v64)v128_dotp_s32(sum_b2, v256_dup_64(1));
+  sums[4] = (v64)v128_dotp_s32(sum_ab, v256_dup_64(1));
+}
+
+uint64_t sse_plane_simd_lbd(const uint8_t *a, int astride, const uint8_t *b, int bstride, int width, int height, int shift, int bitdepth)
+{
+  return sse_plane_simd(a, astride, b, bstride, width, height, shift, bitdepth, 0);
+}
+
+uint64_t sse_plane_simd_hbd(const uint32_t *a, int astride, const uint32_t *b, int bstride, int width, int height, int shift, int bitdepth)
+{
+  return sse_plane_simd(a, astride, b, bstride, width, height, shift, bitdepth, 1);
+}
+
+void ssim_sums_8x8_simd_lbd(const uint8_t *a, int astride, const uint8_t *b, int bstride, int shift, int bitdepth, uint64_t sums[5])
+{
+  ssim_sums_8x8_simd(a, astride, b, bstride, shift, bitdepth, sums, 0);
+}
+
+void ssim_sums_8x8_simd_hbd(const uint32_t *a, int astride, const uint32_t *b, int bstride, int shift, int bitdepth, uint64_t sums[5])
+{
+  ssim_sums_8x8_simd(a, astride, b, bstride, shift, bitdepth, sums, 1);
+}
+#endif
@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+#include "frame_writer.h"
+#include "thread.h"
+
+typedef struct
+{
+  FILE *outfile;
+  uint8_t *data;                 //Copied data, or NULL for a frame
+  size_t size;
+  yuv_frame_t *frame;
+  frame_write_func_t write;
+} write_item_t;
+
+struct frame_writer
+{
+  /* Ring of queued items. The writer thread writes items up to num_queued,
+     and written frames up to num_written are released by the queueing
+     thread, after which their entries can be reused. */
+  write_item_t *items;
+  int max_queued;
+  int num_queued;
+  int num_written;
+  int num_released;
+  int stop;                      //Set to end the writer thread once all items are written
+  frame_release_func_t release;
+  void *owner;
+  thor_thread_t thread;
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+};
+
+static void writer_thread(void *arg)
+{
+  frame_writer_t *writer = arg;
+
+  thor_mutex_lock(&writer->mutex);
+  for (;;) {
+    while (writer->num_written == writer->num_queued && !writer->stop)
+      thor_cond_wait(&writer->cond, &writer->mutex);
+    if (writer->num_written == writer->num_queued)
+      break;
+    write_item_t *item = &writer->items[writer->num_written % writer->max_queued];
+    thor_mutex_unlock(&writer->mutex);
+
+    /* The entry is not touched by the queueing thread until num_written is
+       increased. Data such as the bitstream is flushed so that it is not
+       held back in a pipe. */
+    if (item->data) {
+      if (fwrite(item->data, 1, item->size, item->outfile) != item->size)
+        fatalerror("Problem writing to file.");
+      fflush(item->outfile);
+      free(item->data);
+      item->data = NULL;
+    } else
+      item->write(item->frame, item->outfile);
+
+    thor_mutex_lock(&writer->mutex);
+    writer->num_written++;
+    thor_cond_signal(&writer->cond);
+  }
+  thor_mutex_unlock(&writer->mutex);
+}
+
+/* Release the frames written so far. Called with the mutex held. */
+static void release_written(frame_writer_t *writer)
+{
+  while (writer->num_released < writer->num_written) {
+    write_item_t *item = &writer->items[writer->num_released++ % writer->max_queued];
+    if (item->frame) {
+      thor_mutex_unlock(&writer->mutex);
+      writer->release(writer->owner, item->frame);
+      thor_mutex_lock(&writer->mutex);
+      item->frame = NULL;
+    }
+  }
+}
+
+/* Return an entry for the next item, waiting for one to be written if the queue is full */
+static write_item_t *new_item(frame_writer_t *writer, FILE *outfile)
+{
+  thor_mutex_lock(&writer->mutex);
+  release_written(writer);
+  while (writer->num_queued == writer->num_released + writer->max_queued) {
+    thor_cond_wait(&writer->cond, &writer->mutex);
+    release_written(writer);
+  }
+  thor_mutex_unlock(&writer->mutex);
+  write_item_t *item = &writer->items[writer->num_queued % writer->max_queued];
+  item->outfile = outfile;
+  return item;
+}
+
+static void push_item(frame_writer_t *writer)
+{
+  thor_mutex_lock(&writer->mutex);
+  writer->num_queued++;
+  thor_cond_signal(&writer->cond);
+  thor_mutex_unlock(&writer->mutex);
+}
+
+frame_writer_t *create_frame_writer(int max_queued, frame_release_func_t release, void *owner)
+{
+  frame_writer_t *writer = calloc(1, sizeof(frame_writer_t));
+  if (!writer || !(writer->items = calloc(max_queued, sizeof(write_item_t))))
+    fatalerror("Memory allocation failed");
+
+  writer->max_queued = max_queued;
+  writer->release = release;
+  writer->owner = owner;
+  thor_mutex_init(&writer->mutex);
+  thor_cond_init(&writer->cond);
+  thor_thread_create(&writer->thread, writer_thread, writer);
+  return writer;
+}
+
+void queue_write_data(frame_writer_t *writer, FILE *outfile, const void *data, size_t size)
+{
+  write_item_t *item = new_item(writer, outfile);
+  if (!(item->data = malloc(max(size, 1))))
+    fatalerror("Memory allocation failed");
+  memcpy(item->data, data, size);
+  item->size = size;
+  item->frame = NULL;
+  push_item(writer);
+}
+
+void queue_write_frame(frame_writer_t *writer, FILE *outfile, yuv_frame_t *frame, frame_write_func_t write)
+{
+  write_item_t *item = new_item(writer, outfile);
+  item->data = NULL;
+  item->frame = frame;
+  item->write = write;
+  push_item(writer);
+}
+
+void close_frame_writer(frame_writer_t *writer)
+{
+  thor_mutex_lock(&writer->mutex);
+  writer->stop = 1;
+  thor_cond_signal(&writer->cond);
+  thor_mutex_unlock(&writer->mutex);
+  thor_thread_join(writer->thread);
+
+  thor_mutex_lock(&writer->mutex);
+  release_written(writer);
+  thor_mutex_unlock(&writer->mutex);
+  thor_mutex_destroy(&writer->mutex);
+  thor_cond_destroy(&writer->cond);
+  free(writer->items);
+  free(writer);
+}
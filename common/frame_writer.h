@@ -0,0 +1,58 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_FRAME_WRITER_H_)
+#define _FRAME_WRITER_H_
+
+#include <stdio.h>
+#include "types.h"
+
+/* Writer of the output files on a separate thread, so that the conversion
+   of output frames and stalls of the file system or pipe overlap with the
+   coding of the next frame. Items are written in the order queued, and at
+   most max_queued items are queued at a time. */
+
+typedef struct frame_writer frame_writer_t;
+
+/* Gives a frame back to its owner once it has been written. It is called on
+   the thread queueing the items, from queue_write_data(),
+   queue_write_frame() and close_frame_writer(). */
+typedef void (*frame_release_func_t)(void *owner, yuv_frame_t *frame);
+typedef void (*frame_write_func_t)(yuv_frame_t *frame, FILE *outfile);
+
+frame_writer_t *create_frame_writer(int max_queued, frame_release_func_t release, void *owner);
+
+/* Queue size bytes of data, which are copied */
+void queue_write_data(frame_writer_t *writer, FILE *outfile, const void *data, size_t size);
+
+/* Queue frame to be written by write, e.g. write_yuv_frame_lbd. The frame
+   must stay unchanged until it is released. */
+void queue_write_frame(frame_writer_t *writer, FILE *outfile, yuv_frame_t *frame, frame_write_func_t write);
+
+/* Write and release all queued items */
+void close_frame_writer(frame_writer_t *writer);
+
+#endif
@@ -67,6 +67,8 @@ static inline void fatalerror(char error_text[])
 #define MAX_REORDER_BUFFER 32    //Maximum number of frames to store for reordering
 #define ME_CANDIDATES 6          //Number of ME candidates
 #define MAX_QP 51                //Maximum QP value
+#define MAX_THREADS 64           //Maximum number of worker threads
+#define MAX_PYRAMID_LEVELS 3     //Maximum number of cached down-scaled levels of a frame
 
 #define DYADIC_CODING 1          // Support hierarchical B frames
 
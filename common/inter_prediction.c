@@ -62,7 +62,7 @@ void TEMPLATE(clip_mv)(mv_t *mv_cand, int ypos, int xpos, int fwidth, int fheigh
   mv_cand->x = sign ? -mvx : mvx;
 }
 
-static void get_inter_prediction_chroma(SAMPLE *pblock, SAMPLE *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign, int pic_width2, int pic_height2, int xpos, int ypos, int bitdepth)
+void TEMPLATE(get_inter_prediction_chroma)(SAMPLE *pblock, SAMPLE *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign, int pic_width2, int pic_height2, int xpos, int ypos, int bitdepth)
 {
   int i,j;
 
@@ -215,8 +215,8 @@ void TEMPLATE(get_inter_prediction_yuv)(yuv_frame_t *ref, SAMPLE *pblock_y, SAMP
     if (ref->subsample == 400)
       continue;
     if (ref->sub) {
-      get_inter_prediction_chroma(pblock_u + offsetpC, ref_u + offsetrC, bwidth >> ref->sub, bheight >> ref->sub, rstride_c, pstride >> ref->sub, &mv, sign, width >> ref->sub, height >> ref->sub, xposC, yposC, bitdepth);
-      get_inter_prediction_chroma(pblock_v + offsetpC, ref_v + offsetrC, bwidth >> ref->sub, bheight >> ref->sub, rstride_c, pstride >> ref->sub, &mv, sign, width >> ref->sub, height >> ref->sub, xposC, yposC, bitdepth);
+      TEMPLATE(get_inter_prediction_chroma)(pblock_u + offsetpC, ref_u + offsetrC, bwidth >> ref->sub, bheight >> ref->sub, rstride_c, pstride >> ref->sub, &mv, sign, width >> ref->sub, height >> ref->sub, xposC, yposC, bitdepth);
+      TEMPLATE(get_inter_prediction_chroma)(pblock_v + offsetpC, ref_v + offsetrC, bwidth >> ref->sub, bheight >> ref->sub, rstride_c, pstride >> ref->sub, &mv, sign, width >> ref->sub, height >> ref->sub, xposC, yposC, bitdepth);
     } else {
       // Use luma prediction for chroma in 4:4:4
       TEMPLATE(get_inter_prediction_luma)(pblock_u + offsetpC, ref_u + offsetrC, bwidth, bheight, rstride_c, pstride, &mv, sign, 0, width, height, xposC, yposC, bitdepth);
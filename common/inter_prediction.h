@@ -40,6 +40,7 @@ int get_mv_merge_lbd(int yposY, int xposY, int width, int height, int bwidth, in
 int get_mv_merge_hbd(int yposY, int xposY, int width, int height, int bwidth, int bheight, int sb_size, deblock_data_t *deblock_data, inter_pred_t *merge_candidates);
 
 void TEMPLATE(get_inter_prediction_luma)(SAMPLE *pblock, SAMPLE *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign, int bipred, int pic_width, int pic_height, int xpos, int ypos, int bitdepth);
+void TEMPLATE(get_inter_prediction_chroma)(SAMPLE *pblock, SAMPLE *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign, int pic_width2, int pic_height2, int xpos, int ypos, int bitdepth);
 void TEMPLATE(get_inter_prediction_temp)(int width, int height, yuv_frame_t *ref0, yuv_frame_t *ref1, block_pos_t *block_pos, deblock_data_t *deblock_data, int gop_size, int phase, SAMPLE *pblock_y, SAMPLE *pblock_u, SAMPLE *pblock_v);
 void TEMPLATE(get_inter_prediction_yuv)(yuv_frame_t *ref, SAMPLE *pblock_y, SAMPLE *pblock_u, SAMPLE *pblock_v, block_pos_t *block_pos, mv_t *mv_arr, int sign, int width, int height, int enable_bipred, int split, int bitdepth);
 void TEMPLATE(average_blocks_all)(SAMPLE *rec_y, SAMPLE *rec_u, SAMPLE *rec_v, SAMPLE *pblock0_y, SAMPLE *pblock0_u, SAMPLE *pblock0_v, SAMPLE *pblock1_y, SAMPLE *pblock1_u, SAMPLE *pblock1_v, block_pos_t *block_pos, int sub);
@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <string.h>
+#include "perf_counters.h"
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+static const struct {
+  const char *name;
+  uint32_t type;
+  uint64_t config;
+} perf_events[MAX_PERF_COUNTERS] = {
+  { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+  { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+  { "l1d_misses",    PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+  { "llc_misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+  { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static int open_event(uint32_t type, uint64_t config, int group_fd)
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = group_fd == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return (int)syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+int open_perf_counters(perf_counters_t *perf)
+{
+  int i;
+
+  /* The first event that opens leads the group, events the CPU lacks are left out */
+  perf->num_counters = 0;
+  for (i = 0; i < MAX_PERF_COUNTERS; i++) {
+    int fd = open_event(perf_events[i].type, perf_events[i].config, perf->num_counters ? perf->fd[0] : -1);
+    if (fd < 0)
+      continue;
+    perf->names[perf->num_counters] = perf_events[i].name;
+    perf->fd[perf->num_counters++] = fd;
+  }
+  if (perf->num_counters) {
+    ioctl(perf->fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(perf->fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  }
+  return perf->num_counters;
+}
+
+void read_perf_counters(perf_counters_t *perf, uint64_t *values)
+{
+  uint64_t buf[1 + MAX_PERF_COUNTERS];
+  int i;
+
+  if (!perf->num_counters)
+    return;
+  if (read(perf->fd[0], buf, sizeof(buf)) < (ssize_t)((1 + perf->num_counters) * sizeof(uint64_t)))
+    memset(buf, 0, sizeof(buf));
+  for (i = 0; i < perf->num_counters; i++)
+    values[i] = buf[1 + i];
+}
+
+void close_perf_counters(perf_counters_t *perf)
+{
+  int i;
+  for (i = perf->num_counters - 1; i >= 0; i--)
+    close(perf->fd[i]);
+  perf->num_counters = 0;
+}
+#else
+int open_perf_counters(perf_counters_t *perf)
+{
+  perf->num_counters = 0;
+  return 0;
+}
+
+void read_perf_counters(perf_counters_t *perf, uint64_t *values)
+{
+}
+
+void close_perf_counters(perf_counters_t *perf)
+{
+}
+#endif
@@ -28,13 +28,77 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdlib.h>
 #include <math.h>
 #include "snr.h"
+#include "simd.h"
+#include "common_kernels.h"
+
+/* Scale a sample to bitdepth, shift being the difference between the
+   bitdepths of its frame and bitdepth */
+static int scale_sample(int x, int shift, int bitdepth)
+{
+  return shift < 0 ? x << -shift : (int)saturate((x + (shift ? 1 << (shift - 1) : 0)) >> shift, bitdepth);
+}
+
+uint64_t TEMPLATE(sse_plane)(const SAMPLE *a, int astride, int ashift, const SAMPLE *b, int bstride, int bshift, int width, int height, int bitdepth)
+{
+  if (use_simd && ashift == bshift && ashift >= 0)
+    return TEMPLATE(sse_plane_simd)(a, astride, b, bstride, width, height, ashift, bitdepth);
+
+  uint64_t sum = 0;
+  for (int i = 0; i < height; i++)
+    for (int j = 0; j < width; j++) {
+      int64_t d = scale_sample(a[i*astride+j], ashift, bitdepth) - scale_sample(b[i*bstride+j], bshift, bitdepth);
+      sum += d * d;
+    }
+  return sum;
+}
+
+void TEMPLATE(ssim_sums_8x8)(const SAMPLE *a, int astride, int ashift, const SAMPLE *b, int bstride, int bshift, int bitdepth, uint64_t sums[5])
+{
+  if (use_simd && ashift == bshift && ashift >= 0) {
+    TEMPLATE(ssim_sums_8x8_simd)(a, astride, b, bstride, ashift, bitdepth, sums);
+    return;
+  }
+
+  for (int k = 0; k < 5; k++)
+    sums[k] = 0;
+  for (int i = 0; i < 8; i++)
+    for (int j = 0; j < 8; j++) {
+      uint64_t x = scale_sample(a[i*astride+j], ashift, bitdepth);
+      uint64_t y = scale_sample(b[i*bstride+j], bshift, bitdepth);
+      sums[0] += x;
+      sums[1] += y;
+      sums[2] += x * x;
+      sums[3] += y * y;
+      sums[4] += x * y;
+    }
+}
+
+double TEMPLATE(ssim_plane)(const SAMPLE *a, int astride, int ashift, const SAMPLE *b, int bstride, int bshift, int width, int height, int bitdepth)
+{
+  /* The usual constants (0.01 L)^2 and (0.03 L)^2 for sums of 64 samples */
+  const double maxsignal = (double)((1 << bitdepth) - 1);
+  const double c1 = (0.01 * 64 * maxsignal) * (0.01 * 64 * maxsignal);
+  const double c2 = (0.03 * 64 * maxsignal) * (0.03 * 64 * maxsignal);
+  double ssim = 0;
+  int count = 0;
+
+  for (int i = 0; i + 8 <= height; i += 4)
+    for (int j = 0; j + 8 <= width; j += 4) {
+      uint64_t sums[5];
+      TEMPLATE(ssim_sums_8x8)(a + i*astride + j, astride, ashift, b + i*bstride + j, bstride, bshift, bitdepth, sums);
+      double sa = (double)sums[0], sb = (double)sums[1];
+      double num = (2 * sa * sb + c1) * (2 * (64.0 * sums[4] - sa * sb) + c2);
+      double den = (sa * sa + sb * sb + c1) * (64.0 * sums[2] - sa * sa + 64.0 * sums[3] - sb * sb + c2);
+      ssim += num / den;
+      count++;
+    }
+  return count ? ssim / count : 1.0;
+}
 
 int TEMPLATE(snr_yuv)(snrvals *psnr,yuv_frame_t *f1,yuv_frame_t *f2,int height,int width,int input_bitdepth)
 {
     unsigned int ydim,ydim_chr;
-    unsigned int i,j,xdim,xdim_chr;
-    double sumsqr=0;
-    int ival;
+    unsigned int xdim,xdim_chr;
     double plse;
     int shift1 = f1->bitdepth - input_bitdepth;
     int shift2 = f2->bitdepth - input_bitdepth;
@@ -44,24 +108,10 @@ int TEMPLATE(snr_yuv)(snrvals *psnr,yuv_frame_t *f1,yuv_frame_t *f2,int height,i
     ydim = height;
     ydim_chr = ydim >> f1->sub;
 
-    int s1y = f1->stride_y;
-    int s2y = f2->stride_y;
-    int s1c = f1->stride_c;
-    int s2c = f2->stride_c;
-    int round1 = !!shift1 << (shift1 - 1);
-    int round2 = !!shift2 << (shift2 - 1);
     double maxsignal = (double)((1 << input_bitdepth) - 1);
 
     /* Calculate psnr for Y */
-    sumsqr = 0;
-    for (i = 0; i < ydim; i++)
-      for (j = 0; j < xdim; j++) {
-        ival =
-          (shift1 < 0 ? f1->y[i*s1y+j] << -shift1 : saturate(((f1->y[i*s1y+j] + round1) >> shift1), input_bitdepth)) -
-          (shift2 < 0 ? f2->y[i*s2y+j] << -shift2 : saturate(((f2->y[i*s2y+j] + round2) >> shift2), input_bitdepth));
-        sumsqr += (float)(ival * ival);
-    }
-    plse = sumsqr / (maxsignal * maxsignal * ydim * xdim);
+    plse = TEMPLATE(sse_plane)(f1->y, f1->stride_y, shift1, f2->y, f2->stride_y, shift2, xdim, ydim, input_bitdepth) / (maxsignal * maxsignal * ydim * xdim);
     psnr->y = -10 * log10(plse);
 
     if (f1->subsample == 400) {
@@ -70,28 +120,28 @@ int TEMPLATE(snr_yuv)(snrvals *psnr,yuv_frame_t *f1,yuv_frame_t *f2,int height,i
     }
 
     /* Calculate psnr for U */
-    sumsqr = 0;
-    for (i = 0; i < ydim_chr; i++)
-      for (j = 0; j < xdim_chr; j++) {
-        ival =
-          (shift1 < 0 ? f1->u[i*s1c+j] << -shift1 : saturate(((f1->u[i*s1c+j] + round1) >> shift1), input_bitdepth)) -
-          (shift2 < 0 ? f2->u[i*s2c+j] << -shift2 : saturate(((f2->u[i*s2c+j] + round2) >> shift2), input_bitdepth));
-        sumsqr += (ival * ival);
-    }
-    plse = sumsqr / (maxsignal * maxsignal * ydim_chr * xdim_chr);
+    plse = TEMPLATE(sse_plane)(f1->u, f1->stride_c, shift1, f2->u, f2->stride_c, shift2, xdim_chr, ydim_chr, input_bitdepth) / (maxsignal * maxsignal * ydim_chr * xdim_chr);
     psnr->u = -10 * log10(plse);
-    
+
     /* Calculate psnr for V */
-    sumsqr = 0;
-    for (i = 0; i < ydim_chr; i++)
-      for (j = 0; j < xdim_chr; j++) {
-        ival =
-          (shift1 < 0 ? f1->v[i*s1c+j] << -shift1 : saturate(((f1->v[i*s1c+j] + round1) >> shift1), input_bitdepth)) -
-          (shift2 < 0 ? f2->v[i*s2c+j] << -shift2 : saturate(((f2->v[i*s2c+j] + round2) >> shift2), input_bitdepth));
-        sumsqr += (ival * ival);
-    }
-    plse = sumsqr / (maxsignal * maxsignal * ydim_chr * xdim_chr);
+    plse = TEMPLATE(sse_plane)(f1->v, f1->stride_c, shift1, f2->v, f2->stride_c, shift2, xdim_chr, ydim_chr, input_bitdepth) / (maxsignal * maxsignal * ydim_chr * xdim_chr);
     psnr->v = -10 * log10(plse);
     return 0;
 }
 
+int TEMPLATE(ssim_yuv)(snrvals *ssim,yuv_frame_t *f1,yuv_frame_t *f2,int height,int width,int input_bitdepth)
+{
+    int shift1 = f1->bitdepth - input_bitdepth;
+    int shift2 = f2->bitdepth - input_bitdepth;
+
+    ssim->y = TEMPLATE(ssim_plane)(f1->y, f1->stride_y, shift1, f2->y, f2->stride_y, shift2, width, height, input_bitdepth);
+
+    if (f1->subsample == 400) {
+      ssim->u = ssim->v = 0;
+      return 0;
+    }
+
+    ssim->u = TEMPLATE(ssim_plane)(f1->u, f1->stride_c, shift1, f2->u, f2->stride_c, shift2, width >> f1->sub, height >> f1->sub, input_bitdepth);
+    ssim->v = TEMPLATE(ssim_plane)(f1->v, f1->stride_c, shift1, f2->v, f2->stride_c, shift2, width >> f1->sub, height >> f1->sub, input_bitdepth);
+    return 0;
+}
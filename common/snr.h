@@ -29,7 +29,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "types.h"
 
+/* Quality of f2 against f1 per plane, with the samples of both frames
+   scaled from their bitdepth to input_bitdepth */
 int snr_yuv_lbd(snrvals *psnr,yuv_frame_t *f1,yuv_frame_t *f2,int height,int width,int input_bitdepth);
 int snr_yuv_hbd(snrvals *psnr,yuv_frame_t *f1,yuv_frame_t *f2,int height,int width,int input_bitdepth);
+int ssim_yuv_lbd(snrvals *ssim,yuv_frame_t *f1,yuv_frame_t *f2,int height,int width,int input_bitdepth);
+int ssim_yuv_hbd(snrvals *ssim,yuv_frame_t *f1,yuv_frame_t *f2,int height,int width,int input_bitdepth);
+
+/* Plane level metrics. The samples of plane a are scaled to bitdepth by
+   (x + round) >> ashift with saturation, or x << -ashift if ashift is
+   negative, and similarly for b. */
+uint64_t sse_plane_lbd(const uint8_t *a, int astride, int ashift, const uint8_t *b, int bstride, int bshift, int width, int height, int bitdepth);
+uint64_t sse_plane_hbd(const uint16_t *a, int astride, int ashift, const uint16_t *b, int bstride, int bshift, int width, int height, int bitdepth);
+/* Mean SSIM of the 8x8 windows at every fourth row and column */
+double ssim_plane_lbd(const uint8_t *a, int astride, int ashift, const uint8_t *b, int bstride, int bshift, int width, int height, int bitdepth);
+double ssim_plane_hbd(const uint16_t *a, int astride, int ashift, const uint16_t *b, int bstride, int bshift, int width, int height, int bitdepth);
+/* Sums of a, b, a*a, b*b and a*b over an 8x8 window */
+void ssim_sums_8x8_lbd(const uint8_t *a, int astride, int ashift, const uint8_t *b, int bstride, int bshift, int bitdepth, uint64_t sums[5]);
+void ssim_sums_8x8_hbd(const uint16_t *a, int astride, int ashift, const uint16_t *b, int bstride, int bshift, int bitdepth, uint64_t sums[5]);
 
 #endif
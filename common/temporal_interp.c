@@ -6,6 +6,7 @@
 #include "temporal_interp.h"
 #include "common_frame.h"
 #include "common_kernels.h"
+#include "thread.h"
 
 #define BLOCK_STEP 16
 #define MAX_CANDS 20
@@ -14,7 +15,7 @@
 
 #define COST_FILTER_DIV 10
 
-#define MAX_LEVELS 4
+#define MAX_LEVELS (MAX_PYRAMID_LEVELS+1)
 
 #define SAD_COSTS
 #ifdef SAD_COSTS
@@ -44,8 +45,6 @@ typedef struct mv_data_t {
   int ratio;
   int reversed;
   int skip_thr;
-  mv_t skip_mv;
-  mv_t scaled_skip_mv;
   int bbs;
   int bs;
   int step;
@@ -99,10 +98,6 @@ static mv_data_t* alloc_mv_data(int w, int h, int bs, int bbs, int ratio, int k,
   data->bbs=bbs;
   data->bs=bs;
   data->skip_thr=SKIP_THRESHOLD;/* FIXME: make adaptive*/
-  data->skip_mv.x=0;
-  data->skip_mv.y=0;
-  data->scaled_skip_mv.x=0;
-  data->scaled_skip_mv.y=0;
   data->mv[0]=(mv_t*) malloc(area*sizeof(mv_t));
   data->mv[1]=(mv_t*) malloc(area*sizeof(mv_t));
   data->cost[0]=(cost_t*) malloc(area*sizeof(cost_t));
@@ -140,7 +135,7 @@ static void free_mv_data(mv_data_t* mv_data)
   free(mv_data);
 }
 
-static void scale_frame_down2x2(yuv_frame_t* sin, yuv_frame_t* sout)
+void TEMPLATE(scale_frame_down2x2)(yuv_frame_t* sin, yuv_frame_t* sout)
 {
   int wo=sout->width;
   int ho=sout->height;
@@ -176,6 +171,29 @@ static void scale_frame_down2x2(yuv_frame_t* sin, yuv_frame_t* sout)
   TEMPLATE(pad_yuv_frame)(sout);
 }
 
+/* Return level (0 for f itself, 1 for half size, ...) of the down-scaled
+   pyramid of f. Missing levels are built and kept with f until its
+   content changes. */
+yuv_frame_t* TEMPLATE(get_frame_pyramid)(yuv_frame_t* f, int level)
+{
+  assert(level <= MAX_PYRAMID_LEVELS);
+  while (f->num_down < level) {
+    yuv_frame_t* in = f->num_down ? f->down[f->num_down-1] : f;
+    yuv_frame_t* out = f->down[f->num_down];
+    if (!out) {
+      out = f->down[f->num_down] = malloc(sizeof(yuv_frame_t));
+      TEMPLATE(create_yuv_frame)(out, in->width>>1, in->height>>1, f->subsample, 32, 32, f->bitdepth, f->input_bitdepth);
+    }
+    if (use_simd)
+      TEMPLATE(scale_frame_down2x2_simd)(in, out);
+    else
+      TEMPLATE(scale_frame_down2x2)(in, out);
+    TEMPLATE(pad_yuv_frame)(out);
+    f->num_down++;
+  }
+  return level ? f->down[level-1] : f;
+}
+
 static void upscale_mv_data_2x2(mv_data_t* mv_data_in, mv_data_t* mv_data_out)
 {
 
@@ -316,6 +334,51 @@ static int get_mv_cost(mv_t mv, mv_data_t* mv_data, int idx, int xp, int yp, int
   return (diff*lambda) >> (LAMBDA_SHIFT+ACC_BITS);
 }
 
+void TEMPLATE(block_avg)(SAMPLE *p, SAMPLE *r0, SAMPLE *r1, int sp, int s0, int s1, int width, int height)
+{
+  for (int i=0; i<height; ++i) {
+    for (int j=0; j<width; ++j) {
+      p[i*sp+j] = (r0[i*s0+j]+r1[i*s1+j]+1)/2;
+    }
+  }
+}
+
+/* Copy a size x size block at (x,y) to buf, with the positions clamped to
+   the plane extended by pad on the top and left and ending at wP, hP */
+static void get_clipped_block(SAMPLE* buf, SAMPLE* ref, int s, int x, int y, int size, int wP, int hP, int pad)
+{
+  // Columns 0 to j0-1 are left of the plane, j1 to size-1 right of it
+  const int j0=min(size, max(0, -pad-x));
+  const int j1=max(j0, min(size, wP-x));
+
+  for (int i=0; i<size; ++i) {
+    SAMPLE* r=&ref[min(hP-1, max(-pad, i+y))*s];
+    int j;
+    for (j=0; j<j0; ++j)
+      buf[i*size+j]=r[-pad];
+    memcpy(&buf[i*size+j0], &r[x+j0], (j1-j0)*sizeof(SAMPLE));
+    for (j=j1; j<size; ++j)
+      buf[i*size+j]=r[wP-1];
+  }
+}
+
+static uint32_t block_sad(SAMPLE* p0, SAMPLE* p1, int s0, int s1, int size, uint32_t thr)
+{
+  uint32_t sad=0;
+  if (use_simd && (size == 8 || size == 16)) {
+    sad = TEMPLATE(sad_calc_thr_simd)(p0, p1, s0, s1, size, size, thr);
+  } else if (use_simd && size >= 4) {
+    sad = TEMPLATE(sad_calc_simd_unaligned)(p0, p1, s0, s1, size, size);
+  } else {
+    for (int i=0; i<size; ++i) {
+      for (int j=0; j<size; ++j) {
+        sad += abs(p1[i*s1+j]-p0[i*s0+j]);
+      }
+    }
+  }
+  return sad;
+}
+
 static void mot_comp_avg(int xstart, int ystart, SAMPLE* ref0, int s0, SAMPLE * ref1, int s1, SAMPLE * pic, int sp, mv_t mv0, mv_t mv1, int wP, int hP, int pad, int size, int wt[2]){
 
   int xs[2];
@@ -336,11 +399,7 @@ static void mot_comp_avg(int xstart, int ystart, SAMPLE* ref0, int s0, SAMPLE *
     if (use_simd && size>=4) {
       TEMPLATE(block_avg_simd)(p,r0,r1,sp,s0,s1,size,size);
     } else {
-      for (int i=0; i<size; ++i) {
-        for (int j=0; j<size; ++j) {
-          p[i*sp+j] = (r0[i*s0+j]+r1[i*s1+j]+1)/2;
-        }
-      }
+      TEMPLATE(block_avg)(p,r0,r1,sp,s0,s1,size,size);
     }
 
   } else if (xs[1]>=-pad && xs[1]+size <= wP && ys[1]>=-pad && ys[1]+size<=hP){
@@ -356,16 +415,14 @@ static void mot_comp_avg(int xstart, int ystart, SAMPLE* ref0, int s0, SAMPLE *
 
   } else {
     // Clipped version
-    SAMPLE* r0=ref0;
-    SAMPLE* r1=ref1;
-    for (int i=0; i<size; ++i) {
-      for (int j=0; j<size; ++j) {
-        int xpos0=min(wP-1, max(-pad, j+xs[0]));
-        int xpos1=min(wP-1, max(-pad, j+xs[1]));
-        int ypos0=min(hP-1, max(-pad, i+ys[0]));
-        int ypos1=min(hP-1, max(-pad, i+ys[1]));
-        p[i*sp+j] = (r0[ypos0*s0+xpos0]+r1[ypos1*s1+xpos1]+1)/2;
-      }
+    SAMPLE r0[BLOCK_STEP*BLOCK_STEP];
+    SAMPLE r1[BLOCK_STEP*BLOCK_STEP];
+    get_clipped_block(r0, ref0, s0, xs[0], ys[0], size, wP, hP, pad);
+    get_clipped_block(r1, ref1, s1, xs[1], ys[1], size, wP, hP, pad);
+    if (use_simd && size>=4) {
+      TEMPLATE(block_avg_simd)(p,r0,r1,sp,size,size,size,size);
+    } else {
+      TEMPLATE(block_avg)(p,r0,r1,sp,size,size,size,size);
     }
 
   }
@@ -399,15 +456,7 @@ static uint32_t sad_cost(int xstart, int ystart, yuv_frame_t* pic[2], mv_t mv[2]
 
     SAMPLE* p0=&pic[0]->y[ys[0]*s0+xs[0]];
     SAMPLE* p1=&pic[1]->y[ys[1]*s1+xs[1]];
-    if (use_simd && size >= 4) {
-      bcost += TEMPLATE(sad_calc_simd_unaligned)(p0, p1, s0, s1, size, size);
-    } else {
-      for (int i=0; i<size; ++i) {
-        for (int j=0; j<size; ++j) {
-          bcost += abs(p1[i*s1+j]-p0[i*s0+j]);
-        }
-      }
-    }
+    bcost += block_sad(p0, p1, s0, s1, size, best_cost > bcost ? best_cost-bcost : 0);
 #if TEMP_INTERP_USE_CHROMA
     int csize = size >> &pic[0]->sub;
     if (bcost < best_cost) {
@@ -439,30 +488,24 @@ static uint32_t sad_cost(int xstart, int ystart, yuv_frame_t* pic[2], mv_t mv[2]
 
   } else {
     // Clipped version, luma only
-    SAMPLE* p0=pic[0]->y;
-    SAMPLE* p1=pic[1]->y;
-    for (int i=0; i<size; ++i) {
-      for (int j=0; j<size; ++j) {
-        int xpos0=min(widthP-1, max(-pady, j+xs[0]));
-        int xpos1=min(widthP-1, max(-pady, j+xs[1]));
-        int ypos0=min(heightP-1, max(-pady, i+ys[0]));
-        int ypos1=min(heightP-1, max(-pady, i+ys[1]));
-        bcost += abs(p1[ypos1*s1+xpos1]-p0[ypos0*s0+xpos0]);
-      }
-    }
+    SAMPLE p0[BLOCK_STEP*BLOCK_STEP];
+    SAMPLE p1[BLOCK_STEP*BLOCK_STEP];
+    get_clipped_block(p0, pic[0]->y, s0, xs[0], ys[0], size, widthP, heightP, pady);
+    get_clipped_block(p1, pic[1]->y, s1, xs[1], ys[1], size, widthP, heightP, pady);
+    bcost += block_sad(p0, p1, size, size, size, best_cost > bcost ? best_cost-bcost : 0);
   }
 
   return bcost;
 }
 
-static void skip_test(mv_data_t* mv_data, yuv_frame_t* picdata[2], int xp, int yp)
+static void skip_test(mv_data_t* mv_data, yuv_frame_t* picdata[2], int xp, int yp, mv_t skip_mv, mv_t scaled_skip_mv)
 {
   // Do the search with the larger size, but data is stored at the smaller
   int xstart=xp*mv_data->bs;
   int ystart=yp*mv_data->bs;
 
-  mv_t mv1=mv_data->skip_mv;
-  mv_t mv0=mv_data->scaled_skip_mv;
+  mv_t mv1=skip_mv;
+  mv_t mv0=scaled_skip_mv;
 
   int xs[2];
   int ys[2];
@@ -561,8 +604,8 @@ static void skip_test(mv_data_t* mv_data, yuv_frame_t* picdata[2], int xp, int y
 #endif
   if (skip) {
     mv_data->bgmap[pos]=1;
-    mv_data->mv[1][pos]=mv_data->skip_mv;
-    mv_data->mv[0][pos]=mv_data->scaled_skip_mv;
+    mv_data->mv[1][pos]=skip_mv;
+    mv_data->mv[0][pos]=scaled_skip_mv;
     mv_data->cost[1][pos]=0;
     mv_data->cost[0][pos]=0;
   }
@@ -751,18 +794,18 @@ static mv_t mv_absdist_filter(mv_t* mlist, int num)
 //}
 
 
-static void make_skip_vector(mv_data_t* mv_data, int xp, int yp, int xstep, int ystep)
+static void make_skip_vector(mv_data_t* mv_data, int xp, int yp, int xstep, int ystep, mv_t* skip_mv, mv_t* scaled_skip_mv)
 {
   int bw=mv_data->bw;
-  mv_data->skip_mv.x=0;
-  mv_data->skip_mv.y=0;
+  skip_mv->x=0;
+  skip_mv->y=0;
   mv_t vlist[3];
   int num=0;
   if (yp>0 && xp<bw-xstep) vlist[num++]=mv_data->mv[1][(yp-ystep)*bw+xp+xstep];
   if (xp>0) vlist[num++]=mv_data->mv[1][yp*bw+xp-xstep];
   if (yp>0) vlist[num++]=mv_data->mv[1][(yp-ystep)*bw+xp];
-  if (num) mv_data->skip_mv=mv_absdist_filter(vlist,num);
-  mv_data->scaled_skip_mv=scale_mv(mv_data->skip_mv, -mv_data->wt[1], mv_data->wt[0]);
+  if (num) *skip_mv=mv_absdist_filter(vlist,num);
+  *scaled_skip_mv=scale_mv(*skip_mv, -mv_data->wt[1], mv_data->wt[0]);
 }
 
 
@@ -783,7 +826,104 @@ static void init_mv_data(mv_data_t* mv_data, const mv_data_t* guide_mv_data, int
 }
 */
 
-static void motion_estimate_bi(mv_data_t* mv_data, mv_data_t** guide_mv_data, int num_guides, yuv_frame_t* indata0, yuv_frame_t* indata1, int k)
+/* State shared by the block rows of motion_estimate_bi() and
+   interpolate_frames(), which are processed in parallel */
+typedef struct {
+  mv_data_t* mv_data;
+  mv_data_t** guide_mv_data;
+  int num_guides;
+  yuv_frame_t* pic[2];
+  yuv_frame_t* outdata;
+  mv_t* mv0;       // Merge search result
+  mv_t* mv1;
+  int* progress;   // Blocks searched in each row
+  int sync;        // Rows may run concurrently
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+  int wP;
+  int hP;
+  int pad;
+  int row0;        // First block row of interpolate_row_job()
+} interp_rows_t;
+
+static void wait_progress(interp_rows_t* rows, int row, int count)
+{
+  thor_mutex_lock(&rows->mutex);
+  while (rows->progress[row]<count)
+    thor_cond_wait(&rows->cond, &rows->mutex);
+  thor_mutex_unlock(&rows->mutex);
+}
+
+static void set_progress(interp_rows_t* rows, int row, int count)
+{
+  thor_mutex_lock(&rows->mutex);
+  rows->progress[row]=count;
+  thor_cond_broadcast(&rows->cond);
+  thor_mutex_unlock(&rows->mutex);
+}
+
+/* Search one row of large blocks. The candidates and mv costs use the blocks
+   to the left, above and above right, so the rows run as a wavefront: a
+   block waits for the row above to get one block past it. */
+static void search_row_job(void* arg, int row, int thread)
+{
+  interp_rows_t* rows=arg;
+  mv_data_t* mv_data=rows->mv_data;
+  const int bw=mv_data->bw;
+  const int step=mv_data->step;
+  const int cols=bw/step;
+  const int i=row*step;
+  mv_t cand_list[MAX_CANDS];
+
+  for (int c=0; c<cols; c++) {
+    int j=c*step;
+    mv_t skip_mv, scaled_skip_mv;
+    if (rows->sync && row>0)
+      wait_progress(rows, row-1, min(c+2, cols));
+    make_skip_vector(mv_data, j, i, step, step, &skip_mv, &scaled_skip_mv);
+    skip_test(mv_data, rows->pic, j, i, skip_mv, scaled_skip_mv);
+    int pos=i*bw+j;
+    if (mv_data->bgmap[pos]==0) {
+
+      int num_cands=get_cands(mv_data, cand_list, rows->guide_mv_data, rows->num_guides, j, i, MAX_CANDS, step, step);
+      adaptive_search_v2(mv_data, rows->num_guides!=0, cand_list, num_cands, rows->pic, j, i, step, step);
+    }
+    // propagate
+    const mv_t mv0=mv_data->mv[0][pos];
+    const mv_t mv1=mv_data->mv[1][pos];
+    int bgval=mv_data->bgmap[pos];
+    for (int q=0; q<step; ++q) {
+      for (int p=0; p<step; ++p) {
+        mv_data->mv[0][pos+q*bw+p]=mv0;
+        mv_data->mv[1][pos+q*bw+p]=mv1;
+        mv_data->bgmap[pos+q*bw+p]=bgval;
+      }
+    }
+    if (rows->sync)
+      set_progress(rows, row, c+1);
+  }
+}
+
+/* Refine one row of small blocks with the vectors of their neighbours */
+static void merge_row_job(void* arg, int i, int thread)
+{
+  interp_rows_t* rows=arg;
+  mv_data_t* mv_data=rows->mv_data;
+  const int bw=mv_data->bw;
+  mv_t cand_list[MAX_CANDS];
+
+  for (int j=0; j<bw; j++) {
+    int num_cands=get_merge_cands(mv_data, cand_list, 1, j, i, MAX_CANDS);
+    if (num_cands>1){
+      merge_candidate_search(cand_list, num_cands, mv_data, rows->mv0, rows->mv1, rows->pic, j, i);
+    } else {
+      rows->mv0[i*bw+j]=mv_data->mv[0][i*bw+j];
+      rows->mv1[i*bw+j]=mv_data->mv[1][i*bw+j];
+    }
+  }
+}
+
+static void motion_estimate_bi(mv_data_t* mv_data, mv_data_t** guide_mv_data, int num_guides, yuv_frame_t* indata0, yuv_frame_t* indata1, int k, struct thor_workers* workers)
 {
   // Estimate indata0 from indata1 and vice-versa
 
@@ -798,115 +938,99 @@ static void motion_estimate_bi(mv_data_t* mv_data, mv_data_t** guide_mv_data, in
   memset(mv_data->bgmap, 0, sizeof(int)*bw*bh);
 
   const int step=mv_data->step;
-  mv_t cand_list[MAX_CANDS];
+  interp_rows_t rows;
 
+  rows.mv_data=mv_data;
+  rows.guide_mv_data=guide_mv_data;
+  rows.num_guides=num_guides;
+  rows.pic[0] = mv_data->reversed ? indata1 : indata0;
+  rows.pic[1] = mv_data->reversed ? indata0 : indata1;
+  rows.sync=thor_workers_num_threads(workers)>1;
+  rows.progress=(int*) thor_alloc(bh/step*sizeof(int), 16);
+  memset(rows.progress, 0, bh/step*sizeof(int));
+  thor_mutex_init(&rows.mutex);
+  thor_cond_init(&rows.cond);
 
-  yuv_frame_t* pic[2];
-  pic[0] = mv_data->reversed ? indata1 : indata0;
-  pic[1] = mv_data->reversed ? indata0 : indata1;
-
-  for (int i=0; i<bh; i+=step) {
-    for (int j=0; j<bw; j+=step) {
-      make_skip_vector(mv_data, j, i, step, step);
-      skip_test(mv_data, pic, j, i);
-      int pos=i*bw+j;
-      if (mv_data->bgmap[pos]==0) {
-
-        int num_cands=get_cands(mv_data, cand_list, guide_mv_data, num_guides, j, i, MAX_CANDS, step, step);
-        adaptive_search_v2(mv_data, num_guides!=0, cand_list, num_cands, pic, j, i, step, step);
-      }
-      // propagate
-      const mv_t mv0=mv_data->mv[0][pos];
-      const mv_t mv1=mv_data->mv[1][pos];
-      int bgval=mv_data->bgmap[pos];
-      for (int q=0; q<step; ++q) {
-        for (int p=0; p<step; ++p) {
-          mv_data->mv[0][pos+q*bw+p]=mv0;
-          mv_data->mv[1][pos+q*bw+p]=mv1;
-          mv_data->bgmap[pos+q*bw+p]=bgval;
-        }
-      }
-    }
-  }
+  thor_workers_run(workers, search_row_job, &rows, bh/step);
 
-  mv_t * mv0 = (mv_t*) thor_alloc(bw*bh*sizeof(mv_t), 32);
-  mv_t * mv1 = (mv_t*) thor_alloc(bw*bh*sizeof(mv_t), 32);
+  thor_mutex_destroy(&rows.mutex);
+  thor_cond_destroy(&rows.cond);
+  thor_free(rows.progress);
 
-  for (int i=0; i<bh; i++) {
-    for (int j=0; j<bw; j++) {
-      int num_cands=get_merge_cands(mv_data, cand_list, 1, j, i, MAX_CANDS);
-      if (num_cands>1){
-        merge_candidate_search(cand_list, num_cands, mv_data, mv0, mv1, pic, j, i);
-      } else {
-        mv0[i*bw+j]=mv_data->mv[0][i*bw+j];
-        mv1[i*bw+j]=mv_data->mv[1][i*bw+j];
-      }
-    }
-  }
+  rows.mv0 = (mv_t*) thor_alloc(bw*bh*sizeof(mv_t), 32);
+  rows.mv1 = (mv_t*) thor_alloc(bw*bh*sizeof(mv_t), 32);
+
+  thor_workers_run(workers, merge_row_job, &rows, bh);
 
-  memcpy(mv_data->mv[0], mv0, bw*bh*sizeof(mv_t));
-  memcpy(mv_data->mv[1], mv1, bw*bh*sizeof(mv_t));
+  memcpy(mv_data->mv[0], rows.mv0, bw*bh*sizeof(mv_t));
+  memcpy(mv_data->mv[1], rows.mv1, bw*bh*sizeof(mv_t));
 
-  thor_free(mv0);
-  thor_free(mv1);
+  thor_free(rows.mv0);
+  thor_free(rows.mv1);
 }
 
 static void interpolate_comp(mv_data_t* mv_data, SAMPLE* p0, int s0, SAMPLE* p1, int s1,
-    SAMPLE* out, int so, int wP, int hP, int pad, int chroma)
+    SAMPLE* out, int so, int wP, int hP, int pad, int chroma, int yp)
 {
   const int bw=mv_data->bw;
-  const int bh=mv_data->bh;
   const int bs=chroma ? mv_data->bs/2 :  mv_data->bs;
 
-  for (int yp=0; yp<bh; yp++) {
-    for (int xp=0; xp<bw; xp++) {
-
-      int xstart=xp*bs;
-      int ystart=yp*bs;
-      mv_t mv0=mv_data->mv[0][yp*bw+xp];
-      mv_t mv1=mv_data->mv[1][yp*bw+xp];
-      if (chroma){
-        mv1.x >>= 1;
-        mv1.y >>= 1;
-        mv0 = scale_mv(mv1, -mv_data->wt[1], mv_data->wt[0]);
-      }
-      mot_comp_avg(xstart, ystart, p0, s0, p1, s1, out, so, mv0, mv1, wP, hP, pad, bs, mv_data->wt);
+  for (int xp=0; xp<bw; xp++) {
 
+    int xstart=xp*bs;
+    int ystart=yp*bs;
+    mv_t mv0=mv_data->mv[0][yp*bw+xp];
+    mv_t mv1=mv_data->mv[1][yp*bw+xp];
+    if (chroma){
+      mv1.x >>= 1;
+      mv1.y >>= 1;
+      mv0 = scale_mv(mv1, -mv_data->wt[1], mv_data->wt[0]);
     }
+    mot_comp_avg(xstart, ystart, p0, s0, p1, s1, out, so, mv0, mv1, wP, hP, pad, bs, mv_data->wt);
+
   }
 
 }
 
-static void interpolate_frame(mv_data_t* mv_data, yuv_frame_t* indata0, yuv_frame_t* indata1, yuv_frame_t* outdata, int w, int h, int k, int ratio)
+/* Interpolate one row of small blocks in all planes */
+static void interpolate_row_job(void* arg, int row, int thread)
 {
-
-  yuv_frame_t* pic[2];
-  pic[0] = mv_data->reversed ? indata1 : indata0;
-  pic[1] = mv_data->reversed ? indata0 : indata1;
+  interp_rows_t* rows=arg;
+  int yp=rows->row0+row;
+  yuv_frame_t** pic=rows->pic;
+  yuv_frame_t* outdata=rows->outdata;
+  const int sub=pic[0]->sub;
 
   // Y
-  // For MC purposes, pad by 1/2 a block
-  int pad=mv_data->bs/2;
-  int wP=w+pad;
-  int hP=h+pad;
-  int wPc=wP >> indata0->sub;
-  int hPc=hP >> indata0->sub;
-  int padc=pad >> indata0->sub;
-
-  interpolate_comp(mv_data, pic[0]->y, pic[0]->stride_y, pic[1]->y, pic[1]->stride_y, outdata->y, outdata->stride_y, wP, hP, pad, 0);
+  interpolate_comp(rows->mv_data, pic[0]->y, pic[0]->stride_y, pic[1]->y, pic[1]->stride_y, outdata->y, outdata->stride_y, rows->wP, rows->hP, rows->pad, 0, yp);
 
-  if (indata0->subsample == 400)
+  if (pic[0]->subsample == 400)
     return;
 
   // U
-  interpolate_comp(mv_data, pic[0]->u, pic[0]->stride_c, pic[1]->u, pic[1]->stride_c, outdata->u, outdata->stride_c, wPc, hPc, padc, indata0->sub);
+  interpolate_comp(rows->mv_data, pic[0]->u, pic[0]->stride_c, pic[1]->u, pic[1]->stride_c, outdata->u, outdata->stride_c, rows->wP >> sub, rows->hP >> sub, rows->pad >> sub, sub, yp);
 
   // V
-  interpolate_comp(mv_data, pic[0]->v, pic[0]->stride_c, pic[1]->v, pic[1]->stride_c, outdata->v, outdata->stride_c, wPc, hPc, padc, indata0->sub);
+  interpolate_comp(rows->mv_data, pic[0]->v, pic[0]->stride_c, pic[1]->v, pic[1]->stride_c, outdata->v, outdata->stride_c, rows->wP >> sub, rows->hP >> sub, rows->pad >> sub, sub, yp);
+}
 
+static void init_interp_rows(interp_rows_t* rows, mv_data_t* mv_data, yuv_frame_t* indata0, yuv_frame_t* indata1, yuv_frame_t* outdata)
+{
+  rows->mv_data=mv_data;
+  rows->pic[0] = mv_data->reversed ? indata1 : indata0;
+  rows->pic[1] = mv_data->reversed ? indata0 : indata1;
+  rows->outdata=outdata;
+
+  // For MC purposes, pad by 1/2 a block
+  rows->pad=mv_data->bs/2;
+  rows->wP=mv_data->pw+rows->pad;
+  rows->hP=mv_data->ph+rows->pad;
+  rows->row0=0;
 }
 
-void TEMPLATE(interpolate_frames)(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos)
+/* Estimate the motion between ref0 and ref1 coarse to fine and return the
+   full resolution motion field */
+static mv_data_t* estimate_motion(yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos, struct thor_workers* workers)
 {
   int widthin = ref0->width;
   int heightin = ref0->height;
@@ -918,14 +1042,8 @@ void TEMPLATE(interpolate_frames)(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv
   mv_data_t * guide_mv_data[NUM_GUIDES];
 
   yuv_frame_t* in_down[MAX_LEVELS][2];
-  yuv_frame_t* out_down[MAX_LEVELS];
 
   int interpolate = 1;
-  for (int j=1; j<max_levels; j++) {
-    out_down[j]=malloc(sizeof(yuv_frame_t));
-    TEMPLATE(create_yuv_frame)(out_down[j],widthin>>j,heightin>>j, ref0->subsample, 32, 32, ref0->bitdepth, ref0->input_bitdepth);
-  }
-  out_down[0]=new_frame;
 
   for (int j=0; j<max_levels; j++) {
     mv_data[j] = alloc_mv_data(widthin>>j, heightin>>j, BLOCK_STEP/2, BLOCK_STEP, ratio, pos, interpolate);
@@ -934,27 +1052,10 @@ void TEMPLATE(interpolate_frames)(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv
     spatial_mv_data[j]->ratio = ratio;
   }
 
-  /* Higher levels are down-sampled*/
-  for (int i=1; i<max_levels; ++i) {
-    in_down[i][0]=malloc(sizeof(yuv_frame_t));
-    in_down[i][1]=malloc(sizeof(yuv_frame_t));
-    TEMPLATE(create_yuv_frame)(in_down[i][0],widthin>>i, heightin>>i, ref0->subsample, 32, 32, ref0->bitdepth, ref0->input_bitdepth);
-    TEMPLATE(create_yuv_frame)(in_down[i][1],widthin>>i, heightin>>i, ref0->subsample, 32, 32, ref0->bitdepth, ref0->input_bitdepth);
-  }
-  // Level 0 is just the original pictures
-  in_down[0][0]=ref0;
-  in_down[0][1]=ref1;
-
-  for (int l=0; l<max_levels-1; ++l) {
-    if (use_simd) {
-      TEMPLATE(scale_frame_down2x2_simd)(in_down[l][0], in_down[l+1][0]);
-      TEMPLATE(scale_frame_down2x2_simd)(in_down[l][1], in_down[l+1][1]);
-    } else {
-      scale_frame_down2x2(in_down[l][0], in_down[l+1][0]);
-      scale_frame_down2x2(in_down[l][1], in_down[l+1][1]);
-    }
-    TEMPLATE(pad_yuv_frame)(in_down[l+1][0]);
-    TEMPLATE(pad_yuv_frame)(in_down[l+1][1]);
+  /* Higher levels are down-sampled and cached with the references */
+  for (int l=0; l<max_levels; ++l) {
+    in_down[l][0]=TEMPLATE(get_frame_pyramid)(ref0, l);
+    in_down[l][1]=TEMPLATE(get_frame_pyramid)(ref1, l);
   }
 
 
@@ -963,8 +1064,7 @@ void TEMPLATE(interpolate_frames)(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv
     if (lvl!=max_levels-1) {
       guide_mv_data[num_guides++]=spatial_mv_data[lvl];
     }
-    motion_estimate_bi(mv_data[lvl], guide_mv_data, num_guides, in_down[lvl][0], in_down[lvl][1], pos);
-    if (lvl==0) interpolate_frame(mv_data[lvl], in_down[lvl][0], in_down[lvl][1], out_down[lvl], widthin, heightin, pos, ratio);
+    motion_estimate_bi(mv_data[lvl], guide_mv_data, num_guides, in_down[lvl][0], in_down[lvl][1], pos, workers);
     if (lvl>0) {
       upscale_mv_data_2x2(mv_data[lvl], spatial_mv_data[lvl-1]);
     }
@@ -972,22 +1072,71 @@ void TEMPLATE(interpolate_frames)(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv
   }
 
   for (int j=1; j<max_levels; j++) {
-    TEMPLATE(close_yuv_frame)(out_down[j]);
-    free(out_down[j]);
+    free_mv_data(mv_data[j]);
   }
-
   for (int j=0; j<max_levels; j++) {
-    free_mv_data(mv_data[j]);
     free_mv_data(spatial_mv_data[j]);
   }
 
-  /* Higher levels are down-sampled*/
-  for (int i=1; i<max_levels; ++i) {
-    TEMPLATE(close_yuv_frame)(in_down[i][0]);
-    TEMPLATE(close_yuv_frame)(in_down[i][1]);
-    free(in_down[i][0]);
-    free(in_down[i][1]);
-  }
+  return mv_data[0];
+}
 
+void TEMPLATE(interpolate_frames)(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos, struct thor_workers* workers)
+{
+  interp_rows_t rows;
+  mv_data_t* mv_data = estimate_motion(ref0, ref1, ratio, pos, workers);
+
+  init_interp_rows(&rows, mv_data, ref0, ref1, new_frame);
+  thor_workers_run(workers, interpolate_row_job, &rows, mv_data->bh);
+
+  free_mv_data(mv_data);
+}
+
+/* Luma rows per band of a deferred interpolated frame. A multiple of
+   BLOCK_STEP, so that the blocks overlapping the bottom edge belong to
+   the last band. */
+#define INTERP_BAND_SIZE 64
+
+struct interp_state {
+  interp_rows_t rows;
+  struct thor_workers* workers;
+  int num_bands;
+  uint8_t* valid;  // Bands synthesised and padded so far
+};
+
+struct interp_state* TEMPLATE(interpolate_frames_deferred)(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos, struct thor_workers* workers)
+{
+  struct interp_state* state = malloc(sizeof(struct interp_state));
+  mv_data_t* mv_data = estimate_motion(ref0, ref1, ratio, pos, workers);
+
+  init_interp_rows(&state->rows, mv_data, ref0, ref1, new_frame);
+  state->workers = workers;
+  state->num_bands = (mv_data->ph + INTERP_BAND_SIZE - 1) / INTERP_BAND_SIZE;
+  state->valid = calloc(state->num_bands, sizeof(uint8_t));
+  return state;
 }
 
+void TEMPLATE(interpolate_frame_rows)(struct interp_state* state, int ystart, int yend)
+{
+  mv_data_t* mv_data = state->rows.mv_data;
+  const int h = mv_data->ph;
+  const int band_rows = INTERP_BAND_SIZE / mv_data->bs;
+
+  ystart = clip(ystart, 0, h - 1);
+  yend = clip(yend, 1, h);
+  for (int b = ystart / INTERP_BAND_SIZE; b <= (yend - 1) / INTERP_BAND_SIZE; b++) {
+    if (state->valid[b])
+      continue;
+    state->rows.row0 = b * band_rows;
+    thor_workers_run(state->workers, interpolate_row_job, &state->rows, min(band_rows, mv_data->bh - state->rows.row0));
+    TEMPLATE(pad_yuv_frame_rows)(state->rows.outdata, b * INTERP_BAND_SIZE, min(h, (b + 1) * INTERP_BAND_SIZE));
+    state->valid[b] = 1;
+  }
+}
+
+void TEMPLATE(close_interp_state)(struct interp_state* state)
+{
+  free_mv_data(state->rows.mv_data);
+  free(state->valid);
+  free(state);
+}
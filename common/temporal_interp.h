@@ -2,7 +2,25 @@
 #define __TEMPORAL_INTERP
 #include "types.h"
 
-void interpolate_frames_lbd(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos);
-void interpolate_frames_hbd(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos);
+struct thor_workers;
+struct interp_state;
+
+void interpolate_frames_lbd(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos, struct thor_workers* workers);
+void interpolate_frames_hbd(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos, struct thor_workers* workers);
+/* Estimate the motion as interpolate_frames() but synthesise new_frame
+   only when interpolate_frame_rows() asks for the rows [ystart, yend).
+   Synthesised rows are also padded. */
+struct interp_state* interpolate_frames_deferred_lbd(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos, struct thor_workers* workers);
+struct interp_state* interpolate_frames_deferred_hbd(yuv_frame_t* new_frame, yuv_frame_t* ref0, yuv_frame_t* ref1, int ratio, int pos, struct thor_workers* workers);
+void interpolate_frame_rows_lbd(struct interp_state* state, int ystart, int yend);
+void interpolate_frame_rows_hbd(struct interp_state* state, int ystart, int yend);
+void close_interp_state_lbd(struct interp_state* state);
+void close_interp_state_hbd(struct interp_state* state);
+void block_avg_lbd(uint8_t *p, uint8_t *r0, uint8_t *r1, int sp, int s0, int s1, int width, int height);
+void block_avg_hbd(uint16_t *p, uint16_t *r0, uint16_t *r1, int sp, int s0, int s1, int width, int height);
+yuv_frame_t* get_frame_pyramid_lbd(yuv_frame_t* f, int level);
+yuv_frame_t* get_frame_pyramid_hbd(yuv_frame_t* f, int level);
+void scale_frame_down2x2_lbd(yuv_frame_t* sin, yuv_frame_t* sout);
+void scale_frame_down2x2_hbd(yuv_frame_t* sin, yuv_frame_t* sout);
 
 #endif
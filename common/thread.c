@@ -0,0 +1,324 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 200112L
+#endif
+
+#include <stdlib.h>
+#include "global.h"
+#include "thread.h"
+
+#if !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+typedef struct
+{
+  thor_thread_func_t func;
+  void *arg;
+} thread_start_t;
+
+#if defined(_WIN32)
+#include <process.h>
+
+static unsigned __stdcall thread_main(void *arg)
+#else
+static void *thread_main(void *arg)
+#endif
+{
+  thread_start_t start = *(thread_start_t *)arg;
+  free(arg);
+  start.func(start.arg);
+  return 0;
+}
+
+void thor_thread_create(thor_thread_t *thread, thor_thread_func_t func, void *arg)
+{
+  thread_start_t *start = malloc(sizeof(thread_start_t));
+  if (!start)
+    fatalerror("Memory allocation failed\n");
+  start->func = func;
+  start->arg = arg;
+#if defined(_WIN32)
+  *thread = (HANDLE)_beginthreadex(NULL, 0, thread_main, start, 0, NULL);
+  if (!*thread)
+    fatalerror("Could not create thread\n");
+#else
+  if (pthread_create(thread, NULL, thread_main, start))
+    fatalerror("Could not create thread\n");
+#endif
+}
+
+void thor_thread_join(thor_thread_t thread)
+{
+#if defined(_WIN32)
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+#else
+  pthread_join(thread, NULL);
+#endif
+}
+
+#if defined(_WIN32)
+void thor_mutex_init(thor_mutex_t *mutex) { InitializeCriticalSection(mutex); }
+void thor_mutex_destroy(thor_mutex_t *mutex) { DeleteCriticalSection(mutex); }
+void thor_mutex_lock(thor_mutex_t *mutex) { EnterCriticalSection(mutex); }
+void thor_mutex_unlock(thor_mutex_t *mutex) { LeaveCriticalSection(mutex); }
+
+void thor_cond_init(thor_cond_t *cond) { InitializeConditionVariable(cond); }
+void thor_cond_destroy(thor_cond_t *cond) { }
+void thor_cond_wait(thor_cond_t *cond, thor_mutex_t *mutex) { SleepConditionVariableCS(cond, mutex, INFINITE); }
+void thor_cond_signal(thor_cond_t *cond) { WakeConditionVariable(cond); }
+void thor_cond_broadcast(thor_cond_t *cond) { WakeAllConditionVariable(cond); }
+
+int thor_num_cpus(void)
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+#else
+void thor_mutex_init(thor_mutex_t *mutex) { pthread_mutex_init(mutex, NULL); }
+void thor_mutex_destroy(thor_mutex_t *mutex) { pthread_mutex_destroy(mutex); }
+void thor_mutex_lock(thor_mutex_t *mutex) { pthread_mutex_lock(mutex); }
+void thor_mutex_unlock(thor_mutex_t *mutex) { pthread_mutex_unlock(mutex); }
+
+void thor_cond_init(thor_cond_t *cond) { pthread_cond_init(cond, NULL); }
+void thor_cond_destroy(thor_cond_t *cond) { pthread_cond_destroy(cond); }
+void thor_cond_wait(thor_cond_t *cond, thor_mutex_t *mutex) { pthread_cond_wait(cond, mutex); }
+void thor_cond_signal(thor_cond_t *cond) { pthread_cond_signal(cond); }
+void thor_cond_broadcast(thor_cond_t *cond) { pthread_cond_broadcast(cond); }
+
+int thor_num_cpus(void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+#else
+  return 1;
+#endif
+}
+#endif
+
+struct thor_workers
+{
+  int num_threads;
+  thor_thread_t *threads;
+  struct worker_start *start;
+  thor_mutex_t mutex;
+  thor_cond_t wake;              //Signalled when a batch starts or on close
+  thor_cond_t done;              //Signalled when the last worker finishes a batch
+  thor_job_func_t func;
+  void *arg;
+  int num_jobs;
+  int next_job;
+  int active;                    //Worker threads not yet finished with the batch
+  unsigned int batch;
+  int stop;
+};
+
+struct worker_start
+{
+  thor_workers_t *workers;
+  int thread;
+};
+
+/* Run jobs until none are left, called and returning with the mutex held */
+static void run_jobs(thor_workers_t *workers, int thread)
+{
+  while (workers->next_job < workers->num_jobs) {
+    int job = workers->next_job++;
+    thor_mutex_unlock(&workers->mutex);
+    workers->func(workers->arg, job, thread);
+    thor_mutex_lock(&workers->mutex);
+  }
+}
+
+static void worker_thread(void *arg)
+{
+  struct worker_start *start = arg;
+  thor_workers_t *workers = start->workers;
+  unsigned int batch = 0;
+
+  thor_mutex_lock(&workers->mutex);
+  for (;;) {
+    while (!workers->stop && workers->batch == batch)
+      thor_cond_wait(&workers->wake, &workers->mutex);
+    if (workers->stop)
+      break;
+    batch = workers->batch;
+    run_jobs(workers, start->thread);
+    if (--workers->active == 0)
+      thor_cond_signal(&workers->done);
+  }
+  thor_mutex_unlock(&workers->mutex);
+}
+
+thor_workers_t *thor_workers_create(int num_threads)
+{
+  thor_workers_t *workers = calloc(1, sizeof(thor_workers_t));
+  int i;
+
+  if (!workers)
+    fatalerror("Memory allocation failed\n");
+  workers->num_threads = max(1, num_threads);
+  workers->threads = malloc(workers->num_threads * sizeof(thor_thread_t));
+  workers->start = malloc(workers->num_threads * sizeof(struct worker_start));
+  if (!workers->threads || !workers->start)
+    fatalerror("Memory allocation failed\n");
+  thor_mutex_init(&workers->mutex);
+  thor_cond_init(&workers->wake);
+  thor_cond_init(&workers->done);
+  for (i = 1; i < workers->num_threads; i++) {
+    workers->start[i].workers = workers;
+    workers->start[i].thread = i;
+    thor_thread_create(&workers->threads[i], worker_thread, &workers->start[i]);
+  }
+  return workers;
+}
+
+void thor_workers_close(thor_workers_t *workers)
+{
+  int i;
+
+  if (!workers)
+    return;
+  thor_mutex_lock(&workers->mutex);
+  workers->stop = 1;
+  thor_cond_broadcast(&workers->wake);
+  thor_mutex_unlock(&workers->mutex);
+  for (i = 1; i < workers->num_threads; i++)
+    thor_thread_join(workers->threads[i]);
+  thor_mutex_destroy(&workers->mutex);
+  thor_cond_destroy(&workers->wake);
+  thor_cond_destroy(&workers->done);
+  free(workers->threads);
+  free(workers->start);
+  free(workers);
+}
+
+int thor_workers_num_threads(const thor_workers_t *workers)
+{
+  return workers ? workers->num_threads : 1;
+}
+
+void thor_workers_run(thor_workers_t *workers, thor_job_func_t func, void *arg, int num_jobs)
+{
+  int i;
+
+  if (!workers || workers->num_threads == 1 || num_jobs <= 1) {
+    for (i = 0; i < num_jobs; i++)
+      func(arg, i, 0);
+    return;
+  }
+  thor_mutex_lock(&workers->mutex);
+  workers->func = func;
+  workers->arg = arg;
+  workers->num_jobs = num_jobs;
+  workers->next_job = 0;
+  workers->active = workers->num_threads - 1;
+  workers->batch++;
+  thor_cond_broadcast(&workers->wake);
+  run_jobs(workers, 0);
+  while (workers->active)
+    thor_cond_wait(&workers->done, &workers->mutex);
+  thor_mutex_unlock(&workers->mutex);
+}
+
+struct thor_task
+{
+  thor_thread_t thread;
+  thor_mutex_t mutex;
+  thor_cond_t cond;              //Signalled when a job is started or finished, or on close
+  thor_thread_func_t func;       //Current job, NULL when idle
+  void *arg;
+  int stop;
+};
+
+static void task_thread(void *arg)
+{
+  thor_task_t *task = arg;
+
+  thor_mutex_lock(&task->mutex);
+  for (;;) {
+    while (!task->stop && !task->func)
+      thor_cond_wait(&task->cond, &task->mutex);
+    if (!task->func)
+      break;
+    thor_mutex_unlock(&task->mutex);
+    task->func(task->arg);
+    thor_mutex_lock(&task->mutex);
+    task->func = NULL;
+    thor_cond_broadcast(&task->cond);
+  }
+  thor_mutex_unlock(&task->mutex);
+}
+
+thor_task_t *thor_task_create(void)
+{
+  thor_task_t *task = calloc(1, sizeof(thor_task_t));
+
+  if (!task)
+    fatalerror("Memory allocation failed\n");
+  thor_mutex_init(&task->mutex);
+  thor_cond_init(&task->cond);
+  thor_thread_create(&task->thread, task_thread, task);
+  return task;
+}
+
+void thor_task_close(thor_task_t *task)
+{
+  if (!task)
+    return;
+  thor_mutex_lock(&task->mutex);
+  task->stop = 1;
+  thor_cond_broadcast(&task->cond);
+  thor_mutex_unlock(&task->mutex);
+  thor_thread_join(task->thread);
+  thor_mutex_destroy(&task->mutex);
+  thor_cond_destroy(&task->cond);
+  free(task);
+}
+
+void thor_task_run(thor_task_t *task, thor_thread_func_t func, void *arg)
+{
+  thor_mutex_lock(&task->mutex);
+  while (task->func)
+    thor_cond_wait(&task->cond, &task->mutex);
+  task->func = func;
+  task->arg = arg;
+  thor_cond_broadcast(&task->cond);
+  thor_mutex_unlock(&task->mutex);
+}
+
+void thor_task_wait(thor_task_t *task)
+{
+  thor_mutex_lock(&task->mutex);
+  while (task->func)
+    thor_cond_wait(&task->cond, &task->mutex);
+  thor_mutex_unlock(&task->mutex);
+}
@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _THREAD_H_
+#define _THREAD_H_
+
+/* Minimal threads, mutexes and condition variables on top of POSIX
+   threads or the Windows API */
+
+#if defined(_WIN32)
+#include <windows.h>
+typedef HANDLE thor_thread_t;
+typedef CRITICAL_SECTION thor_mutex_t;
+typedef CONDITION_VARIABLE thor_cond_t;
+#else
+#include <pthread.h>
+typedef pthread_t thor_thread_t;
+typedef pthread_mutex_t thor_mutex_t;
+typedef pthread_cond_t thor_cond_t;
+#endif
+
+typedef void (*thor_thread_func_t)(void *arg);
+
+void thor_thread_create(thor_thread_t *thread, thor_thread_func_t func, void *arg);
+void thor_thread_join(thor_thread_t thread);
+
+void thor_mutex_init(thor_mutex_t *mutex);
+void thor_mutex_destroy(thor_mutex_t *mutex);
+void thor_mutex_lock(thor_mutex_t *mutex);
+void thor_mutex_unlock(thor_mutex_t *mutex);
+
+void thor_cond_init(thor_cond_t *cond);
+void thor_cond_destroy(thor_cond_t *cond);
+void thor_cond_wait(thor_cond_t *cond, thor_mutex_t *mutex);
+void thor_cond_signal(thor_cond_t *cond);
+void thor_cond_broadcast(thor_cond_t *cond);
+
+/* Number of processors available, at least 1 */
+int thor_num_cpus(void);
+
+/* Pool of worker threads. thor_workers_run() calls func for the jobs 0 to
+   num_jobs-1 in any order and returns when all are done. The calling thread
+   takes part as thread 0, and the other threads are numbered from 1, so that
+   jobs can use per-thread scratch buffers. A NULL pool runs the jobs in the
+   calling thread. */
+typedef struct thor_workers thor_workers_t;
+typedef void (*thor_job_func_t)(void *arg, int job, int thread);
+
+thor_workers_t *thor_workers_create(int num_threads);
+void thor_workers_close(thor_workers_t *workers);
+int thor_workers_num_threads(const thor_workers_t *workers);
+void thor_workers_run(thor_workers_t *workers, thor_job_func_t func, void *arg, int num_jobs);
+
+/* Thread running one job at a time in the background. thor_task_run()
+   waits for the previous job to finish before it starts func(arg), and
+   thor_task_wait() waits for the current job. */
+typedef struct thor_task thor_task_t;
+
+thor_task_t *thor_task_create(void);
+void thor_task_close(thor_task_t *task);
+void thor_task_run(thor_task_t *task, thor_thread_func_t func, void *arg);
+void thor_task_wait(thor_task_t *task);
+
+#endif
@@ -0,0 +1,238 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_WIN32)
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "global.h"
+#include "timer.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+
+double get_wall_time(void)
+{
+  LARGE_INTEGER freq, count;
+  QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&count);
+  return (double)count.QuadPart / (double)freq.QuadPart;
+}
+#else
+#include <time.h>
+
+double get_wall_time(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+}
+#endif
+
+stage_timer_t *create_stage_timer(const char *filename, const char * const *names, int num_stages, int use_perf)
+{
+  stage_timer_t *timer;
+  size_t len = strlen(filename);
+  int i, c;
+
+  if (num_stages > MAX_TIMER_STAGES)
+    fatalerror("Too many timer stages\n");
+  if (!(timer = calloc(1, sizeof(stage_timer_t))))
+    fatalerror("Memory allocation failed\n");
+  if (!(timer->file = fopen(filename, "w")))
+    fatalerror("Could not open timing file\n");
+  timer->names = names;
+  timer->num_stages = num_stages;
+  timer->json = len >= 5 && !strcmp(filename + len - 5, ".json");
+  if (use_perf && !open_perf_counters(&timer->perf))
+    fprintf(stderr, "Hardware performance counters are not available, reporting wall clock time only\n");
+
+  if (timer->json) {
+    fprintf(timer->file, "{\"stages\":[");
+    for (i = 0; i < num_stages; i++)
+      fprintf(timer->file, "%s\"%s\"", i ? "," : "", names[i]);
+    fprintf(timer->file, "],\n\"counters\":[");
+    for (c = 0; c < timer->perf.num_counters; c++)
+      fprintf(timer->file, "%s\"%s\"", c ? "," : "", timer->perf.names[c]);
+    fprintf(timer->file, "],\n\"frames\":[");
+  } else {
+    fprintf(timer->file, "frame,type,frames,bits,total_ms");
+    for (i = 0; i < num_stages; i++)
+      fprintf(timer->file, ",%s_ms", names[i]);
+    fprintf(timer->file, ",other_ms");
+    for (i = 0; i <= num_stages && timer->perf.num_counters; i++)
+      for (c = 0; c < timer->perf.num_counters; c++)
+        fprintf(timer->file, ",%s_%s", i < num_stages ? names[i] : "other", timer->perf.names[c]);
+    fprintf(timer->file, "\n");
+  }
+  return timer;
+}
+
+static void write_stage_record(stage_timer_t *timer, double total, const double *stage, uint64_t perf[][MAX_PERF_COUNTERS])
+{
+  int num_counters = timer->perf.num_counters;
+  double other = total;
+  int i, c;
+
+  if (timer->json) {
+    fprintf(timer->file, "\"total_ms\":%.3f", 1000.0*total);
+    for (i = 0; i < timer->num_stages; i++) {
+      fprintf(timer->file, ",\"%s_ms\":%.3f", timer->names[i], 1000.0*stage[i]);
+      other -= stage[i];
+    }
+    fprintf(timer->file, ",\"other_ms\":%.3f", 1000.0*other);
+    for (i = 0; i <= timer->num_stages && num_counters; i++)
+      for (c = 0; c < num_counters; c++)
+        fprintf(timer->file, ",\"%s_%s\":%llu", i < timer->num_stages ? timer->names[i] : "other", timer->perf.names[c], (unsigned long long)perf[i][c]);
+    fprintf(timer->file, "}");
+  } else {
+    fprintf(timer->file, "%.3f", 1000.0*total);
+    for (i = 0; i < timer->num_stages; i++) {
+      fprintf(timer->file, ",%.3f", 1000.0*stage[i]);
+      other -= stage[i];
+    }
+    fprintf(timer->file, ",%.3f", 1000.0*other);
+    for (i = 0; i <= timer->num_stages && num_counters; i++)
+      for (c = 0; c < num_counters; c++)
+        fprintf(timer->file, ",%llu", (unsigned long long)perf[i][c]);
+    fprintf(timer->file, "\n");
+  }
+}
+
+void close_stage_timer(stage_timer_t *timer)
+{
+  uint64_t sum_perf[MAX_TIMER_STAGES+1][MAX_PERF_COUNTERS] = {{0}};
+  double sum[MAX_TIMER_STAGES] = {0};
+  double sum_time = 0;
+  long long sum_bits = 0;
+  int sum_frames = 0;
+  int t, i, c;
+
+  if (timer->json)
+    fprintf(timer->file, "],\n\"types\":{");
+  for (t = 0; t < MAX_TIMER_FRAME_TYPES; t++) {
+    if (timer->json)
+      fprintf(timer->file, "%s\n\"%c\":{\"frames\":%d,\"bits\":%lld,", t ? "," : "", "IPB"[t], timer->num_frames[t], timer->total_bits[t]);
+    else
+      fprintf(timer->file, "total,%c,%d,%lld,", "IPB"[t], timer->num_frames[t], timer->total_bits[t]);
+    write_stage_record(timer, timer->total_time[t], timer->total[t], timer->total_perf[t]);
+
+    sum_frames += timer->num_frames[t];
+    sum_bits += timer->total_bits[t];
+    sum_time += timer->total_time[t];
+    for (i = 0; i <= timer->num_stages; i++) {
+      if (i < timer->num_stages)
+        sum[i] += timer->total[t][i];
+      for (c = 0; c < timer->perf.num_counters; c++)
+        sum_perf[i][c] += timer->total_perf[t][i][c];
+    }
+  }
+  if (timer->json)
+    fprintf(timer->file, "},\n\"total\":{\"frames\":%d,\"bits\":%lld,", sum_frames, sum_bits);
+  else
+    fprintf(timer->file, "total,,%d,%lld,", sum_frames, sum_bits);
+  write_stage_record(timer, sum_time, sum, sum_perf);
+  if (timer->json)
+    fprintf(timer->file, "}\n");
+
+  close_perf_counters(&timer->perf);
+  fclose(timer->file);
+  free(timer);
+}
+
+/* Add the counter increments since the last read to stage */
+static void update_perf(stage_timer_t *timer, int stage)
+{
+  uint64_t now[MAX_PERF_COUNTERS];
+  int c;
+
+  read_perf_counters(&timer->perf, now);
+  for (c = 0; c < timer->perf.num_counters; c++) {
+    timer->frame_perf[stage][c] += now[c] - timer->perf_last[c];
+    timer->perf_last[c] = now[c];
+  }
+}
+
+void stage_begin(stage_timer_t *timer, int stage)
+{
+  double now = get_wall_time();
+  if (timer->depth)
+    timer->frame[timer->stack[timer->depth-1]] += now - timer->last;
+  else if (timer->perf.num_counters)
+    update_perf(timer, timer->num_stages);
+  if (timer->depth < MAX_TIMER_DEPTH)
+    timer->stack[timer->depth++] = stage;
+  timer->last = now;
+}
+
+void stage_end(stage_timer_t *timer)
+{
+  double now = get_wall_time();
+  if (timer->depth) {
+    int stage = timer->stack[--timer->depth];
+    timer->frame[stage] += now - timer->last;
+    if (!timer->depth && timer->perf.num_counters)
+      update_perf(timer, stage);
+  }
+  timer->last = now;
+}
+
+void stage_frame_begin(stage_timer_t *timer)
+{
+  memset(timer->frame, 0, sizeof(timer->frame));
+  memset(timer->frame_perf, 0, sizeof(timer->frame_perf));
+  timer->depth = 0;
+  read_perf_counters(&timer->perf, timer->perf_last);
+  timer->frame_start = timer->last = get_wall_time();
+}
+
+void stage_frame_end(stage_timer_t *timer, int frame_num, int frame_type, int bits)
+{
+  double total = get_wall_time() - timer->frame_start;
+  int t = frame_type < MAX_TIMER_FRAME_TYPES ? frame_type : MAX_TIMER_FRAME_TYPES - 1;
+  int first = !(timer->num_frames[0] + timer->num_frames[1] + timer->num_frames[2]);
+  int i, c;
+
+  if (timer->perf.num_counters)
+    update_perf(timer, timer->num_stages);
+  for (i = 0; i <= timer->num_stages; i++) {
+    if (i < timer->num_stages)
+      timer->total[t][i] += timer->frame[i];
+    for (c = 0; c < timer->perf.num_counters; c++)
+      timer->total_perf[t][i][c] += timer->frame_perf[i][c];
+  }
+  timer->total_time[t] += total;
+  timer->total_bits[t] += bits;
+  timer->num_frames[t]++;
+
+  if (timer->json)
+    fprintf(timer->file, "%s\n{\"frame\":%d,\"type\":\"%c\",\"bits\":%d,", first ? "" : ",", frame_num, "IPB"[t], bits);
+  else
+    fprintf(timer->file, "%d,%c,1,%d,", frame_num, "IPB"[t], bits);
+  write_stage_record(timer, total, timer->frame, timer->frame_perf);
+}
@@ -0,0 +1,80 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+  list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+  list of conditions and the following disclaimer in the documentation and/or
+  other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#include <stdio.h>
+#include "perf_counters.h"
+
+#define MAX_TIMER_STAGES 16
+#define MAX_TIMER_DEPTH 16
+#define MAX_TIMER_FRAME_TYPES 3  // I, P and B frames
+
+/* Per-stage wall clock timer. Stages may nest; the time spent in a nested
+   stage is attributed to the innermost stage only, so the stage times of a
+   frame add up to (at most) the frame time. Hardware counters, if enabled,
+   are read only when entering and leaving top-level stages and so include
+   the stages nested inside. */
+typedef struct
+{
+  const char * const *names;
+  int num_stages;
+  int depth;
+  int stack[MAX_TIMER_DEPTH];
+  double last;
+  double frame_start;
+  double frame[MAX_TIMER_STAGES];
+  int json;
+  FILE *file;
+  perf_counters_t perf;
+  uint64_t perf_last[MAX_PERF_COUNTERS];
+  uint64_t frame_perf[MAX_TIMER_STAGES+1][MAX_PERF_COUNTERS];  // Last entry for time outside the stages
+  /* Totals per frame type */
+  int num_frames[MAX_TIMER_FRAME_TYPES];
+  long long total_bits[MAX_TIMER_FRAME_TYPES];
+  double total_time[MAX_TIMER_FRAME_TYPES];
+  double total[MAX_TIMER_FRAME_TYPES][MAX_TIMER_STAGES];
+  uint64_t total_perf[MAX_TIMER_FRAME_TYPES][MAX_TIMER_STAGES+1][MAX_PERF_COUNTERS];
+} stage_timer_t;
+
+/* Monotonic wall clock time in seconds */
+double get_wall_time(void);
+
+/* Per-frame records are written as JSON if filename ends in .json, otherwise as CSV.
+   With use_perf the hardware counters are added if the system provides them. */
+stage_timer_t *create_stage_timer(const char *filename, const char * const *names, int num_stages, int use_perf);
+void close_stage_timer(stage_timer_t *timer);
+void stage_begin(stage_timer_t *timer, int stage);
+void stage_end(stage_timer_t *timer);
+void stage_frame_begin(stage_timer_t *timer);
+void stage_frame_end(stage_timer_t *timer, int frame_num, int frame_type, int bits);
+
+/* The timer pointer is NULL when timing is disabled */
+#define STAGE_BEGIN(timer, stage) do { if (timer) stage_begin(timer, stage); } while (0)
+#define STAGE_END(timer) do { if (timer) stage_end(timer); } while (0)
+
+#endif
@@ -55,7 +55,7 @@ typedef struct
     double v;
 } snrvals;
 
-typedef struct
+typedef struct yuv_frame_t
 {   
     SAMPLE *y;
     SAMPLE *u;
@@ -77,6 +77,8 @@ typedef struct
     int frame_num;
     int bitdepth;
     int input_bitdepth;
+    struct yuv_frame_t *down[MAX_PYRAMID_LEVELS]; // 2x2 down-scaled pyramid, built on first use
+    int num_down;                                 // Levels of down[] matching the frame
 } yuv_frame_t;
 
 typedef enum {     // Order matters: log2(size)-2
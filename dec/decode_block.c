@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <limits.h>
 #include <math.h>
 #include <string.h>
 #include <memory.h>
@@ -42,6 +43,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "intra_prediction.h"
 #include "simd.h"
 #include "wt_matrix.h"
+#include "temporal_interp.h"
 
 extern int chroma_qp[52];
 
@@ -222,6 +224,42 @@ static void copy_deblock_data(decoder_info_t *decoder_info, block_info_dec_t *bl
   }
 }
 
+/* Return the reference frame of ref_idx. The interpolated reference is
+   synthesised on demand, so make sure the rows that mv_arr can reach
+   (with filter taps and either MV sign) are available. A NULL mv_arr
+   requests the whole frame. */
+static yuv_frame_t *get_ref_frame(decoder_info_t *decoder_info, int ref_idx, block_pos_t *block_pos, mv_t *mv_arr, int split){
+  int r = decoder_info->frame_info.ref_array[ref_idx];
+  if (r >= 0)
+    return decoder_info->ref[r];
+  if (!decoder_info->interp_state)
+    return decoder_info->interp_frames[0];
+
+  int height = decoder_info->height;
+  int ystart = 0, yend = height;
+  if (mv_arr) {
+    int div = split + 1;
+    int bwidth = block_pos->bwidth / div;
+    int bheight = block_pos->bheight / div;
+    ystart = INT_MAX;
+    yend = INT_MIN;
+    for (int index = 0; index < div*div; index++) {
+      int ypos = block_pos->ypos + ((index >> 1) & 1)*bheight;
+      for (int sign = 0; sign < 2; sign++) {
+        mv_t mv = mv_arr[index];
+        TEMPLATE(clip_mv)(&mv, block_pos->ypos, block_pos->xpos, decoder_info->width, height, bwidth, bheight, sign);
+        int mvy = sign ? -mv.y : mv.y;
+        ystart = min(ystart, ypos + (mvy >> 2) - 8);
+        yend = max(yend, ypos + bheight + (mvy >> 2) + 8);
+      }
+    }
+  }
+  STAGE_BEGIN(decoder_info->timer, DEC_STAGE_INTERP);
+  TEMPLATE(interpolate_frame_rows)(decoder_info->interp_state, ystart, yend);
+  STAGE_END(decoder_info->timer);
+  return decoder_info->interp_frames[0];
+}
+
 static void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos,int sub){
 
   int width = decoder_info->width;
@@ -287,6 +325,8 @@ static void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos
   read_block(decoder_info,stream,&block_info,frame_type);
   mode = block_info.block_param.mode;
 
+  STAGE_BEGIN(decoder_info->timer, DEC_STAGE_RECONSTRUCT);
+
   if (mode == MODE_INTRA){
     int ql = decoder_info->qmtx ? qp_to_qlevel(qpY,decoder_info->qmtx_offset) : 0;
     intra_mode = block_info.block_param.intra_mode;
@@ -314,13 +354,12 @@ static void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos
         SAMPLE *pblock1_u = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE >> 2*sub)*sizeof(SAMPLE), 32);
         SAMPLE *pblock1_v = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE >> 2*sub)*sizeof(SAMPLE), 32);
 
-        int r0 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx0];
-        yuv_frame_t *ref0 = r0 >= 0 ? decoder_info->ref[r0] : decoder_info->interp_frames[0];
+        int temp = decoder_info->bit_count.stat_frame_type == B_FRAME && decoder_info->interp_ref == 2 && block_info.block_param.skip_idx==0;
+        yuv_frame_t *ref0 = get_ref_frame(decoder_info, block_info.block_param.ref_idx0, &block_info.block_pos, temp ? NULL : block_info.block_param.mv_arr0, 0);
         int sign0 = ref0->frame_num >= rec->frame_num;
-        int r1 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx1];
-        yuv_frame_t *ref1 = r1 >= 0 ? decoder_info->ref[r1] : decoder_info->interp_frames[0];
+        yuv_frame_t *ref1 = get_ref_frame(decoder_info, block_info.block_param.ref_idx1, &block_info.block_pos, temp ? NULL : block_info.block_param.mv_arr1, 0);
         int sign1 = ref1->frame_num >= rec->frame_num;
-        if (decoder_info->bit_count.stat_frame_type == B_FRAME && decoder_info->interp_ref == 2 && block_info.block_param.skip_idx==0) {
+        if (temp) {
           TEMPLATE(get_inter_prediction_temp)(width, height, ref0, ref1, &block_info.block_pos, decoder_info->deblock_data, decoder_info->num_reorder_pics + 1, decoder_info->frame_info.phase, pblock_y, pblock_u, pblock_v);
         }
         else {
@@ -337,8 +376,7 @@ static void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos
       }
       else{
         int ref_idx = block_info.block_param.ref_idx0; //TODO: Move to top
-        int r = decoder_info->frame_info.ref_array[ref_idx];
-        ref = r>=0 ? decoder_info->ref[r] : decoder_info->interp_frames[0];
+        ref = get_ref_frame(decoder_info, ref_idx, &block_info.block_pos, block_info.block_param.mv_arr0, 0);
         int sign = ref->frame_num > rec->frame_num;
 
         TEMPLATE(get_inter_prediction_yuv)(ref, pblock_y, pblock_u, pblock_v, &block_info.block_pos, block_info.block_param.mv_arr0, sign, width, height, bipred, 0, decoder_info->bitdepth);
@@ -352,6 +390,7 @@ static void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos
         memcpy(&rec_v[j*rec->stride_c], &pblock_v[j*sizeC], (bwidth >> sub)*sizeof(SAMPLE));
       }
       copy_deblock_data(decoder_info, &block_info);
+      STAGE_END(decoder_info->timer);
       return;
     }
     else if (mode==MODE_MERGE){
@@ -364,13 +403,11 @@ static void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos
         SAMPLE *pblock1_u = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE >> 2*sub)*sizeof(SAMPLE), 32);
         SAMPLE *pblock1_v = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE >> 2*sub)*sizeof(SAMPLE), 32);
 
-        int r0 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx0];
-        yuv_frame_t *ref0 = r0 >= 0 ? decoder_info->ref[r0] : decoder_info->interp_frames[0];
+        yuv_frame_t *ref0 = get_ref_frame(decoder_info, block_info.block_param.ref_idx0, &block_info.block_pos, block_info.block_param.mv_arr0, 0);
         int sign0 = ref0->frame_num >= rec->frame_num;
         TEMPLATE(get_inter_prediction_yuv)(ref0, pblock0_y, pblock0_u, pblock0_v, &block_info.block_pos, block_info.block_param.mv_arr0, sign0, width, height, bipred, 0, decoder_info->bitdepth);
 
-        int r1 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx1];
-        yuv_frame_t *ref1 = r1 >= 0 ? decoder_info->ref[r1] : decoder_info->interp_frames[0];
+        yuv_frame_t *ref1 = get_ref_frame(decoder_info, block_info.block_param.ref_idx1, &block_info.block_pos, block_info.block_param.mv_arr1, 0);
         int sign1 = ref1->frame_num >= rec->frame_num;
         TEMPLATE(get_inter_prediction_yuv)(ref1, pblock1_y, pblock1_u, pblock1_v, &block_info.block_pos, block_info.block_param.mv_arr1, sign1, width, height, bipred, 0, decoder_info->bitdepth);
 
@@ -385,16 +422,14 @@ static void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos
       }
       else{
         int ref_idx = block_info.block_param.ref_idx0; //TODO: Move to top
-        int r = decoder_info->frame_info.ref_array[ref_idx];
-        ref = r>=0 ? decoder_info->ref[r] : decoder_info->interp_frames[0];
+        ref = get_ref_frame(decoder_info, ref_idx, &block_info.block_pos, block_info.block_param.mv_arr0, 0);
         int sign = ref->frame_num > rec->frame_num;
         TEMPLATE(get_inter_prediction_yuv)(ref, pblock_y, pblock_u, pblock_v, &block_info.block_pos, block_info.block_param.mv_arr0, sign, width, height, bipred, 0, decoder_info->bitdepth);
       }
     }
     else if (mode == MODE_INTER){
       int ref_idx = block_info.block_param.ref_idx0;
-      int r = decoder_info->frame_info.ref_array[ref_idx];
-      ref = r>=0 ? decoder_info->ref[r] : decoder_info->interp_frames[0];
+      ref = get_ref_frame(decoder_info, ref_idx, &block_info.block_pos, block_info.block_param.mv_arr0, decoder_info->pb_split);
       int sign = ref->frame_num > rec->frame_num;
       TEMPLATE(get_inter_prediction_yuv)(ref, pblock_y, pblock_u, pblock_v, &block_info.block_pos, block_info.block_param.mv_arr0, sign, width, height, bipred, decoder_info->pb_split, decoder_info->bitdepth);
     }
@@ -407,13 +442,11 @@ static void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos
       SAMPLE *pblock1_u = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE >> 2*sub)*sizeof(SAMPLE), 32);
       SAMPLE *pblock1_v = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE >> 2*sub)*sizeof(SAMPLE), 32);
 
-      int r0 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx0];
-      yuv_frame_t *ref0 = r0 >= 0 ? decoder_info->ref[r0] : decoder_info->interp_frames[0];
+      yuv_frame_t *ref0 = get_ref_frame(decoder_info, block_info.block_param.ref_idx0, &block_info.block_pos, block_info.block_param.mv_arr0, decoder_info->pb_split);
       int sign0 = ref0->frame_num >= rec->frame_num;
       TEMPLATE(get_inter_prediction_yuv)(ref0, pblock0_y, pblock0_u, pblock0_v, &block_info.block_pos, block_info.block_param.mv_arr0, sign0, width, height, bipred, decoder_info->pb_split, decoder_info->bitdepth);
 
-      int r1 = decoder_info->frame_info.ref_array[block_info.block_param.ref_idx1];
-      yuv_frame_t *ref1 = r1 >= 0 ? decoder_info->ref[r1] : decoder_info->interp_frames[0];
+      yuv_frame_t *ref1 = get_ref_frame(decoder_info, block_info.block_param.ref_idx1, &block_info.block_pos, block_info.block_param.mv_arr1, decoder_info->pb_split);
       int sign1 = ref1->frame_num >= rec->frame_num;
       TEMPLATE(get_inter_prediction_yuv)(ref1, pblock1_y, pblock1_u, pblock1_v, &block_info.block_pos, block_info.block_param.mv_arr1, sign1, width, height, bipred, decoder_info->pb_split, decoder_info->bitdepth);
 
@@ -439,6 +472,7 @@ static void decode_block(decoder_info_t *decoder_info,int size,int ypos,int xpos
 
   /* Copy deblock data to frame array */
   copy_deblock_data(decoder_info,&block_info);
+  STAGE_END(decoder_info->timer);
 
   thor_free(pblock0_y);
   thor_free(pblock0_u);
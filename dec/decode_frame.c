@@ -49,7 +49,7 @@ static int clpf_bit(int k, int l, const yuv_frame_t *r, const yuv_frame_t *o, co
   return get_flc(1, (stream_t*)stream);
 }
 
-void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
+void decode_frame(decoder_info_t *decoder_info)
 {
   int height = decoder_info->height;
   int width = decoder_info->width;
@@ -60,10 +60,11 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
   stream_t *stream = decoder_info->stream;
 
   int bit_start = stream->bitcnt;
-  int rec_buffer_idx;
 
   decoder_info->frame_info.interp_ref = 0;
+  STAGE_BEGIN(decoder_info->timer, DEC_STAGE_HEADER);
   read_frame_header(decoder_info, stream);
+  STAGE_END(decoder_info->timer);
   decoder_info->bit_count.stat_frame_type = decoder_info->frame_info.frame_type;
   int qp = decoder_info->frame_info.qp;
   if (decoder_info->frame_info.frame_type != I_FRAME) {
@@ -87,9 +88,6 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
     }
   }
 
-  rec_buffer_idx = decoder_info->frame_info.display_frame_num%MAX_REORDER_BUFFER;
-  decoder_info->rec = &rec_buffer[rec_buffer_idx];
-  decoder_info->tmp = &rec_buffer[MAX_REORDER_BUFFER];
   decoder_info->rec->frame_num = decoder_info->frame_info.display_frame_num;
 
   if (decoder_info->frame_info.num_ref>2 && decoder_info->frame_info.ref_array[0]==-1) {
@@ -107,8 +105,10 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
       off1 = off2 = 1;
     }
     // FIXME: won't work for the 1-sided case
-    TEMPLATE(interpolate_frames)(decoder_info->interp_frames[0], ref1, ref2, off1+off2 , off2);
-    TEMPLATE(pad_yuv_frame)(decoder_info->interp_frames[0]);
+    STAGE_BEGIN(decoder_info->timer, DEC_STAGE_INTERP);
+    // Only the motion is estimated here, decode_block() synthesises the rows it predicts from
+    decoder_info->interp_state = TEMPLATE(interpolate_frames_deferred)(decoder_info->interp_frames[0], ref1, ref2, off1+off2 , off2, decoder_info->workers);
+    STAGE_END(decoder_info->timer);
     decoder_info->interp_frames[0]->frame_num = display_frame_num;
   }
 
@@ -116,8 +116,10 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
   decoder_info->bit_count.frame_type[decoder_info->bit_count.stat_frame_type] += 1;
   decoder_info->frame_info.qp = qp;
   decoder_info->frame_info.qpb = qp;
+  decoder_info->frame_info.frame_qp = qp;
 
   //Generate new interpolated frame
+  STAGE_BEGIN(decoder_info->timer, DEC_STAGE_PARSE);
   for (k=0;k<num_sb_ver;k++){
     for (l=0;l<num_sb_hor;l++){
       int sub = decoder_info->subsample == 400 ? 31 : decoder_info->subsample == 420;
@@ -125,6 +127,17 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
       int yposY = k*sb_size;
       TEMPLATE(process_block_dec)(decoder_info, sb_size, yposY, xposY, sub);
     }
+
+    /* Low-delay mode: each group of SB rows is followed by a new unit */
+    int rows_per_unit = decoder_info->sb_rows_per_unit;
+    if (rows_per_unit && ((k+1) % rows_per_unit == 0 || k+1 == num_sb_ver))
+      next_unit_dec(stream);
+  }
+  STAGE_END(decoder_info->timer);
+
+  if (decoder_info->interp_state) {
+    TEMPLATE(close_interp_state)(decoder_info->interp_state);
+    decoder_info->interp_state = NULL;
   }
 
   qp = decoder_info->frame_info.qp = decoder_info->frame_info.qpb;
@@ -140,14 +153,20 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
   }
 
   if (decoder_info->deblocking){
+    STAGE_BEGIN(decoder_info->timer, DEC_STAGE_DEBLOCK);
     TEMPLATE(deblock_frame_y)(decoder_info->rec, decoder_info->deblock_data, width, height, qp, decoder_info->bitdepth);
     if (decoder_info->subsample != 400) {
       int qpc = decoder_info->subsample != 444 ? chroma_qp[qp] : qp;
       TEMPLATE(deblock_frame_uv)(decoder_info->rec, decoder_info->deblock_data, width, height, qpc, decoder_info->bitdepth);
     }
+    STAGE_END(decoder_info->timer);
   }
 
 #if CDEF
+  STAGE_BEGIN(decoder_info->timer, DEC_STAGE_CDEF);
+  if (decoder_info->sb_rows_per_unit)
+    read_cdef_params(decoder_info, stream);
+
   if (decoder_info->cdef_enable) {
     int nhfb = (height + CDEF_BLOCKSIZE - 1) >> CDEF_BLOCKSIZE_LOG2;
     int nvfb = (width + CDEF_BLOCKSIZE - 1) >> CDEF_BLOCKSIZE_LOG2;
@@ -173,13 +192,15 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
         }
       }
     }
-    TEMPLATE(cdef_frame)(decoder_info->cdef, decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, decoder_info->bitdepth, 0);
-    TEMPLATE(cdef_frame)(decoder_info->cdef, decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, decoder_info->bitdepth, 1);
-    TEMPLATE(cdef_frame)(decoder_info->cdef, decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, decoder_info->bitdepth, 2);
+    TEMPLATE(cdef_frame)(decoder_info->cdef, decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, decoder_info->bitdepth, 1, 0);
+    TEMPLATE(cdef_frame)(decoder_info->cdef, decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, decoder_info->bitdepth, 1, 1);
+    TEMPLATE(cdef_frame)(decoder_info->cdef, decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, decoder_info->bitdepth, 1, 2);
   }
+  STAGE_END(decoder_info->timer);
 #endif
 
   if (decoder_info->clpf) {
+    STAGE_BEGIN(decoder_info->timer, DEC_STAGE_CLPF);
     int strength_y = get_flc(2, stream);
     int strength_u = get_flc(2, stream);
     int strength_v = get_flc(2, stream);
@@ -188,12 +209,13 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
       int enable_fb_flag = fb_size_log2 != 4;
       if (fb_size_log2 == 4)
         fb_size_log2 = 7;
-      TEMPLATE(clpf_frame)(decoder_info->rec, 0, decoder_info->deblock_data, stream, enable_fb_flag, strength_y + (strength_y == 3), fb_size_log2, decoder_info->bitdepth, PLANE_Y, qp, enable_fb_flag ? clpf_bit : clpf_true);
+      TEMPLATE(clpf_frame)(decoder_info->rec, 0, decoder_info->deblock_data, stream, enable_fb_flag, strength_y + (strength_y == 3), fb_size_log2, decoder_info->bitdepth, PLANE_Y, qp, enable_fb_flag ? clpf_bit : clpf_true, decoder_info->workers);
     }
     if (strength_u)
-      TEMPLATE(clpf_frame)(decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, strength_u + (strength_u == 3), 4, decoder_info->bitdepth, PLANE_U, qp, clpf_true);
+      TEMPLATE(clpf_frame)(decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, strength_u + (strength_u == 3), 4, decoder_info->bitdepth, PLANE_U, qp, clpf_true, decoder_info->workers);
     if (strength_v)
-      TEMPLATE(clpf_frame)(decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, strength_v + (strength_v == 3), 4, decoder_info->bitdepth, PLANE_V, qp, clpf_true);
+      TEMPLATE(clpf_frame)(decoder_info->rec, 0, decoder_info->deblock_data, stream, 0, strength_v + (strength_v == 3), 4, decoder_info->bitdepth, PLANE_V, qp, clpf_true, decoder_info->workers);
+    STAGE_END(decoder_info->timer);
   }
 
   /* Sliding window operation for reference frame buffer by circular buffer */
@@ -208,7 +230,13 @@ void decode_frame(decoder_info_t *decoder_info, yuv_frame_t* rec_buffer)
   decoder_info->ref[0] = tmp;
 
   /* Pad the reconstructed frame and write into ref[0] */
-  TEMPLATE(create_reference_frame)(decoder_info->ref[0],decoder_info->rec);
+  if (decoder_info->frame_info.non_ref)
+    decoder_info->ref[0]->frame_num = decoder_info->rec->frame_num; // Keep the slot in the sliding window only
+  else {
+    STAGE_BEGIN(decoder_info->timer, DEC_STAGE_REFERENCE);
+    TEMPLATE(create_reference_frame)(decoder_info->ref[0],decoder_info->rec);
+    STAGE_END(decoder_info->timer);
+  }
 }
 
 
@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "maindec.h"
 
-void decode_frame(decoder_info_t *encoder_info,yuv_frame_t* rec_buffer);
+/* Decode the frame in decoder_info->stream into decoder_info->rec */
+void decode_frame(decoder_info_t *decoder_info);
 
 #endif
@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "global.h"
 #include "getbits.h"
 
@@ -45,26 +46,40 @@ static const unsigned int msk[33] =
   0xffffffff
 };
 
-int initbits_dec(FILE *infile, stream_t *str)
+/* Start reading the length-prefixed unit at data. Returns nonzero if
+   there is no complete unit before end. */
+int initbits_dec(const uint8_t *data, const uint8_t *end, stream_t *str)
 {
-  uint8_t frame_bytes_buf[4];
   uint32_t length;
-  int ret;
 
   str->incnt = 0;
   str->rdptr = str->rdbfr + 2048;
   str->bitcnt = 0;
-  str->infile = infile;
-
-  length = 0;
-  ret = fread(frame_bytes_buf, sizeof(frame_bytes_buf), 1, infile) != 1;
-  if (!ret)
-  {
-    length = frame_bytes_buf[0] << 24 | frame_bytes_buf[1] << 16
-     | frame_bytes_buf[2] << 8 | frame_bytes_buf[3];
-  }
+  str->data = data;
+  str->end = end;
+  str->length = 0;
+
+  if (end - data < 4)
+    return 1;
+  length = data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+  if (length > (uint32_t)(end - data - 4))
+    return 1;
+  str->data = data + 4;
   str->length = length;
 
+  return 0;
+}
+
+/* Continue with the next length-prefixed unit of the current frame */
+int next_unit_dec(stream_t *str)
+{
+  int bitcnt = str->bitcnt;
+  int ret;
+
+  // Skip any trailing bytes of the previous unit
+  ret = initbits_dec(str->data + str->length, str->end, str);
+  str->bitcnt = bitcnt;
+
   return ret;
 }
 
@@ -84,10 +99,9 @@ int fillbfr(stream_t *str)
     read_size = str->length;
     if (read_size > 0) {
       if (read_size > 2048) read_size = 2048;
-      //l = (int)fread(str->rdbfr,sizeof(unsigned char),2048,str->infile);
       str->rdptr = str->rdbfr + 2048 - read_size;
-      if (fread(str->rdptr, sizeof(*str->rdptr), read_size, str->infile) != read_size)
-        fprintf(stderr, "Warning: short read");
+      memcpy(str->rdptr, str->data, read_size);
+      str->data += read_size;
       str->length -= read_size;
 
       while (str->incnt <= 24 && (str->rdptr < str->rdbfr + 2048))
@@ -27,11 +27,12 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #if !defined(_GETBITS_H_)
 #define _GETBITS_H_
 
-#include <stdio.h>
+#include <stdint.h>
 
 typedef struct
 {
-  FILE *infile;
+  const uint8_t *data;  // Unread bytes of the current unit
+  const uint8_t *end;   // End of the frame data
   unsigned char rdbfr[2051];
   unsigned char *rdptr;
   unsigned int inbfr;
@@ -40,7 +41,8 @@ typedef struct
   uint32_t length;
 } stream_t;
 
-int initbits_dec(FILE *infile, stream_t *str);
+int initbits_dec(const uint8_t *data, const uint8_t *end, stream_t *str);
+int next_unit_dec(stream_t *str);
 int fillbfr(stream_t *str);
 unsigned int showbits(stream_t *str, int n);
 unsigned int getbits1(stream_t *str);
@@ -33,27 +33,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <assert.h>
 
 #include "global.h"
-#include "maindec.h"
-#include "decode_frame.h"
+#include "thordec.h"
 #include "common_frame.h"
-#include "getvlc.h"
-#include "../common/simd.h"
-#include "wt_matrix.h"
-#include "read_bits.h"
+#include "frame_writer.h"
 
-void rferror(char error_text[])
-{
-    fprintf(stderr,"Run-time error...\n");
-    fprintf(stderr,"%s\n",error_text);
-    fprintf(stderr,"...now exiting to system...\n");
-    exit(1);
-}
+#define OUTPUT_QUEUE_SIZE 8       //Items queued for the writer thread
 
-void parse_arg(int argc, char** argv, FILE **infile, FILE **outfile)
+static const char * const dec_stage_names[NUM_DEC_STAGES] = {
+  "header", "interp", "parse", "reconstruct", "deblock", "cdef", "clpf", "reference", "output"
+};
+
+void parse_arg(int argc, char** argv, FILE **infile, FILE **outfile, char **outfilestr, char **timingfilestr, int *perf, FILE **statsfile, int *threads, int *quiet)
 {
-    if (argc < 2)
+    int i = 2;
+
+    if (argc < 2 || argv[1][0] == '-')
     {
-        fprintf(stdout, "usage: %s infile [outfile]\n", argv[0]);
+        fprintf(stdout, "usage: %s infile [outfile] [-timing file [-perf]] [-stats file] [-threads n] [-quiet]\n", argv[0]);
         rferror("Wrong number of arguments.");
     }
 
@@ -62,16 +58,49 @@ void parse_arg(int argc, char** argv, FILE **infile, FILE **outfile)
         rferror("Could not open in-file for reading.");
     }
 
-    if (argc > 2)
+    *outfile = NULL;
+    *outfilestr = NULL;
+    if (argc > 2 && argv[2][0] != '-')
     {
-        if (!(*outfile = fopen(argv[2], "wb")))
+        *outfilestr = argv[i++];
+        if (!(*outfile = fopen(*outfilestr, "wb")))
         {
             rferror("Could not open out-file for writing.");
         }
     }
-    else
+
+    *timingfilestr = NULL;
+    *perf = 0;
+    *statsfile = NULL;
+    *threads = 0;
+    *quiet = 0;
+    for (; i < argc; i++)
     {
-        *outfile = NULL;
+        if (!strcmp(argv[i], "-timing") && i + 1 < argc)
+            *timingfilestr = argv[++i];
+        else if (!strcmp(argv[i], "-perf"))
+            *perf = 1;
+        else if (!strcmp(argv[i], "-stats") && i + 1 < argc)
+        {
+            i++;
+            if (!strcmp(argv[i], "-"))
+                *statsfile = stdout;
+            else if (!(*statsfile = fopen(argv[i], "w")))
+                rferror("Could not open stats file for writing.");
+        }
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+        {
+            *threads = atoi(argv[++i]);
+            if (*threads < 0 || *threads > MAX_THREADS)
+                rferror("threads must be in the range 0 to 64.");
+        }
+        else if (!strcmp(argv[i], "-quiet"))
+            *quiet = 1;
+        else
+        {
+            fprintf(stdout, "usage: %s infile [outfile] [-timing file [-perf]] [-stats file] [-threads n] [-quiet]\n", argv[0]);
+            rferror("Unknown argument.");
+        }
     }
 }
 
@@ -90,281 +119,383 @@ unsigned int leading_zeros(unsigned int code)
   return count;
 }
 
+static const char * const bit_category_names[] = {
+  "frame_header", "super_mode", "intra_mode", "mv", "skip_idx", "coeff_y", "coeff_u", "coeff_v", "cbp", "clpf"
+};
+#define NUM_BIT_CATEGORIES (int)(sizeof(bit_category_names)/sizeof(bit_category_names[0]))
+
+static const char * const block_mode_names[NUM_BLOCK_MODES] = {
+  "skip", "intra", "inter", "bipred", "merge"
+};
+
+static void get_bit_categories(const bit_count_t *bit_count, int t, uint32_t *bits)
+{
+  bits[0] = bit_count->frame_header[t];
+  bits[1] = bit_count->super_mode[t];
+  bits[2] = bit_count->intra_mode[t];
+  bits[3] = bit_count->mv[t];
+  bits[4] = bit_count->skip_idx[t];
+  bits[5] = bit_count->coeff_y[t];
+  bits[6] = bit_count->coeff_u[t];
+  bits[7] = bit_count->coeff_v[t];
+  bits[8] = bit_count->cbp[t];
+  bits[9] = bit_count->clpf[t];
+}
+
+/* Write the bits per syntax category and the block mode and size histograms
+   (in units of 8x8 blocks) of frame type t as JSON members. If prev is given
+   only what was added since prev is written. */
+static void write_stats_counts(FILE *file, const bit_count_t *bit_count, const bit_count_t *prev, int t)
+{
+  uint32_t bits[NUM_BIT_CATEGORIES];
+  uint32_t prev_bits[NUM_BIT_CATEGORIES] = {0};
+  int i;
+
+  get_bit_categories(bit_count, t, bits);
+  if (prev)
+    get_bit_categories(prev, t, prev_bits);
+
+  fprintf(file, "\"bits_by_category\":{");
+  for (i = 0; i < NUM_BIT_CATEGORIES; i++)
+    fprintf(file, "%s\"%s\":%u", i ? "," : "", bit_category_names[i], bits[i] - prev_bits[i]);
+  fprintf(file, "},\"modes\":{");
+  for (i = 0; i < NUM_BLOCK_MODES; i++)
+    fprintf(file, "%s\"%s\":%u", i ? "," : "", block_mode_names[i], bit_count->mode[t][i] - (prev ? prev->mode[t][i] : 0));
+  fprintf(file, "},\"sizes\":{");
+  for (i = 0; i < NUM_BLOCK_SIZES; i++)
+    fprintf(file, "%s\"%dx%d\":%u", i ? "," : "", 8<<i, 8<<i, bit_count->size[t][i] - (prev ? prev->size[t][i] : 0));
+  fprintf(file, "}");
+}
+
+/* Summary of the bit and parameter statistics over the whole sequence */
+static void print_bit_statistics(const decoder_info_t *decoder_info)
+{
+  bit_count_t bit_count = decoder_info->bit_count;
+  int i,j;
+  uint32_t tot_bits[NUM_FRAME_TYPES] = {0};
+
+  for (i=0;i<NUM_FRAME_TYPES;i++){
+    tot_bits[i] = bit_count.frame_header[i] +
+                  bit_count.super_mode[i] +
+                  bit_count.intra_mode[i] +
+                  bit_count.mv[i] +
+                  bit_count.skip_idx[i] +
+                  bit_count.coeff_y[i] +
+                  bit_count.coeff_u[i] +
+                  bit_count.coeff_v[i] +
+                  bit_count.cbp[i] +
+                  bit_count.clpf[i];
+  }
+  tot_bits[0] += bit_count.sequence_header;
+  int ni = bit_count.frame_type[0];
+  int np = bit_count.frame_type[1];
+  int nb = bit_count.frame_type[2];
+  if (np==0) np = (1<<30); //Hack to avoid division by zero if there are no P frames
+  if (nb==0) nb = (1<<30); //Hack to avoid division by zero if there are no B frames
+
+  printf("\n\nBIT STATISTICS:\n");
+  printf("Sequence header: %4d\n",bit_count.sequence_header);
+  printf("                           I pictures:           P pictures:           B pictures:\n");
+  printf("                           total    average      total    average      total    average\n");
+  printf("Frame header:          %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.frame_header[0],bit_count.frame_header[0]/ni,bit_count.frame_header[1],bit_count.frame_header[1]/np,bit_count.frame_header[2],bit_count.frame_header[2]/nb);
+  printf("Super mode:            %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.super_mode[0],bit_count.super_mode[0]/ni,bit_count.super_mode[1],bit_count.super_mode[1]/np,bit_count.super_mode[2],bit_count.super_mode[2]/nb);
+  printf("Intra mode:            %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.intra_mode[0],bit_count.intra_mode[0]/ni,bit_count.intra_mode[1],bit_count.intra_mode[1]/np, bit_count.intra_mode[2],bit_count.intra_mode[2]/nb);
+  printf("MV:                    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mv[0],bit_count.mv[0],bit_count.mv[1],bit_count.mv[1]/np, bit_count.mv[2],bit_count.mv[2]/nb);
+  printf("Skip idx:              %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.skip_idx[0],bit_count.skip_idx[0],bit_count.skip_idx[1],bit_count.skip_idx[1]/np,bit_count.skip_idx[2],bit_count.skip_idx[2]/nb);
+  printf("Coeff_y:               %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.coeff_y[0],bit_count.coeff_y[0]/ni,bit_count.coeff_y[1],bit_count.coeff_y[1]/np,bit_count.coeff_y[2],bit_count.coeff_y[2]/nb);
+  printf("Coeff_u:               %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.coeff_u[0],bit_count.coeff_u[0]/ni,bit_count.coeff_u[1],bit_count.coeff_u[1]/np,bit_count.coeff_u[2],bit_count.coeff_u[2]/nb);
+  printf("Coeff_v:               %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.coeff_v[0],bit_count.coeff_v[0]/ni,bit_count.coeff_v[1],bit_count.coeff_v[1]/np,bit_count.coeff_v[2],bit_count.coeff_v[2]/nb);
+  printf("CBP (TU-split):        %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.cbp[0],bit_count.cbp[0]/ni,bit_count.cbp[1],bit_count.cbp[1]/np,bit_count.cbp[2],bit_count.cbp[2]/nb);
+  printf("CLPF:                  %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.clpf[0],bit_count.clpf[0]/ni,bit_count.clpf[1],bit_count.clpf[1]/np,bit_count.clpf[2],bit_count.clpf[2]/nb);
+  printf("Total:                 %9d  %9d  %9d  %9d  %9d  %9d\n",tot_bits[0],tot_bits[0],tot_bits[1],tot_bits[1]/np,tot_bits[2],tot_bits[2]/nb);
+  printf("---------------------------------------------------------------------------------------\n\n");
+
+  printf("PARAMETER STATISTICS:\n");
+  printf("                           I pictures:           P pictures:           B pictures:\n");
+  printf("                           total    average      total    average      total    average\n");
+  printf("Skip-blocks (8x8):     %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][0],bit_count.mode[0][0]/ni,bit_count.mode[1][0],bit_count.mode[1][0]/np,bit_count.mode[2][0],bit_count.mode[2][0]/nb);
+  printf("Intra-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][1],bit_count.mode[0][1]/ni,bit_count.mode[1][1],bit_count.mode[1][1]/np,bit_count.mode[2][1],bit_count.mode[2][1]/nb);
+  printf("Inter-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][2],bit_count.mode[0][2]/ni,bit_count.mode[1][2],bit_count.mode[1][2]/np,bit_count.mode[2][2],bit_count.mode[2][2]/nb);
+  printf("Bipred-blocks (8x8):   %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][3],bit_count.mode[0][3]/ni,bit_count.mode[1][3],bit_count.mode[1][3]/np,bit_count.mode[2][3],bit_count.mode[2][3]/nb);
+  printf("Merge-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][4],bit_count.mode[0][4]/ni,bit_count.mode[1][4],bit_count.mode[1][4]/np,bit_count.mode[2][4],bit_count.mode[2][4]/nb);
+
+  printf("\n");
+  printf("8x8-blocks (8x8):      %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][0],bit_count.size[0][0]/ni,bit_count.size[1][0],bit_count.size[1][0]/np,bit_count.size[2][0],bit_count.size[2][0]/nb);
+  printf("16x16-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][1],bit_count.size[0][1]/ni,bit_count.size[1][1],bit_count.size[1][1]/np,bit_count.size[2][1],bit_count.size[2][1]/nb);
+  printf("32x32-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][2],bit_count.size[0][2]/ni,bit_count.size[1][2],bit_count.size[1][2]/np,bit_count.size[2][2],bit_count.size[2][2]/nb);
+  printf("64x64-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][3],bit_count.size[0][3]/ni,bit_count.size[1][3],bit_count.size[1][3]/np,bit_count.size[2][3],bit_count.size[2][3]/nb);
+  printf("128x128-blocks (8x8):  %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][4],bit_count.size[0][4]/ni,bit_count.size[1][4],bit_count.size[1][4]/np,bit_count.size[2][4],bit_count.size[2][4]/nb);
+
+  printf("\n");
+  printf("Mode and size distribution for P pictures:\n");
+  printf("                            SKIP      INTRA      INTER     BIPRED      MERGE\n");
+  printf("8x8-blocks (8x8):      %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][0][0],bit_count.size_and_mode[P_FRAME][0][1],bit_count.size_and_mode[P_FRAME][0][2],bit_count.size_and_mode[P_FRAME][0][3],bit_count.size_and_mode[P_FRAME][0][4]);
+  printf("16x16-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][1][0],bit_count.size_and_mode[P_FRAME][1][1],bit_count.size_and_mode[P_FRAME][1][2],bit_count.size_and_mode[P_FRAME][1][3],bit_count.size_and_mode[P_FRAME][1][4]);
+  printf("32x32-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][2][0],bit_count.size_and_mode[P_FRAME][2][1],bit_count.size_and_mode[P_FRAME][2][2],bit_count.size_and_mode[P_FRAME][2][3],bit_count.size_and_mode[P_FRAME][2][4]);
+  printf("64x64-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][3][0],bit_count.size_and_mode[P_FRAME][3][1],bit_count.size_and_mode[P_FRAME][3][2],bit_count.size_and_mode[P_FRAME][3][3],bit_count.size_and_mode[P_FRAME][3][4]);
+  printf("128x128-blocks (8x8):  %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][4][0],bit_count.size_and_mode[P_FRAME][4][1],bit_count.size_and_mode[P_FRAME][4][2],bit_count.size_and_mode[P_FRAME][4][3],bit_count.size_and_mode[P_FRAME][4][4]);
+
+
+  printf("\n");
+  printf("Mode and size distribution for B pictures:\n");
+  printf("                            SKIP      INTRA      INTER     BIPRED      MERGE\n");
+  printf("8x8-blocks (8x8):      %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][0][0], bit_count.size_and_mode[B_FRAME][0][1], bit_count.size_and_mode[B_FRAME][0][2], bit_count.size_and_mode[B_FRAME][0][3], bit_count.size_and_mode[B_FRAME][0][4]);
+  printf("16x16-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][1][0], bit_count.size_and_mode[B_FRAME][1][1], bit_count.size_and_mode[B_FRAME][1][2], bit_count.size_and_mode[B_FRAME][1][3], bit_count.size_and_mode[B_FRAME][1][4]);
+  printf("32x32-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][2][0], bit_count.size_and_mode[B_FRAME][2][1], bit_count.size_and_mode[B_FRAME][2][2], bit_count.size_and_mode[B_FRAME][2][3], bit_count.size_and_mode[B_FRAME][2][4]);
+  printf("64x64-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][3][0], bit_count.size_and_mode[B_FRAME][3][1], bit_count.size_and_mode[B_FRAME][3][2], bit_count.size_and_mode[B_FRAME][3][3], bit_count.size_and_mode[B_FRAME][3][4]);
+  printf("128x128-blocks (8x8):  %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][4][0], bit_count.size_and_mode[B_FRAME][4][1], bit_count.size_and_mode[B_FRAME][4][2], bit_count.size_and_mode[B_FRAME][4][3], bit_count.size_and_mode[B_FRAME][4][4]);
+
+  int idx;
+  int num = 5 + decoder_info->max_num_ref;
+  printf("\nSuper-mode distribution for P pictures:\n");
+  printf("                    SKIP   SPLIT INTERr0   MERGE   BIPRED  INTRA ");
+  for (i = 1; i < decoder_info->max_num_ref; i++) printf("INTERr%1d ", i);
+  printf("\n");
+  for (idx=0;idx<NUM_BLOCK_SIZES;idx++){
+    int size = 8<<idx;
+    printf("%3d x %3d-blocks: ",size,size);
+    for (i=0;i<num;i++){
+      printf("%8d",bit_count.super_mode_stat[P_FRAME][idx][i]);
+    }
+    printf("\n");
+  }
+ 
+  printf("\nSuper-mode distribution for B pictures:\n");
+  printf("                    SKIP   SPLIT INTERr0   MERGE   BIPRED  INTRA ");
+  for (i = 1; i < decoder_info->max_num_ref; i++) printf("INTERr%1d ", i);
+  printf("\n");
+  for (idx = 0; idx<NUM_BLOCK_SIZES; idx++) {
+    int size = 8 << idx;
+    printf("%3d x %3d-blocks: ", size, size);
+    for (i = 0; i<num; i++) {
+      printf("%8d", bit_count.super_mode_stat[B_FRAME][idx][i]);
+    }
+    printf("\n");
+  }
+
+  int size;
+  int max_num_ref = 4;
+  printf("\n");
+  printf("Ref_idx and size distribution for P pictures:\n");
+  for (i=0;i<NUM_BLOCK_SIZES;i++){
+    size = 1<<(i+3);
+    printf("%3d x %3d-blocks: ",size,size);
+    for (j=0;j<decoder_info->max_num_ref;j++){
+      printf("%6d",bit_count.size_and_ref_idx[P_FRAME][i][j]);
+    }
+    printf("\n");
+  }
+
+  printf("\n");
+  printf("Ref_idx and size distribution for B pictures:\n");
+  for (i = 0; i<NUM_BLOCK_SIZES; i++) {
+    size = 1 << (i + 3);
+    printf("%3d x %3d-blocks: ", size, size);
+    for (j = 0; j<decoder_info->max_num_ref; j++) {
+      printf("%6d", bit_count.size_and_ref_idx[B_FRAME][i][j]);
+    }
+    printf("\n");
+  }
+  printf("\n");
+  printf("bi-ref-P:  ");
+  for (j=0;j<max_num_ref*max_num_ref;j++){
+    printf("%7d",bit_count.bi_ref[P_FRAME][j]);
+  }
+  printf("\n");
+  printf("bi-ref-B:  ");
+  for (j = 0; j<max_num_ref*max_num_ref; j++) {
+    printf("%7d", bit_count.bi_ref[B_FRAME][j]);
+  }
+  printf("\n");
+  printf("-----------------------------------------------------------------\n");
+}
+
+/* Read the next length-prefixed unit from infile and append it to the
+   buffer. Returns 0 at the end of the file. */
+static int read_unit(FILE *infile, uint8_t **buf, uint32_t *size, uint32_t *capacity)
+{
+  uint8_t length_buf[4];
+
+  if (fread(length_buf, sizeof(length_buf), 1, infile) != 1)
+    return 0;
+  uint32_t length = length_buf[0] << 24 | length_buf[1] << 16 | length_buf[2] << 8 | length_buf[3];
+  if (*size + 4 + length > *capacity) {
+    *capacity = max(2 * *capacity, *size + 4 + length);
+    if (!(*buf = realloc(*buf, *capacity)))
+      rferror("Could not allocate input buffer.");
+  }
+  memcpy(*buf + *size, length_buf, 4);
+  if (fread(*buf + *size + 4, 1, length, infile) != length)
+    fprintf(stderr, "Warning: short read");
+  *size += 4 + length;
+  return 1;
+}
+
 #undef TEMPLATE
-#define TEMPLATE(func) (decoder_info.bitdepth == 8 ? func ## _lbd : func ## _hbd)
+#define TEMPLATE(func) (decoder_info->bitdepth == 8 ? func ## _lbd : func ## _hbd)
+
+static void release_frame(void *dec, yuv_frame_t *frame)
+{
+  thor_decoder_release_frame(dec, frame);
+}
+
+/* Queue the decoded frame for the writer thread, which releases it once written */
+static void write_frame(const decoder_info_t *decoder_info, thor_decoder_t *dec, const yuv_frame_t *frame,
+                        frame_writer_t *writer, FILE *outfile, int y4m_output)
+{
+  STAGE_BEGIN(decoder_info->timer, DEC_STAGE_OUTPUT);
+  if (!outfile)
+    thor_decoder_release_frame(dec, frame);
+  else {
+    if (y4m_output)
+      queue_write_data(writer, outfile, "FRAME\x0a", 6);
+    queue_write_frame(writer, outfile, (yuv_frame_t *)frame, TEMPLATE(write_yuv_frame));
+  }
+  STAGE_END(decoder_info->timer);
+}
 
 int main(int argc, char** argv)
 {
     FILE *infile,*outfile;
-    decoder_info_t decoder_info;
-    stream_t stream;
-    yuv_frame_t rec[MAX_REORDER_BUFFER+1];  // Last is for temp use
-    yuv_frame_t ref[MAX_REF_FRAMES];
-    int rec_available[MAX_REORDER_BUFFER]={0};
-    int rec_buffer_idx;
-    int op_rec_buffer_idx;
+    thor_decoder_t *dec;
+    const decoder_info_t *decoder_info = NULL;
+    const yuv_frame_t *frame;
+    uint8_t *buf = NULL;
+    uint32_t buf_size = 0;
+    uint32_t buf_capacity = 0;
     int decode_frame_num = 0;
-    int last_frame_output = -1;
     int done = 0;
-    int width;
-    int height;
-    int r;
-
-    init_use_simd();
 
-    parse_arg(argc, argv, &infile, &outfile);
-    char *p = strrchr(argv[2], '.');
+    char *outfilestr, *timingfilestr;
+    int perf;
+    FILE *statsfile;
+    int threads;
+    int quiet;
+    parse_arg(argc, argv, &infile, &outfile, &outfilestr, &timingfilestr, &perf, &statsfile, &threads, &quiet);
+    if (perf && !timingfilestr)
+        rferror("-perf requires -timing.");
+    char *p = outfilestr ? strrchr(outfilestr, '.') : NULL;
     int y4m_output = p != NULL && !strcmp(p,".y4m");
+    stage_timer_t *timer = timingfilestr ? create_stage_timer(timingfilestr, dec_stage_names, NUM_DEC_STAGES, perf) : NULL;
     
     fseek(infile, 0, SEEK_END);
     int input_file_size = ftell(infile);
     fseek(infile, 0, SEEK_SET);
-    
-    initbits_dec(infile, &stream);
-
-    decoder_info.stream = &stream;
 
-    memset(&decoder_info.bit_count,0,sizeof(bit_count_t));
+    dec = thor_decoder_create(timer, threads);
+    frame_writer_t *writer = create_frame_writer(OUTPUT_QUEUE_SIZE, release_frame, dec);
 
-    int bit_start = stream.bitcnt;
-    /* Read sequence header */
+    bit_count_t prev_bit_count;
+    long long stats_bits[NUM_FRAME_TYPES] = {0};
+    double stats_time[NUM_FRAME_TYPES] = {0};
+    double frame_start = 0;
+    if (statsfile)
+      fprintf(statsfile, "{\"frames\":[");
 
-    read_sequence_header(&decoder_info, &stream);
-    width = decoder_info.width;
-    height = decoder_info.height;
-    if (decoder_info.qmtx) {
-      alloc_wmatrices(decoder_info.iwmatrix, 1);
-    }
-
-    decoder_info.bit_count.sequence_header += (stream.bitcnt - bit_start);
-
-    for (r=0;r<MAX_REORDER_BUFFER+1;r++){
-      TEMPLATE(create_yuv_frame)(&rec[r],width,height,decoder_info.subsample,0,0,decoder_info.bitdepth,decoder_info.input_bitdepth);
-    }
-    for (r=0;r<MAX_REF_FRAMES;r++){
-      TEMPLATE(create_yuv_frame)(&ref[r],width,height,decoder_info.subsample,PADDING_Y,PADDING_Y,decoder_info.bitdepth,decoder_info.input_bitdepth);
-      decoder_info.ref[r] = &ref[r];
-    }
-    if (decoder_info.interp_ref) {
-      for (r=0;r<MAX_SKIP_FRAMES;r++){
-        decoder_info.interp_frames[r] = malloc(sizeof(yuv_frame_t));
-        TEMPLATE(create_yuv_frame)(decoder_info.interp_frames[r],width,height,decoder_info.subsample,PADDING_Y,PADDING_Y,decoder_info.bitdepth,decoder_info.input_bitdepth);
-      }
-    }
-
-    decoder_info.deblock_data = (deblock_data_t *)malloc((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t));
-
-#if CDEF
-    int nhfb = (height+CDEF_BLOCKSIZE-1)>>CDEF_BLOCKSIZE_LOG2;
-    int nvfb = (width+CDEF_BLOCKSIZE-1)>>CDEF_BLOCKSIZE_LOG2;
-    decoder_info.cdef_enable = 1;
-    decoder_info.cdef = malloc(nhfb * nvfb * sizeof(*decoder_info.cdef));
-#endif
-    if (y4m_output) {
-        fprintf(outfile,
-                "YUV4MPEG2 W%d H%d F%d:1 Ip A%d:%d C",
-                width, height, 30, 1, 1);
-      if (decoder_info.subsample == 400)
-        fprintf(outfile, "mono");
-      else
-        fprintf(outfile, "%d", decoder_info.subsample);
-      if (decoder_info.input_bitdepth > 8)
-        fprintf(outfile, "p%d XYSCSS=%dp%d", decoder_info.input_bitdepth, decoder_info.subsample, decoder_info.input_bitdepth);
-      fprintf(outfile, "\x0a");
-    }
-
-    do
+    while (!done)
     {
-      decoder_info.frame_info.decode_order_frame_num = decode_frame_num;
-      decode_frame(&decoder_info,rec);
-      rec_buffer_idx = decoder_info.frame_info.display_frame_num%MAX_REORDER_BUFFER;
-      rec_available[rec_buffer_idx]=1;
-
-      done = initbits_dec(infile, &stream);
-
-      op_rec_buffer_idx = (last_frame_output+1)%MAX_REORDER_BUFFER;
-      if (rec_available[op_rec_buffer_idx]) {
-        last_frame_output++;
-        if (y4m_output)
-          fprintf(outfile, "FRAME\x0a");
-        TEMPLATE(write_yuv_frame)(&rec[op_rec_buffer_idx],outfile);
-        rec_available[op_rec_buffer_idx] = 0;
+      /* Read units until they make up a whole frame */
+      uint32_t used;
+      while (!(used = thor_decoder_frame_size(dec, buf, buf_size))) {
+        if (!read_unit(infile, &buf, &buf_size, &buf_capacity)) {
+          done = 1;
+          break;
+        }
       }
-      printf("decode_frame_num=%4d display_frame_num=%4d input_file_size=%12d bitcnt=%12d\n",
-          decode_frame_num,decoder_info.frame_info.display_frame_num,input_file_size,stream.bitcnt);
-      decode_frame_num++;
-    }
-    while (!done);
-    // Output the tail
-    int i,j;
-    for (i=1; i<=MAX_REORDER_BUFFER; ++i) {
-      op_rec_buffer_idx=(last_frame_output+i) % MAX_REORDER_BUFFER;
-      if (rec_available[op_rec_buffer_idx]) {
-        if (y4m_output)
-          fprintf(outfile, "FRAME\x0a");
-        TEMPLATE(write_yuv_frame)(&rec[op_rec_buffer_idx],outfile);
-      } else
+      if (done)
         break;
-    }
 
-    bit_count_t bit_count = decoder_info.bit_count;
-    uint32_t tot_bits[NUM_FRAME_TYPES] = {0};
-
-    for (i=0;i<NUM_FRAME_TYPES;i++){
-      tot_bits[i] = bit_count.frame_header[i] +
-                    bit_count.super_mode[i] +
-                    bit_count.intra_mode[i] +
-                    bit_count.mv[i] +
-                    bit_count.skip_idx[i] +
-                    bit_count.coeff_y[i] +
-                    bit_count.coeff_u[i] +
-                    bit_count.coeff_v[i] +
-                    bit_count.cbp[i] +
-                    bit_count.clpf[i];
-    }
-    tot_bits[0] += bit_count.sequence_header;
-    int ni = bit_count.frame_type[0];
-    int np = bit_count.frame_type[1];
-    int nb = bit_count.frame_type[2];
-    if (np==0) np = (1<<30); //Hack to avoid division by zero if there are no P frames
-    if (nb==0) nb = (1<<30); //Hack to avoid division by zero if there are no B frames
-
-    printf("\n\nBIT STATISTICS:\n");
-    printf("Sequence header: %4d\n",bit_count.sequence_header);
-    printf("                           I pictures:           P pictures:           B pictures:\n");
-    printf("                           total    average      total    average      total    average\n");
-    printf("Frame header:          %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.frame_header[0],bit_count.frame_header[0]/ni,bit_count.frame_header[1],bit_count.frame_header[1]/np,bit_count.frame_header[2],bit_count.frame_header[2]/nb);
-    printf("Super mode:            %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.super_mode[0],bit_count.super_mode[0]/ni,bit_count.super_mode[1],bit_count.super_mode[1]/np,bit_count.super_mode[2],bit_count.super_mode[2]/nb);
-    printf("Intra mode:            %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.intra_mode[0],bit_count.intra_mode[0]/ni,bit_count.intra_mode[1],bit_count.intra_mode[1]/np, bit_count.intra_mode[2],bit_count.intra_mode[2]/nb);
-    printf("MV:                    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mv[0],bit_count.mv[0],bit_count.mv[1],bit_count.mv[1]/np, bit_count.mv[2],bit_count.mv[2]/nb);
-    printf("Skip idx:              %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.skip_idx[0],bit_count.skip_idx[0],bit_count.skip_idx[1],bit_count.skip_idx[1]/np,bit_count.skip_idx[2],bit_count.skip_idx[2]/nb);
-    printf("Coeff_y:               %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.coeff_y[0],bit_count.coeff_y[0]/ni,bit_count.coeff_y[1],bit_count.coeff_y[1]/np,bit_count.coeff_y[2],bit_count.coeff_y[2]/nb);
-    printf("Coeff_u:               %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.coeff_u[0],bit_count.coeff_u[0]/ni,bit_count.coeff_u[1],bit_count.coeff_u[1]/np,bit_count.coeff_u[2],bit_count.coeff_u[2]/nb);
-    printf("Coeff_v:               %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.coeff_v[0],bit_count.coeff_v[0]/ni,bit_count.coeff_v[1],bit_count.coeff_v[1]/np,bit_count.coeff_v[2],bit_count.coeff_v[2]/nb);
-    printf("CBP (TU-split):        %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.cbp[0],bit_count.cbp[0]/ni,bit_count.cbp[1],bit_count.cbp[1]/np,bit_count.cbp[2],bit_count.cbp[2]/nb);
-    printf("CLPF:                  %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.clpf[0],bit_count.clpf[0]/ni,bit_count.clpf[1],bit_count.clpf[1]/np,bit_count.clpf[2],bit_count.clpf[2]/nb);
-    printf("Total:                 %9d  %9d  %9d  %9d  %9d  %9d\n",tot_bits[0],tot_bits[0],tot_bits[1],tot_bits[1]/np,tot_bits[2],tot_bits[2]/nb);
-    printf("---------------------------------------------------------------------------------------\n\n");
-
-    printf("PARAMETER STATISTICS:\n");
-    printf("                           I pictures:           P pictures:           B pictures:\n");
-    printf("                           total    average      total    average      total    average\n");
-    printf("Skip-blocks (8x8):     %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][0],bit_count.mode[0][0]/ni,bit_count.mode[1][0],bit_count.mode[1][0]/np,bit_count.mode[2][0],bit_count.mode[2][0]/nb);
-    printf("Intra-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][1],bit_count.mode[0][1]/ni,bit_count.mode[1][1],bit_count.mode[1][1]/np,bit_count.mode[2][1],bit_count.mode[2][1]/nb);
-    printf("Inter-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][2],bit_count.mode[0][2]/ni,bit_count.mode[1][2],bit_count.mode[1][2]/np,bit_count.mode[2][2],bit_count.mode[2][2]/nb);
-    printf("Bipred-blocks (8x8):   %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][3],bit_count.mode[0][3]/ni,bit_count.mode[1][3],bit_count.mode[1][3]/np,bit_count.mode[2][3],bit_count.mode[2][3]/nb);
-    printf("Merge-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.mode[0][4],bit_count.mode[0][4]/ni,bit_count.mode[1][4],bit_count.mode[1][4]/np,bit_count.mode[2][4],bit_count.mode[2][4]/nb);
-
-    printf("\n");
-    printf("8x8-blocks (8x8):      %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][0],bit_count.size[0][0]/ni,bit_count.size[1][0],bit_count.size[1][0]/np,bit_count.size[2][0],bit_count.size[2][0]/nb);
-    printf("16x16-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][1],bit_count.size[0][1]/ni,bit_count.size[1][1],bit_count.size[1][1]/np,bit_count.size[2][1],bit_count.size[2][1]/nb);
-    printf("32x32-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][2],bit_count.size[0][2]/ni,bit_count.size[1][2],bit_count.size[1][2]/np,bit_count.size[2][2],bit_count.size[2][2]/nb);
-    printf("64x64-blocks (8x8):    %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][3],bit_count.size[0][3]/ni,bit_count.size[1][3],bit_count.size[1][3]/np,bit_count.size[2][3],bit_count.size[2][3]/nb);
-    printf("128x128-blocks (8x8):  %9d  %9d  %9d  %9d  %9d  %9d\n",bit_count.size[0][4],bit_count.size[0][4]/ni,bit_count.size[1][4],bit_count.size[1][4]/np,bit_count.size[2][4],bit_count.size[2][4]/nb);
-
-    printf("\n");
-    printf("Mode and size distribution for P pictures:\n");
-    printf("                            SKIP      INTRA      INTER     BIPRED      MERGE\n");
-    printf("8x8-blocks (8x8):      %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][0][0],bit_count.size_and_mode[P_FRAME][0][1],bit_count.size_and_mode[P_FRAME][0][2],bit_count.size_and_mode[P_FRAME][0][3],bit_count.size_and_mode[P_FRAME][0][4]);
-    printf("16x16-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][1][0],bit_count.size_and_mode[P_FRAME][1][1],bit_count.size_and_mode[P_FRAME][1][2],bit_count.size_and_mode[P_FRAME][1][3],bit_count.size_and_mode[P_FRAME][1][4]);
-    printf("32x32-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][2][0],bit_count.size_and_mode[P_FRAME][2][1],bit_count.size_and_mode[P_FRAME][2][2],bit_count.size_and_mode[P_FRAME][2][3],bit_count.size_and_mode[P_FRAME][2][4]);
-    printf("64x64-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][3][0],bit_count.size_and_mode[P_FRAME][3][1],bit_count.size_and_mode[P_FRAME][3][2],bit_count.size_and_mode[P_FRAME][3][3],bit_count.size_and_mode[P_FRAME][3][4]);
-    printf("128x128-blocks (8x8):  %9d  %9d  %9d  %9d  %9d\n",bit_count.size_and_mode[P_FRAME][4][0],bit_count.size_and_mode[P_FRAME][4][1],bit_count.size_and_mode[P_FRAME][4][2],bit_count.size_and_mode[P_FRAME][4][3],bit_count.size_and_mode[P_FRAME][4][4]);
-
-
-    printf("\n");
-    printf("Mode and size distribution for B pictures:\n");
-    printf("                            SKIP      INTRA      INTER     BIPRED      MERGE\n");
-    printf("8x8-blocks (8x8):      %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][0][0], bit_count.size_and_mode[B_FRAME][0][1], bit_count.size_and_mode[B_FRAME][0][2], bit_count.size_and_mode[B_FRAME][0][3], bit_count.size_and_mode[B_FRAME][0][4]);
-    printf("16x16-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][1][0], bit_count.size_and_mode[B_FRAME][1][1], bit_count.size_and_mode[B_FRAME][1][2], bit_count.size_and_mode[B_FRAME][1][3], bit_count.size_and_mode[B_FRAME][1][4]);
-    printf("32x32-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][2][0], bit_count.size_and_mode[B_FRAME][2][1], bit_count.size_and_mode[B_FRAME][2][2], bit_count.size_and_mode[B_FRAME][2][3], bit_count.size_and_mode[B_FRAME][2][4]);
-    printf("64x64-blocks (8x8):    %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][3][0], bit_count.size_and_mode[B_FRAME][3][1], bit_count.size_and_mode[B_FRAME][3][2], bit_count.size_and_mode[B_FRAME][3][3], bit_count.size_and_mode[B_FRAME][3][4]);
-    printf("128x128-blocks (8x8):  %9d  %9d  %9d  %9d  %9d\n", bit_count.size_and_mode[B_FRAME][4][0], bit_count.size_and_mode[B_FRAME][4][1], bit_count.size_and_mode[B_FRAME][4][2], bit_count.size_and_mode[B_FRAME][4][3], bit_count.size_and_mode[B_FRAME][4][4]);
-
-    int idx;
-    int num = 5 + decoder_info.max_num_ref;
-    printf("\nSuper-mode distribution for P pictures:\n");
-    printf("                    SKIP   SPLIT INTERr0   MERGE   BIPRED  INTRA ");
-    for (i = 1; i < decoder_info.max_num_ref; i++) printf("INTERr%1d ", i);
-    printf("\n");
-    for (idx=0;idx<NUM_BLOCK_SIZES;idx++){
-      int size = 8<<idx;
-      printf("%3d x %3d-blocks: ",size,size);
-      for (i=0;i<num;i++){
-        printf("%8d",bit_count.super_mode_stat[P_FRAME][idx][i]);
+      if (timer)
+        stage_frame_begin(timer);
+      if (statsfile) {
+        if (decoder_info)
+          prev_bit_count = decoder_info->bit_count;
+        else
+          memset(&prev_bit_count, 0, sizeof(prev_bit_count));
+        frame_start = get_wall_time();
       }
-      printf("\n");
-    }
-   
-    printf("\nSuper-mode distribution for B pictures:\n");
-    printf("                    SKIP   SPLIT INTERr0   MERGE   BIPRED  INTRA ");
-    for (i = 1; i < decoder_info.max_num_ref; i++) printf("INTERr%1d ", i);
-    printf("\n");
-    for (idx = 0; idx<NUM_BLOCK_SIZES; idx++) {
-      int size = 8 << idx;
-      printf("%3d x %3d-blocks: ", size, size);
-      for (i = 0; i<num; i++) {
-        printf("%8d", bit_count.super_mode_stat[B_FRAME][idx][i]);
+      thor_decoder_decode(dec, buf, buf_size);
+      buf_size -= used;
+      memmove(buf, buf + used, buf_size);
+      int frame_bits = thor_decoder_frame_bits(dec);
+
+      if (!decoder_info) {
+        decoder_info = thor_decoder_info(dec);
+        if (y4m_output) {
+          char header[128];
+          int len = sprintf(header, "YUV4MPEG2 W%d H%d F%d:1 Ip A%d:%d C",
+                            decoder_info->width, decoder_info->height, 30, 1, 1);
+          if (decoder_info->subsample == 400)
+            len += sprintf(header + len, "mono");
+          else
+            len += sprintf(header + len, "%d", decoder_info->subsample);
+          if (decoder_info->input_bitdepth > 8)
+            len += sprintf(header + len, "p%d XYSCSS=%dp%d", decoder_info->input_bitdepth, decoder_info->subsample, decoder_info->input_bitdepth);
+          len += sprintf(header + len, "\x0a");
+          queue_write_data(writer, outfile, header, len);
+        }
       }
-      printf("\n");
-    }
 
-    int size;
-    int max_num_ref = 4;
-    printf("\n");
-    printf("Ref_idx and size distribution for P pictures:\n");
-    for (i=0;i<NUM_BLOCK_SIZES;i++){
-      size = 1<<(i+3);
-      printf("%3d x %3d-blocks: ",size,size);
-      for (j=0;j<decoder_info.max_num_ref;j++){
-        printf("%6d",bit_count.size_and_ref_idx[P_FRAME][i][j]);
+      if (statsfile) {
+        double frame_time = get_wall_time() - frame_start;
+        int t = decoder_info->bit_count.stat_frame_type;
+        fprintf(statsfile, "%s\n{\"decode_frame\":%d,\"display_frame\":%d,\"type\":\"%c\",\"qp\":%d,\"bits\":%d,\"decode_ms\":%.3f,",
+                decode_frame_num ? "," : "", decode_frame_num, decoder_info->frame_info.display_frame_num, "IPB"[t],
+                decoder_info->frame_info.frame_qp, frame_bits, 1000*frame_time);
+        write_stats_counts(statsfile, &decoder_info->bit_count, &prev_bit_count, t);
+        fprintf(statsfile, "}");
+        stats_bits[t] += frame_bits;
+        stats_time[t] += frame_time;
       }
-      printf("\n");
-    }
 
-    printf("\n");
-    printf("Ref_idx and size distribution for B pictures:\n");
-    for (i = 0; i<NUM_BLOCK_SIZES; i++) {
-      size = 1 << (i + 3);
-      printf("%3d x %3d-blocks: ", size, size);
-      for (j = 0; j<decoder_info.max_num_ref; j++) {
-        printf("%6d", bit_count.size_and_ref_idx[B_FRAME][i][j]);
+      while ((frame = thor_decoder_get_frame(dec))) {
+        write_frame(decoder_info, dec, frame, writer, outfile, y4m_output);
       }
-      printf("\n");
-    }
-    printf("\n");
-    printf("bi-ref-P:  ");
-    for (j=0;j<max_num_ref*max_num_ref;j++){
-      printf("%7d",bit_count.bi_ref[P_FRAME][j]);
-    }
-    printf("\n");
-    printf("bi-ref-B:  ");
-    for (j = 0; j<max_num_ref*max_num_ref; j++) {
-      printf("%7d", bit_count.bi_ref[B_FRAME][j]);
-    }
-    printf("\n");
-    printf("-----------------------------------------------------------------\n");
-    for (r=0;r<MAX_REORDER_BUFFER+1;r++){
-      TEMPLATE(close_yuv_frame)(&rec[r]);
+      if (timer)
+        stage_frame_end(timer, decoder_info->frame_info.display_frame_num, decoder_info->bit_count.stat_frame_type, frame_bits);
+      if (!quiet) {
+        printf("decode_frame_num=%4d display_frame_num=%4d input_file_size=%12d bitcnt=%12d\n",
+            decode_frame_num,decoder_info->frame_info.display_frame_num,input_file_size,frame_bits);
+        fflush(stdout);
+      }
+      decode_frame_num++;
     }
-    for (r=0;r<MAX_REF_FRAMES;r++){
-      TEMPLATE(close_yuv_frame)(&ref[r]);
+    // Output the tail
+    thor_decoder_flush(dec);
+    while ((frame = thor_decoder_get_frame(dec))) {
+      write_frame(decoder_info, dec, frame, writer, outfile, y4m_output);
     }
-    if (decoder_info.interp_ref) {
-      for (r=0;r<MAX_SKIP_FRAMES;r++){
-        TEMPLATE(close_yuv_frame)(decoder_info.interp_frames[r]);
-        free(decoder_info.interp_frames[r]);
+    close_frame_writer(writer);
+    if (!decoder_info)
+      rferror("No frames in the bitstream.");
+
+    if (statsfile) {
+      int i;
+      fprintf(statsfile, "\n],\n\"sequence_header_bits\":%u,\n\"types\":{", decoder_info->bit_count.sequence_header);
+      for (i = 0; i < NUM_FRAME_TYPES; i++) {
+        fprintf(statsfile, "%s\n\"%c\":{\"frames\":%u,\"bits\":%lld,\"decode_ms\":%.3f,",
+                i ? "," : "", "IPB"[i], decoder_info->bit_count.frame_type[i], stats_bits[i], 1000*stats_time[i]);
+        write_stats_counts(statsfile, &decoder_info->bit_count, NULL, i);
+        fprintf(statsfile, "}");
       }
+      fprintf(statsfile, "\n}}\n");
+      if (statsfile != stdout)
+        fclose(statsfile);
+      else
+        fflush(stdout);
     }
 
-    free(decoder_info.deblock_data);
-#if CDEF
-    free(decoder_info.cdef);
-#endif
+    if (!quiet)
+      print_bit_statistics(decoder_info);
+
+    thor_decoder_close(dec);
+    free(buf);
     if (infile)
       fclose(infile);
     if (outfile)
       fclose(outfile);
+    if (timer)
+      close_stage_timer(timer);
 
     return 0;
 }
@@ -30,12 +30,31 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include "getbits.h"
 #include "types.h"
+#include "timer.h"
+
+struct thor_workers;
+struct interp_state;
+
+/* Stages reported by -timing */
+typedef enum {
+  DEC_STAGE_HEADER,
+  DEC_STAGE_INTERP,
+  DEC_STAGE_PARSE,
+  DEC_STAGE_RECONSTRUCT,
+  DEC_STAGE_DEBLOCK,
+  DEC_STAGE_CDEF,
+  DEC_STAGE_CLPF,
+  DEC_STAGE_REFERENCE,
+  DEC_STAGE_OUTPUT,
+  NUM_DEC_STAGES
+} dec_stage_t;
 
 typedef struct 
 {
   frame_type_t frame_type;
   uint8_t qp;
   uint8_t qpb; //TODO: Move to some structure at 64x64 level
+  uint8_t frame_qp; // QP signalled in the frame header
   int num_ref;
   int ref_array[MAX_REF_FRAMES];
   int num_intra_modes;
@@ -43,6 +62,7 @@ typedef struct
   int display_frame_num;
   int interp_ref;
   int phase;
+  int non_ref;
 } frame_info_t;
 
 typedef struct
@@ -62,9 +82,9 @@ typedef struct
 {
   frame_info_t frame_info;
   yuv_frame_t *rec;
-  yuv_frame_t *tmp;
   yuv_frame_t *ref[MAX_REF_FRAMES];
   yuv_frame_t *interp_frames[MAX_SKIP_FRAMES];
+  struct interp_state *interp_state; // Rows of interp_frames[0] not yet synthesised
   stream_t *stream;
   deblock_data_t *deblock_data;
   int width;
@@ -96,6 +116,9 @@ typedef struct
   int cfl_intra;
   int bitdepth;
   int input_bitdepth;
+  int sb_rows_per_unit;
+  stage_timer_t *timer;
+  struct thor_workers *workers;
   qmtx_t *iwmatrix[NUM_QM_LEVELS][3][2][TR_SIZE_RANGE];
 #if CDEF
   cdef_strengths *cdef;
@@ -105,4 +128,6 @@ typedef struct
 #endif
 } decoder_info_t;
 
+void rferror(char error_text[]);
+
 #endif
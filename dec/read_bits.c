@@ -41,8 +41,6 @@ extern int zigzag16[16];
 extern int zigzag64[64];
 extern int zigzag256[256];
 
-int YPOS, XPOS;
-
 #undef TEMPLATE
 #define TEMPLATE(func) (decoder_info->bitdepth == 8 ? func ## _lbd : func ## _hbd)
 
@@ -79,7 +77,26 @@ void read_sequence_header(decoder_info_t *decoder_info, stream_t *stream) {
   decoder_info->input_bitdepth = get_flc(1, stream) ? 10 : 8;
   if (decoder_info->input_bitdepth == 10)
     decoder_info->input_bitdepth += 2 * get_flc(1, stream);
+  decoder_info->sb_rows_per_unit = get_flc(1, stream) ? get_flc(6, stream) + 1 : 0;
+}
+
+#if CDEF
+void read_cdef_params(decoder_info_t *dec_info, stream_t *stream) {
+  dec_info->cdef_damping[1] = dec_info->cdef_damping[0] = get_flc(2, stream) + 3;
+  dec_info->cdef_bits = get_flc(2, stream);
+
+  for (int i = 0; i < (1 << dec_info->cdef_bits); i++) {
+    dec_info->cdef_presets[i].pri_strength[0] = get_flc(4, stream);
+    dec_info->cdef_presets[i].skip_condition[0] = get_flc(1, stream);
+    dec_info->cdef_presets[i].sec_strength[0] = get_flc(2, stream);
+    if (dec_info->subsample != 400) {
+      dec_info->cdef_presets[i].pri_strength[1] = get_flc(4, stream);
+      dec_info->cdef_presets[i].skip_condition[1] = get_flc(1, stream);
+      dec_info->cdef_presets[i].sec_strength[1] = get_flc(2, stream);
+    }
+  }
 }
+#endif
 
 void read_frame_header(decoder_info_t *dec_info, stream_t *stream) {
   frame_info_t *frame_info = &dec_info->frame_info;
@@ -100,21 +117,12 @@ void read_frame_header(decoder_info_t *dec_info, stream_t *stream) {
     frame_info->num_ref = 0;
   }
   frame_info->display_frame_num = get_flc(16, stream);
+  frame_info->non_ref = frame_info->frame_type != I_FRAME ? get_flc(1, stream) : 0;
 
 #if CDEF
-  dec_info->cdef_damping[1] = dec_info->cdef_damping[0] = get_flc(2, stream) + 3;
-  dec_info->cdef_bits = get_flc(2, stream);
-
-  for (int i = 0; i < (1 << dec_info->cdef_bits); i++) {
-    dec_info->cdef_presets[i].pri_strength[0] = get_flc(4, stream);
-    dec_info->cdef_presets[i].skip_condition[0] = get_flc(1, stream);
-    dec_info->cdef_presets[i].sec_strength[0] = get_flc(2, stream);
-    if (dec_info->subsample != 400) {
-      dec_info->cdef_presets[i].pri_strength[1] = get_flc(4, stream);
-      dec_info->cdef_presets[i].skip_condition[1] = get_flc(1, stream);
-      dec_info->cdef_presets[i].sec_strength[1] = get_flc(2, stream);
-    }
-  }
+  // In low-delay mode the CDEF parameters follow the SB rows
+  if (!dec_info->sb_rows_per_unit)
+    read_cdef_params(dec_info, stream);
 #endif
 }
 
@@ -263,9 +271,6 @@ int read_block(decoder_info_t *decoder_info,stream_t *stream,block_info_dec_t *b
   int ypos = block_info->block_pos.ypos;
   int xpos = block_info->block_pos.xpos;
 
-  YPOS = ypos;
-  XPOS = xpos;
-
   int sizeY = size;
   int sizeC = size>>block_info->sub;
 
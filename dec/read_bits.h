@@ -37,6 +37,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 void read_sequence_header(decoder_info_t *decoder_info, stream_t *stream);
 void read_frame_header(decoder_info_t *decoder_info, stream_t *stream);
+#if CDEF
+void read_cdef_params(decoder_info_t *decoder_info, stream_t *stream);
+#endif
 int read_delta_qp(stream_t *stream);
 void read_mv(stream_t *stream,mv_t *mv,mv_t *mvp);
 void read_coeff(stream_t *stream,int16_t *coeff,int size);
@@ -0,0 +1,288 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "global.h"
+#include "thordec.h"
+#include "decode_frame.h"
+#include "common_frame.h"
+#include "../common/simd.h"
+#include "wt_matrix.h"
+#include "read_bits.h"
+#include "thread.h"
+
+typedef enum {
+  FRAME_FREE,
+  FRAME_DECODED,                 //Waiting to be returned in display order
+  FRAME_OUTPUT                   //Held by the application
+} frame_state_t;
+
+typedef struct
+{
+  yuv_frame_t frame;
+  frame_state_t state;
+} pool_frame_t;
+
+struct thor_decoder
+{
+  decoder_info_t decoder_info;
+  int initialized;               //Sequence header read and buffers allocated
+  stream_t stream;
+  yuv_frame_t ref[MAX_REF_FRAMES];
+  int decode_frame_num;
+  int frame_bits;
+
+  /* Decoded frames, allocated as needed. The frames do not move, since
+     pointers to them are handed out. */
+  pool_frame_t **pool;
+  int pool_size;
+  int next_output;               //Display order number of the next frame to return
+  int flushing;
+};
+
+void rferror(char error_text[])
+{
+    fprintf(stderr,"Run-time error...\n");
+    fprintf(stderr,"%s\n",error_text);
+    fprintf(stderr,"...now exiting to system...\n");
+    exit(1);
+}
+
+#undef TEMPLATE
+#define TEMPLATE(func) (decoder_info->bitdepth == 8 ? func ## _lbd : func ## _hbd)
+
+/* Allocate the buffers once the sequence header has been read */
+static void init_decoder(thor_decoder_t *dec)
+{
+  decoder_info_t *decoder_info = &dec->decoder_info;
+  int width = decoder_info->width;
+  int height = decoder_info->height;
+  int r;
+
+  if (decoder_info->qmtx) {
+    alloc_wmatrices(decoder_info->iwmatrix, 1);
+  }
+
+  for (r=0;r<MAX_REF_FRAMES;r++){
+    TEMPLATE(create_yuv_frame)(&dec->ref[r],width,height,decoder_info->subsample,PADDING_Y,PADDING_Y,decoder_info->bitdepth,decoder_info->input_bitdepth);
+    decoder_info->ref[r] = &dec->ref[r];
+  }
+  if (decoder_info->interp_ref) {
+    for (r=0;r<MAX_SKIP_FRAMES;r++){
+      decoder_info->interp_frames[r] = malloc(sizeof(yuv_frame_t));
+      TEMPLATE(create_yuv_frame)(decoder_info->interp_frames[r],width,height,decoder_info->subsample,PADDING_Y,PADDING_Y,decoder_info->bitdepth,decoder_info->input_bitdepth);
+    }
+  }
+
+  decoder_info->deblock_data = (deblock_data_t *)malloc((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t));
+
+#if CDEF
+  int nhfb = (height+CDEF_BLOCKSIZE-1)>>CDEF_BLOCKSIZE_LOG2;
+  int nvfb = (width+CDEF_BLOCKSIZE-1)>>CDEF_BLOCKSIZE_LOG2;
+  decoder_info->cdef_enable = 1;
+  decoder_info->cdef = malloc(nhfb * nvfb * sizeof(*decoder_info->cdef));
+#endif
+
+  dec->initialized = 1;
+}
+
+/* Return a frame not in use, adding one to the pool if needed */
+static yuv_frame_t *get_free_frame(thor_decoder_t *dec)
+{
+  decoder_info_t *decoder_info = &dec->decoder_info;
+  int i;
+
+  for (i = 0; i < dec->pool_size; i++) {
+    if (dec->pool[i]->state == FRAME_FREE)
+      return &dec->pool[i]->frame;
+  }
+
+  dec->pool = realloc(dec->pool, (dec->pool_size + 1) * sizeof(*dec->pool));
+  if (!dec->pool || !(dec->pool[dec->pool_size] = malloc(sizeof(pool_frame_t))))
+    rferror("Could not allocate frame.");
+  pool_frame_t *entry = dec->pool[dec->pool_size++];
+  TEMPLATE(create_yuv_frame)(&entry->frame,decoder_info->width,decoder_info->height,decoder_info->subsample,0,0,decoder_info->bitdepth,decoder_info->input_bitdepth);
+  entry->state = FRAME_FREE;
+  return &entry->frame;
+}
+
+static pool_frame_t *find_pool_frame(thor_decoder_t *dec, const yuv_frame_t *frame)
+{
+  int i;
+  for (i = 0; i < dec->pool_size; i++) {
+    if (&dec->pool[i]->frame == frame)
+      return dec->pool[i];
+  }
+  return NULL;
+}
+
+thor_decoder_t *thor_decoder_create(stage_timer_t *timer, int threads)
+{
+  thor_decoder_t *dec = calloc(1, sizeof(thor_decoder_t));
+  if (!dec)
+    rferror("Could not allocate decoder.");
+
+  init_use_simd();
+
+  dec->decoder_info.timer = timer;
+  dec->decoder_info.stream = &dec->stream;
+  dec->decoder_info.workers = thor_workers_create(threads ? threads : min(thor_num_cpus(), MAX_THREADS));
+  return dec;
+}
+
+void thor_decoder_close(thor_decoder_t *dec)
+{
+  decoder_info_t *decoder_info = &dec->decoder_info;
+  int r;
+
+  for (r = 0; r < dec->pool_size; r++) {
+    TEMPLATE(close_yuv_frame)(&dec->pool[r]->frame);
+    free(dec->pool[r]);
+  }
+  free(dec->pool);
+  if (dec->initialized) {
+    for (r=0;r<MAX_REF_FRAMES;r++){
+      TEMPLATE(close_yuv_frame)(&dec->ref[r]);
+    }
+    if (decoder_info->interp_ref) {
+      for (r=0;r<MAX_SKIP_FRAMES;r++){
+        TEMPLATE(close_yuv_frame)(decoder_info->interp_frames[r]);
+        free(decoder_info->interp_frames[r]);
+      }
+    }
+    free(decoder_info->deblock_data);
+#if CDEF
+    free(decoder_info->cdef);
+#endif
+  }
+  thor_workers_close(decoder_info->workers);
+  free(dec);
+}
+
+uint32_t thor_decoder_frame_size(thor_decoder_t *dec, const uint8_t *data, uint32_t size)
+{
+  decoder_info_t *decoder_info = &dec->decoder_info;
+  const uint8_t *end = data + size;
+  stream_t stream;
+  int num_units = 1;
+
+  if (initbits_dec(data, end, &stream))
+    return 0;
+
+  /* The sequence header gives the number of units per frame */
+  if (!dec->initialized)
+    read_sequence_header(decoder_info, &stream);
+  if (decoder_info->sb_rows_per_unit) {
+    int sb_size = 1 << decoder_info->log2_sb_size;
+    int num_sb_ver = (decoder_info->height + sb_size - 1) / sb_size;
+    /* A unit per group of SB rows followed by one for the loop filters */
+    num_units = (num_sb_ver + decoder_info->sb_rows_per_unit - 1) / decoder_info->sb_rows_per_unit + 1;
+  }
+
+  while (--num_units) {
+    if (next_unit_dec(&stream))
+      return 0;
+  }
+  return (uint32_t)(stream.data + stream.length - data);
+}
+
+uint32_t thor_decoder_decode(thor_decoder_t *dec, const uint8_t *data, uint32_t size)
+{
+  decoder_info_t *decoder_info = &dec->decoder_info;
+  stream_t *stream = &dec->stream;
+  uint32_t frame_size = thor_decoder_frame_size(dec, data, size);
+
+  if (!frame_size)
+    return 0;
+
+  initbits_dec(data, data + frame_size, stream);
+  if (!dec->initialized) {
+    int bit_start = stream->bitcnt;
+    read_sequence_header(decoder_info, stream);
+    decoder_info->bit_count.sequence_header += (stream->bitcnt - bit_start);
+    init_decoder(dec);
+  }
+
+  decoder_info->frame_info.decode_order_frame_num = dec->decode_frame_num++;
+  decoder_info->rec = get_free_frame(dec);
+  decode_frame(decoder_info);
+  find_pool_frame(dec, decoder_info->rec)->state = FRAME_DECODED;
+  dec->frame_bits = stream->bitcnt;
+
+  return frame_size;
+}
+
+void thor_decoder_flush(thor_decoder_t *dec)
+{
+  dec->flushing = 1;
+}
+
+const yuv_frame_t *thor_decoder_get_frame(thor_decoder_t *dec)
+{
+  pool_frame_t *next = NULL;
+  int i;
+
+  /* At the end of the stream take the first remaining frame in display order */
+  for (i = 0; i < dec->pool_size; i++) {
+    pool_frame_t *entry = dec->pool[i];
+    if (entry->state != FRAME_DECODED)
+      continue;
+    if (entry->frame.frame_num == dec->next_output) {
+      next = entry;
+      break;
+    }
+    if (dec->flushing && (!next || entry->frame.frame_num < next->frame.frame_num))
+      next = entry;
+  }
+  if (!next)
+    return NULL;
+
+  next->state = FRAME_OUTPUT;
+  dec->next_output = next->frame.frame_num + 1;
+  return &next->frame;
+}
+
+void thor_decoder_release_frame(thor_decoder_t *dec, const yuv_frame_t *frame)
+{
+  pool_frame_t *entry = find_pool_frame(dec, frame);
+  if (!entry || entry->state != FRAME_OUTPUT)
+    rferror("Released a frame not returned by thor_decoder_get_frame().");
+  entry->state = FRAME_FREE;
+}
+
+const decoder_info_t *thor_decoder_info(const thor_decoder_t *dec)
+{
+  return dec->initialized ? &dec->decoder_info : NULL;
+}
+
+int thor_decoder_frame_bits(const thor_decoder_t *dec)
+{
+  return dec->frame_bits;
+}
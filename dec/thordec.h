@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_THORDEC_H_)
+#define _THORDEC_H_
+
+#include <stdint.h>
+#include "maindec.h"
+
+/* Decoder library interface. Coded frames are passed in decoding order and
+   decoded frames are returned in display order. All state is kept in the
+   decoder handle, so several decoders may be used in one process, each from
+   one thread at a time. */
+
+typedef struct thor_decoder thor_decoder_t;
+
+/* timer may be NULL, otherwise the decoding stages are timed. threads is the
+   number of worker threads for the temporal interpolation and the loop
+   filters, 0 for one per processor. */
+thor_decoder_t *thor_decoder_create(stage_timer_t *timer, int threads);
+void thor_decoder_close(thor_decoder_t *dec);
+
+/* Return the number of bytes of a coded frame at the start of data, i.e. its
+   length-prefixed units as stored in a Thor bitstream file, or 0 if data does
+   not hold the whole frame yet. */
+uint32_t thor_decoder_frame_size(thor_decoder_t *dec, const uint8_t *data, uint32_t size);
+
+/* Decode the coded frame at the start of data. Returns the number of bytes
+   used, or 0 if data does not hold the whole frame yet, in which case
+   nothing is decoded. The first frame starts with the sequence header. */
+uint32_t thor_decoder_decode(thor_decoder_t *dec, const uint8_t *data, uint32_t size);
+
+/* Signal the end of the stream, so that the remaining frames are returned
+   even if there is a gap in the display order. */
+void thor_decoder_flush(thor_decoder_t *dec);
+
+/* Return the next decoded frame in display order, or NULL if none is ready.
+   The frame is not copied: it stays valid and unchanged until it is given
+   back with thor_decoder_release_frame(), and any number of frames may be
+   held. */
+const yuv_frame_t *thor_decoder_get_frame(thor_decoder_t *dec);
+void thor_decoder_release_frame(thor_decoder_t *dec, const yuv_frame_t *frame);
+
+/* Sequence parameters, bit statistics and the frame info of the last
+   decoded frame. NULL until the first frame has been decoded. */
+const decoder_info_t *thor_decoder_info(const thor_decoder_t *dec);
+
+/* Bits of the last decoded frame, including the sequence header for the first one */
+int thor_decoder_frame_bits(const thor_decoder_t *dec);
+
+#endif
@@ -256,7 +256,6 @@ SIMD_INLINE v128 calc_delta(v128 x, v128 a, v128 b, v128 c, v128 d, v128 e,
 
 void TEMPLATE(detect_clpf_simd)(const SAMPLE *rec,const SAMPLE *org,int x0, int y0, int width, int height, int ostride, int rstride, int *sum0, int *sum1, unsigned int strength, unsigned int shift, unsigned int size, unsigned int dmp)
 {
-  TEMPLATE(detect_clpf)(rec, org, x0, y0, width, height, ostride, rstride, sum0, sum1, strength, shift, size, dmp);
   const int bottom = height - 2 - y0;
   const int right = width - 8 - x0;
   ssd128_internal ssd0 = v128_ssd_u8_init();
@@ -902,9 +901,78 @@ int calc_cbp_simd(int16_t *block, int size, int threshold) {
     sum = v64_add_16(sum, v64_load_aligned(block+2*size));
     sum = v64_add_16(sum, v64_load_aligned(block+3*size));
     sum = v64_add_32(v64_shr_n_s32(sum, 16),
-                     v64_shr_n_s32(v64_shl_n_32(v128_abs_s16(sum), 16), 16));
-    cbp = v64_high_s32(sum) > threshold || v64_low_s32(sum) > threshold;
+                     v64_shr_n_s32(v64_shl_n_32(sum, 16), 16));
+    cbp = abs(v64_high_s32(sum)) > threshold || abs(v64_low_s32(sum)) > threshold;
   }
   return cbp;
 }
 #endif
+
+#ifndef HBD
+/* Distortion of the CDEF search. The samples are widened to 16 bit, so the
+   low and high bitdepth versions share the code below specialised by the
+   constant hbd argument. */
+
+// 8 samples of a row, or 4 samples of rows 0 and 1 with row 0 in the low half
+SIMD_INLINE v128 cdef_dist_load(const void *p, int stride, int width, int hbd) {
+  if (width == 8)
+    return hbd ? v128_load_unaligned(p) : v128_unpack_u8_s16(v64_load_unaligned(p));
+  return hbd ? v128_from_v64(v64_load_unaligned((const uint16_t *)p + stride), v64_load_unaligned(p)) :
+    v128_unpack_u8_s16(v64_from_32(u32_load_unaligned((const uint8_t *)p + stride), u32_load_unaligned(p)));
+}
+
+SIMD_INLINE const void *cdef_dist_row(const void *p, int idx, int hbd) {
+  return hbd ? (const void *)((const uint16_t *)p + idx) : (const void *)((const uint8_t *)p + idx);
+}
+
+SIMD_INLINE uint64_t cdef_sse_simd(const void *a, int astride, const void *b, int bstride, int width, int height, int hbd) {
+  const int rows = width == 8 ? 1 : 2;
+  v128 sse = v128_zero();
+  for (int i = 0; i < height; i += rows) {
+    v128 d = v128_sub_16(cdef_dist_load(cdef_dist_row(a, i * astride, hbd), astride, width, hbd),
+                         cdef_dist_load(cdef_dist_row(b, i * bstride, hbd), bstride, width, hbd));
+    sse = v128_add_32(sse, v128_madd_s16(d, d));
+  }
+  return (uint32_t)v128_dotp_s32(sse, v128_dup_32(1));
+}
+
+SIMD_INLINE void dist_8x8_sums_simd(const void *dst, int dstride, const void *src, int sstride, uint64_t sums[5], int hbd) {
+  v128 sum_s = v128_zero(), sum_d = v128_zero();
+  v128 sum_s2 = v128_zero(), sum_d2 = v128_zero(), sum_sd = v128_zero();
+  const v128 ones = v128_dup_16(1);
+  for (int i = 0; i < 8; i++) {
+    v128 s = cdef_dist_load(cdef_dist_row(src, i * sstride, hbd), sstride, 8, hbd);
+    v128 d = cdef_dist_load(cdef_dist_row(dst, i * dstride, hbd), dstride, 8, hbd);
+    sum_s = v128_add_16(sum_s, s);
+    sum_d = v128_add_16(sum_d, d);
+    sum_s2 = v128_add_32(sum_s2, v128_madd_s16(s, s));
+    sum_d2 = v128_add_32(sum_d2, v128_madd_s16(d, d));
+    sum_sd = v128_add_32(sum_sd, v128_madd_s16(s, d));
+  }
+  sums[0] = (uint32_t)v128_dotp_s16(sum_s, ones);
+  sums[1] = (uint32_t)v128_dotp_s16(sum_d, ones);
+  sums[2] = (uint32_t)v128_dotp_s32(sum_s2, v128_dup_32(1));
+  sums[3] = (uint32_t)v128_dotp_s32(sum_d2, v128_dup_32(1));
+  sums[4] = (uint32_t)v128_dotp_s32(sum_sd, v128_dup_32(1));
+}
+
+uint64_t cdef_sse_simd_lbd(const uint8_t *a, int astride, const uint8_t *b, int bstride, int width, int height)
+{
+  return cdef_sse_simd(a, astride, b, bstride, width, height, 0);
+}
+
+uint64_t cdef_sse_simd_hbd(const uint16_t *a, int astride, const uint16_t *b, int bstride, int width, int height)
+{
+  return cdef_sse_simd(a, astride, b, bstride, width, height, 1);
+}
+
+void dist_8x8_sums_simd_lbd(const uint8_t *dst, int dstride, const uint8_t *src, int sstride, uint64_t sums[5])
+{
+  dist_8x8_sums_simd(dst, dstride, src, sstride, sums, 0);
+}
+
+void dist_8x8_sums_simd_hbd(const uint16_t *dst, int dstride, const uint16_t *src, int sstride, uint64_t sums[5])
+{
+  dist_8x8_sums_simd(dst, dstride, src, sstride, sums, 1);
+}
+#endif
@@ -36,6 +36,8 @@ void TEMPLATE(detect_multi_clpf_simd)(const SAMPLE *rec,const SAMPLE *org,int x0
 unsigned int TEMPLATE(sad_calc_fasthalf_simd)(const SAMPLE *a, const SAMPLE *b, int astride, int bstride, int width, int height, int *x, int *y);
 unsigned int TEMPLATE(sad_calc_fastquarter_simd)(const SAMPLE *o, const SAMPLE *r, int os, int rs, int width, int height, int *x, int *y);
 unsigned int TEMPLATE(widesad_calc_simd)(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height, int *x);
+uint64_t TEMPLATE(cdef_sse_simd)(const SAMPLE *a, int astride, const SAMPLE *b, int bstride, int width, int height);
+void TEMPLATE(dist_8x8_sums_simd)(const SAMPLE *dst, int dstride, const SAMPLE *src, int sstride, uint64_t sums[5]);
 
 int calc_cbp_simd(int16_t *block, int size, int threshold);
 #endif
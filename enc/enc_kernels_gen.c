@@ -256,7 +256,6 @@ SIMD_INLINE v256 calc_delta(v256 x, v256 a, v256 b, v256 c, v256 d, v256 e,
 
 void TEMPLATE(detect_clpf_simd)(const SAMPLE *rec,const SAMPLE *org,int x0, int y0, int width, int height, int ostride, int rstride, int *sum0, int *sum1, unsigned int strength, unsigned int shift, unsigned int size, unsigned int dmp)
 {
-  TEMPLATE(detect_clpf)(rec, org, x0, y0, width, height, ostride, rstride, sum0, sum1, strength, shift, size, dmp);
   const int bottom = height - 2 - y0;
   const int right = width - 8 - x0;
   ssd256_internal_s16 ssd0 = v256_ssd_s16_init();
@@ -902,9 +901,78 @@ int calc_cbp_simd(int32_t *block, int size, int threshold) {
     sum = v128_add_32(sum, v128_load_aligned(block+2*size));
     sum = v128_add_32(sum, v128_load_aligned(block+3*size));
     sum = v128_add_64(v128_shr_n_s64(sum, 16),
-                     v128_shr_n_s64(v128_shl_n_64(v256_abs_s32(sum), 16), 16));
-    cbp = v128_high_v64(sum) > threshold || v128_low_v64(sum) > threshold;
+                     v128_shr_n_s64(v128_shl_n_64(sum, 16), 16));
+    cbp = abs(v128_high_v64(sum)) > threshold || abs(v128_low_v64(sum)) > threshold;
   }
   return cbp;
 }
 #endif
+
+#ifndef HBD
+/* Distortion of the CDEF search. The samples are widened to 16 bit, so the
+   low and high bitdepth versions share the code below specialised by the
+   constant hbd argument. */
+
+// 8 samples of a row, or 4 samples of rows 0 and 1 with row 0 in the low half
+SIMD_INLINE v256 cdef_dist_load(const void *p, int stride, int width, int hbd) {
+  if (width == 8)
+    return hbd ? v256_load_unaligned(p) : v256_unpack_u16_s32(v128_load_unaligned(p));
+  return hbd ? v256_from_v128(v128_load_unaligned((const uint32_t *)p + stride), v128_load_unaligned(p)) :
+    v256_unpack_u16_s32(v128_from_v64(v64_load_unaligned((const uint8_t *)p + stride), v64_load_unaligned(p)));
+}
+
+SIMD_INLINE const void *cdef_dist_row(const void *p, int idx, int hbd) {
+  return hbd ? (const void *)((const uint32_t *)p + idx) : (const void *)((const uint8_t *)p + idx);
+}
+
+SIMD_INLINE uint64_t cdef_sse_simd(const void *a, int astride, const void *b, int bstride, int width, int height, int hbd) {
+  const int rows = width == 8 ? 1 : 2;
+  v256 sse = v256_zero();
+  for (int i = 0; i < height; i += rows) {
+    v256 d = v256_sub_32(cdef_dist_load(cdef_dist_row(a, i * astride, hbd), astride, width, hbd),
+                         cdef_dist_load(cdef_dist_row(b, i * bstride, hbd), bstride, width, hbd));
+    sse = v256_add_64(sse, v256_madd_s32(d, d));
+  }
+  return (v64)v128_dotp_s32(sse, v256_dup_64(1));
+}
+
+SIMD_INLINE void dist_8x8_sums_simd(const void *dst, int dstride, const void *src, int sstride, uint64_t sums[5], int hbd) {
+  v256 sum_s = v256_zero(), sum_d = v256_zero();
+  v256 sum_s2 = v256_zero(), sum_d2 = v256_zero(), sum_sd = v256_zero();
+  const v256 ones = v256_dup_32(1);
+  for (int i = 0; i < 8; i++) {
+    v256 s = cdef_dist_load(cdef_dist_row(src, i * sstride, hbd), sstride, 8, hbd);
+    v256 d = cdef_dist_load(cdef_dist_row(dst, i * dstride, hbd), dstride, 8, hbd);
+    sum_s = v256_add_32(sum_s, s);
+    sum_d = v256_add_32(sum_d, d);
+    sum_s2 = v256_add_64(sum_s2, v256_madd_s32(s, s));
+    sum_d2 = v256_add_64(sum_d2, v256_madd_s32(d, d));
+    sum_sd = v256_add_64(sum_sd, v256_madd_s32(s, d));
+  }
+  sums[0] = (v64)v256_dotp_s32(sum_s, ones);
+  sums[1] = (v64)v256_dotp_s32(sum_d, ones);
+  sums[2] = (v64)v128_dotp_s32(sum_s2, v256_dup_64(1));
+  sums[3] = (v64)v128_dotp_s32(sum_d2, v256_dup_64(1));
+  sums[4] = (v64)v128_dotp_s32(sum_sd, v256_dup_64(1));
+}
+
+uint64_t cdef_sse_simd_lbd(const uint8_t *a, int astride, const uint8_t *b, int bstride, int width, int height)
+{
+  return cdef_sse_simd(a, astride, b, bstride, width, height, 0);
+}
+
+uint64_t cdef_sse_simd_hbd(const uint32_t *a, int astride, const uint32_t *b, int bstride, int width, int height)
+{
+  return cdef_sse_simd(a, astride, b, bstride, width, height, 1);
+}
+
+void dist_8x8_sums_simd_lbd(const uint8_t *dst, int dstride, const uint8_t *src, int sstride, uint64_t sums[5])
+{
+  dist_8x8_sums_simd(dst, dstride, src, sstride, sums, 0);
+}
+
+void dist_8x8_sums_simd_hbd(const uint32_t *dst, int dstride, const uint32_t *src, int sstride, uint64_t sums[5])
+{
+  dist_8x8_sums_simd(dst, dstride, src, sstride, sums, 1);
+}
+#endif
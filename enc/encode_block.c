@@ -38,6 +38,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "strings.h"
 #include "snr.h"
 #include "mainenc.h"
+#include "encode_block.h"
 #include "write_bits.h"
 #include "putvlc.h"
 #include "transform.h"
@@ -46,8 +47,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "intra_prediction.h"
 #include "enc_kernels.h"
 #include "wt_matrix.h"
-
-int YPOS,XPOS;
+#include "hash_me.h"
+#include "subpel_cache.h"
 
 extern int chroma_qp[52];
 extern int zigzag16[16];
@@ -171,7 +172,7 @@ static void get_residual(int16_t *block, SAMPLE *pblock, SAMPLE *orig, int size,
 
 
 /* Return the best approximated half-pel position around the centre using SIMD friendly averages */
-static unsigned int sad_calc_fasthalf(const SAMPLE *a, const SAMPLE *b, int astride, int bstride, int width, int height, int *x, int *y)
+unsigned int TEMPLATE(sad_calc_fasthalf)(const SAMPLE *a, const SAMPLE *b, int astride, int bstride, int width, int height, int *x, int *y)
 {
   unsigned int tl = 0, tr = 0, br = 0, bl = 0, top = 0, right = 0, down = 0, left = 0;
   int bestx = 0, besty = -2;
@@ -283,7 +284,7 @@ static unsigned int sad_calc_fasthalf(const SAMPLE *a, const SAMPLE *b, int astr
 
 
 /* Return the best approximated quarter-pel position around the centre using SIMD friendly averages */
-static unsigned int sad_calc_fastquarter(const SAMPLE *o, const SAMPLE *r, int os, int rs, int width, int height, int *x, int *y)
+unsigned int TEMPLATE(sad_calc_fastquarter)(const SAMPLE *o, const SAMPLE *r, int os, int rs, int width, int height, int *x, int *y)
 {
   unsigned int tl = 0, tr = 0, br = 0, bl = 0, top = 0, right = 0, down = 0, left = 0;
   int bestx = 0, besty = -1;
@@ -414,7 +415,7 @@ static unsigned int sad_calc_fastquarter(const SAMPLE *o, const SAMPLE *r, int o
   return top;
 }
 
-static unsigned int sad_calc(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height)
+unsigned int TEMPLATE(sad_calc)(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height)
 {
   unsigned int sad = 0;
 
@@ -427,7 +428,7 @@ static unsigned int sad_calc(SAMPLE *a, SAMPLE *b, int astride, int bstride, int
   return sad;
 }
 
-static unsigned int widesad_calc(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height, int *x)
+unsigned int TEMPLATE(widesad_calc)(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height, int *x)
 {
   // Calculate the SAD for five positions x.xXx.x and return the best
   if (use_simd && width == 16 && height == 16) {
@@ -452,7 +453,7 @@ static unsigned int widesad_calc(SAMPLE *a, SAMPLE *b, int astride, int bstride,
   }
 }
 
-static uint64_t ssd_calc(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width,int height)
+uint64_t TEMPLATE(ssd_calc)(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width,int height)
 {
   uint64_t ssd = 0;
   if (use_simd && width > 4 && width==height)
@@ -464,6 +465,24 @@ static uint64_t ssd_calc(SAMPLE *a, SAMPLE *b, int astride, int bstride, int wid
   return ssd;
 }
 
+static inline unsigned int counted_sad(uint64_t *count, SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height)
+{
+  count[COUNT_SAD]++;
+  return TEMPLATE(sad_calc)(a, b, astride, bstride, width, height);
+}
+
+static inline unsigned int counted_widesad(uint64_t *count, SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height, int *x)
+{
+  count[COUNT_WIDESAD]++;
+  return TEMPLATE(widesad_calc)(a, b, astride, bstride, width, height, x);
+}
+
+static inline void counted_subpel(uint64_t *count, SAMPLE *pblock, SAMPLE *ref, int width, int height, int stride, int pstride, mv_t *mv, int sign, int bipred, int pic_width, int pic_height, int xpos, int ypos, int bitdepth)
+{
+  count[COUNT_SUBPEL]++;
+  TEMPLATE(get_inter_prediction_luma)(pblock, ref, width, height, stride, pstride, mv, sign, bipred, pic_width, pic_height, xpos, ypos, bitdepth);
+}
+
 static int quote_mv_bits(int mv_diff_y, int mv_diff_x)
 {
   int bits = 0;
@@ -514,7 +533,7 @@ static int quote_mv_bits(int mv_diff_y, int mv_diff_x)
   return bits;
 }
 
-static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, int width, int height, mv_t *mv, mv_t *mvc, mv_t *mvp, double lambda,enc_params *params, int sign, int fwidth, int fheight, int xpos, int ypos, mv_t *mvcand, int *mvcand_num, int enable_bipred){
+static int motion_estimate(SAMPLE *orig, SAMPLE *ref, subpel_ref_t *subpel_ref, int size, int stride_r, int width, int height, mv_t *mv, mv_t *mvc, mv_t *mvp, double lambda,enc_params *params, int sign, int fwidth, int fheight, int xpos, int ypos, mv_t *mvcand, int *mvcand_num, int enable_bipred, uint64_t *count){
   unsigned int sad;
   uint32_t min_sad;
   SAMPLE *rf = thor_alloc(MAX_SB_SIZE*MAX_SB_SIZE*sizeof(SAMPLE), 32);
@@ -542,10 +561,10 @@ static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, in
           TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, sign);
           if (step == 32 && size == 16 && params->encoder_speed < 2 && params->encoder_speed > 0) {
             int x = 0;
-            sad = widesad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height,&x);
+            sad = counted_widesad(count, orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height,&x);
             mv_cand.x += s*x << 2;
           } else
-            sad = sad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height);
+            sad = counted_sad(count, orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height);
           sad >>= params->bitdepth - 8;
           sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
           if (sad < min_sad){
@@ -567,9 +586,9 @@ static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, in
     mv_cand.x = mvcand[idx].x << 2;
     TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, sign);
     if (size == 16)
-      sad = widesad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height, &x);
+      sad = counted_widesad(count, orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height, &x);
     else
-      sad = sad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height);
+      sad = counted_sad(count, orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height);
     sad >>= params->bitdepth - 8;
     mv_cand.x += s*x << 2;
     sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
@@ -580,7 +599,31 @@ static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, in
   }
   mv_ref = mv_opt;
 
-  int maxsteps = size <= 16 || params->encoder_speed == 0 ? 6 : 0;
+  if (params->encoder_speed > 2) {
+    /* Small diamond search */
+    static const int dmy[] = { -1, 0, 0, 1 };
+    static const int dmx[] = {  0,-1, 1, 0 };
+    for (int step = 0; step < 8; step++) {
+      int best_dir = -1;
+      for (int dir = 0; dir < 4; dir++) {
+        mv_cand.y = mv_ref.y + dmy[dir]*4;
+        mv_cand.x = mv_ref.x + dmx[dir]*4;
+        TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, sign);
+        sad = counted_sad(count, orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height) >> (params->bitdepth - 8);
+        sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
+        if (sad < min_sad){
+          min_sad = sad;
+          mv_opt = mv_cand;
+          best_dir = dir;
+        }
+      }
+      if (best_dir < 0)
+        break;
+      mv_ref = mv_opt;
+    }
+  }
+
+  int maxsteps = params->encoder_speed > 2 ? 0 : size <= 16 || params->encoder_speed == 0 ? 6 : 0;
   int start = 0;
   int end = 5;
 
@@ -598,7 +641,7 @@ static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, in
       mv_cand.x = mv_ref.x + diy[dir]*4;
 
       TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, sign);
-      sad = sad_calc(orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height) >> (params->bitdepth - 8);
+      sad = counted_sad(count, orig,ref + s*(mv_cand.x >> 2) + s*(mv_cand.y >> 2)*stride_r,size,stride_r,width,height) >> (params->bitdepth - 8);
       sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
       if (sad < min_sad){
         min_sad = sad;
@@ -631,8 +674,13 @@ static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, in
 
       mv_cand.y = mv_ref.y + hmpos[i];
       mv_cand.x = mv_ref.x + hnpos[i];
-      TEMPLATE(get_inter_prediction_luma)(rf,ref,width,height,stride_r,width,&mv_cand, sign,enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME: Search 8 half pel positions
-      sad = sad_calc(orig,rf,size,width,width,height) >> (params->bitdepth - 8);
+      SAMPLE *sp = subpel_ref ? TEMPLATE(get_subpel_block)(subpel_ref,ref,width,height,&mv_cand,sign,enable_bipred,xpos,ypos) : NULL;
+      if (sp)
+        sad = counted_sad(count, orig,sp,size,subpel_ref->stride,width,height) >> (params->bitdepth - 8);
+      else {
+        counted_subpel(count, rf,ref,width,height,stride_r,width,&mv_cand, sign,enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME: Search 8 half pel positions
+        sad = counted_sad(count, orig,rf,size,width,width,height) >> (params->bitdepth - 8);
+      }
       sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
 
       if (sad < cmin) {
@@ -652,8 +700,13 @@ static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, in
     for (int i = 1; i <= 8; i++) {
       mv_cand.y = mv_opt.y + qmpos[i];
       mv_cand.x = mv_opt.x + qnpos[i];
-      TEMPLATE(get_inter_prediction_luma)(rf,ref,width,height,stride_r,width,&mv_cand, sign,enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME: Search 8 quarter pel positions
-      sad = sad_calc(orig,rf,size,width,width,height) >> (params->bitdepth - 8);
+      SAMPLE *sp = subpel_ref ? TEMPLATE(get_subpel_block)(subpel_ref,ref,width,height,&mv_cand,sign,enable_bipred,xpos,ypos) : NULL;
+      if (sp)
+        sad = counted_sad(count, orig,sp,size,subpel_ref->stride,width,height) >> (params->bitdepth - 8);
+      else {
+        counted_subpel(count, rf,ref,width,height,stride_r,width,&mv_cand, sign,enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME: Search 8 quarter pel positions
+        sad = counted_sad(count, orig,rf,size,width,width,height) >> (params->bitdepth - 8);
+      }
       sad += (int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
       if (sad < cmin) {
         cmin = sad;
@@ -667,10 +720,11 @@ static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, in
 
     /* Half-pel search */
     int spx, spy;
+    count[COUNT_SAD] += 8;
     if (use_simd && width > 4)
       sad = TEMPLATE(sad_calc_fasthalf_simd)(orig, ref + (mv_ref.x >> 2) + (mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
     else
-      sad = sad_calc_fasthalf(orig, ref + (mv_ref.x >> 2) + (mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
+      sad = TEMPLATE(sad_calc_fasthalf)(orig, ref + (mv_ref.x >> 2) + (mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
     sad >>= params->bitdepth - 8;
     sad += (unsigned int)(lambda * (double)quote_mv_bits(mv_ref.y + s*spy - mvp->y, mv_ref.x + s*spx - mvp->x) + 0.5);
 
@@ -687,18 +741,21 @@ static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, in
     mv_opt.x += xdelta_hp;
     mv_opt.y += ydelta_hp;
 
-    /* Quarter-pel search */
-    if (use_simd && width > 4)
-      sad = TEMPLATE(sad_calc_fastquarter_simd)(orig, ref + s*(mv_ref.x >> 2) + s*(mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
-    else
-      sad = sad_calc_fastquarter(orig, ref + s*(mv_ref.x >> 2) + s*(mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
-    sad >>= params->bitdepth - 8;
-    sad += (int)(lambda * (double)quote_mv_bits(mv_ref.y + s*spy - mvp->y, mv_ref.x + s*spx - mvp->x) + 0.5);
+    /* Quarter-pel search (not for the fastest speed) */
+    if (params->encoder_speed < 4) {
+      count[COUNT_SAD] += 8;
+      if (use_simd && width > 4)
+        sad = TEMPLATE(sad_calc_fastquarter_simd)(orig, ref + s*(mv_ref.x >> 2) + s*(mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
+      else
+        sad = TEMPLATE(sad_calc_fastquarter)(orig, ref + s*(mv_ref.x >> 2) + s*(mv_ref.y >> 2)*stride_r, size, stride_r, width, height, &spx, &spy);
+      sad >>= params->bitdepth - 8;
+      sad += (int)(lambda * (double)quote_mv_bits(mv_ref.y + s*spy - mvp->y, mv_ref.x + s*spx - mvp->x) + 0.5);
 
-    if (sad < cmin) {
-      cmin = sad;
-      xdelta_qp = s*spx;
-      ydelta_qp = s*spy;
+      if (sad < cmin) {
+        cmin = sad;
+        xdelta_qp = s*spx;
+        ydelta_qp = s*spy;
+      }
     }
   }
 
@@ -710,7 +767,7 @@ static int motion_estimate(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, in
   return min(cmin, min_sad);
 }
 
-static int motion_estimate_sync(SAMPLE *orig, SAMPLE *ref, int size, int stride_r, int width, int height, mv_t *mv, mv_t *mvc, mv_t *mvp, double lambda,enc_params *params, int sign, int fwidth, int fheight, int xpos, int ypos, mv_t *mvcand, int *mvcand_num, int enable_bipred){
+static int motion_estimate_sync(SAMPLE *orig, SAMPLE *ref, subpel_ref_t *subpel_ref, int size, int stride_r, int width, int height, mv_t *mv, mv_t *mvc, mv_t *mvp, double lambda,enc_params *params, int sign, int fwidth, int fheight, int xpos, int ypos, mv_t *mvcand, int *mvcand_num, int enable_bipred, uint64_t *count){
   int k,l,range,step;
   uint32_t sad, min_sad;
   SAMPLE *rf = thor_alloc(MAX_SB_SIZE*MAX_SB_SIZE*sizeof(SAMPLE), 32);
@@ -755,8 +812,8 @@ static int motion_estimate_sync(SAMPLE *orig, SAMPLE *ref, int size, int stride_
         mv_cand.x = mv_ref.x + l;
 
         TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, sign);
-        TEMPLATE(get_inter_prediction_luma)(rf,ref,width,height,stride_r,width,&mv_cand, sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-sync: telescope search
-        sad = sad_calc(orig,rf,size,width,width,height);
+        counted_subpel(count, rf,ref,width,height,stride_r,width,&mv_cand, sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-sync: telescope search
+        sad = counted_sad(count, orig,rf,size,width,width,height);
         sad >>= params->bitdepth - 8;
         mv_diff_y = mv_cand.y - mvp->y;
         mv_diff_x = mv_cand.x - mvp->x;
@@ -779,8 +836,8 @@ static int motion_estimate_sync(SAMPLE *orig, SAMPLE *ref, int size, int stride_
     mv_cand = mvcand[idx];
 
     TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, sign);
-    TEMPLATE(get_inter_prediction_luma)(rf,ref,width,height,stride_r,width,&mv_cand, sign,enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-sync: candidate search
-    sad = sad_calc(orig,rf,size,width,width,height) >> (params->bitdepth - 8);
+    counted_subpel(count, rf,ref,width,height,stride_r,width,&mv_cand, sign,enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-sync: candidate search
+    sad = counted_sad(count, orig,rf,size,width,width,height) >> (params->bitdepth - 8);
     mv_diff_y = mv_cand.y - mvp->y;
     mv_diff_x = mv_cand.x - mvp->x;
     sad += (int)(lambda * (double)quote_mv_bits(mv_diff_y,mv_diff_x) + 0.5);
@@ -795,7 +852,7 @@ static int motion_estimate_sync(SAMPLE *orig, SAMPLE *ref, int size, int stride_
   return min_sad;
 }
 
-static int motion_estimate_bi(SAMPLE *orig, SAMPLE *ref0, SAMPLE *ref1, int size, int stride_r, int width, int height, mv_t *mv, mv_t *mvc, mv_t *mvp, double lambda, enc_params *params, int sign, int fwidth, int fheight, int xpos, int ypos, mv_t *mvcand, int *mvcand_num, int enable_bipred) {
+static int motion_estimate_bi(SAMPLE *orig, SAMPLE *ref0, SAMPLE *ref1, int size, int stride_r, int width, int height, mv_t *mv, mv_t *mvc, mv_t *mvp, double lambda, enc_params *params, int sign, int fwidth, int fheight, int xpos, int ypos, mv_t *mvcand, int *mvcand_num, int enable_bipred, uint64_t *count) {
   int k, l, range, step;
   uint32_t min_sad, sad;
   SAMPLE *rf = thor_alloc(MAX_SB_SIZE*MAX_SB_SIZE*sizeof(SAMPLE), 32);
@@ -844,10 +901,10 @@ static int motion_estimate_bi(SAMPLE *orig, SAMPLE *ref0, SAMPLE *ref1, int size
 
 
         TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, sign);
-        TEMPLATE(get_inter_prediction_luma)(rf0, ref0, width, height, stride_r, width, &mv_cand, sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-bi: telescope search - ref0
+        counted_subpel(count, rf0, ref0, width, height, stride_r, width, &mv_cand, sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-bi: telescope search - ref0
 
         TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, 1 - sign);
-        TEMPLATE(get_inter_prediction_luma)(rf1, ref1, width, height, stride_r, width, &mv_cand, 1 - sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-bi: telescope search - ref1
+        counted_subpel(count, rf1, ref1, width, height, stride_r, width, &mv_cand, 1 - sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-bi: telescope search - ref1
 
         int i, j;
         for (i = 0; i < size; i++) {
@@ -856,7 +913,7 @@ static int motion_estimate_bi(SAMPLE *orig, SAMPLE *ref0, SAMPLE *ref1, int size
           }
         }
 
-        sad = sad_calc(orig, rf, size, width, width, height) >> (params->bitdepth - 8);
+        sad = counted_sad(count, orig, rf, size, width, width, height) >> (params->bitdepth - 8);
         mv_diff_y = mv_cand.y - mvp->y;
         mv_diff_x = mv_cand.x - mvp->x;
         sad += (uint32_t)(lambda * (double)quote_mv_bits(mv_diff_y, mv_diff_x) + 0.5);
@@ -884,10 +941,10 @@ static int motion_estimate_bi(SAMPLE *orig, SAMPLE *ref0, SAMPLE *ref1, int size
     mv_cand = mvcand[idx];
 
     TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, sign);
-    TEMPLATE(get_inter_prediction_luma)(rf0, ref0, width, height, stride_r, width, &mv_cand, sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-bi: candidate search - ref0
+    counted_subpel(count, rf0, ref0, width, height, stride_r, width, &mv_cand, sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-bi: candidate search - ref0
 
     TEMPLATE(clip_mv)(&mv_cand, ypos, xpos, fwidth, fheight, size, size, 1 - sign);
-    TEMPLATE(get_inter_prediction_luma)(rf1, ref1, width, height, stride_r, width, &mv_cand, 1 - sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-bi: candidate search - ref1
+    counted_subpel(count, rf1, ref1, width, height, stride_r, width, &mv_cand, 1 - sign, enable_bipred,fwidth,fheight,xpos,ypos,params->bitdepth); //ME-bi: candidate search - ref1
 
     int i, j;
     for (i = 0; i < size; i++) {
@@ -895,7 +952,7 @@ static int motion_estimate_bi(SAMPLE *orig, SAMPLE *ref0, SAMPLE *ref1, int size
         rf[i*size + j] = (SAMPLE)(((int)rf0[i*size + j] + (int)rf1[i*size + j]) >> 1);
       }
     }
-    sad = sad_calc(orig, rf, size, width, width, height) >> (params->bitdepth - 8);
+    sad = counted_sad(count, orig, rf, size, width, width, height) >> (params->bitdepth - 8);
     mv_diff_y = mv_cand.y - mvp->y;
     mv_diff_x = mv_cand.x - mvp->x;
     sad += (uint32_t)(lambda * (double)quote_mv_bits(mv_diff_y, mv_diff_x) + 0.5);
@@ -917,15 +974,15 @@ static uint32_t cost_calc(yuv_block_t *org_block,yuv_block_t *rec_block,int stri
 {
   uint64_t cost;
   uint64_t ssd_y,ssd_u,ssd_v;
-  ssd_y = ssd_calc(org_block->y,rec_block->y,stride,stride,width,height);
-  ssd_u = ssd_calc(org_block->u,rec_block->u,stride>>sub,stride>>sub,width>>sub,height>>sub);
-  ssd_v = ssd_calc(org_block->v,rec_block->v,stride>>sub,stride>>sub,width>>sub,height>>sub);
+  ssd_y = TEMPLATE(ssd_calc)(org_block->y,rec_block->y,stride,stride,width,height);
+  ssd_u = TEMPLATE(ssd_calc)(org_block->u,rec_block->u,stride>>sub,stride>>sub,width>>sub,height>>sub);
+  ssd_v = TEMPLATE(ssd_calc)(org_block->v,rec_block->v,stride>>sub,stride>>sub,width>>sub,height>>sub);
   cost = ((ssd_y + ssd_u + ssd_v) >> (bitdepth*2-16)) + (int64_t)(lambda*nbits + 0.5);
   if (cost > 1 << 30) cost = 1 << 30; //Robustification
   return cost;
 }
 
-static int search_intra_prediction_params(SAMPLE *org_y,yuv_frame_t *rec,block_pos_t *block_pos,int width,int height,int num_intra_modes,intra_mode_t *intra_mode,int bitdepth)
+static int search_intra_prediction_params(SAMPLE *org_y,yuv_frame_t *rec,block_pos_t *block_pos,int width,int height,int num_intra_modes,intra_mode_t *intra_mode,int bitdepth,uint64_t *count)
 {
   int size = block_pos->size;
   int yposY = block_pos->ypos;
@@ -945,32 +1002,33 @@ static int search_intra_prediction_params(SAMPLE *org_y,yuv_frame_t *rec,block_p
 
 
   /* Search for intra modes */
+  count[COUNT_INTRA_MODES] += num_intra_modes;
   min_sad = (1<<30);
   *intra_mode = MODE_DC;
 
   TEMPLATE(get_dc_pred)(xposY >=0 ? left:top,yposY >= 0 ? top:left,size,pblock,size, bitdepth);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_DC;
     min_sad = sad;
   }
 
   TEMPLATE(get_hor_pred)(left,size,pblock,size);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_HOR;
     min_sad = sad;
   }
 
   TEMPLATE(get_ver_pred)(top,size,pblock,size);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_VER;
     min_sad = sad;
   }
 
   TEMPLATE(get_planar_pred)(left,top,top_left,size,pblock,size,bitdepth);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_PLANAR;
     min_sad = sad;
@@ -984,42 +1042,42 @@ static int search_intra_prediction_params(SAMPLE *org_y,yuv_frame_t *rec,block_p
   }
 
   TEMPLATE(get_upleft_pred)(left,top,top_left,size,pblock,size);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_UPLEFT;
     min_sad = sad;
   }
 
   TEMPLATE(get_upright_pred)(top,size,pblock,size);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_UPRIGHT;
     min_sad = sad;
   }
 
   TEMPLATE(get_upupright_pred)(top,size,pblock,size);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_UPUPRIGHT;
     min_sad = sad;
   }
 
   TEMPLATE(get_upupleft_pred)(left,top,top_left,size,pblock,size);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_UPUPLEFT;
     min_sad = sad;
   }
 
   TEMPLATE(get_upleftleft_pred)(left,top,top_left,size,pblock,size);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_UPLEFTLEFT;
     min_sad = sad;
   }
 
   TEMPLATE(get_downleftleft_pred)(left,size,pblock,size);
-  sad = sad_calc(org_y,pblock,size,size,size,size) >> (bitdepth-8);
+  sad = counted_sad(count, org_y,pblock,size,size,size,size) >> (bitdepth-8);
   if (sad < min_sad){
     *intra_mode = MODE_DOWNLEFTLEFT;
     min_sad = sad;
@@ -1030,7 +1088,125 @@ static int search_intra_prediction_params(SAMPLE *org_y,yuv_frame_t *rec,block_p
   return min_sad;
 }
 
-static int search_inter_prediction_params(SAMPLE *org_y,yuv_frame_t *ref,block_pos_t *block_pos,mv_t *mvc, mv_t *mvp, mv_t *mv_arr, part_t part, double lambda, enc_params *params, int sign,int fwidth,int fheight, mv_t *mvcand, int *mvcand_num, int enable_bipred)
+static int flat_block(const SAMPLE *a, int stride)
+{
+  for (int i = 0; i < HASH_ME_BLOCK; i++) {
+    for (int j = 0; j < HASH_ME_BLOCK; j++) {
+      if (a[i*stride + j] != a[0])
+        return 0;
+    }
+  }
+  return 1;
+}
+
+/* Find the integer MV of the block among the positions where the original reference
+   frame had the same content. Returns the cost of the best such MV, or -1 if none.
+   The match is exact if the hashes of all sub-blocks are equal in the original
+   frames, and the regular search can then be skipped. */
+static int hash_motion_estimate(ref_hash_t *ref_hash, SAMPLE *orig, int ostride, yuv_frame_t *ref, int xpos, int ypos, int width, int height, mv_t *mv, mv_t *mvp, double lambda, int sign, int bitdepth, int *exact, uint64_t *count)
+{
+  int s = sign ? -1 : 1;
+  int rstride = ref->stride_y;
+  int fwidth = ref->width;
+  int fheight = ref->height;
+  int best_cost = -1;
+  int num_cand = 0;
+  mv_t mv_cand;
+
+  *exact = 0;
+
+  if (width < HASH_ME_BLOCK || height < HASH_ME_BLOCK)
+    return -1;
+
+  /* Use the first sub-block which is not flat to look up the hash table */
+  int bx = -1, by = -1;
+  for (int i = 0; i + HASH_ME_BLOCK <= height && by < 0; i += HASH_ME_BLOCK) {
+    for (int j = 0; j + HASH_ME_BLOCK <= width; j += HASH_ME_BLOCK) {
+      if (!flat_block(orig + i*ostride + j, ostride)) {
+        by = i;
+        bx = j;
+        break;
+      }
+    }
+  }
+
+  /* Flat blocks match everywhere, so only try the predictor and the zero MV
+     and accept them if they leave no residual */
+  if (by < 0) {
+    for (int i = 0; i < 2; i++) {
+      mv_cand.x = i ? 0 : ((mvp->x + 2) >> 2) << 2;
+      mv_cand.y = i ? 0 : ((mvp->y + 2) >> 2) << 2;
+      int ry = ypos + s*(mv_cand.y >> 2);
+      int rx = xpos + s*(mv_cand.x >> 2);
+      if (rx < 0 || ry < 0 || rx + width > fwidth || ry + height > fheight)
+        continue;
+      if (counted_sad(count, orig, ref->y + ry*rstride + rx, ostride, rstride, width, height) == 0) {
+        *mv = mv_cand;
+        *exact = 1;
+        return (int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
+      }
+    }
+    return -1;
+  }
+
+  /* Hashes of all sub-blocks to check that the whole block matches */
+  uint32_t sub_hash[(MAX_SB_SIZE/HASH_ME_BLOCK)*(MAX_SB_SIZE/HASH_ME_BLOCK)];
+  int num_sub = 0;
+  for (int i = 0; i + HASH_ME_BLOCK <= height; i += HASH_ME_BLOCK) {
+    for (int j = 0; j + HASH_ME_BLOCK <= width; j += HASH_ME_BLOCK)
+      sub_hash[num_sub++] = TEMPLATE(block_hash)(orig + i*ostride + j, ostride);
+  }
+
+  uint32_t hash = TEMPLATE(block_hash)(orig + by*ostride + bx, ostride);
+  for (int pos = ref_hash->head[hash_me_index(hash)]; pos >= 0 && num_cand < HASH_ME_MAX_CAND; pos = ref_hash->next[pos]) {
+    if (ref_hash->hash[pos] != hash)
+      continue;
+    int ry = pos / fwidth - by;
+    int rx = pos % fwidth - bx;
+    if (rx < 0 || ry < 0 || rx + width > fwidth || ry + height > fheight)
+      continue;
+    num_cand++;
+    mv_cand.x = s*(rx - xpos)*4;
+    mv_cand.y = s*(ry - ypos)*4;
+    int match = 1;
+    for (int i = 0, k = 0; i + HASH_ME_BLOCK <= height && match; i += HASH_ME_BLOCK) {
+      for (int j = 0; j + HASH_ME_BLOCK <= width && match; j += HASH_ME_BLOCK)
+        match = sub_hash[k++] == ref_hash->hash[(ry + i)*fwidth + rx + j];
+    }
+    if (*exact && !match)
+      continue;
+    int sad = counted_sad(count, orig, ref->y + ry*rstride + rx, ostride, rstride, width, height) >> (bitdepth - 8);
+    int cost = sad + (int)(lambda * (double)quote_mv_bits(mv_cand.y - mvp->y, mv_cand.x - mvp->x) + 0.5);
+    if (best_cost < 0 || cost < best_cost || (match && !*exact)) {
+      best_cost = cost;
+      *mv = mv_cand;
+      *exact = match;
+    }
+  }
+  return best_cost;
+}
+
+/* Choose between the hash match and the MV from the regular search */
+static int select_hash_mv(int hash_cost, mv_t *hash_mv, int me_cost, mv_t *mv)
+{
+  if (hash_cost >= 0 && hash_cost < me_cost) {
+    *mv = *hash_mv;
+    return hash_cost;
+  }
+  return me_cost;
+}
+
+static ref_hash_t *hash_for_ref(encoder_info_t *encoder_info, yuv_frame_t *ref)
+{
+  return encoder_info->hash_me ? find_ref_hash(encoder_info->hash_me, ref) : NULL;
+}
+
+static subpel_ref_t *subpel_for_ref(encoder_info_t *encoder_info, yuv_frame_t *ref)
+{
+  return encoder_info->subpel_cache ? find_subpel_ref(encoder_info->subpel_cache, ref) : NULL;
+}
+
+static int search_inter_prediction_params(SAMPLE *org_y,yuv_frame_t *ref,ref_hash_t *ref_hash,subpel_ref_t *subpel_ref,block_pos_t *block_pos,mv_t *mvc, mv_t *mvp, mv_t *mv_arr, part_t part, double lambda, enc_params *params, int sign,int fwidth,int fheight, mv_t *mvcand, int *mvcand_num, int enable_bipred, uint64_t *count)
 {
   int size = block_pos->size;
   int yposY = block_pos->ypos;
@@ -1043,12 +1219,20 @@ static int search_inter_prediction_params(SAMPLE *org_y,yuv_frame_t *ref,block_p
   int ostride = size;
   int index,py,px,offset_r,offset_o,width,height;
   int sad=0;
+  int hash_cost, exact = 0;
+  mv_t hash_mv;
   if (part==PART_NONE){
     width = size;
     height = size;
     offset_o = 0;
     offset_r = 0;
-    sad += (params->sync ? motion_estimate_sync : motion_estimate)(org_y+offset_o,ref_y+offset_r,ostride,rstride,width,height,&mv,mvc,&mvp2,lambda,params,sign,fwidth,fheight,xposY,yposY,mvcand,mvcand_num, enable_bipred);
+    hash_cost = ref_hash ? hash_motion_estimate(ref_hash, org_y+offset_o, ostride, ref, xposY, yposY, width, height, &hash_mv, &mvp2, lambda, sign, params->bitdepth, &exact, count) : -1;
+    if (exact) {
+      mv = hash_mv;
+      sad += hash_cost;
+    }
+    else
+      sad += select_hash_mv(hash_cost, &hash_mv, (params->sync ? motion_estimate_sync : motion_estimate)(org_y+offset_o,ref_y+offset_r,subpel_ref,ostride,rstride,width,height,&mv,mvc,&mvp2,lambda,params,sign,fwidth,fheight,xposY,yposY,mvcand,mvcand_num, enable_bipred, count), &mv);
     mv_arr[0] = mv;
     mv_arr[1] = mv;
     mv_arr[2] = mv;
@@ -1061,7 +1245,13 @@ static int search_inter_prediction_params(SAMPLE *org_y,yuv_frame_t *ref,block_p
       py = index>>1;
       offset_o = py*(size/2)*ostride;
       offset_r = py*(size/2)*rstride;
-      sad += motion_estimate(org_y+offset_o,ref_y+offset_r,ostride,rstride,width,height,&mv,mvc,&mvp2,lambda,params,sign,fwidth,fheight,xposY,yposY,mvcand,mvcand_num, enable_bipred);
+      hash_cost = ref_hash ? hash_motion_estimate(ref_hash, org_y+offset_o, ostride, ref, xposY, yposY+py*(size/2), width, height, &hash_mv, &mvp2, lambda, sign, params->bitdepth, &exact, count) : -1;
+      if (exact) {
+        mv = hash_mv;
+        sad += hash_cost;
+      }
+      else
+        sad += select_hash_mv(hash_cost, &hash_mv, motion_estimate(org_y+offset_o,ref_y+offset_r,subpel_ref,ostride,rstride,width,height,&mv,mvc,&mvp2,lambda,params,sign,fwidth,fheight,xposY,yposY,mvcand,mvcand_num, enable_bipred, count), &mv);
       mv_arr[index] = mv;
       mv_arr[index+1] = mv;
       mvp2 = mv_arr[0]; //mv predictor from inside block
@@ -1074,7 +1264,13 @@ static int search_inter_prediction_params(SAMPLE *org_y,yuv_frame_t *ref,block_p
       px = index;
       offset_o = px*(size/2);
       offset_r = px*(size/2);
-      sad += motion_estimate(org_y+offset_o,ref_y+offset_r,ostride,rstride,width,height,&mv,mvc,&mvp2,lambda,params,sign,fwidth,fheight,xposY,yposY,mvcand,mvcand_num,enable_bipred);
+      hash_cost = ref_hash ? hash_motion_estimate(ref_hash, org_y+offset_o, ostride, ref, xposY+px*(size/2), yposY, width, height, &hash_mv, &mvp2, lambda, sign, params->bitdepth, &exact, count) : -1;
+      if (exact) {
+        mv = hash_mv;
+        sad += hash_cost;
+      }
+      else
+        sad += select_hash_mv(hash_cost, &hash_mv, motion_estimate(org_y+offset_o,ref_y+offset_r,subpel_ref,ostride,rstride,width,height,&mv,mvc,&mvp2,lambda,params,sign,fwidth,fheight,xposY,yposY,mvcand,mvcand_num,enable_bipred, count), &mv);
       mv_arr[index] = mv;
       mv_arr[index+2] = mv;
       mvp2 = mv_arr[0]; //mv predictor from inside block
@@ -1088,7 +1284,13 @@ static int search_inter_prediction_params(SAMPLE *org_y,yuv_frame_t *ref,block_p
       py = (index&2)>>1;
       offset_o = py*(size/2)*ostride + px*(size/2);
       offset_r = py*(size/2)*rstride + px*(size/2);
-      sad += motion_estimate(org_y+offset_o,ref_y+offset_r,ostride,rstride,width,height,&mv,mvc,&mvp2,lambda,params,sign,fwidth,fheight,xposY,yposY,mvcand,mvcand_num,enable_bipred);
+      hash_cost = ref_hash ? hash_motion_estimate(ref_hash, org_y+offset_o, ostride, ref, xposY+px*(size/2), yposY+py*(size/2), width, height, &hash_mv, &mvp2, lambda, sign, params->bitdepth, &exact, count) : -1;
+      if (exact) {
+        mv = hash_mv;
+        sad += hash_cost;
+      }
+      else
+        sad += select_hash_mv(hash_cost, &hash_mv, motion_estimate(org_y+offset_o,ref_y+offset_r,subpel_ref,ostride,rstride,width,height,&mv,mvc,&mvp2,lambda,params,sign,fwidth,fheight,xposY,yposY,mvcand,mvcand_num,enable_bipred, count), &mv);
       mv_arr[index] = mv;
       mvp2 = mv_arr[0]; //mv predictor from inside block
     }
@@ -1337,6 +1539,59 @@ static int encode_and_reconstruct_block_inter (encoder_info_t *encoder_info, SAM
     return cbp;
 }
 
+/* Inter prediction of all planes for a skip, merge, inter or bipred block */
+static void get_inter_block_prediction(encoder_info_t *encoder_info, block_info_t *block_info, block_param_t *block_param, SAMPLE *pblock_y, SAMPLE *pblock_u, SAMPLE *pblock_v)
+{
+  int width = encoder_info->width;
+  int height = encoder_info->height;
+  block_mode_t mode = block_param->mode;
+  int enable_bipred = encoder_info->params->enable_bipred;
+  yuv_frame_t *rec = encoder_info->rec;
+  int r0,r1;
+  yuv_frame_t *ref0;
+  yuv_frame_t *ref1;
+  int sign,split;
+
+  if (mode == MODE_INTER || mode == MODE_BIPRED)
+    split = encoder_info->params->enable_pb_split;
+  else
+    split = 0;
+  if (block_param->dir==2 || mode == MODE_BIPRED){
+    r0 = encoder_info->frame_info.ref_array[block_param->ref_idx0];
+    ref0 = r0 >= 0 ? encoder_info->ref[r0] : encoder_info->interp_frames[0];
+    r1 = encoder_info->frame_info.ref_array[block_param->ref_idx1];
+    ref1 = r1 >= 0 ? encoder_info->ref[r1] : encoder_info->interp_frames[0];
+    if (encoder_info->frame_info.frame_type == B_FRAME && encoder_info->params->interp_ref == 2 && mode == MODE_SKIP && block_param->skip_idx==0) {
+      TEMPLATE(get_inter_prediction_temp)(width, height, ref0, ref1, &block_info->block_pos, encoder_info->deblock_data, encoder_info->params->num_reorder_pics + 1, encoder_info->frame_info.phase, pblock_y, pblock_u, pblock_v);
+    }
+    else {
+      SAMPLE *pblock0_y = thor_alloc(MAX_SB_SIZE*MAX_SB_SIZE*sizeof(SAMPLE), 32);
+      SAMPLE *pblock0_u = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
+      SAMPLE *pblock0_v = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
+      SAMPLE *pblock1_y = thor_alloc(MAX_SB_SIZE*MAX_SB_SIZE*sizeof(SAMPLE), 32);
+      SAMPLE *pblock1_u = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
+      SAMPLE *pblock1_v = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
+      sign = ref0->frame_num > rec->frame_num;
+      TEMPLATE(get_inter_prediction_yuv)(ref0, pblock0_y, pblock0_u, pblock0_v, &block_info->block_pos, block_param->mv_arr0, sign, width, height, enable_bipred, split, encoder_info->params->bitdepth);
+      sign = ref1->frame_num > rec->frame_num;
+      TEMPLATE(get_inter_prediction_yuv)(ref1, pblock1_y, pblock1_u, pblock1_v, &block_info->block_pos, block_param->mv_arr1, sign, width, height, enable_bipred, split, encoder_info->params->bitdepth);
+      TEMPLATE(average_blocks_all)(pblock_y, pblock_u, pblock_v, pblock0_y, pblock0_u, pblock0_v, pblock1_y, pblock1_u, pblock1_v, &block_info->block_pos, block_info->sub);
+      thor_free(pblock0_y);
+      thor_free(pblock0_u);
+      thor_free(pblock0_v);
+      thor_free(pblock1_y);
+      thor_free(pblock1_u);
+      thor_free(pblock1_v);
+    }
+  }
+  else{
+    r0 = encoder_info->frame_info.ref_array[block_param->ref_idx0];
+    ref0 = r0>=0 ? encoder_info->ref[r0] : encoder_info->interp_frames[0];
+    sign = ref0->frame_num > rec->frame_num;
+    TEMPLATE(get_inter_prediction_yuv)(ref0, pblock_y, pblock_u, pblock_v, &block_info->block_pos, block_param->mv_arr0, sign, width, height, enable_bipred, split, encoder_info->params->bitdepth);
+  }
+}
+
 static int encode_block(encoder_info_t *encoder_info, stream_t *stream, block_info_t *block_info,block_param_t *block_param)
 {
   int width = encoder_info->width;
@@ -1350,12 +1605,13 @@ static int encode_block(encoder_info_t *encoder_info, stream_t *stream, block_in
   int sizeC = size>>block_info->sub;
   block_mode_t mode = block_param->mode;
 
+  search_count(encoder_info, size)[COUNT_ENCODE_BLOCK]++;
+
   int nbits;
   cbp_t cbp;
   intra_mode_t intra_mode;
 
   frame_type_t frame_type = encoder_info->frame_info.frame_type;
-  int enable_bipred = encoder_info->params->enable_bipred;
   int qpY = block_info->qp;
   int qpC = block_info->sub ? chroma_qp[qpY] : qpY;
 
@@ -1365,7 +1621,9 @@ static int encode_block(encoder_info_t *encoder_info, stream_t *stream, block_in
     memcpy(block_info->rec_block->y, block_info->rec_block_best->y, size*size*sizeof(SAMPLE));
     memcpy(block_info->rec_block->u, block_info->rec_block_best->u, (size*size >> 2*block_info->sub) * sizeof(SAMPLE));
     memcpy(block_info->rec_block->v, block_info->rec_block_best->v, (size*size >> 2*block_info->sub) * sizeof(SAMPLE));
+    STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ENTROPY);
     nbits = write_block(stream, encoder_info, block_info, block_param);
+    STAGE_END(encoder_info->timer);
     return nbits;
   }
 
@@ -1373,20 +1631,10 @@ static int encode_block(encoder_info_t *encoder_info, stream_t *stream, block_in
   SAMPLE *pblock_y = thor_alloc(MAX_SB_SIZE*MAX_SB_SIZE*sizeof(SAMPLE), 32);
   SAMPLE *pblock_u = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
   SAMPLE *pblock_v = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
-  SAMPLE *pblock0_y = thor_alloc(MAX_SB_SIZE*MAX_SB_SIZE*sizeof(SAMPLE), 32);
-  SAMPLE *pblock0_u = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
-  SAMPLE *pblock0_v = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
-  SAMPLE *pblock1_y = thor_alloc(MAX_SB_SIZE*MAX_SB_SIZE*sizeof(SAMPLE), 32);
-  SAMPLE *pblock1_u = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
-  SAMPLE *pblock1_v = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
   int16_t *coeffq_y = thor_alloc(2 * MAX_TR_SIZE*MAX_TR_SIZE, 32);
   int16_t *coeffq_u = thor_alloc(2 * MAX_TR_SIZE*MAX_TR_SIZE, 32);
   int16_t *coeffq_v = thor_alloc(2 * MAX_TR_SIZE*MAX_TR_SIZE, 32);
 
-  int r0,r1;
-  yuv_frame_t *ref0;
-  yuv_frame_t *ref1;
-
   /* Pointers to block of original pixels */
   SAMPLE *org_y = block_info->org_block->y;
   SAMPLE *org_u = block_info->org_block->u;
@@ -1402,6 +1650,7 @@ static int encode_block(encoder_info_t *encoder_info, stream_t *stream, block_in
   block_param->tb_split = tb_split;
   block_param->mode = mode;
 
+  STAGE_BEGIN(encoder_info->timer, ENC_STAGE_TRANSFORM);
   if (mode==MODE_INTRA){
     intra_mode = block_param->intra_mode;
 
@@ -1431,33 +1680,7 @@ static int encode_block(encoder_info_t *encoder_info, stream_t *stream, block_in
     if (cbp.v) memcpy(block_param->coeff_v, coeffq_v, 4*MAX_QUANT_SIZE*MAX_QUANT_SIZE * sizeof(uint16_t));
   }
   else {
-    int sign,split;
-    if (mode == MODE_INTER || mode == MODE_BIPRED)
-      split = encoder_info->params->enable_pb_split;
-    else
-      split = 0;
-    if (block_param->dir==2 || mode == MODE_BIPRED){
-      r0 = encoder_info->frame_info.ref_array[block_param->ref_idx0];
-      ref0 = r0 >= 0 ? encoder_info->ref[r0] : encoder_info->interp_frames[0];
-      r1 = encoder_info->frame_info.ref_array[block_param->ref_idx1];
-      ref1 = r1 >= 0 ? encoder_info->ref[r1] : encoder_info->interp_frames[0];
-      if (encoder_info->frame_info.frame_type == B_FRAME && encoder_info->params->interp_ref == 2 && mode == MODE_SKIP && block_param->skip_idx==0) {
-        TEMPLATE(get_inter_prediction_temp)(width, height, ref0, ref1, &block_info->block_pos, encoder_info->deblock_data, encoder_info->params->num_reorder_pics + 1, encoder_info->frame_info.phase, pblock_y, pblock_u, pblock_v);
-      }
-      else {
-        sign = ref0->frame_num > rec->frame_num;
-        TEMPLATE(get_inter_prediction_yuv)(ref0, pblock0_y, pblock0_u, pblock0_v, &block_info->block_pos, block_param->mv_arr0, sign, encoder_info->width, encoder_info->height, enable_bipred, split, encoder_info->params->bitdepth);
-        sign = ref1->frame_num > rec->frame_num;
-        TEMPLATE(get_inter_prediction_yuv)(ref1, pblock1_y, pblock1_u, pblock1_v, &block_info->block_pos, block_param->mv_arr1, sign, encoder_info->width, encoder_info->height, enable_bipred, split, encoder_info->params->bitdepth);
-        TEMPLATE(average_blocks_all)(pblock_y, pblock_u, pblock_v, pblock0_y, pblock0_u, pblock0_v, pblock1_y, pblock1_u, pblock1_v, &block_info->block_pos, block_info->sub);
-      }
-    }
-    else{
-      r0 = encoder_info->frame_info.ref_array[block_param->ref_idx0];
-      ref0 = r0>=0 ? encoder_info->ref[r0] : encoder_info->interp_frames[0];
-      sign = ref0->frame_num > rec->frame_num;
-      TEMPLATE(get_inter_prediction_yuv)(ref0, pblock_y, pblock_u, pblock_v, &block_info->block_pos, block_param->mv_arr0, sign, encoder_info->width, encoder_info->height, enable_bipred, split, encoder_info->params->bitdepth);
-    }
+    get_inter_block_prediction(encoder_info, block_info, block_param, pblock_y, pblock_u, pblock_v);
 
     if (mode == MODE_SKIP || zero_block) {
       memcpy(rec_y, pblock_y, sizeY*sizeY*sizeof(SAMPLE));
@@ -1489,20 +1712,17 @@ static int encode_block(encoder_info_t *encoder_info, stream_t *stream, block_in
     }
 
   }
+  STAGE_END(encoder_info->timer);
   block_param->cbp = cbp;
+  STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ENTROPY);
   nbits = write_block(stream,encoder_info,block_info,block_param);
+  STAGE_END(encoder_info->timer);
 
   if (tb_split) {
     /* Used for deblocking only (i.e. not for bitstream generation) */
     block_param->cbp.y = block_param->cbp.u = block_param->cbp.v = 1; //TODO: Do properly with respect to deblocking filter
   }
 
-  thor_free(pblock0_y);
-  thor_free(pblock0_u);
-  thor_free(pblock0_v);
-  thor_free(pblock1_y);
-  thor_free(pblock1_u);
-  thor_free(pblock1_v);
   thor_free(pblock_y);
   thor_free(pblock_u);
   thor_free(pblock_v);
@@ -1733,7 +1953,7 @@ static int search_bipred_prediction_params (encoder_info_t *encoder_info, block_
     SAMPLE *ref0_y = ref0->y + ref_posY;
     SAMPLE *ref1_y = ref1->y + ref_posY;
 
-    sad = motion_estimate_bi(org_block->y, ref0_y, ref1_y, ostride, rstride, size, size, &mv, &mv_center[r_idx0], mvp, sqrt(lambda), encoder_info->params, sign, encoder_info->width, encoder_info->height, xpos, ypos, frame_info->mvcand[r_idx0], frame_info->mvcand_num + r_idx0, 1);
+    sad = motion_estimate_bi(org_block->y, ref0_y, ref1_y, ostride, rstride, size, size, &mv, &mv_center[r_idx0], mvp, sqrt(lambda), encoder_info->params, sign, encoder_info->width, encoder_info->height, xpos, ypos, frame_info->mvcand[r_idx0], frame_info->mvcand_num + r_idx0, 1, search_count(encoder_info, block_info->block_pos.size));
     *ref_idx0 = r_idx0;
     *ref_idx1 = r_idx1;
     mv_arr0[0] = mv_arr0[1] = mv_arr0[2] = mv_arr0[3] = mv;
@@ -1802,7 +2022,9 @@ static int search_bipred_prediction_params (encoder_info_t *encoder_info, block_
         int sign = ref->frame_num > rec->frame_num;
         mv_t mvp2 = (frame_type == B_FRAME && list == 1) ? mv : *mvp;
         mvc = &mv_center[ref_idx];
-        sad = (uint32_t)search_inter_prediction_params(org8, ref, &block_info->block_pos, mvc, &mvp2, mv_all[part], part, sqrt(lambda), encoder_info->params, sign, width, height, frame_info->mvcand[ref_idx], frame_info->mvcand_num + ref_idx, enable_bipred);
+        STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ME);
+        sad = (uint32_t)search_inter_prediction_params(org8, ref, hash_for_ref(encoder_info, ref), subpel_for_ref(encoder_info, ref), &block_info->block_pos, mvc, &mvp2, mv_all[part], part, sqrt(lambda), encoder_info->params, sign, width, height, frame_info->mvcand[ref_idx], frame_info->mvcand_num + ref_idx, enable_bipred, search_count(encoder_info, block_info->block_pos.size));
+        STAGE_END(encoder_info->timer);
         for (int i = 0; i < 4; i++)
           add_mvcandidate(mv_all[part] + i, frame_info->mvcand[ref_idx], frame_info->mvcand_num + ref_idx, frame_info->mvcand_mask + ref_idx);
         if (sad < min_sad) {
@@ -1929,7 +2151,7 @@ static int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_in
         tmp_block_param.dir = block_info->merge_candidates[merge_idx].bipred_flag;
         tmp_block_param.mode = mode;
         min_tb_param = 0;
-        max_tb_param = block_info->max_num_tb_part - 1;
+        max_tb_param = encoder_info->frame_info.tb_split_search ? block_info->max_num_tb_part - 1 : 0;
         for (tb_param = min_tb_param; tb_param <= max_tb_param; tb_param++) {
           tmp_block_param.tb_param = tb_param;
           nbits = encode_block(encoder_info, stream, block_info, &tmp_block_param);
@@ -1942,7 +2164,9 @@ static int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_in
       }
 
       if (intra_inter_sad){
-        sad_intra = search_intra_prediction_params(org_block->y,rec,&block_info->block_pos,encoder_info->width,encoder_info->height,encoder_info->frame_info.num_intra_modes,&intra_mode,encoder_info->params->bitdepth);
+        STAGE_BEGIN(encoder_info->timer, ENC_STAGE_INTRA);
+        sad_intra = search_intra_prediction_params(org_block->y,rec,&block_info->block_pos,encoder_info->width,encoder_info->height,encoder_info->frame_info.num_intra_modes,&intra_mode,encoder_info->params->bitdepth, search_count(encoder_info, block_info->block_pos.size));
+        STAGE_END(encoder_info->timer);
         nbits = 2;
         sad_intra += (int)(sqrt(lambda)*(double)nbits + 0.5);
       }
@@ -1978,7 +2202,9 @@ static int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_in
         mv_center[ref_idx] = mvp; //Center integer ME search to mvp for uni-pred, part=PART_NONE;
         sad_inter = MAX_UINT32;
         for (part=0;part<block_info->max_num_pb_part;part++){
-          sad = (uint32_t)search_inter_prediction_params(org_block->y,ref,&block_info->block_pos,&mv_center[ref_idx],&mvp,mv_all[part],part,sqrt(lambda),encoder_info->params,sign,width,height,frame_info->mvcand[ref_idx],frame_info->mvcand_num + ref_idx,enable_bipred);
+          STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ME);
+          sad = (uint32_t)search_inter_prediction_params(org_block->y,ref,hash_for_ref(encoder_info, ref),subpel_for_ref(encoder_info, ref),&block_info->block_pos,&mv_center[ref_idx],&mvp,mv_all[part],part,sqrt(lambda),encoder_info->params,sign,width,height,frame_info->mvcand[ref_idx],frame_info->mvcand_num + ref_idx,enable_bipred, search_count(encoder_info, block_info->block_pos.size));
+          STAGE_END(encoder_info->timer);
           for (int i = 0; i < 4; i++)
             add_mvcandidate(mv_all[part] + i, frame_info->mvcand[ref_idx], frame_info->mvcand_num + ref_idx, frame_info->mvcand_mask + ref_idx);
           mv_center[ref_idx] = mv_all[0][0];
@@ -1997,7 +2223,7 @@ static int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_in
             memcpy(tmp_block_param.mv_arr0,mv_all[part],4*sizeof(mv_t));
             memcpy(tmp_block_param.mv_arr1,mv_all[part],4*sizeof(mv_t));
             min_tb_param = encoder_info->params->encoder_speed<1 ? -1 : 0; //tb_split == -1 means force residual to zero.
-            max_tb_param = block_info->max_num_tb_part - 1;
+            max_tb_param = encoder_info->frame_info.tb_split_search ? block_info->max_num_tb_part - 1 : 0;
             tmp_block_param.mode = mode;
             for (tb_param=min_tb_param; tb_param<=max_tb_param; tb_param++){
               tmp_block_param.tb_param = tb_param;
@@ -2029,9 +2255,11 @@ static int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_in
         int ref_idx0, ref_idx1;
         mv_t mv_arr0[4], mv_arr1[4];
         min_tb_param = 0;
-        max_tb_param = block_info->max_num_tb_part - 1;
+        max_tb_param = encoder_info->frame_info.tb_split_search ? block_info->max_num_tb_part - 1 : 0;
         for (part = 0; part < num_bi_part; part++) {
+          STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ME);
           search_bipred_prediction_params(encoder_info, block_info, part, mv_center, &mvp, &ref_idx0, &ref_idx1, mv_arr0, mv_arr1, 0);
+          STAGE_END(encoder_info->timer);
           tmp_block_param.pb_part = part;
           tmp_block_param.ref_idx0 = ref_idx0;
           memcpy(tmp_block_param.mv_arr0, mv_arr0, 4 * sizeof(mv_t));
@@ -2050,7 +2278,9 @@ static int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_in
         } //for part..
 
         if (encoder_info->frame_info.frame_type == B_FRAME && encoder_info->params->encoder_speed == 0) {
+          STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ME);
           search_bipred_prediction_params(encoder_info, block_info, part, mv_center, &mvp, &ref_idx0, &ref_idx1, mv_arr0, mv_arr1, 1);
+          STAGE_END(encoder_info->timer);
           tmp_block_param.pb_part = PART_NONE;
           tmp_block_param.ref_idx0 = ref_idx0;
           memcpy(tmp_block_param.mv_arr0, mv_arr0, 4 * sizeof(mv_t));
@@ -2073,13 +2303,14 @@ static int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_in
     mode = MODE_INTRA;
     if (do_intra) {
       min_tb_param = 0;
-      max_tb_param = block_info->max_num_tb_part - 1;
+      max_tb_param = encoder_info->frame_info.tb_split_search ? block_info->max_num_tb_part - 1 : 0;
 
       /* Find intra mode (by RDO or SAD) */
       if (encoder_info->params->intra_rdo) {
         uint32_t min_intra_cost = MAX_UINT32;
         intra_mode_t best_intra_mode = MODE_DC;
         int num_intra_modes = frame_info->num_intra_modes;
+        search_count(encoder_info, size)[COUNT_INTRA_MODES] += num_intra_modes;
         for (intra_mode = MODE_DC; intra_mode < num_intra_modes; intra_mode++) {
           tmp_block_param.intra_mode = intra_mode;
           for (tb_param = 0; tb_param <= max_tb_param; tb_param++) {
@@ -2096,7 +2327,9 @@ static int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_in
         intra_mode = best_intra_mode;
       }
       else {
-        search_intra_prediction_params(org_block->y, rec, &block_info->block_pos, encoder_info->width, encoder_info->height, frame_info->num_intra_modes, &intra_mode, encoder_info->params->bitdepth);
+        STAGE_BEGIN(encoder_info->timer, ENC_STAGE_INTRA);
+        search_intra_prediction_params(org_block->y, rec, &block_info->block_pos, encoder_info->width, encoder_info->height, frame_info->num_intra_modes, &intra_mode, encoder_info->params->bitdepth, search_count(encoder_info, block_info->block_pos.size));
+        STAGE_END(encoder_info->timer);
       }
 
       /* Do final encoding with selected intra mode */
@@ -2116,10 +2349,153 @@ static int mode_decision_rdo(encoder_info_t *encoder_info,block_info_t *block_in
 
   /* Rewind bitstream to reference position */
   write_stream_pos(stream,&stream_pos_ref);
+  search_count(encoder_info, block_info->block_pos.size)[COUNT_REWIND]++;
 
   return min_cost;
 }
 
+/* SAD-based mode decision for encoder_speed > 2. Candidates are ranked by luma
+   prediction SAD and an estimate of the signalling cost, and only the selected
+   mode is transformed, quantized and written. */
+static int mode_decision_fast(encoder_info_t *encoder_info,block_info_t *block_info)
+{
+  int size = block_info->block_pos.size;
+  int ypos = block_info->block_pos.ypos;
+  int xpos = block_info->block_pos.xpos;
+  int bwidth = block_info->block_pos.bwidth;
+  int bheight = block_info->block_pos.bheight;
+  int width = encoder_info->width;
+  int height = encoder_info->height;
+  int bitdepth = encoder_info->params->bitdepth;
+
+  stream_t *stream = encoder_info->stream;
+  yuv_block_t *org_block = block_info->org_block;
+  frame_info_t *frame_info = &encoder_info->frame_info;
+  frame_type_t frame_type = frame_info->frame_type;
+  double lambda = block_info->lambda;
+  double sqrt_lambda = sqrt(lambda);
+  int rectangular_flag = bwidth != size || bheight != size;
+
+  SAMPLE *pblock_y = thor_alloc(MAX_SB_SIZE*MAX_SB_SIZE*sizeof(SAMPLE), 32);
+  SAMPLE *pblock_u = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
+  SAMPLE *pblock_v = thor_alloc((MAX_SB_SIZE*MAX_SB_SIZE>>2*block_info->sub)*sizeof(SAMPLE), 32);
+  block_param_t tmp_block_param;
+  block_param_t best_block_param;
+  uint32_t min_sad = MAX_UINT32;
+  uint32_t sad;
+  int idx,nbits;
+
+  /* Set reference bitstream position before doing anything at this block size */
+  stream_pos_t stream_pos_ref;
+  read_stream_pos(&stream_pos_ref,stream);
+
+  tmp_block_param.tb_param = 0;
+  tmp_block_param.pb_part = PART_NONE;
+  best_block_param.mode = MODE_INTRA;
+  best_block_param.intra_mode = MODE_DC;
+
+  if (frame_type != I_FRAME && rectangular_flag) {
+    /* Only skip is possible for blocks crossing the frame boundary */
+    tmp_block_param.mode = MODE_SKIP;
+    for (idx = 0; idx < block_info->num_skip_vec; idx++) {
+      tmp_block_param.skip_idx = idx;
+      tmp_block_param.ref_idx0 = block_info->skip_candidates[idx].ref_idx0;
+      tmp_block_param.ref_idx1 = block_info->skip_candidates[idx].ref_idx1;
+      tmp_block_param.mv_arr0[0] = block_info->skip_candidates[idx].mv0;
+      tmp_block_param.mv_arr1[0] = block_info->skip_candidates[idx].mv1;
+      tmp_block_param.dir = block_info->skip_candidates[idx].bipred_flag;
+      get_inter_block_prediction(encoder_info, block_info, &tmp_block_param, pblock_y, pblock_u, pblock_v);
+      sad = counted_sad(search_count(encoder_info, size), org_block->y, pblock_y, size, size, bwidth, bheight) >> (bitdepth - 8);
+      sad += (uint32_t)(sqrt_lambda * (1 + idx) + 0.5);
+      if (sad < min_sad) {
+        min_sad = sad;
+        best_block_param = tmp_block_param;
+      }
+    }
+  }
+  else if (frame_type != I_FRAME) {
+    /* Merge candidates */
+    tmp_block_param.mode = MODE_MERGE;
+    for (idx = 0; idx < block_info->num_merge_vec; idx++) {
+      tmp_block_param.skip_idx = idx;
+      tmp_block_param.ref_idx0 = block_info->merge_candidates[idx].ref_idx0;
+      tmp_block_param.ref_idx1 = block_info->merge_candidates[idx].ref_idx1;
+      tmp_block_param.mv_arr0[0] = block_info->merge_candidates[idx].mv0;
+      tmp_block_param.mv_arr1[0] = block_info->merge_candidates[idx].mv1;
+      tmp_block_param.dir = block_info->merge_candidates[idx].bipred_flag;
+      get_inter_block_prediction(encoder_info, block_info, &tmp_block_param, pblock_y, pblock_u, pblock_v);
+      sad = counted_sad(search_count(encoder_info, size), org_block->y, pblock_y, size, size, size, size) >> (bitdepth - 8);
+      sad += (uint32_t)(sqrt_lambda * (2 + idx) + 0.5);
+      if (sad < min_sad) {
+        min_sad = sad;
+        best_block_param = tmp_block_param;
+      }
+    }
+
+    /* Motion estimation in the nearest allowed reference frame only */
+    int ref_idx = frame_type == B_FRAME && frame_info->interp_ref > 2;
+    int r = frame_info->ref_array[ref_idx];
+    yuv_frame_t *ref = r >= 0 ? encoder_info->ref[r] : encoder_info->interp_frames[0];
+    int sign = ref->frame_num > encoder_info->rec->frame_num;
+    mv_t mv_arr[4];
+    mv_t mvp = TEMPLATE(get_mv_pred)(ypos,xpos,width,height,size,size,1 << encoder_info->params->log2_sb_size,ref_idx,encoder_info->deblock_data);
+    mv_t mv_center = mvp;
+    add_mvcandidate(&mvp, frame_info->mvcand[ref_idx], frame_info->mvcand_num + ref_idx, frame_info->mvcand_mask + ref_idx);
+    block_info->mvp = mvp;
+    STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ME);
+    sad = (uint32_t)search_inter_prediction_params(org_block->y,ref,hash_for_ref(encoder_info, ref),subpel_for_ref(encoder_info, ref),&block_info->block_pos,&mv_center,&mvp,mv_arr,PART_NONE,sqrt_lambda,encoder_info->params,sign,width,height,frame_info->mvcand[ref_idx],frame_info->mvcand_num + ref_idx,encoder_info->params->enable_bipred, search_count(encoder_info, block_info->block_pos.size));
+    STAGE_END(encoder_info->timer);
+    add_mvcandidate(mv_arr, frame_info->mvcand[ref_idx], frame_info->mvcand_num + ref_idx, frame_info->mvcand_mask + ref_idx);
+    sad += (uint32_t)(sqrt_lambda * 2 + 0.5);
+    if (sad < min_sad) {
+      min_sad = sad;
+      best_block_param = tmp_block_param;
+      best_block_param.mode = MODE_INTER;
+      best_block_param.dir = 0;
+      best_block_param.ref_idx0 = ref_idx;
+      best_block_param.ref_idx1 = ref_idx;
+      memcpy(best_block_param.mv_arr0, mv_arr, 4*sizeof(mv_t));
+      memcpy(best_block_param.mv_arr1, mv_arr, 4*sizeof(mv_t));
+    }
+  }
+
+  if (!rectangular_flag) {
+    intra_mode_t intra_mode;
+    STAGE_BEGIN(encoder_info->timer, ENC_STAGE_INTRA);
+    sad = search_intra_prediction_params(org_block->y,encoder_info->rec,&block_info->block_pos,width,height,frame_info->num_intra_modes,&intra_mode,bitdepth, search_count(encoder_info, block_info->block_pos.size));
+    STAGE_END(encoder_info->timer);
+    sad += (uint32_t)(sqrt_lambda * (frame_type == I_FRAME ? 2 : 4) + 0.5);
+    if (sad < min_sad) {
+      min_sad = sad;
+      best_block_param = tmp_block_param;
+      best_block_param.mode = MODE_INTRA;
+      best_block_param.intra_mode = intra_mode;
+    }
+  }
+
+  if (min_sad == MAX_UINT32) {
+    thor_free(pblock_y);
+    thor_free(pblock_u);
+    thor_free(pblock_v);
+    return MAX_UINT32;
+  }
+
+  /* Encode and reconstruct the selected mode only */
+  best_block_param.tb_param = 0;
+  nbits = encode_block(encoder_info,stream,block_info,&best_block_param);
+  uint32_t cost = cost_calc(org_block,block_info->rec_block,size,bwidth,bheight,block_info->sub,nbits,lambda,bitdepth);
+  copy_best_parameters(size, block_info->sub, block_info, best_block_param);
+
+  /* Rewind bitstream to reference position */
+  write_stream_pos(stream,&stream_pos_ref);
+  search_count(encoder_info, block_info->block_pos.size)[COUNT_REWIND]++;
+
+  thor_free(pblock_y);
+  thor_free(pblock_u);
+  thor_free(pblock_v);
+  return cost;
+}
+
 static int check_early_skip_transform_coeff (int16_t *coeff, int qp, int size, double relative_threshold)
 {
   int tr_log2size = log2i(size);
@@ -2179,7 +2555,8 @@ static int check_early_skip_sub_block (encoder_info_t *encoder_info, SAMPLE *ori
   return cbp;
 }
 
-static int calc_cbp(int16_t *block, int size, int threshold) {
+#ifndef HBD
+int calc_cbp(int16_t *block, int size, int threshold) {
   int sum, i, j;
   if (size == 16) {
     for (j = 0; j < 16; j++) {
@@ -2210,6 +2587,7 @@ static int calc_cbp(int16_t *block, int size, int threshold) {
   }
   return 0;
 }
+#endif
 
 static int check_early_skip_sub_blockC (encoder_info_t *encoder_info, SAMPLE *orig, int orig_stride, int size, int qp, SAMPLE *pblock, float early_skip_threshold)
 {
@@ -2416,6 +2794,14 @@ int TEMPLATE(process_block)(encoder_info_t *encoder_info,int size,int ypos,int x
   int encode_this_size = ypos + size <= height && xpos + size <= width;
   int encode_rectangular_size = !encode_this_size && frame_type != I_FRAME;
   int top_down = size == 2 * MIN_BLOCK_SIZE && encode_this_size && frame_type != I_FRAME && !encoder_info->params->sync && encoder_info->params->encoder_speed > 0;
+
+  /* The fastest speeds only do mode decision for block sizes 16 to 64 */
+  int fast_mode_decision = encoder_info->params->encoder_speed > 2;
+  if (fast_mode_decision) {
+    encode_smaller_size = encode_smaller_size && (size > 16 || !encode_this_size);
+    top_down = 0;
+  }
+  int mode_decision_this_size = !fast_mode_decision || size <= 64 || !encode_smaller_size;
   uint32_t top_down_threshold = size * size * iq_8x8[qp] / 8;
 
   cost_small = 1<<28;
@@ -2470,17 +2856,16 @@ int TEMPLATE(process_block)(encoder_info_t *encoder_info,int size,int ypos,int x
 
   if (encode_this_size && frame_type != I_FRAME && encoder_info->params->early_skip_thr > 0.0){
 
-    YPOS = ypos;
-    XPOS = xpos;
-
     /* Search through all skip candidates for early skip */
     block_info->final_encode = 2;
     early_skip_flag = search_early_skip_candidates(encoder_info,block_info);
 
     /* Rewind stream to start position of this block size */
     write_stream_pos(stream,&stream_pos_ref);
+    search_count(encoder_info, size)[COUNT_REWIND]++;
 
     if (early_skip_flag){
+      search_count(encoder_info, size)[COUNT_EARLY_SKIP]++;
 
       /* Encode block with final choice of skip_idx */
       block_info->final_encode = 3;
@@ -2505,7 +2890,9 @@ int TEMPLATE(process_block)(encoder_info_t *encoder_info,int size,int ypos,int x
   if (encode_smaller_size && !top_down){
     new_size = size/2;
     split_flag = 1;
+    STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ENTROPY);
     write_super_mode(stream, encoder_info, block_info, block_param, split_flag, encode_this_size);
+    STAGE_END(encoder_info->timer);
     if (size == sb_size && (encoder_info->params->max_delta_qp || encoder_info->params->bitrate)) {
       write_delta_qp(stream,block_info->delta_qp);
     }
@@ -2516,28 +2903,34 @@ int TEMPLATE(process_block)(encoder_info_t *encoder_info,int size,int ypos,int x
     cost_small += TEMPLATE(process_block)(encoder_info,new_size,ypos+1*new_size,xpos+1*new_size,qp,sub);
   }
 
-  if (encode_this_size || encode_rectangular_size){
-    YPOS = ypos;
-    XPOS = xpos;
+  if ((encode_this_size || encode_rectangular_size) && mode_decision_this_size){
 
-    /* RDO-based mode decision */
+    /* RDO-based or SAD-based mode decision */
     block_info->final_encode = 0;
-    cost = mode_decision_rdo(encoder_info,block_info);
+    if (fast_mode_decision)
+      cost = mode_decision_fast(encoder_info,block_info);
+    else
+      cost = mode_decision_rdo(encoder_info,block_info);
 
     if (top_down && cost > top_down_threshold) {
       new_size = size/2;
       split_flag = 1;
+      STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ENTROPY);
       write_super_mode(stream, encoder_info, block_info, block_param, split_flag, encode_this_size);
+      STAGE_END(encoder_info->timer);
       cost_small = 0; //TODO: Why not nbit * lambda?
       cost_small += TEMPLATE(process_block)(encoder_info,new_size,ypos+0*new_size,xpos+0*new_size,qp,sub);
       cost_small += TEMPLATE(process_block)(encoder_info,new_size,ypos+1*new_size,xpos+0*new_size,qp,sub);
       cost_small += TEMPLATE(process_block)(encoder_info,new_size,ypos+0*new_size,xpos+1*new_size,qp,sub);
       cost_small += TEMPLATE(process_block)(encoder_info,new_size,ypos+1*new_size,xpos+1*new_size,qp,sub);
     }
+    else if (top_down)
+      search_count(encoder_info, size)[COUNT_SPLIT_STOP]++;
 
     if (cost <= cost_small) {
       /* Rewind bitstream to reference position of this block size */
       write_stream_pos(stream, &stream_pos_ref);
+      search_count(encoder_info, size)[COUNT_REWIND]++;
       block_info->final_encode = 1;
       encode_block(encoder_info, stream, block_info, &block_info->block_param);
 
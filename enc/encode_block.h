@@ -28,9 +28,22 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define _ENCODE_BLOCK_H_
 
 #include "mainenc.h"
+#include "simd.h"
 
 int TEMPLATE(process_block)(encoder_info_t *encoder_info,int size,int yposY,int xposY, int qp, int sub);
 void TEMPLATE(detect_clpf)(const SAMPLE *rec,const SAMPLE *org,int x0, int y0, int width, int height, int ostride,int rstride, int *sum0, int *sum1, unsigned int strength, unsigned int shift, unsigned int size, unsigned int dmp);
 void TEMPLATE(detect_multi_clpf)(const SAMPLE *rec,const SAMPLE *org,int x0, int y0, int width, int height, int ostride,int rstride, int *sum, unsigned int shift, unsigned int size, unsigned int dmp);
+unsigned int TEMPLATE(sad_calc)(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height);
+unsigned int TEMPLATE(widesad_calc)(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width, int height, int *x);
+uint64_t TEMPLATE(ssd_calc)(SAMPLE *a, SAMPLE *b, int astride, int bstride, int width,int height);
+unsigned int TEMPLATE(sad_calc_fasthalf)(const SAMPLE *a, const SAMPLE *b, int astride, int bstride, int width, int height, int *x, int *y);
+unsigned int TEMPLATE(sad_calc_fastquarter)(const SAMPLE *o, const SAMPLE *r, int os, int rs, int width, int height, int *x, int *y);
+int calc_cbp(int16_t *block, int size, int threshold);
+
+/* Search effort counters of the current frame type and block size */
+static inline uint64_t *search_count(encoder_info_t *encoder_info, int size)
+{
+  return encoder_info->search_stats.count[encoder_info->frame_info.frame_type][log2i(size) - 3];
+}
 
 #endif
@@ -37,6 +37,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "enc_kernels.h"
 #include "inter_prediction.h"
 #include "write_bits.h"
+#include "rt_control.h"
+#include "hash_me.h"
+#include "subpel_cache.h"
+#include "thread.h"
 
 extern int chroma_qp[52];
 extern double squared_lambda_QP[52];
@@ -201,13 +205,23 @@ static uint64_t dist_8x8(SAMPLE *dst, int dstride, SAMPLE *src,
   uint64_t sum_d2 = 0;
   uint64_t sum_sd = 0;
   int i, j;
-  for (i = 0; i < 8; i++) {
-    for (j = 0; j < 8; j++) {
-      sum_s += src[i * sstride + j];
-      sum_d += dst[i * dstride + j];
-      sum_s2 += src[i * sstride + j] * src[i * sstride + j];
-      sum_d2 += dst[i * dstride + j] * dst[i * dstride + j];
-      sum_sd += src[i * sstride + j] * dst[i * dstride + j];
+  if (use_simd) {
+    uint64_t sums[5];
+    TEMPLATE(dist_8x8_sums_simd)(dst, dstride, src, sstride, sums);
+    sum_s = sums[0];
+    sum_d = sums[1];
+    sum_s2 = sums[2];
+    sum_d2 = sums[3];
+    sum_sd = sums[4];
+  } else {
+    for (i = 0; i < 8; i++) {
+      for (j = 0; j < 8; j++) {
+        sum_s += src[i * sstride + j];
+        sum_d += dst[i * dstride + j];
+        sum_s2 += src[i * sstride + j] * src[i * sstride + j];
+        sum_d2 += dst[i * dstride + j] * dst[i * dstride + j];
+        sum_sd += src[i * sstride + j] * dst[i * dstride + j];
+      }
     }
   }
   /* Compute the variance -- the calculation cannot go negative. */
@@ -225,6 +239,157 @@ static int cdef_cmp(const void *a, const void *b) {
   return *(uint32_t*)a < *(uint32_t*)b ? -1 : *(uint32_t*)a > *(uint32_t*)b;
 }
 
+/* State shared by the filter blocks searched in parallel */
+typedef struct {
+  yuv_frame_t *rec;
+  yuv_frame_t *org;
+  deblock_data_t *deblock_data;
+  encoder_info_t *encoder_info;
+  int *ci_index;
+  uint64_t(*mse[2])[TOTAL_STRENGTHS];
+  uint16_t **src16;  // Per thread
+  SAMPLE **dst;      // Per thread
+  int num_fb_hor;
+  int speed;
+} cdef_search_t;
+
+/* Find the direction and variance of the 8x8 luma blocks of a filter block.
+   They are kept in encoder_info->cdef for all strengths and for cdef_frame(). */
+static void cdef_find_dirs(yuv_frame_t *rec, cdef_strengths *cdef, int xoff, int yoff, int coeff_shift) {
+  const int h = min(rec->height - yoff, CDEF_BLOCKSIZE);
+  const int w = min(rec->width - xoff, CDEF_BLOCKSIZE);
+  const int sstride = rec->stride_y;
+  SAMPLE *src_buffer = rec->y + yoff * sstride + xoff;
+
+  for (int m = 0; m < (h + 7) >> 3; m++)
+    for (int n = 0; n < (w + 7) >> 3; n++)
+      cdef->dir[m * 8 + n] = (use_simd ? TEMPLATE(cdef_find_dir_simd) : TEMPLATE(cdef_find_dir))(src_buffer + m * 8 * sstride + n * 8, sstride, &cdef->var[m * 8 + n], coeff_shift);
+}
+
+static void cdef_find_dirs_job(void *arg, int job, int thread) {
+  cdef_search_t *search = arg;
+  const int ci = search->ci_index[job];
+  cdef_find_dirs(search->rec, &search->encoder_info->cdef[ci], (ci % search->num_fb_hor) << CDEF_BLOCKSIZE_LOG2,
+                 (ci / search->num_fb_hor) << CDEF_BLOCKSIZE_LOG2, search->encoder_info->params->bitdepth - 8);
+}
+
+/* Filter one filter block with every strength and store the mse of luma and
+   chroma in row sb of search->mse */
+static void cdef_search_job(void *arg, int sb, int thread) {
+  cdef_search_t *search = arg;
+  yuv_frame_t *rec = search->rec;
+  yuv_frame_t *org = search->org;
+  encoder_info_t *encoder_info = search->encoder_info;
+  const int speed = search->speed;
+  const int ci = search->ci_index[sb];
+  const int width = rec->width;
+  const int height = rec->height;
+  const int fb_size_log2 = CDEF_BLOCKSIZE_LOG2;
+  const int k = ci / search->num_fb_hor;
+  const int l = ci % search->num_fb_hor;
+  const int xoff = l << fb_size_log2;
+  const int yoff = k << fb_size_log2;
+  const int total_strengths = pristrengths[speed];
+  const int pri_damping = encoder_info->cdef_damping;
+  const int sec_damping = pri_damping;
+  const int bs = 8;
+  const int bslog = log2i(bs);
+  const int padding = 2 + CDEF_FULL;
+  const int hpadding = 16 - padding;
+  const int stride16 = (64 + 2 * padding + 15) & ~15;
+  const int offset16 = padding * stride16 + padding + hpadding;
+  uint16_t *src16 = search->src16[thread];
+  SAMPLE *dst = search->dst[thread];
+  int cdef_directions_copy[8][2 + CDEF_FULL];
+  int coeff_shift = encoder_info->params->bitdepth - 8;
+  int h, w;
+
+  cdef_init(stride16, cdef_directions_copy);
+
+  // Calculate the actual filter block size near frame edges
+  h = min(height, (k + 1) << fb_size_log2) & ((1 << fb_size_log2) - 1);
+  w = min(width, (l + 1) << fb_size_log2) & ((1 << fb_size_log2) - 1);
+  h += !h << fb_size_log2;
+  w += !w << fb_size_log2;
+
+  cdef_find_dirs(rec, &encoder_info->cdef[ci], xoff, yoff, coeff_shift);
+
+  for (int plane = 0; plane < 3; plane++) {
+    const int sub = plane != 0 && rec->sub;
+    const int sstride = plane != 0 ? rec->stride_c : rec->stride_y;
+    SAMPLE *src_buffer = plane != 0 ? (plane == 1 ? rec->u : rec->v) : rec->y;
+
+    // Prepare input
+    int sizex = min(width - xoff, 64) >> sub;
+    int sizey =  min(height - yoff, 64) >> sub;
+    int xpos = xoff >> sub;
+    int ypos = yoff >> sub;
+    boundary_type bt =
+      (TILE_LEFT_BOUNDARY & -!xpos) |
+      (TILE_ABOVE_BOUNDARY & -!ypos) |
+      (TILE_RIGHT_BOUNDARY & -(xpos == (width >> sub) - sizex)) |
+      (TILE_BOTTOM_BOUNDARY & -(ypos == (height >> sub) - sizey));
+
+    TEMPLATE(cdef_prepare_input)(sizex, sizey, xpos, ypos, bt, padding, src16 + offset16, stride16, src_buffer, sstride);
+
+    for (int gi = 0; gi < total_strengths; gi++) {
+      int level;
+      int pri_strength, sec_strength;
+      level = gi / CDEF_SEC_STRENGTHS;
+      level = priconv[speed][level];
+      pri_strength = level;
+      sec_strength = (gi % CDEF_SEC_STRENGTHS);
+
+      if (plane < 2)
+        search->mse[plane][sb][gi] = 0;
+
+      for (int m = 0; m < ((h + bs - 1) >> (bslog + sub)); m++) {
+        for (int n = 0; n < ((w + bs - 1) >> (bslog + sub)); n++) {
+          int sizex, sizey;
+          xpos = (xoff >> sub) + n * bs;
+          ypos = (yoff >> sub) + m * bs;
+          sizex = min((width >> sub) - xpos, bs);
+          sizey = min((height >> sub) - ypos, bs);
+          int index = ((yoff + m * 8) / MIN_PB_SIZE) * (width/MIN_PB_SIZE) + ((xoff + n * 8) / MIN_PB_SIZE);
+
+          if (search->deblock_data[index].mode != MODE_SKIP) {
+
+            int adj_str = plane ? pri_strength : adjust_strength(pri_strength, encoder_info->cdef[ci].var[m * bs + n]);
+            int adj_pri_damping = adj_str ? max(log2i(adj_str), pri_damping - !!plane) : pri_damping - !!plane;
+            int adj_sec_damping = sec_damping - !!plane;
+
+            // Apply the filter.
+#ifdef HBD
+            (use_simd ? cdef_filter_block_simd : cdef_filter_block)(NULL, dst, sizex, src16 + offset16 + n * bs + m * bs * stride16, stride16,
+                         adj_str << coeff_shift, sec_strength << coeff_shift,
+                         pri_strength ? encoder_info->cdef[ci].dir[m * bs + n] : 0, adj_pri_damping + coeff_shift, adj_sec_damping + coeff_shift, sizex,
+                         cdef_directions_copy, coeff_shift);
+#else
+            (use_simd ? cdef_filter_block_simd : cdef_filter_block)(dst, NULL, sizex, src16 + offset16 + n * bs + m * bs * stride16, stride16,
+                         adj_str << coeff_shift, sec_strength << coeff_shift,
+                         pri_strength ? encoder_info->cdef[ci].dir[m * bs + n] : 0, adj_pri_damping + coeff_shift, adj_sec_damping + coeff_shift, sizex,
+                         cdef_directions_copy, coeff_shift);
+#endif
+
+            // Calc mse.  TODO: Improve metric
+            SAMPLE *org_buffer = (plane != 0 ? (plane == 1 ? org->u : org->v) : org->y) + ypos * sstride + xpos;
+            if (plane || sizex != 8 || sizey != 8) {
+              if (use_simd && (sizex == 8 || (sizex == 4 && !(sizey & 1))))
+                search->mse[!!plane][sb][gi] += TEMPLATE(cdef_sse_simd)(dst, sizex, org_buffer, sstride, sizex, sizey);
+              else
+                for (int i = 0; i < sizey; i++)
+                  for (int j = 0; j < sizex; j++)
+                    search->mse[!!plane][sb][gi] += (dst[i * sizex + j] - org_buffer[i * sstride + j]) *
+                      (dst[i * sizex + j] - org_buffer[i * sstride + j]);
+            } else
+              search->mse[!!plane][sb][gi] += dist_8x8(dst, sizex, org_buffer, sstride, coeff_shift);
+          }
+        }
+      }
+    }
+  }
+}
+
 int TEMPLATE(cdef_search)(yuv_frame_t *rec, yuv_frame_t *org, deblock_data_t *deblock_data, const frame_info_t *frame_info, encoder_info_t *encoder_info,
                           int strengths[8], int uv_strengths[8], int speed) {
   int width = rec->width;
@@ -232,29 +397,30 @@ int TEMPLATE(cdef_search)(yuv_frame_t *rec, yuv_frame_t *org, deblock_data_t *de
   const int fb_size_log2 = CDEF_BLOCKSIZE_LOG2;
   const int num_fb_hor = (width + (1 << fb_size_log2) - 1) >> fb_size_log2;
   const int num_fb_ver = (height + (1 << fb_size_log2) - 1) >> fb_size_log2;
+  const int num_threads = thor_workers_num_threads(encoder_info->workers);
   uint64_t best_tot_mse = (uint64_t)1 << 63;
   uint64_t tot_mse;
-  uint64_t(*mse[2])[TOTAL_STRENGTHS];
-  int pri_damping = encoder_info->cdef_damping;
-  int sec_damping = pri_damping;
-  const int total_strengths = pristrengths[speed];
   int sb_count = 0;
-  const int bs = 8;
-  const int bslog = log2i(bs);
   int padding = 2 + CDEF_FULL;
   int hpadding = 16 - padding;
   int stride16 = (64 + 2 * padding + 15) & ~15;
-  int offset16 = padding * stride16 + padding + hpadding;
-  uint16_t *src16 = thor_alloc((64 + 2 * padding) * stride16 * sizeof(uint16_t) + hpadding, 32);
-  SAMPLE *dst = thor_alloc(bs * bs * sizeof(SAMPLE), 32);
-  int cdef_directions[8][2 + CDEF_FULL];
-  int cdef_directions_copy[8][2 + CDEF_FULL];
   int *ci_index = thor_alloc(num_fb_hor * num_fb_ver * sizeof(*ci_index), 16);
   int *selected_strength = thor_alloc(num_fb_hor * num_fb_ver * sizeof(*ci_index), 16);
   stream_t *stream = encoder_info->stream;
-  const int bitdepth = encoder_info->params->bitdepth;
+  cdef_search_t search;
 
-  cdef_init(stride16, cdef_directions_copy);
+  // The filter blocks to search
+  for (int ci = 0; ci < num_fb_hor * num_fb_ver; ci++)
+    if (!cdef_allskip((ci % num_fb_hor) << fb_size_log2, (ci / num_fb_hor) << fb_size_log2, width, height, deblock_data, fb_size_log2))
+      ci_index[sb_count++] = ci;
+
+  search.rec = rec;
+  search.org = org;
+  search.deblock_data = deblock_data;
+  search.encoder_info = encoder_info;
+  search.ci_index = ci_index;
+  search.num_fb_hor = num_fb_hor;
+  search.speed = speed;
 
   if (speed == 3) encoder_info->cdef_bits = 0;
 
@@ -278,114 +444,25 @@ int TEMPLATE(cdef_search)(yuv_frame_t *rec, yuv_frame_t *org, deblock_data_t *de
         ci++;
       }
     }
+    thor_workers_run(encoder_info->workers, cdef_find_dirs_job, &search, sb_count);
+    thor_free(ci_index);
+    thor_free(selected_strength);
     return 0;
   }
 
-  mse[0] = thor_alloc(sizeof(**mse) * num_fb_hor * num_fb_ver, 32);
-  mse[1] = thor_alloc(sizeof(**mse) * num_fb_hor * num_fb_ver, 32);
-
-  int ci = -1;
-  for (int k = 0; k < num_fb_ver; k++) {
-    for (int l = 0; l < num_fb_hor; l++) {
-
-      int h, w;
-      const int xoff = l << fb_size_log2;
-      const int yoff = k << fb_size_log2;
-      int allskip = cdef_allskip(xoff, yoff, width, height, deblock_data, fb_size_log2);
-      ci++;
-
-      if (allskip)
-        continue;
+  search.mse[0] = thor_alloc(sizeof(**search.mse) * num_fb_hor * num_fb_ver, 32);
+  search.mse[1] = thor_alloc(sizeof(**search.mse) * num_fb_hor * num_fb_ver, 32);
+  search.src16 = thor_alloc(num_threads * sizeof(*search.src16), 16);
+  search.dst = thor_alloc(num_threads * sizeof(*search.dst), 16);
+  for (int t = 0; t < num_threads; t++) {
+    search.src16[t] = thor_alloc((64 + 2 * padding) * stride16 * sizeof(uint16_t) + hpadding, 32);
+    search.dst[t] = thor_alloc(8 * 8 * sizeof(SAMPLE), 32);
+  }
 
-      // Calculate the actual filter block size near frame edges
-      h = min(height, (k + 1) << fb_size_log2) & ((1 << fb_size_log2) - 1);
-      w = min(width, (l + 1) << fb_size_log2) & ((1 << fb_size_log2) - 1);
-      h += !h << fb_size_log2;
-      w += !w << fb_size_log2;
+  // Gather the mse of every strength, one filter block per job
+  thor_workers_run(encoder_info->workers, cdef_search_job, &search, sb_count);
 
-      int index = (yoff/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (xoff/MIN_PB_SIZE);
-
-      int coeff_shift = bitdepth - 8;
-
-      // TODO: HBD
-      for (int plane = 0; plane < 3; plane++) {
-        const int sub = plane != 0 && rec->sub;
-        const int sstride = plane != 0 ? rec->stride_c : rec->stride_y;
-        SAMPLE *src_buffer = plane != 0 ? (plane == 1 ? rec->u : rec->v) : rec->y;
-        cdef_init(sstride, cdef_directions);  // TODO: calc once
-
-        // Prepare input
-	int sizex = min(width - xoff, 64) >> sub;
-	int sizey =  min(height - yoff, 64) >> sub;
-	int xpos = xoff >> sub;
-	int ypos = yoff >> sub;
-	boundary_type bt =
-	  (TILE_LEFT_BOUNDARY & -!xpos) |
-	  (TILE_ABOVE_BOUNDARY & -!ypos) |
-	  (TILE_RIGHT_BOUNDARY & -(xpos == (width >> sub) - sizex)) |
-	  (TILE_BOTTOM_BOUNDARY & -(ypos == (height >> sub) - sizey));
-
-	TEMPLATE(cdef_prepare_input)(sizex, sizey, xpos, ypos, bt, padding, src16 + offset16, stride16, src_buffer, sstride);
-
-        for (int gi = 0; gi < total_strengths; gi++) {
-          int level;
-          int pri_strength, sec_strength;
-          level = gi / CDEF_SEC_STRENGTHS;
-          level = priconv[speed][level];
-          pri_strength = level;
-          sec_strength = (gi % CDEF_SEC_STRENGTHS);
-
-          if (plane < 2)
-            mse[plane][sb_count][gi] = 0;
-
-          for (int m = 0; m < ((h + bs - 1) >> (bslog + sub)); m++) {
-            for (int n = 0; n < ((w + bs - 1) >> (bslog + sub)); n++) {
-              int sizex, sizey;
-              xpos = (xoff >> sub) + n * bs;
-              ypos = (yoff >> sub) + m * bs;
-              sizex = min((width >> sub) - xpos, bs);
-              sizey = min((height >> sub) - ypos, bs);
-              index = ((yoff + m * 8) / MIN_PB_SIZE) * (width/MIN_PB_SIZE) + ((xoff + n * 8) / MIN_PB_SIZE);
-
-              if (plane == 0 && gi == 0)
-                encoder_info->cdef[ci].dir[m * bs + n] = (use_simd ? TEMPLATE(cdef_find_dir_simd) : TEMPLATE(cdef_find_dir))(src_buffer + ypos * sstride + xpos, sstride, &encoder_info->cdef[ci].var[m * bs + n], coeff_shift);
-
-              if (deblock_data[index].mode != MODE_SKIP) {
-
-                int adj_str = plane ? pri_strength : adjust_strength(pri_strength, encoder_info->cdef[ci].var[m * bs + n]);
-                int adj_pri_damping = adj_str ? max(log2i(adj_str), pri_damping - !!plane) : pri_damping - !!plane;
-                int adj_sec_damping = sec_damping - !!plane;
-
-                // Apply the filter.
-#ifdef HBD
-                (use_simd ? cdef_filter_block_simd : cdef_filter_block)(NULL, dst, sizex, src16 + offset16 + n * bs + m * bs * stride16, stride16,
-                             adj_str << coeff_shift, sec_strength << coeff_shift,
-                             pri_strength ? encoder_info->cdef[ci].dir[m * bs + n] : 0, adj_pri_damping + coeff_shift, adj_sec_damping + coeff_shift, sizex,
-                             cdef_directions_copy, coeff_shift);
-#else
-                (use_simd ? cdef_filter_block_simd : cdef_filter_block)(dst, NULL, sizex, src16 + offset16 + n * bs + m * bs * stride16, stride16,
-                             adj_str << coeff_shift, sec_strength << coeff_shift,
-                             pri_strength ? encoder_info->cdef[ci].dir[m * bs + n] : 0, adj_pri_damping + coeff_shift, adj_sec_damping + coeff_shift, sizex,
-                             cdef_directions_copy, coeff_shift);
-#endif
-
-                // Calc mse.  TODO: Improve metric
-                SAMPLE *org_buffer = (plane != 0 ? (plane == 1 ? org->u : org->v) : org->y) + ypos * sstride + xpos;
-                if (plane || sizex != 8 || sizey != 8)
-                  for (int i = 0; i < sizey; i++)
-                    for (int j = 0; j < sizex; j++)
-                       mse[!!plane][sb_count][gi] += (dst[i * sizex + j] - org_buffer[i * sstride + j]) *
-                        (dst[i * sizex + j] - org_buffer[i * sstride + j]);
-                else
-                  mse[!!plane][sb_count][gi] += dist_8x8(dst, sizex, org_buffer, sstride, coeff_shift);
-              }
-            }
-          }
-        }
-      }
-      ci_index[sb_count++] = ci;
-    }
-  }
+  uint64_t(**mse)[TOTAL_STRENGTHS] = search.mse;
 
   int nb_strengths;
   int nb_strength_bits;
@@ -432,10 +509,13 @@ int TEMPLATE(cdef_search)(yuv_frame_t *rec, yuv_frame_t *org, deblock_data_t *de
     }
   }
 
-  // Reduce the number of bits per block
-  nb_strength_bits = log2i(j);
-
+  // The number of bits per block is fixed by the space already reserved for
+  // the frame level parameters, so fill the unused presets with duplicates
   nb_strengths = 1 << nb_strength_bits;
+  for (int i = j; i < nb_strengths; i++) {
+    strengths[i] = strengths[0];
+    uv_strengths[i] = uv_strengths[0];
+  }
 
   // Assign the best preset to every filter block
   for (int i = 0; i < sb_count; i++) {
@@ -479,8 +559,12 @@ int TEMPLATE(cdef_search)(yuv_frame_t *rec, yuv_frame_t *org, deblock_data_t *de
 
   thor_free(mse[0]);
   thor_free(mse[1]);
-  thor_free(src16);
-  thor_free(dst);
+  for (int t = 0; t < num_threads; t++) {
+    thor_free(search.src16[t]);
+    thor_free(search.dst[t]);
+  }
+  thor_free(search.src16);
+  thor_free(search.dst);
 
   thor_free(ci_index);
   thor_free(selected_strength);
@@ -489,9 +573,86 @@ int TEMPLATE(cdef_search)(yuv_frame_t *rec, yuv_frame_t *org, deblock_data_t *de
 }
 #endif
 
-static int clpf_decision(int k, int l, const yuv_frame_t *rec, const yuv_frame_t *org, const deblock_data_t *deblock_data, int block_size, int w, int h, void *stream, unsigned int strength, unsigned int fb_size_log2, unsigned int shift, unsigned int size, int qp) {
+/* Square errors of the 8x8 blocks of each plane before filtering and after
+   filtering with the strengths 1, 2 and 4, found in one pass over the frame
+   and shared by clpf_test_frame() and clpf_decision(). Skip blocks are 0. */
+typedef struct {
+  yuv_frame_t *rec;
+  yuv_frame_t *org;
+  const deblock_data_t *deblock_data;
+  stream_t *stream;  // For the luma filter block flags
+  int (*sums[3])[4];
+  int cols[3];
+  int rows[3];
+  int bitdepth;
+  int qp;
+} clpf_stats_t;
+
+/* Find the square errors of one row of 8x8 blocks. The jobs are the luma rows
+   followed by the rows of the two chroma planes. */
+static void clpf_stats_job(void *arg, int job, int thread) {
+  clpf_stats_t *stats = arg;
+  yuv_frame_t *rec = stats->rec;
+  yuv_frame_t *org = stats->org;
+  const int bs = 8;
+  int plane = PLANE_Y;
+
+  while (job >= stats->rows[plane])
+    job -= stats->rows[plane++];
+
+  const int sub = plane != PLANE_Y && org->sub;
+  const SAMPLE *rec_buffer = plane != PLANE_Y ? (plane == PLANE_U ? rec->u : rec->v) : rec->y;
+  const SAMPLE *org_buffer = plane != PLANE_Y ? (plane == PLANE_U ? org->u : org->v) : org->y;
+  const int rec_width = plane != PLANE_Y ? (rec->width >> rec->sub) : rec->width;
+  const int rec_height = plane != PLANE_Y ? (rec->height >> rec->sub) : rec->height;
+  const int rec_stride = plane != PLANE_Y ? rec->stride_c : rec->stride_y;
+  const int org_stride = plane != PLANE_Y ? org->stride_c : org->stride_y;
+  const int damping = stats->bitdepth - 4 - (plane != PLANE_Y) + (stats->qp >> 4);
+  const int ypos = job * bs;
+
+  for (int n = 0; n < stats->cols[plane]; n++) {
+    int xpos = n * bs;
+    int index = ((ypos << sub) / MIN_PB_SIZE)*(rec->width / MIN_PB_SIZE) + ((xpos << sub) / MIN_PB_SIZE);
+    int *sum = stats->sums[plane][job * stats->cols[plane] + n];
+    if (stats->deblock_data[index].mode != MODE_SKIP) {
+      if (use_simd)
+        TEMPLATE(detect_multi_clpf_simd)(rec_buffer, org_buffer, xpos, ypos, rec_width, rec_height, org_stride, rec_stride, sum, stats->bitdepth - 8, bs, damping);
+      else
+        TEMPLATE(detect_multi_clpf)(rec_buffer, org_buffer, xpos, ypos, rec_width, rec_height, org_stride, rec_stride, sum, stats->bitdepth - 8, bs, damping);
+    }
+  }
+}
+
+static void clpf_find_stats(clpf_stats_t *stats, encoder_info_t *encoder_info, int qp) {
+  yuv_frame_t *rec = encoder_info->rec;
+  int num_jobs = 0;
+
+  stats->rec = rec;
+  stats->org = encoder_info->orig;
+  stats->deblock_data = encoder_info->deblock_data;
+  stats->stream = encoder_info->stream;
+  stats->bitdepth = encoder_info->params->bitdepth;
+  stats->qp = qp;
+  for (int plane = PLANE_Y; plane <= PLANE_V; plane++) {
+    const int sub = plane != PLANE_Y ? rec->sub : 0;
+    stats->cols[plane] = (rec->width >> sub) / 8;
+    stats->rows[plane] = (rec->height >> sub) / 8;
+    stats->sums[plane] = calloc(stats->cols[plane] * stats->rows[plane], sizeof(*stats->sums[plane]));
+    num_jobs += stats->rows[plane];
+  }
+  thor_workers_run(encoder_info->workers, clpf_stats_job, stats, num_jobs);
+}
+
+static void clpf_free_stats(clpf_stats_t *stats) {
+  for (int plane = PLANE_Y; plane <= PLANE_V; plane++)
+    free(stats->sums[plane]);
+}
+
+/* Signal whether to filter a luma filter block. arg is the clpf_stats_t. */
+static int clpf_decision(int k, int l, const yuv_frame_t *rec, const yuv_frame_t *org, const deblock_data_t *deblock_data, int block_size, int w, int h, void *arg, unsigned int strength, unsigned int fb_size_log2, unsigned int shift, unsigned int size, int qp) {
+  const clpf_stats_t *stats = arg;
+  const int i = (strength >> shift) == 4 ? 3 : strength >> shift;
   int sum0 = 0, sum1 = 0;
-  int damping = shift + 4 + (qp >> 4);
 
   for (int m = 0; m < h; m++) {
     for (int n = 0; n < w; n++) {
@@ -499,14 +660,13 @@ static int clpf_decision(int k, int l, const yuv_frame_t *rec, const yuv_frame_t
       int ypos = (k<<fb_size_log2) + m*block_size;
       int index = (ypos / MIN_PB_SIZE)*(rec->width / MIN_PB_SIZE) + (xpos / MIN_PB_SIZE);
       if (deblock_data[index].mode != MODE_SKIP) {
-        if (use_simd && size == 8)
-          TEMPLATE(detect_clpf_simd)(rec->y, org->y, xpos, ypos, rec->width, rec->height, org->stride_y, rec->stride_y, &sum0, &sum1, strength, shift, size, damping);
-        else
-          TEMPLATE(detect_clpf)(rec->y, org->y, xpos, ypos, rec->width, rec->height, org->stride_y, rec->stride_y, &sum0, &sum1, strength, shift, size, damping);
+        const int *sum = stats->sums[PLANE_Y][(ypos / 8) * stats->cols[PLANE_Y] + xpos / 8];
+        sum0 += sum[0];
+        sum1 += sum[i];
       }
     }
   }
-  put_flc(1, sum1 < sum0, (stream_t*)stream);
+  put_flc(1, sum1 < sum0, stats->stream);
   return sum1 < sum0;
 }
 
@@ -520,11 +680,10 @@ static int clpf_decision(int k, int l, const yuv_frame_t *rec, const yuv_frame_t
 // res[2][1-3] : strength=1,2,4, fb size = 64
 // res[3][0]   : (bit count, fb size = 32)
 // res[3][1-3] : strength=1,2,4, fb size = 32
-static int clpf_rdo(int y, int x, yuv_frame_t *rec, yuv_frame_t *org, const deblock_data_t *deblock_data, unsigned int block_size, unsigned int fb_size_log2, int w, int h, int64_t res[4][4], int bitdepth, plane_t plane, int qp) {
+static int clpf_rdo(int y, int x, const clpf_stats_t *stats, unsigned int block_size, unsigned int fb_size_log2, int w, int h, int64_t res[4][4], plane_t plane) {
   int filtered = 0;
   int sum[4];
   int bslog = log2i(block_size);
-  int damping = bitdepth - 4 - (plane != PLANE_Y) + (qp >> 4);
 
   sum[0] = sum[1] = sum[2] = sum[3] = 0;
   if (plane == PLANE_Y && fb_size_log2 > log2i(MAX_SB_SIZE) - 3) {
@@ -538,12 +697,12 @@ static int clpf_rdo(int y, int x, yuv_frame_t *rec, yuv_frame_t *org, const debl
     int64_t oldfiltered = res[i][0];
     res[i][0] = 0;
 
-    filtered = clpf_rdo(y, x, rec, org, deblock_data, block_size, fb_size_log2, w1, h1, res, bitdepth, plane, qp);
+    filtered = clpf_rdo(y, x, stats, block_size, fb_size_log2, w1, h1, res, plane);
     if (1<<(fb_size_log2-bslog) < w)
-      filtered |= clpf_rdo(y, x+(1<<fb_size_log2), rec, org, deblock_data, block_size, fb_size_log2, w2, h1, res, bitdepth, plane, qp);
+      filtered |= clpf_rdo(y, x+(1<<fb_size_log2), stats, block_size, fb_size_log2, w2, h1, res, plane);
     if (1<<(fb_size_log2-bslog) < h) {
-      filtered |= clpf_rdo(y+(1<<fb_size_log2), x, rec, org, deblock_data, block_size, fb_size_log2, w1, h2, res, bitdepth, plane, qp);
-      filtered |= clpf_rdo(y+(1<<fb_size_log2), x+(1<<fb_size_log2), rec, org, deblock_data, block_size, fb_size_log2, w2, h2, res, bitdepth, plane, qp);
+      filtered |= clpf_rdo(y+(1<<fb_size_log2), x, stats, block_size, fb_size_log2, w1, h2, res, plane);
+      filtered |= clpf_rdo(y+(1<<fb_size_log2), x+(1<<fb_size_log2), stats, block_size, fb_size_log2, w2, h2, res, plane);
     }
 
     res[i][1] = min(sum1 + res[i][0], res[i][1]);
@@ -553,24 +712,18 @@ static int clpf_rdo(int y, int x, yuv_frame_t *rec, yuv_frame_t *org, const debl
     return filtered;
   }
 
-  SAMPLE *rec_buffer = plane != PLANE_Y ? (plane == PLANE_U ? rec->u : rec->v) : rec->y;
-  SAMPLE *org_buffer = plane != PLANE_Y ? (plane == PLANE_U ? org->u : org->v) : org->y;
-  int rec_width = plane != PLANE_Y ? (rec->width >> rec->sub) : rec->width;
-  int rec_height = plane != PLANE_Y ? (rec->height >> rec->sub) : rec->height;
-  int rec_stride = plane != PLANE_Y ? rec->stride_c : rec->stride_y;
-  int org_stride = plane != PLANE_Y ? org->stride_c : org->stride_y;
-
   for (int m = 0; m < h; m++) {
     for (int n = 0; n < w; n++) {
       int xpos = x + n*block_size;
       int ypos = y + m*block_size;
-      int sub = plane != PLANE_Y && org->sub;
-      int index = ((ypos << sub) / MIN_PB_SIZE)*(rec->width / MIN_PB_SIZE) + ((xpos << sub) / MIN_PB_SIZE);
-      if (deblock_data[index].mode != MODE_SKIP) {
-        if (use_simd && block_size == 8)
-          TEMPLATE(detect_multi_clpf_simd)(rec_buffer, org_buffer, xpos, ypos, rec_width, rec_height, org_stride, rec_stride, sum, bitdepth - 8, block_size, damping);
-        else
-          TEMPLATE(detect_multi_clpf)(rec_buffer, org_buffer, xpos, ypos, rec_width, rec_height, org_stride, rec_stride, sum, bitdepth - 8, block_size, damping);
+      int sub = plane != PLANE_Y && stats->org->sub;
+      int index = ((ypos << sub) / MIN_PB_SIZE)*(stats->rec->width / MIN_PB_SIZE) + ((xpos << sub) / MIN_PB_SIZE);
+      if (stats->deblock_data[index].mode != MODE_SKIP) {
+        const int *s = stats->sums[plane][(ypos / block_size) * stats->cols[plane] + xpos / block_size];
+        sum[0] += s[0];
+        sum[1] += s[1];
+        sum[2] += s[2];
+        sum[3] += s[3];
         filtered = 1;
       }
     }
@@ -585,7 +738,8 @@ static int clpf_rdo(int y, int x, yuv_frame_t *rec, yuv_frame_t *org, const debl
   return filtered;
 }
 
-static void clpf_test_frame(yuv_frame_t *rec, yuv_frame_t *org, const deblock_data_t *deblock_data, const frame_info_t *frame_info, int *best_strength, int *best_bs, int bitdepth, plane_t plane) {
+static void clpf_test_frame(const clpf_stats_t *stats, const frame_info_t *frame_info, int *best_strength, int *best_bs, plane_t plane) {
+  const yuv_frame_t *rec = stats->rec;
 
   int64_t sums[4][4];
   int width = plane != PLANE_Y ? rec->width >> rec->sub : rec->width;
@@ -595,7 +749,7 @@ static void clpf_test_frame(yuv_frame_t *rec, yuv_frame_t *org, const deblock_da
   int fb_size_log2 = log2i(MAX_SB_SIZE);
 
   if (plane != PLANE_Y)
-    clpf_rdo(0, 0, rec, org, deblock_data, bs, fb_size_log2, width/bs, height/bs, sums, bitdepth, plane, frame_info->qp);
+    clpf_rdo(0, 0, stats, bs, fb_size_log2, width/bs, height/bs, sums, plane);
   else
     for (int k = 0; k < (height+(1<<fb_size_log2)-bs)>>fb_size_log2; k++) {
       for (int l = 0; l < (width+(1<<fb_size_log2)-bs)>>fb_size_log2; l++) {
@@ -603,7 +757,7 @@ static void clpf_test_frame(yuv_frame_t *rec, yuv_frame_t *org, const deblock_da
         int w = min(width, (l+1)<<fb_size_log2) & ((1<<fb_size_log2)-1);
         h += !h << fb_size_log2;
         w += !w << fb_size_log2;
-        clpf_rdo((k<<fb_size_log2), (l<<fb_size_log2), rec, org, deblock_data, bs, fb_size_log2, w/bs, h/bs, sums, bitdepth, plane, frame_info->qp);
+        clpf_rdo((k<<fb_size_log2), (l<<fb_size_log2), stats, bs, fb_size_log2, w/bs, h/bs, sums, plane);
       }
     }
 
@@ -634,6 +788,52 @@ static void clpf_test_frame(yuv_frame_t *rec, yuv_frame_t *org, const deblock_da
   *best_strength = best ? 1<<((best-1) & 3) : 0;  
 }
 
+// Pick CLPF strengths from QP for the fastest encoder speeds
+static void clpf_strength_from_qp(const frame_info_t *frame_info, int *strength_y, int *strength_uv) {
+  int level = frame_info->qp < 24 ? 1 : frame_info->qp < 36 ? 2 : 3;
+  level = min(level, min(frame_info->max_clpf_strength, 3));
+  *strength_y = level ? 1 << (level - 1) : 0;
+  *strength_uv = *strength_y >> 1;
+}
+
+// Signal the luma CLPF filter block flags of clpf_frame() without filtering the frame
+static void clpf_signal_frame(const clpf_stats_t *stats, unsigned int strength, unsigned int fb_size_log2) {
+  const yuv_frame_t *rec = stats->rec;
+  const deblock_data_t *deblock_data = stats->deblock_data;
+  const int bitdepth = stats->bitdepth;
+  const int bs = 8;
+  int width = rec->width;
+  int height = rec->height;
+  const int num_fb_hor = (width + (1 << fb_size_log2) - 1) >> fb_size_log2;
+  const int num_fb_ver = (height + (1 << fb_size_log2) - 1) >> fb_size_log2;
+
+  strength <<= bitdepth - 8;
+  for (int k = 0; k < num_fb_ver; k++) {
+    for (int l = 0; l < num_fb_hor; l++) {
+      int h, w;
+      int allskip = 1;
+      const int xoff = l << fb_size_log2;
+      const int yoff = k << fb_size_log2;
+      for (int m = 0; allskip && m < (1 << fb_size_log2) / bs; m++) {
+        for (int n = 0; allskip && n < (1 << fb_size_log2) / bs; n++) {
+          int xpos = xoff + n * bs;
+          int ypos = yoff + m * bs;
+          if (xpos < width && ypos < height) {
+            int index = (ypos/MIN_PB_SIZE)*(width/MIN_PB_SIZE) + (xpos/MIN_PB_SIZE);
+            allskip &= deblock_data[index].mode == MODE_SKIP;
+          }
+        }
+      }
+      h = min(height, (k + 1) << fb_size_log2) & ((1 << fb_size_log2) - 1);
+      w = min(width, (l + 1) << fb_size_log2) & ((1 << fb_size_log2) - 1);
+      h += !h << fb_size_log2;
+      w += !w << fb_size_log2;
+      if (!allskip)
+        clpf_decision(k, l, rec, stats->org, deblock_data, bs, w / bs, h / bs, (void *)stats, strength, fb_size_log2, bitdepth - 8, bs, stats->qp);
+    }
+  }
+}
+
 void TEMPLATE(encode_frame)(encoder_info_t *encoder_info)
 {
   int k,l;
@@ -685,15 +885,22 @@ void TEMPLATE(encode_frame)(encoder_info_t *encoder_info)
   encoder_info->cdef_damping = 5;
   encoder_info->cdef_bits = frame_info->frame_type == I_FRAME ? 3 : 3 - (encoder_info->frame_info.qp + 4) / 16;
 
+  // The fastest speeds use a single strength derived from QP without search
+  if (encoder_info->params->encoder_speed > 2 || encoder_info->params->cdef == 4)
+    encoder_info->cdef_bits = 0;
+
   for (int i = 0; i < (1 << encoder_info->cdef_bits); i++)
     encoder_info->cdef_strengths[i] = encoder_info->cdef_uv_strengths[i] = 127;
 #endif
 
+  STAGE_BEGIN(encoder_info->timer, ENC_STAGE_ENTROPY);
   write_frame_header(stream, encoder_info);
+  STAGE_END(encoder_info->timer);
 
   // Initialize prev_qp to qp used in frame header
   encoder_info->frame_info.prev_qp = encoder_info->frame_info.qp;
 
+  STAGE_BEGIN(encoder_info->timer, ENC_STAGE_BLOCKS);
   for (k=0;k<num_sb_ver;k++){
     for (l=0;l<num_sb_hor;l++){
       int sub = encoder_info->params->subsample == 400 ? 31 : encoder_info->params->subsample == 420;
@@ -726,6 +933,7 @@ void TEMPLATE(encode_frame)(encoder_info_t *encoder_info)
         }
         encoder_info->frame_info.prev_qp = pqp; // Restore prev_qp from local variable
         write_stream_pos(stream,&stream_pos_ref);
+        search_count(encoder_info, sb_size)[COUNT_REWIND]++;
         TEMPLATE(process_block)(encoder_info, sb_size, yposY, xposY, best_qp, sub);
       }
       else{
@@ -742,7 +950,15 @@ void TEMPLATE(encode_frame)(encoder_info_t *encoder_info)
         }
       }
     }
+    if (encoder_info->rtc)
+      rt_control_sb_row(encoder_info->rtc, encoder_info, k+1, num_sb_ver);
+
+    /* Low-delay mode: end a unit after each group of SB rows */
+    int rows_per_unit = encoder_info->params->sb_rows_per_unit;
+    if (rows_per_unit && ((k+1) % rows_per_unit == 0 || k+1 == num_sb_ver))
+      flush_unit_bits(stream, encoder_info->out);
   }
+  STAGE_END(encoder_info->timer);
 
   qp = encoder_info->frame_info.qp = encoder_info->frame_info.prev_qp; //TODO: Consider using average QP instead
 
@@ -755,23 +971,40 @@ void TEMPLATE(encode_frame)(encoder_info_t *encoder_info)
     TEMPLATE(store_mv)(width, height, b_level, frame_type, frame_num, gop_size, encoder_info->deblock_data);
   }
 
-  if (encoder_info->params->deblocking){
+  /* The in-loop filters only need to be applied if the reconstruction is used */
+  int apply_filters = !frame_info->non_ref || encoder_info->params->reconfilestr || encoder_info->params->snrcalc || encoder_info->params->ssim;
+
+  if (encoder_info->params->deblocking && apply_filters){
     //TODO: Use QP per SB or average QP
+    STAGE_BEGIN(encoder_info->timer, ENC_STAGE_DEBLOCK);
     TEMPLATE(deblock_frame_y)(encoder_info->rec, encoder_info->deblock_data, width, height, qp, encoder_info->params->bitdepth);
     if (encoder_info->params->subsample != 400) {
       int qpc = encoder_info->params->subsample != 444 ? chroma_qp[qp] : qp;
       TEMPLATE(deblock_frame_uv)(encoder_info->rec, encoder_info->deblock_data, width, height, qpc, encoder_info->params->bitdepth);
     }
+    STAGE_END(encoder_info->timer);
   }
 
 #if CDEF
+  // In low-delay mode the CDEF parameters start the unit following the SB rows
+  if (encoder_info->params->sb_rows_per_unit) {
+    read_stream_pos(&encoder_info->cdef_header_pos, stream);
+    write_cdef_params(stream, encoder_info);
+  }
+
   if (encoder_info->params->cdef) {
+    STAGE_BEGIN(encoder_info->timer, ENC_STAGE_CDEF_SEARCH);
     int cdef_bits = TEMPLATE(cdef_search)(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, frame_info, encoder_info, encoder_info->cdef_strengths, encoder_info->cdef_uv_strengths, encoder_info->params->cdef - 1);
+    STAGE_END(encoder_info->timer);
 
     // Apply the filter using the chosen strengths
-    TEMPLATE(cdef_frame)(encoder_info->cdef, encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, encoder_info->params->bitdepth, 0);
-    TEMPLATE(cdef_frame)(encoder_info->cdef, encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, encoder_info->params->bitdepth, 1);
-    TEMPLATE(cdef_frame)(encoder_info->cdef, encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, encoder_info->params->bitdepth, 2);
+    if (apply_filters) {
+      STAGE_BEGIN(encoder_info->timer, ENC_STAGE_CDEF_FILTER);
+      TEMPLATE(cdef_frame)(encoder_info->cdef, encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, encoder_info->params->bitdepth, 0, 0);
+      TEMPLATE(cdef_frame)(encoder_info->cdef, encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, encoder_info->params->bitdepth, 0, 1);
+      TEMPLATE(cdef_frame)(encoder_info->cdef, encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, encoder_info->params->bitdepth, 0, 2);
+      STAGE_END(encoder_info->timer);
+    }
 
     // Modify the uncompressed header
     stream_pos_t cur_stream_pos;
@@ -790,10 +1023,22 @@ void TEMPLATE(encode_frame)(encoder_info_t *encoder_info)
       int enable_fb_flag = 1;
       int fb_size_log2;
       int strength_y, strength_u, strength_v;
-      // Find the best strength for the entire frame
-      clpf_test_frame(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, frame_info, &strength_y, &fb_size_log2, encoder_info->params->bitdepth, PLANE_Y);
-      clpf_test_frame(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, frame_info, &strength_u, 0, encoder_info->params->bitdepth, PLANE_U);
-      clpf_test_frame(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, frame_info, &strength_v, 0, encoder_info->params->bitdepth, PLANE_V);
+      clpf_stats_t stats;
+      if (encoder_info->params->encoder_speed > 2) {
+        // Derive frame level strengths from QP without search
+        clpf_strength_from_qp(frame_info, &strength_y, &strength_u);
+        strength_v = strength_u;
+        fb_size_log2 = 0;
+        memset(&stats, 0, sizeof(stats));
+      } else {
+        // Find the best strength for the entire frame
+        STAGE_BEGIN(encoder_info->timer, ENC_STAGE_CLPF_SEARCH);
+        clpf_find_stats(&stats, encoder_info, qp);
+        clpf_test_frame(&stats, frame_info, &strength_y, &fb_size_log2, PLANE_Y);
+        clpf_test_frame(&stats, frame_info, &strength_u, 0, PLANE_U);
+        clpf_test_frame(&stats, frame_info, &strength_v, 0, PLANE_V);
+        STAGE_END(encoder_info->timer);
+      }
       if (!fb_size_log2) { // Disable sb signal
         enable_fb_flag = 0;
         fb_size_log2 = log2i(MAX_SB_SIZE);
@@ -803,14 +1048,20 @@ void TEMPLATE(encode_frame)(encoder_info_t *encoder_info)
       put_flc(2, strength_u - (strength_u == 4), stream);
       put_flc(2, strength_v - (strength_v == 4), stream);
       // Apply the filter using the chosen strengths
+      STAGE_BEGIN(encoder_info->timer, ENC_STAGE_CLPF_FILTER);
       if (strength_y) {
         put_flc(2, (fb_size_log2 - 4)*enable_fb_flag, stream);
-        TEMPLATE(clpf_frame)(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, enable_fb_flag, strength_y, fb_size_log2, encoder_info->params->bitdepth, PLANE_Y, qp, clpf_decision);
+        if (apply_filters)
+          TEMPLATE(clpf_frame)(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, &stats, enable_fb_flag, strength_y, fb_size_log2, encoder_info->params->bitdepth, PLANE_Y, qp, clpf_decision, encoder_info->workers);
+        else if (enable_fb_flag)
+          clpf_signal_frame(&stats, strength_y, fb_size_log2);
       }
-      if (strength_u)
-        TEMPLATE(clpf_frame)(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, strength_u, 4, encoder_info->params->bitdepth, PLANE_U, qp, NULL);
-      if (strength_v)
-        TEMPLATE(clpf_frame)(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, strength_v, 4, encoder_info->params->bitdepth, PLANE_V, qp, NULL);
+      if (strength_u && apply_filters)
+        TEMPLATE(clpf_frame)(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, strength_u, 4, encoder_info->params->bitdepth, PLANE_U, qp, NULL, encoder_info->workers);
+      if (strength_v && apply_filters)
+        TEMPLATE(clpf_frame)(encoder_info->rec, encoder_info->orig, encoder_info->deblock_data, stream, 0, strength_v, 4, encoder_info->params->bitdepth, PLANE_V, qp, NULL, encoder_info->workers);
+      STAGE_END(encoder_info->timer);
+      clpf_free_stats(&stats);
     }
   }
 
@@ -832,7 +1083,17 @@ void TEMPLATE(encode_frame)(encoder_info_t *encoder_info)
   encoder_info->ref[0] = tmp;
 
   /* Pad the reconstructed frame and write into ref[0] */
-  TEMPLATE(create_reference_frame)(encoder_info->ref[0],encoder_info->rec);
+  if (frame_info->non_ref)
+    encoder_info->ref[0]->frame_num = encoder_info->rec->frame_num; // Keep the slot in the sliding window only
+  else {
+    STAGE_BEGIN(encoder_info->timer, ENC_STAGE_REFERENCE);
+    TEMPLATE(create_reference_frame)(encoder_info->ref[0],encoder_info->rec);
+    if (encoder_info->hash_me)
+      TEMPLATE(add_ref_hash)(encoder_info->hash_me, encoder_info->ref[0], encoder_info->orig);
+    if (encoder_info->subpel_cache)
+      TEMPLATE(add_subpel_ref)(encoder_info->subpel_cache, encoder_info->ref[0], encoder_info->params->enable_bipred, encoder_info->params->bitdepth);
+    STAGE_END(encoder_info->timer);
+  }
 
 #if 0
   /* To test sliding window operation */
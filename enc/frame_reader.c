@@ -0,0 +1,238 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "global.h"
+#include "frame_reader.h"
+#include "strings.h"
+#include "thread.h"
+
+#define MAX_Y4M_HEADER 256
+
+struct frame_reader
+{
+  FILE *infile;
+  int y4m;
+  unsigned int frame_headerlen;  //Bytes before each raw frame
+  int skip;
+  int num_frames;
+  long frame_size;
+
+  /* Ring of frames read ahead. The reader thread fills frames up to
+     num_released + num_buffers, the encoder takes them in order and holds
+     the last one taken until the next call. */
+  uint8_t **buffers;
+  int num_buffers;
+  int num_read;
+  int num_taken;
+  int num_released;
+  int end;                       //Set by the reader thread after the last frame
+  int stop;                      //Set to stop the reader thread early
+  thor_thread_t thread;
+  int started;
+  thor_mutex_t mutex;
+  thor_cond_t cond;
+};
+
+/* Read one line, including the newline, into buf. Returns -1 at the end of
+   the file or if the line does not fit. */
+static int read_line(FILE *infile, char *buf, int size)
+{
+  int len = 0;
+  int c;
+
+  while ((c = fgetc(infile)) != EOF) {
+    if (len == size - 1)
+      return -1;
+    buf[len++] = (char)c;
+    if (c == '\n') {
+      buf[len] = 0;
+      return len;
+    }
+  }
+  return -1;
+}
+
+/* Skip n bytes of input without seeking, so that pipes work */
+static int skip_bytes(FILE *infile, long n)
+{
+  while (n-- > 0) {
+    if (fgetc(infile) == EOF)
+      return -1;
+  }
+  return 0;
+}
+
+/* Read the next frame, preceded by its header, into buf. Returns -1 at the
+   end of the input, including for an incomplete last frame. */
+static int read_frame(frame_reader_t *reader, uint8_t *buf)
+{
+  if (reader->y4m) {
+    char line[MAX_Y4M_HEADER];
+    if (read_line(reader->infile, line, sizeof(line)) < 0)
+      return -1;
+    if (strncmp(line, "FRAME", 5))
+      fatalerror("Corrupt Y4M file");
+  } else if (skip_bytes(reader->infile, reader->frame_headerlen))
+    return -1;
+  if (buf)
+    return fread(buf, 1, reader->frame_size, reader->infile) == (size_t)reader->frame_size ? 0 : -1;
+  return skip_bytes(reader->infile, reader->frame_size);
+}
+
+static void reader_thread(void *arg)
+{
+  frame_reader_t *reader = arg;
+  int i;
+  int ret = 0;
+
+  for (i = 0; i < reader->skip && !ret; i++)
+    ret = read_frame(reader, NULL);
+
+  for (i = 0; i < reader->num_frames && !ret; i++) {
+    thor_mutex_lock(&reader->mutex);
+    while (reader->num_read == reader->num_released + reader->num_buffers && !reader->stop)
+      thor_cond_wait(&reader->cond, &reader->mutex);
+    thor_mutex_unlock(&reader->mutex);
+    if (reader->stop)
+      break;
+
+    /* The buffer is not touched by the encoder until num_read is increased */
+    ret = read_frame(reader, reader->buffers[reader->num_read % reader->num_buffers]);
+
+    thor_mutex_lock(&reader->mutex);
+    if (!ret)
+      reader->num_read++;
+    thor_cond_signal(&reader->cond);
+    thor_mutex_unlock(&reader->mutex);
+  }
+
+  thor_mutex_lock(&reader->mutex);
+  reader->end = 1;
+  thor_cond_signal(&reader->cond);
+  thor_mutex_unlock(&reader->mutex);
+}
+
+frame_reader_t *open_frame_reader(enc_params *params)
+{
+  frame_reader_t *reader = calloc(1, sizeof(frame_reader_t));
+  if (!reader)
+    fatalerror("Memory allocation failed");
+
+  if (!strcmp(params->infilestr, "-")) {
+    reader->infile = stdin;
+#if defined(_WIN32)
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+  } else if (!(reader->infile = fopen(params->infilestr, "rb")))
+    fatalerror("Could not open in-file for reading.");
+
+  /* A y4m stream starts with a header line giving its format */
+  char header[MAX_Y4M_HEADER];
+  int c = fgetc(reader->infile);
+  if (c == 'Y') {
+    header[0] = (char)c;
+    if (read_line(reader->infile, header + 1, sizeof(header) - 1) < 0 || strncmp(header, "YUV4MPEG2 ", 10))
+      fatalerror("Corrupt Y4M file");
+    if (parse_y4m_header(params, header) < 0)
+      fatalerror("Error while reading encoder paramaters.");
+    reader->y4m = 1;
+  } else {
+    if (c != EOF)
+      ungetc(c, reader->infile);
+    if (skip_bytes(reader->infile, params->file_headerlen))
+      fatalerror("Error reading frame from file");
+    reader->frame_headerlen = params->frame_headerlen;
+  }
+
+  reader->skip = params->skip;
+  reader->num_frames = params->num_frames;
+  thor_mutex_init(&reader->mutex);
+  thor_cond_init(&reader->cond);
+  return reader;
+}
+
+void start_frame_reader(frame_reader_t *reader, long frame_size, int num_buffers)
+{
+  int i;
+
+  reader->frame_size = frame_size;
+  reader->num_buffers = num_buffers;
+  if (!(reader->buffers = calloc(num_buffers, sizeof(uint8_t *))))
+    fatalerror("Memory allocation failed");
+  for (i = 0; i < num_buffers; i++) {
+    if (!(reader->buffers[i] = malloc(frame_size)))
+      fatalerror("Could not allocate input frame.");
+  }
+  thor_thread_create(&reader->thread, reader_thread, reader);
+  reader->started = 1;
+}
+
+const uint8_t *read_next_frame(frame_reader_t *reader)
+{
+  const uint8_t *frame = NULL;
+
+  thor_mutex_lock(&reader->mutex);
+  /* The previous frame is no longer used */
+  reader->num_released = reader->num_taken;
+  thor_cond_signal(&reader->cond);
+  while (reader->num_read == reader->num_taken && !reader->end)
+    thor_cond_wait(&reader->cond, &reader->mutex);
+  if (reader->num_read > reader->num_taken)
+    frame = reader->buffers[reader->num_taken++ % reader->num_buffers];
+  thor_mutex_unlock(&reader->mutex);
+  return frame;
+}
+
+void close_frame_reader(frame_reader_t *reader)
+{
+  int i;
+
+  if (reader->started) {
+    thor_mutex_lock(&reader->mutex);
+    reader->stop = 1;
+    thor_cond_signal(&reader->cond);
+    thor_mutex_unlock(&reader->mutex);
+    thor_thread_join(reader->thread);
+  }
+  for (i = 0; i < reader->num_buffers; i++)
+    free(reader->buffers[i]);
+  free(reader->buffers);
+  thor_mutex_destroy(&reader->mutex);
+  thor_cond_destroy(&reader->cond);
+  if (reader->infile != stdin)
+    fclose(reader->infile);
+  free(reader);
+}
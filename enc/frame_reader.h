@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_FRAME_READER_H_)
+#define _FRAME_READER_H_
+
+#include <stdint.h>
+#include "mainenc.h"
+
+/* Sequential reader of raw or y4m input frames. The file is read once from
+   the start, so it may be a pipe, and reading runs ahead of the encoder on a
+   separate thread. */
+
+typedef struct frame_reader frame_reader_t;
+
+/* Open params->infilestr, or standard input if it is "-". The header of a
+   y4m stream is read and applied to params. */
+frame_reader_t *open_frame_reader(enc_params *params);
+
+/* Start reading frames of frame_size bytes into num_buffers buffers. The
+   first params->skip frames are discarded and at most params->num_frames
+   frames are read. */
+void start_frame_reader(frame_reader_t *reader, long frame_size, int num_buffers);
+
+/* Return the next frame, or NULL at the end of the input. The frame is valid
+   until the next call. */
+const uint8_t *read_next_frame(frame_reader_t *reader);
+
+void close_frame_reader(frame_reader_t *reader);
+
+#endif
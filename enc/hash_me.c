@@ -0,0 +1,178 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "global.h"
+#include "hash_me.h"
+
+/* Multipliers of the polynomial hashes along the rows and the columns */
+#define HASH_ROW_MUL 0x01000193u
+#define HASH_COL_MUL 0x9e3779b1u
+
+static uint32_t power(uint32_t mul, int n)
+{
+  uint32_t p = 1;
+  while (n--)
+    p *= mul;
+  return p;
+}
+
+/* Final mixing of the polynomial hash so that the top bits can be used as index */
+static inline uint32_t mix_hash(uint32_t h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+uint32_t TEMPLATE(block_hash)(const SAMPLE *block, int stride)
+{
+  uint32_t h = 0;
+  for (int i = 0; i < HASH_ME_BLOCK; i++) {
+    uint32_t row = 0;
+    for (int j = 0; j < HASH_ME_BLOCK; j++)
+      row = row * HASH_ROW_MUL + block[i*stride + j];
+    h = h * HASH_COL_MUL + row;
+  }
+  return mix_hash(h);
+}
+
+/* Hash every block position of the original luma plane using rolling hashes
+   and link the positions with equal index into chains in raster scan order */
+static void TEMPLATE(build_ref_hash)(ref_hash_t *ref_hash, const yuv_frame_t *orig)
+{
+  const int width = orig->width;
+  const int height = orig->height;
+  const int stride = orig->stride_y;
+  const int n = HASH_ME_BLOCK;
+  const uint32_t row_pow = power(HASH_ROW_MUL, n - 1);
+  const uint32_t col_pow = power(HASH_COL_MUL, n - 1);
+  uint32_t *row_hash = (uint32_t *)ref_hash->next; // Reused until the chains are built
+  uint32_t *col_hash = ref_hash->hash + (height - n + 1) * width; // Unused last rows of hash
+
+  for (int i = 0; i < height; i++) {
+    const SAMPLE *src = (const SAMPLE *)orig->y + i * stride;
+    uint32_t h = 0;
+    for (int j = 0; j < n; j++)
+      h = h * HASH_ROW_MUL + src[j];
+    row_hash[i*width] = h;
+    for (int j = 1; j <= width - n; j++) {
+      h = (h - src[j-1] * row_pow) * HASH_ROW_MUL + src[j+n-1];
+      row_hash[i*width + j] = h;
+    }
+  }
+
+  for (int j = 0; j <= width - n; j++) {
+    uint32_t h = 0;
+    for (int i = 0; i < n; i++)
+      h = h * HASH_COL_MUL + row_hash[i*width + j];
+    col_hash[j] = h;
+  }
+  for (int i = 0; i <= height - n; i++) {
+    for (int j = 0; j <= width - n; j++) {
+      ref_hash->hash[i*width + j] = mix_hash(col_hash[j]);
+      if (i < height - n)
+        col_hash[j] = (col_hash[j] - row_hash[i*width + j] * col_pow) * HASH_COL_MUL + row_hash[(i+n)*width + j];
+    }
+  }
+
+  memset(ref_hash->head, 0xff, (1 << HASH_ME_BITS) * sizeof(int));
+  for (int i = height - n; i >= 0; i--) {
+    for (int j = width - n; j >= 0; j--) {
+      int pos = i*width + j;
+      int idx = hash_me_index(ref_hash->hash[pos]);
+      ref_hash->next[pos] = ref_hash->head[idx];
+      ref_hash->head[idx] = pos;
+    }
+  }
+}
+
+/* Build the hash table of a frame entering the reference buffer from its original
+   samples, replacing the table of the oldest reference frame */
+void TEMPLATE(add_ref_hash)(hash_me_t *hash_me, const yuv_frame_t *ref, const yuv_frame_t *orig)
+{
+  ref_hash_t *oldest = &hash_me->table[0];
+
+  if (orig->width < HASH_ME_BLOCK || orig->height < HASH_ME_BLOCK)
+    return;
+
+  for (int i = 1; i < HASH_ME_POOL; i++) {
+    if (hash_me->table[i].age < oldest->age)
+      oldest = &hash_me->table[i];
+  }
+
+  if (oldest->width != orig->width || oldest->height != orig->height) {
+    free(oldest->hash);
+    free(oldest->next);
+    free(oldest->head);
+    oldest->width = orig->width;
+    oldest->height = orig->height;
+    oldest->hash = (uint32_t *)malloc(orig->width * orig->height * sizeof(uint32_t));
+    oldest->next = (int *)malloc(orig->width * orig->height * sizeof(int));
+    oldest->head = (int *)malloc((1 << HASH_ME_BITS) * sizeof(int));
+    if (!oldest->hash || !oldest->next || !oldest->head)
+      fatalerror("Memory allocation failed\n");
+  }
+  TEMPLATE(build_ref_hash)(oldest, orig);
+  oldest->frame = ref;
+  oldest->frame_num = ref->frame_num;
+  oldest->age = ++hash_me->count;
+}
+
+#ifndef HBD
+hash_me_t *create_hash_me(void)
+{
+  hash_me_t *hash_me = (hash_me_t *)calloc(1, sizeof(hash_me_t));
+  if (!hash_me)
+    fatalerror("Memory allocation failed\n");
+  return hash_me;
+}
+
+void close_hash_me(hash_me_t *hash_me)
+{
+  for (int i = 0; i < HASH_ME_POOL; i++) {
+    free(hash_me->table[i].hash);
+    free(hash_me->table[i].next);
+    free(hash_me->table[i].head);
+  }
+  free(hash_me);
+}
+
+/* Return the hash table of a reference frame, or NULL if it has none */
+ref_hash_t *find_ref_hash(hash_me_t *hash_me, const yuv_frame_t *ref)
+{
+  for (int i = 0; i < HASH_ME_POOL; i++) {
+    ref_hash_t *ref_hash = &hash_me->table[i];
+    if (ref_hash->age && ref_hash->frame == ref && ref_hash->frame_num == ref->frame_num)
+      return ref_hash;
+  }
+  return NULL;
+}
+#endif
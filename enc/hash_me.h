@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_HASH_ME_H_)
+#define _HASH_ME_H_
+
+#include "types.h"
+
+/* Exact-match motion search using hashes of the original reference frame blocks */
+#define HASH_ME_BLOCK 8          //Size of the hashed blocks
+#define HASH_ME_BITS 16          //Number of hash bits used to index the table
+#define HASH_ME_POOL 4           //Number of most recent reference frames with a hash table
+#define HASH_ME_MAX_CAND 32      //Maximum number of matching positions to evaluate
+
+typedef struct
+{
+  const yuv_frame_t *frame;      //Reference frame the table belongs to
+  int frame_num;
+  unsigned int age;
+  int width;
+  int height;
+  uint32_t *hash;                //Hash of the block at every position
+  int *next;                     //Next position in the same hash chain
+  int *head;                     //First position of each hash chain
+} ref_hash_t;
+
+typedef struct hash_me
+{
+  ref_hash_t table[HASH_ME_POOL];
+  unsigned int count;
+} hash_me_t;
+
+hash_me_t *create_hash_me(void);
+void close_hash_me(hash_me_t *hash_me);
+ref_hash_t *find_ref_hash(hash_me_t *hash_me, const yuv_frame_t *ref);
+void add_ref_hash_lbd(hash_me_t *hash_me, const yuv_frame_t *ref, const yuv_frame_t *orig);
+void add_ref_hash_hbd(hash_me_t *hash_me, const yuv_frame_t *ref, const yuv_frame_t *orig);
+uint32_t block_hash_lbd(const uint8_t *block, int stride);
+uint32_t block_hash_hbd(const uint16_t *block, int stride);
+
+static inline int hash_me_index(uint32_t hash)
+{
+  return hash >> (32 - HASH_ME_BITS);
+}
+
+#endif
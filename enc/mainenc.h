@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "putbits.h"
 #include "types.h"
 #include "rc.h"
+#include "timer.h"
 
 typedef struct
 {
@@ -87,6 +88,7 @@ typedef struct
 #endif
   int clpf;
   int snrcalc;
+  int ssim;
   int use_block_contexts;
   int enable_bipred;
   int bitrate;
@@ -105,11 +107,61 @@ typedef struct
   int bitdepth;
   int frame_bitdepth;
   int input_bitdepth;
+  float target_fps;
+  int sb_rows_per_unit;
+  int hash_me;
+  int subpel_cache;
+  char *timingfilestr;
+  int perf;
+  int threads;
 } enc_params;
 
+/* Stages reported by -timing */
+typedef enum {
+  ENC_STAGE_READ,
+  ENC_STAGE_INTERP,
+  ENC_STAGE_ME,
+  ENC_STAGE_INTRA,
+  ENC_STAGE_TRANSFORM,
+  ENC_STAGE_ENTROPY,
+  ENC_STAGE_BLOCKS,
+  ENC_STAGE_DEBLOCK,
+  ENC_STAGE_CDEF_SEARCH,
+  ENC_STAGE_CDEF_FILTER,
+  ENC_STAGE_CLPF_SEARCH,
+  ENC_STAGE_CLPF_FILTER,
+  ENC_STAGE_REFERENCE,
+  ENC_STAGE_SNR,
+  ENC_STAGE_OUTPUT,
+  NUM_ENC_STAGES
+} enc_stage_t;
+
+/* Search effort counters, reported with -stat */
+typedef enum {
+  COUNT_SAD,           // SAD evaluations in motion and intra search
+  COUNT_WIDESAD,       // widesad_calc evaluations (five positions each)
+  COUNT_SUBPEL,        // sub-pel predictions made by the motion search
+  COUNT_ENCODE_BLOCK,  // encode_block() trials
+  COUNT_REWIND,        // bitstream rewinds
+  COUNT_EARLY_SKIP,    // blocks coded after the early skip test
+  COUNT_SPLIT_STOP,    // top-down splits not searched
+  COUNT_INTRA_MODES,   // intra modes tested
+  NUM_SEARCH_COUNTERS
+} search_counter_t;
+
+typedef struct
+{
+  uint64_t count[NUM_FRAME_TYPES][NUM_BLOCK_SIZES][NUM_SEARCH_COUNTERS];
+} search_stats_t;
+
 struct yuv_block;
 typedef struct yuv_block *pyuv_block;
 
+struct rt_control;
+struct hash_me;
+struct subpel_cache;
+struct thor_workers;
+
 typedef struct
 {
   block_pos_t block_pos;
@@ -155,6 +207,8 @@ typedef struct
   int min_ref_dist;
   int phase;
   int max_clpf_strength;
+  int non_ref;
+  int tb_split_search;
 } frame_info_t;
 
 typedef struct 
@@ -168,8 +222,15 @@ typedef struct
   yuv_frame_t *ref[MAX_REF_FRAMES];
   yuv_frame_t *interp_frames[MAX_SKIP_FRAMES];
   stream_t *stream;
+  packet_buffer_t *out;
   deblock_data_t *deblock_data;
   rate_control_t *rc;
+  struct rt_control *rtc;
+  struct hash_me *hash_me;
+  struct subpel_cache *subpel_cache;
+  struct thor_workers *workers;
+  stage_timer_t *timer;
+  search_stats_t search_stats;
   int width;
   int height;
   int depth;
@@ -30,40 +30,51 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "global.h"
 #include "putbits.h"
 
-static void flush_bytebuf(stream_t *str, FILE *outfile)
+static void write_packet_bytes(packet_buffer_t *out, const uint8_t *data, uint32_t bytes)
 {
-  if (outfile)
+  if (out->size + bytes > out->capacity)
   {
-    if (fwrite(str->bitstream, sizeof(unsigned char), str->bytepos, outfile) != str->bytepos)
+    uint32_t capacity = max(out->capacity*2, out->size + bytes);
+    uint8_t *p = realloc(out->data, capacity);
+    if (!p)
     {
-      fatalerror("Problem writing bitstream to file.");
+      fatalerror("Problem allocating bitstream output buffer.");
     }
+    out->data = p;
+    out->capacity = capacity;
+  }
+  memcpy(out->data + out->size, data, bytes);
+  out->size += bytes;
+}
+
+static void flush_bytebuf(stream_t *str, packet_buffer_t *out)
+{
+  if (out)
+  {
+    write_packet_bytes(out, str->bitstream, str->bytepos);
   }
   str->bytepos = 0;
 }
 
-void flush_all_bits(stream_t *str, FILE *outfile)
+static uint32_t flush_bits(stream_t *str, packet_buffer_t *out)
 {
   uint32_t frame_bytes;
   int i;
   int bytes = 4 - str->bitrest/8;
   frame_bytes = str->bytepos + bytes;
-  if (outfile)
+  if (out)
   {
     uint8_t frame_bytes_buf[4];
     for (i = 0; i < 4; i++)
     {
       frame_bytes_buf[i] = (uint8_t)(frame_bytes >> (24 - i*8));
     }
-    if (fwrite(frame_bytes_buf, sizeof(frame_bytes_buf), 1, outfile) != 1)
-    {
-      fatalerror("Problem writing bitstream to file.");
-    }
+    write_packet_bytes(out, frame_bytes_buf, sizeof(frame_bytes_buf));
   }
 
   if ((str->bytepos+bytes) > str->bytesize)
   {
-    flush_bytebuf(str,outfile);
+    flush_bytebuf(str,out);
   }
   for (i = 0; i < bytes; i++)
   {
@@ -72,18 +83,24 @@ void flush_all_bits(stream_t *str, FILE *outfile)
   str->bitbuf = 0;
   str->bitrest = 32;
 
-  if (outfile)
-  {
-    if (fwrite(str->bitstream,sizeof(unsigned char),str->bytepos,outfile) != str->bytepos)
-    {
-      fatalerror("Problem writing bitstream to file.");
-    }
-  }
-  str->bytepos = 0;
-}    
-                    
+  flush_bytebuf(str,out);
+  return frame_bytes;
+}
+
+void flush_all_bits(stream_t *str, packet_buffer_t *out)
+{
+  flush_bits(str, out);
+  str->unit_bytes = 0;
+}
+
+/* Write the bits so far as a separate unit without ending the frame */
+void flush_unit_bits(stream_t *str, packet_buffer_t *out)
+{
+  str->unit_bytes += flush_bits(str, out);
+}
+
 int get_bit_pos(stream_t *str){
-  int bitpos = 8*str->bytepos + (32 - str->bitrest);
+  int bitpos = 8*(str->unit_bytes + str->bytepos) + (32 - str->bitrest);
   return bitpos; 
 }
 
@@ -130,12 +147,20 @@ static unsigned int putbits(unsigned int n, unsigned int val, stream_t *str)
 void write_stream_pos(stream_t *stream, stream_pos_t *stream_pos){
   // Flush bitrest to memory if we move forward
   if (stream_pos->bytepos > stream->bytepos) {
-    uint32_t tmp = 0;
-    for (int i = 0; i < 4; i++)
-      tmp |= stream->bitstream[stream->bytepos + i] << ((3 - i) * 8);
-    tmp &= mask(stream->bitrest);
-    putbits(stream->bitrest, tmp, stream);
-    flush_bitbuf(stream, 4);
+    if (stream->bitrest < 32) {
+      uint32_t tmp = 0;
+      for (int i = 0; i < 4; i++)
+        tmp |= stream->bitstream[stream->bytepos + i] << ((3 - i) * 8);
+      tmp &= mask(stream->bitrest);
+      putbits(stream->bitrest, tmp, stream);
+      flush_bitbuf(stream, 4);
+    }
+  }
+  // Keep the rewritten bits if we move forward within the same word
+  else if (stream_pos->bytepos == stream->bytepos && stream_pos->bitrest <= stream->bitrest && stream->bitrest < 32) {
+    stream->bitbuf = (stream->bitbuf & ~mask(stream->bitrest)) | (stream_pos->bitbuf & mask(stream->bitrest));
+    stream->bitrest = stream_pos->bitrest;
+    return;
   }
 
   stream->bitrest = stream_pos->bitrest;
@@ -39,6 +39,7 @@ typedef struct
   uint8_t *bitstream;   //Compressed bit stream
   uint32_t bitbuf;       //Recent bits not written the bitstream yet
   uint32_t bitrest;      //Empty bits in bitbuf
+  uint32_t unit_bytes;   //Bytes of the current frame already written as earlier units
 } stream_t;
 
 typedef struct
@@ -48,7 +49,16 @@ typedef struct
   uint32_t bitrest;      //Empty bits in bitbuf
 } stream_pos_t;
 
-void flush_all_bits(stream_t *str, FILE *outfile);
+/* Growable memory buffer receiving the flushed bitstream */
+typedef struct
+{
+  uint8_t *data;
+  uint32_t size;
+  uint32_t capacity;
+} packet_buffer_t;
+
+void flush_all_bits(stream_t *str, packet_buffer_t *out);
+void flush_unit_bits(stream_t *str, packet_buffer_t *out);
 int get_bit_pos(stream_t *str);
 unsigned int leading_zeros(unsigned int code);
 
@@ -0,0 +1,148 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "global.h"
+#include <string.h>
+#include "rt_control.h"
+#include "timer.h"
+
+/* Smoothing factor for the frame load estimate */
+#define RT_SMOOTH 0.25
+/* Increase level if the smoothed load exceeds this */
+#define RT_LOAD_UP 0.95
+/* Decrease level if the smoothed load stays below this for RT_HOLD_FRAMES frames */
+#define RT_LOAD_DOWN 0.6
+#define RT_HOLD_FRAMES 8
+/* Increase level immediately if a single inter frame exceeds the budget by this factor */
+#define RT_LOAD_PANIC 1.5
+
+/* Minimum effort per level. The configured effort is used where it is lower. */
+static const int rt_encoder_speed[RT_MAX_LEVEL+1] = { 0, 0, 1, 2, 2 };
+static const float rt_early_skip_thr[RT_MAX_LEVEL+1] = { 0.0, 0.8, 0.8, 1.0, 1.5 };
+static const int rt_cdef[RT_MAX_LEVEL+1] = { 1, 2, 3, 3, 4 };
+static const int rt_max_num_ref[RT_MAX_LEVEL+1] = { 4, 4, 4, 2, 1 };
+
+/* Set the encoder effort parameters that may change between SB rows */
+static void apply_level(rt_control_t *rtc, encoder_info_t *encoder_info, int level)
+{
+  enc_params *params = encoder_info->params;
+
+  params->encoder_speed = max(rtc->encoder_speed, rt_encoder_speed[level]);
+  params->early_skip_thr = rtc->early_skip_thr > rt_early_skip_thr[level] ? rtc->early_skip_thr : rt_early_skip_thr[level];
+  params->intra_rdo = level >= 2 ? 0 : rtc->intra_rdo;
+  if (rtc->cdef)
+    params->cdef = max(rtc->cdef, rt_cdef[level]);
+
+  // The transform split syntax is fixed by the sequence header so only the search is disabled
+  encoder_info->frame_info.tb_split_search = level >= 1 ? 0 : rtc->enable_tb_split;
+}
+
+void init_rt_control(rt_control_t *rtc, enc_params *params)
+{
+  memset(rtc, 0, sizeof(rt_control_t));
+  rtc->frame_budget = 1.0 / params->target_fps;
+  rtc->encoder_speed = params->encoder_speed;
+  rtc->max_num_ref = params->max_num_ref;
+  rtc->intra_rdo = params->intra_rdo;
+  rtc->early_skip_thr = params->early_skip_thr;
+  rtc->enable_tb_split = params->enable_tb_split;
+#if CDEF
+  rtc->cdef = params->cdef;
+#endif
+}
+
+void rt_control_restore(rt_control_t *rtc, enc_params *params)
+{
+  params->encoder_speed = rtc->encoder_speed;
+  params->intra_rdo = rtc->intra_rdo;
+  params->early_skip_thr = rtc->early_skip_thr;
+#if CDEF
+  params->cdef = rtc->cdef;
+#endif
+}
+
+void rt_control_frame_start(rt_control_t *rtc, encoder_info_t *encoder_info)
+{
+  frame_info_t *frame_info = &encoder_info->frame_info;
+
+  rtc->frame_start = get_wall_time();
+  rtc->row_level = rtc->level;
+  apply_level(rtc, encoder_info, rtc->level);
+
+  /* Drop the most distant references. B frames keep both directions and
+     interpolated references need their two source frames. */
+  int max_num_ref = min(rtc->max_num_ref, rt_max_num_ref[rtc->level]);
+  if (frame_info->frame_type == B_FRAME)
+    max_num_ref = max(max_num_ref, 2);
+  if (!frame_info->interp_ref && frame_info->num_ref > max_num_ref)
+    frame_info->num_ref = max_num_ref;
+}
+
+void rt_control_sb_row(rt_control_t *rtc, encoder_info_t *encoder_info, int row, int num_rows)
+{
+  if (row >= num_rows || rtc->row_level >= RT_MAX_LEVEL)
+    return;
+
+  /* Increase the level for the remaining rows if the frame is projected to miss its deadline */
+  double elapsed = get_wall_time() - rtc->frame_start;
+  if (elapsed * num_rows / row > rtc->frame_budget) {
+    rtc->row_level++;
+    rtc->row_escalations++;
+    apply_level(rtc, encoder_info, rtc->row_level);
+  }
+}
+
+void rt_control_frame_end(rt_control_t *rtc, encoder_info_t *encoder_info)
+{
+  double frame_time = get_wall_time() - rtc->frame_start;
+  double ratio = frame_time / rtc->frame_budget;
+  int level = rtc->level;
+
+  rtc->level_count[rtc->row_level]++;
+  rtc->tot_time += frame_time;
+  rtc->max_time = frame_time > rtc->max_time ? frame_time : rtc->max_time;
+  rtc->last_time = frame_time;
+  rtc->late_frames += ratio > 1.0;
+  rtc->load = rtc->frame_count ? (1.0 - RT_SMOOTH) * rtc->load + RT_SMOOTH * ratio : ratio;
+  rtc->frame_count++;
+  rtc->hold++;
+
+  if (rtc->row_level > level)
+    level = rtc->row_level;
+  else if ((rtc->load > RT_LOAD_UP && rtc->hold >= 2) ||
+           (ratio > RT_LOAD_PANIC && encoder_info->frame_info.frame_type != I_FRAME))
+    level = min(level + 1, RT_MAX_LEVEL);
+  else if (rtc->load < RT_LOAD_DOWN && rtc->hold >= RT_HOLD_FRAMES)
+    level = max(level - 1, 0);
+
+  if (level != rtc->level) {
+    /* Require new evidence before the next change */
+    rtc->load = 0.5 * (RT_LOAD_UP + RT_LOAD_DOWN);
+    rtc->level = level;
+    rtc->hold = 0;
+    rtc->level_changes++;
+  }
+}
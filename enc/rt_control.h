@@ -0,0 +1,69 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_RT_CONTROL_H_)
+#define _RT_CONTROL_H_
+
+#include "mainenc.h"
+
+/* Effort reduction levels. Level 0 is the configured effort. */
+#define RT_MAX_LEVEL 4
+
+typedef struct rt_control
+{
+  double frame_budget;                 //  Wall time budget per frame in seconds
+  double frame_start;                  //  Start time of current frame
+  double load;                         //  Smoothed ratio of frame time to frame budget
+  int level;                           //  Effort reduction level for the next frame
+  int row_level;                       //  Effort reduction level for the remaining SB rows of the current frame
+  int hold;                            //  Number of frames since last level change
+
+  /* Configured effort parameters which correspond to level 0 */
+  int encoder_speed;
+  int max_num_ref;
+  int intra_rdo;
+  float early_skip_thr;
+  int enable_tb_split;
+  int cdef;
+
+  /* Parameters that are only used for statistical purposes*/
+  int frame_count;                     //  Total number of frames since startup
+  int late_frames;                     //  Number of frames exceeding the frame budget
+  int level_changes;                   //  Number of frame level changes
+  int row_escalations;                 //  Number of level increases inside a frame
+  int level_count[RT_MAX_LEVEL+1];     //  Number of frames encoded at each level
+  double tot_time;                     //  Total encoding time in seconds
+  double max_time;                     //  Maximum frame encoding time in seconds
+  double last_time;                    //  Encoding time of previous frame in seconds
+
+} rt_control_t;
+
+void init_rt_control(rt_control_t *rtc, enc_params *params);
+void rt_control_frame_start(rt_control_t *rtc, encoder_info_t *encoder_info);
+void rt_control_sb_row(rt_control_t *rtc, encoder_info_t *encoder_info, int row, int num_rows);
+void rt_control_frame_end(rt_control_t *rtc, encoder_info_t *encoder_info);
+void rt_control_restore(rt_control_t *rtc, enc_params *params);
+#endif //_RT_CONTROL_H_
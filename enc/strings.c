@@ -266,7 +266,6 @@ static int parse_params(int argc, char **argv, enc_params *params, param_list *l
 
 enc_params *parse_config_params(int argc, char **argv)
 {
-  FILE *infile;
   param_list list;
   enc_params *params;
   char *default_argv[MAX_PARAMS*2];
@@ -291,6 +290,8 @@ enc_params *parse_config_params(int argc, char **argv)
   add_param_to_list(&list, "-of",                   NULL, ARG_FILENAME, &params->outfilestr);
   add_param_to_list(&list, "-rf",                   NULL, ARG_FILENAME, &params->reconfilestr);
   add_param_to_list(&list, "-stat",                 NULL, ARG_FILENAME, &params->statfilestr);
+  add_param_to_list(&list, "-timing",               NULL, ARG_FILENAME, &params->timingfilestr);  // Per-frame stage timings (.json or CSV)
+  add_param_to_list(&list, "-perf",                  "0", ARG_INTEGER,  &params->perf);  // Add hardware performance counters to the -timing report
   add_param_to_list(&list, "-n",                   "600", ARG_INTEGER,  &params->num_frames);
   add_param_to_list(&list, "-skip",                  "0", ARG_INTEGER,  &params->skip);
   add_param_to_list(&list, "-width",              "1920", ARG_INTEGER,  &params->width);
@@ -338,6 +339,7 @@ enc_params *parse_config_params(int argc, char **argv)
 #endif
   add_param_to_list(&list, "-clpf",                  "0", ARG_INTEGER,  &params->clpf); //0: off, 1: SB-level, 2: frame-level
   add_param_to_list(&list, "-snrcalc",               "1", ARG_INTEGER,  &params->snrcalc);
+  add_param_to_list(&list, "-ssim",                  "0", ARG_INTEGER,  &params->ssim);
   add_param_to_list(&list, "-use_block_contexts",    "0", ARG_INTEGER,  &params->use_block_contexts);
   add_param_to_list(&list, "-enable_bipred",         "0", ARG_INTEGER,  &params->enable_bipred); //TODO: enable_bipred=2 means disable SFP, use separate parameter for SFP instead for clarity
   add_param_to_list(&list, "-bitrate",               "0", ARG_INTEGER,  &params->bitrate);
@@ -354,6 +356,11 @@ enc_params *parse_config_params(int argc, char **argv)
   add_param_to_list(&list, "-bitdepth",              "8", ARG_INTEGER,  &params->bitdepth);  // Internal bitdepth (8, 10 or 12)
   add_param_to_list(&list, "-frame_bitdepth",        "8", ARG_INTEGER,  &params->frame_bitdepth);  // Bitdepth of frame buffers (8 or 16)
   add_param_to_list(&list, "-input_bitdepth",        "8", ARG_INTEGER,  &params->input_bitdepth);  // Bitdepth of input source (8, 10 or 12)
+  add_param_to_list(&list, "-target_fps",          "0.0", ARG_FLOAT,    &params->target_fps);  // Adapt encoder effort to this frame rate (0: off)
+  add_param_to_list(&list, "-sb_rows_per_unit",        "0", ARG_INTEGER,  &params->sb_rows_per_unit);  // Output each group of SB rows as a separate unit (0: whole frames)
+  add_param_to_list(&list, "-hash_me",                 "0", ARG_INTEGER,  &params->hash_me);  // Exact-match motion search using block hashes (for screen content)
+  add_param_to_list(&list, "-subpel_cache",            "0", ARG_INTEGER,  &params->subpel_cache);  // Cache the sub-pel planes of this many recent reference frames (encoder_speed 0)
+  add_param_to_list(&list, "-threads",                 "0", ARG_INTEGER,  &params->threads);  // Worker threads for the frame level searches (0: one per processor)
 
   /* Generate "argv" and "argc" for default parameters */
   default_argc = 1;
@@ -373,81 +380,77 @@ enc_params *parse_config_params(int argc, char **argv)
   if (parse_params(argc, argv, params, &list) < 0)
     return NULL;
 
-  /* Check if input file is y4m and if so use its geometry */
-  if ((infile = fopen(params->infilestr, "rb"))) {
-    char buf[256];
-    int len = (int)fread(buf, 1, sizeof(buf), infile);
-    int pos = 10;
-    int num, den;
-    buf[255] = 0;
-    if (!strncmp(buf, "YUV4MPEG2 ", 10)) {
-      char *end;
-      while (pos < len && buf[pos] != '\n') {
-          switch (buf[pos++]) {
-          case 'W':
-            params->width = strtol(buf+pos, &end, 10);
-            pos = (int)(end-buf);
-            while (buf[pos] != '\n' && buf[pos++] != ' ');
-            break;
-          case 'H':
-            params->height = strtol(buf+pos, &end, 10);
-            pos = (int)(end-buf);
-            while (pos < len && buf[pos] != '\n' && buf[pos++] != ' ');
-            break;
-          case 'F':
-            den = strtol(buf+pos, &end, 10);
-            pos = (int)(end-buf+1);
-            num = strtol(buf+pos, &end, 10);
-            pos = (int)(end-buf+1);
-            params->frame_rate = (float)den/num;
-            while (buf[pos] != '\n' && buf[pos++] != ' ');
-            break;
-          case 'I':
-            if (buf[pos] != 'p') {
-              fprintf(stderr, "Only progressive input supported\n");
-              return NULL;
-            }
-            while (pos < len && buf[pos] != '\n' && buf[pos++] != ' ');
-            break;
-          case 'C':
-            if (!strncmp(buf+pos, "mono", 4)) {
-              params->subsample = 400;
-              pos += 4;
-            } else {
-              params->subsample = strtol(buf+pos, &end, 10);
-              pos = (int)(end-buf);
-            }
-            if (buf[pos] == 'p') {
-              params->input_bitdepth = strtol(buf + ++pos, &end, 10);
-              if (params->input_bitdepth > 8)
-                params->frame_bitdepth = 16;
-            }
-            while (pos < len && buf[pos] != '\n' && buf[pos++] != ' ');
-            break;
-          case 'A':
-            params->aspectnum = strtol(buf+pos, &end, 10);
-            pos = (int)(end-buf+1);
-            params->aspectden = strtol(buf+pos, &end, 10);
-            pos = (int)(end-buf);
-            while (pos < len && buf[pos] != '\n' && buf[pos++] != ' ');
-            break;
-          case 'X':
-          default:
-            while (buf[pos] != ' ' && buf[pos] != '\n' && pos < len)
-              pos++;
-            break;
-          }
-        }
-        if (strncmp(buf+pos, "\nFRAME\n", 7)) {
-          fprintf(stderr, "Corrupt Y4M file\n");
-          return NULL;
-        }
-        params->file_headerlen = pos + 1;
-        params->frame_headerlen = 6;
+  return params;
+}
+
+int parse_y4m_header(enc_params *params, const char *buf)
+{
+  int len = (int)strlen(buf);
+  int pos = 10;
+  int num, den;
+  char *end;
+
+  while (pos < len && buf[pos] != '\n') {
+    switch (buf[pos++]) {
+    case 'W':
+      params->width = strtol(buf+pos, &end, 10);
+      pos = (int)(end-buf);
+      while (buf[pos] != '\n' && buf[pos++] != ' ');
+      break;
+    case 'H':
+      params->height = strtol(buf+pos, &end, 10);
+      pos = (int)(end-buf);
+      while (pos < len && buf[pos] != '\n' && buf[pos++] != ' ');
+      break;
+    case 'F':
+      den = strtol(buf+pos, &end, 10);
+      pos = (int)(end-buf+1);
+      num = strtol(buf+pos, &end, 10);
+      pos = (int)(end-buf+1);
+      params->frame_rate = (float)den/num;
+      while (buf[pos] != '\n' && buf[pos++] != ' ');
+      break;
+    case 'I':
+      if (buf[pos] != 'p') {
+        fprintf(stderr, "Only progressive input supported\n");
+        return -1;
+      }
+      while (pos < len && buf[pos] != '\n' && buf[pos++] != ' ');
+      break;
+    case 'C':
+      if (!strncmp(buf+pos, "mono", 4)) {
+        params->subsample = 400;
+        pos += 4;
+      } else {
+        params->subsample = strtol(buf+pos, &end, 10);
+        pos = (int)(end-buf);
+      }
+      if (buf[pos] == 'p') {
+        params->input_bitdepth = strtol(buf + ++pos, &end, 10);
+        if (params->input_bitdepth > 8)
+          params->frame_bitdepth = 16;
+      }
+      while (pos < len && buf[pos] != '\n' && buf[pos++] != ' ');
+      break;
+    case 'A':
+      params->aspectnum = strtol(buf+pos, &end, 10);
+      pos = (int)(end-buf+1);
+      params->aspectden = strtol(buf+pos, &end, 10);
+      pos = (int)(end-buf);
+      while (pos < len && buf[pos] != '\n' && buf[pos++] != ' ');
+      break;
+    case 'X':
+    default:
+      while (buf[pos] != ' ' && buf[pos] != '\n' && pos < len)
+        pos++;
+      break;
     }
-    fclose(infile);
   }
-  return params;
+  if (buf[pos] != '\n') {
+    fprintf(stderr, "Corrupt Y4M file\n");
+    return -1;
+  }
+  return 0;
 }
 
 void delete_config_params(enc_params *params)
@@ -464,6 +467,9 @@ void delete_config_params(enc_params *params)
   if (params->statfilestr != NULL)
     free(params->statfilestr);
 
+  if (params->timingfilestr != NULL)
+    free(params->timingfilestr);
+
   free(params);
 }
 
@@ -516,10 +522,34 @@ void check_parameters(enc_params *params)
     fatalerror("Intra period must be a multiple of the subgroup size (num_reorder_pics+1).\n");
   }
 
+  if (params->encoder_speed > 4) {
+    fatalerror("encoder_speed must not be larger than 4\n");
+  }
+
   if (params->sync && params->encoder_speed<2) {
     fatalerror("Sync requires encoder_speed=2\n");
   }
 
+  if (params->target_fps < 0) {
+    fatalerror("target_fps must be non-negative\n");
+  }
+
+  if (params->sb_rows_per_unit < 0 || params->sb_rows_per_unit > 64) {
+    fatalerror("sb_rows_per_unit must be in the range 0 to 64\n");
+  }
+
+  if (params->subpel_cache < 0 || params->subpel_cache > MAX_REF_FRAMES) {
+    fatalerror("subpel_cache must be in the range 0 to 33\n");
+  }
+
+  if (params->threads < 0 || params->threads > MAX_THREADS) {
+    fatalerror("threads must be in the range 0 to 64\n");
+  }
+
+  if (params->perf && !params->timingfilestr) {
+    fatalerror("perf requires -timing\n");
+  }
+
   if (params->bitrate > 0 && params->num_reorder_pics > 0){
     fatalerror("Current rate control doesn't work with frame reordering\n");
   }
@@ -32,6 +32,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 enc_params *parse_config_params(int argc, char **argv);
 
+/* Set the geometry, frame rate and format from a y4m stream header, i.e.
+   the line starting with "YUV4MPEG2 " up to and including the newline.
+   Returns -1 if the header is not supported. */
+int parse_y4m_header(enc_params *params, const char *header);
+
 void delete_config_params(enc_params *params);
 
 void check_parameters(enc_params *params);
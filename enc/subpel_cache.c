@@ -0,0 +1,156 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "global.h"
+#include "inter_prediction.h"
+#include "subpel_cache.h"
+
+/* Interpolate one band of MAX_SB_SIZE rows of all the sub-pel planes. The planes are
+   made from blocks of the regular inter prediction so that they are bit-exact with it. */
+static void TEMPLATE(interpolate_band)(subpel_ref_t *subpel_ref, int band)
+{
+  const yuv_frame_t *ref = subpel_ref->frame;
+  const int stride = subpel_ref->stride;
+  const int ystart = band * MAX_SB_SIZE;
+  const int height = min(MAX_SB_SIZE, subpel_ref->height + 2*SUBPEL_PAD - ystart);
+
+  for (int frac = 1; frac <= SUBPEL_PLANES; frac++) {
+    SAMPLE *plane = (SAMPLE *)subpel_ref->plane[frac-1];
+    mv_t mv;
+    mv.y = frac >> 2;
+    mv.x = frac & 3;
+    for (int xstart = 0; xstart < stride; xstart += MAX_SB_SIZE) {
+      SAMPLE *src = (SAMPLE *)ref->y + (ystart - SUBPEL_PAD) * ref->stride_y + xstart - SUBPEL_PAD;
+      TEMPLATE(get_inter_prediction_luma)(plane + ystart * stride + xstart, src, min(MAX_SB_SIZE, stride - xstart), height, ref->stride_y, stride,
+                                          &mv, 0, subpel_ref->bipred, ref->width, ref->height, 0, 0, subpel_ref->bitdepth);
+    }
+  }
+  subpel_ref->ready[band] = 1;
+}
+
+/* Register a frame entering the reference buffer, replacing the planes of the oldest
+   reference frame. The planes are interpolated on first use. */
+void TEMPLATE(add_subpel_ref)(subpel_cache_t *subpel_cache, const yuv_frame_t *ref, int bipred, int bitdepth)
+{
+  subpel_ref_t *oldest = &subpel_cache->table[0];
+
+  for (int i = 1; i < subpel_cache->size; i++) {
+    if (subpel_cache->table[i].age < oldest->age)
+      oldest = &subpel_cache->table[i];
+  }
+
+  if (oldest->width != ref->width || oldest->height != ref->height || oldest->sample_size != sizeof(SAMPLE)) {
+    for (int i = 0; i < SUBPEL_PLANES; i++)
+      free(oldest->plane[i]);
+    free(oldest->ready);
+    oldest->width = ref->width;
+    oldest->height = ref->height;
+    oldest->sample_size = sizeof(SAMPLE);
+    oldest->stride = (ref->width + 2*SUBPEL_PAD + 7) & ~7;
+    oldest->num_bands = (ref->height + 2*SUBPEL_PAD + MAX_SB_SIZE - 1) / MAX_SB_SIZE;
+    for (int i = 0; i < SUBPEL_PLANES; i++) {
+      oldest->plane[i] = malloc(oldest->stride * (ref->height + 2*SUBPEL_PAD) * sizeof(SAMPLE));
+      if (!oldest->plane[i])
+        fatalerror("Memory allocation failed\n");
+    }
+    oldest->ready = (uint8_t *)malloc(oldest->num_bands);
+    if (!oldest->ready)
+      fatalerror("Memory allocation failed\n");
+  }
+  memset(oldest->ready, 0, oldest->num_bands);
+  oldest->frame = ref;
+  oldest->frame_num = ref->frame_num;
+  oldest->bipred = bipred;
+  oldest->bitdepth = bitdepth;
+  oldest->age = ++subpel_cache->count;
+}
+
+/* Return the cached prediction of the block at ref with a fractional motion vector,
+   clipped like in get_inter_prediction_luma, or NULL if it is not cached */
+SAMPLE *TEMPLATE(get_subpel_block)(subpel_ref_t *subpel_ref, SAMPLE *ref, int width, int height, mv_t *mv, int sign, int bipred, int xpos, int ypos)
+{
+  int mvy = sign ? -mv->y : mv->y;
+  int mvx = sign ? -mv->x : mv->x;
+  int frac = (mvy & 3) * 4 + (mvx & 3);
+  int ver_int = mvy >> 2;
+  int hor_int = mvx >> 2;
+  ver_int = min(ver_int, subpel_ref->height - ypos);
+  ver_int = max(ver_int, -xpos - height);
+  hor_int = min(hor_int, subpel_ref->width - xpos);
+  hor_int = max(hor_int, -xpos - width);
+
+  /* xpos and ypos may belong to an enclosing block so the position is taken from ref */
+  int offset = (int)(ref - (SAMPLE *)subpel_ref->frame->y);
+  int stride_y = subpel_ref->frame->stride_y;
+  int y = offset / stride_y + ver_int + SUBPEL_PAD;
+  int x = offset % stride_y + hor_int + SUBPEL_PAD;
+  if (!frac || bipred != subpel_ref->bipred || y < 0 || x < 0 ||
+      y + height > subpel_ref->height + 2*SUBPEL_PAD || x + width > subpel_ref->width + 2*SUBPEL_PAD)
+    return NULL;
+
+  for (int band = y / MAX_SB_SIZE; band <= (y + height - 1) / MAX_SB_SIZE; band++) {
+    if (!subpel_ref->ready[band])
+      TEMPLATE(interpolate_band)(subpel_ref, band);
+  }
+  return (SAMPLE *)subpel_ref->plane[frac-1] + y * subpel_ref->stride + x;
+}
+
+#ifndef HBD
+subpel_cache_t *create_subpel_cache(int size)
+{
+  subpel_cache_t *subpel_cache = (subpel_cache_t *)calloc(1, sizeof(subpel_cache_t));
+  if (subpel_cache)
+    subpel_cache->table = (subpel_ref_t *)calloc(size, sizeof(subpel_ref_t));
+  if (!subpel_cache || !subpel_cache->table)
+    fatalerror("Memory allocation failed\n");
+  subpel_cache->size = size;
+  return subpel_cache;
+}
+
+void close_subpel_cache(subpel_cache_t *subpel_cache)
+{
+  for (int i = 0; i < subpel_cache->size; i++) {
+    for (int j = 0; j < SUBPEL_PLANES; j++)
+      free(subpel_cache->table[i].plane[j]);
+    free(subpel_cache->table[i].ready);
+  }
+  free(subpel_cache->table);
+  free(subpel_cache);
+}
+
+/* Return the sub-pel planes of a reference frame, or NULL if it has none */
+subpel_ref_t *find_subpel_ref(subpel_cache_t *subpel_cache, const yuv_frame_t *ref)
+{
+  for (int i = 0; i < subpel_cache->size; i++) {
+    subpel_ref_t *subpel_ref = &subpel_cache->table[i];
+    if (subpel_ref->age && subpel_ref->frame == ref && subpel_ref->frame_num == ref->frame_num)
+      return subpel_ref;
+  }
+  return NULL;
+}
+#endif
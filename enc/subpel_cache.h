@@ -0,0 +1,67 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_SUBPEL_CACHE_H_)
+#define _SUBPEL_CACHE_H_
+
+#include "types.h"
+
+/* Cache of the interpolated sub-pel luma planes of the most recent reference frames */
+#define SUBPEL_PLANES 15                //Number of fractional positions in quarter-pel resolution
+#define SUBPEL_PAD (PADDING_Y - 8)      //Extension of the cached planes outside the frame
+
+typedef struct
+{
+  const yuv_frame_t *frame;      //Reference frame the planes belong to
+  int frame_num;
+  unsigned int age;
+  int width;
+  int height;
+  int stride;
+  int sample_size;
+  int bipred;
+  int bitdepth;
+  int num_bands;                 //Number of MAX_SB_SIZE rows of the padded planes
+  void *plane[SUBPEL_PLANES];    //Plane (ver_frac*4 + hor_frac - 1), origin at the top-left padded sample
+  uint8_t *ready;                //Bands that have been interpolated
+} subpel_ref_t;
+
+typedef struct subpel_cache
+{
+  subpel_ref_t *table;
+  int size;
+  unsigned int count;
+} subpel_cache_t;
+
+subpel_cache_t *create_subpel_cache(int size);
+void close_subpel_cache(subpel_cache_t *subpel_cache);
+subpel_ref_t *find_subpel_ref(subpel_cache_t *subpel_cache, const yuv_frame_t *ref);
+void add_subpel_ref_lbd(subpel_cache_t *subpel_cache, const yuv_frame_t *ref, int bipred, int bitdepth);
+void add_subpel_ref_hbd(subpel_cache_t *subpel_cache, const yuv_frame_t *ref, int bipred, int bitdepth);
+uint8_t *get_subpel_block_lbd(subpel_ref_t *subpel_ref, uint8_t *ref, int width, int height, mv_t *mv, int sign, int bipred, int xpos, int ypos);
+uint16_t *get_subpel_block_hbd(subpel_ref_t *subpel_ref, uint16_t *ref, int width, int height, mv_t *mv, int sign, int bipred, int xpos, int ypos);
+
+#endif
@@ -0,0 +1,822 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <memory.h>
+
+#include "global.h"
+#include "thorenc.h"
+#include "snr.h"
+#include "common_frame.h"
+#include "encode_frame.h"
+#include "putbits.h"
+#include "temporal_interp.h"
+#include "../common/simd.h"
+#include "rc.h"
+#include "rt_control.h"
+#include "hash_me.h"
+#include "subpel_cache.h"
+#include "thread.h"
+#include "wt_matrix.h"
+#include "write_bits.h"
+
+/* Input frames are kept from the first frame of the subgroup being coded
+   up to the first frame of the next subgroup */
+#define INPUT_BUFFER_SIZE (2*MAX_REORDER_BUFFER)
+
+// Coding order to display order
+static const int cd1[1] = {0};
+static const int cd2[2] = {1,0};
+static const int cd4[4] = {3,1,0,2};
+static const int cd8[8] = {7,3,1,5,0,2,4,6};
+static const int cd16[16] = {15,7,3,11,1,5,9,13,0,2,4,6,8,10,12,14};
+static const int* dyadic_reorder_code_to_display[5] = {cd1,cd2,cd4,cd8,cd16};
+
+// Display order to coding order
+static const int dc1[1+1] = {-1,0};
+static const int dc2[2+1] = {-2,1,0};
+static const int dc4[4+1] = {-4,2,1,3,0};
+static const int dc8[8+1] = {-8,4,2,5,1,6,3,7,0};
+static const int dc16[16+1] = {-16,8,4,9,2,10,5,11,1,12,6,13,3,14,7,15,0};
+static const int* dyadic_reorder_display_to_code[5] = {dc1,dc2,dc4,dc8,dc16};
+
+typedef struct
+{
+  thor_packet_t packet;
+  uint32_t offset;               //Position of the data in the output buffer
+} queued_packet_t;
+
+typedef enum {
+  REC_FREE,
+  REC_AVAILABLE,                 //Waiting to be pulled in display order
+  REC_OUTPUT                     //Held by the application
+} rec_state_t;
+
+/* Quality metrics of one frame, computed in the background while the next
+   frame is coded */
+typedef struct
+{
+  const enc_params *params;
+  yuv_frame_t *orig;
+  yuv_frame_t *rec;
+  int packet;                    //Index of the packet receiving the results
+  snrvals psnr;
+  snrvals ssim;
+} snr_job_t;
+
+struct thor_encoder
+{
+  enc_params params;             //Copy of the parameters, modified for the tail of the sequence
+  encoder_info_t encoder_info;
+  yuv_frame_t orig[2];           //Alternating so that the SNR of the previous frame can still use its input
+  yuv_frame_t ref[MAX_REF_FRAMES];
+  yuv_frame_t rec[MAX_REORDER_BUFFER+1];  // Last one is for temp use
+  rec_state_t rec_state[MAX_REORDER_BUFFER];
+  int last_frame_output;
+  stream_t stream;
+  rate_control_t rc;
+  rt_control_t rtc;
+  long frame_size;
+  int sequence_header_bits;
+
+  /* Input frames in display order */
+  uint8_t *input[INPUT_BUFFER_SIZE];
+  int num_input;
+  int end_of_input;
+
+  /* Position in the sequence */
+  int frame_num0;                //Last frame in display order of the next subgroup to code
+  int sub_gop;
+  int num_encoded_frames;
+  int min_interp_depth;
+  int last_intra_frame_num;
+  int last_PorI_frame;           //Sliding window position of the last P or I frame
+
+  /* Coded frames not pulled yet */
+  packet_buffer_t out;
+  queued_packet_t *packets;
+  int num_packets;
+  int max_packets;
+  int next_packet;
+
+  /* Quality metrics of the last coded frame */
+  thor_task_t *snr_task;
+  snr_job_t snr_job;
+  int snr_pending;
+};
+
+static const char * const enc_stage_names[NUM_ENC_STAGES] = {
+  "read", "interp", "me", "intra", "transform", "entropy", "blocks", "deblock",
+  "cdef_search", "cdef_filter", "clpf_search", "clpf_filter", "reference", "snr", "output"
+};
+
+#undef TEMPLATE
+#define TEMPLATE(func) (enc->params.frame_bitdepth == 8 ? func ## _lbd : func ## _hbd)
+
+static int reorder_frame_offset(int idx, int sub_gop, int dyadic)
+{
+  if (dyadic && sub_gop>1) {
+    return dyadic_reorder_code_to_display[log2i(sub_gop)][idx]-sub_gop+1;
+  } else {
+    if (idx==0) return 0;
+    else return idx-sub_gop;
+  }
+}
+
+static void snr_job_func(void *arg)
+{
+  snr_job_t *job = arg;
+  const enc_params *params = job->params;
+
+  if (params->snrcalc) {
+    if (params->frame_bitdepth == 8)
+      snr_yuv_lbd(&job->psnr, job->orig, job->rec, params->height, params->width, params->input_bitdepth);
+    else
+      snr_yuv_hbd(&job->psnr, job->orig, job->rec, params->height, params->width, params->input_bitdepth);
+  }
+  if (params->ssim) {
+    if (params->frame_bitdepth == 8)
+      ssim_yuv_lbd(&job->ssim, job->orig, job->rec, params->height, params->width, params->input_bitdepth);
+    else
+      ssim_yuv_hbd(&job->ssim, job->orig, job->rec, params->height, params->width, params->input_bitdepth);
+  }
+}
+
+/* Wait for the metrics of the last coded frame and store them in its packet */
+static void finish_snr(thor_encoder_t *enc)
+{
+  if (!enc->snr_pending)
+    return;
+  thor_task_wait(enc->snr_task);
+  enc->packets[enc->snr_job.packet].packet.psnr = enc->snr_job.psnr;
+  enc->packets[enc->snr_job.packet].packet.ssim = enc->snr_job.ssim;
+  enc->snr_pending = 0;
+}
+
+static queued_packet_t *new_packet(thor_encoder_t *enc)
+{
+  if (enc->num_packets == enc->max_packets) {
+    enc->max_packets = max(2*enc->max_packets, 16);
+    enc->packets = realloc(enc->packets, enc->max_packets * sizeof(*enc->packets));
+    if (!enc->packets)
+      fatalerror("Could not allocate packet queue.");
+  }
+  return &enc->packets[enc->num_packets++];
+}
+
+/* Set up and code the frame with display order number frame_num */
+static void encode_frame_num(thor_encoder_t *enc, int frame_num, int last_sub_gop)
+{
+  encoder_info_t *encoder_info = &enc->encoder_info;
+  enc_params *params = &enc->params;
+  stream_t *stream = &enc->stream;
+  int sub_gop = enc->sub_gop;
+  int num_encoded_frames = enc->num_encoded_frames;
+  int min_interp_depth = enc->min_interp_depth;
+  int last_PorI_frame = enc->last_PorI_frame;
+  int rec_buffer_idx;
+  int r,r1,r2,r3;
+
+  if (encoder_info->timer)
+    stage_frame_begin(encoder_info->timer);
+  encoder_info->frame_info.frame_num = frame_num;
+  rec_buffer_idx = encoder_info->frame_info.frame_num%MAX_REORDER_BUFFER;
+  encoder_info->rec = &enc->rec[rec_buffer_idx];
+  if (enc->rec_state[rec_buffer_idx] == REC_OUTPUT)
+    fatalerror("Reconstructed frame not released in time.");
+  encoder_info->tmp = &enc->rec[MAX_REORDER_BUFFER];
+  encoder_info->rec->frame_num = encoder_info->frame_info.frame_num;
+  if (params->num_reorder_pics==0) {
+    if (params->intra_period > 0)
+      encoder_info->frame_info.frame_type = ((num_encoded_frames%params->intra_period) == 0 ? I_FRAME : P_FRAME);
+    else
+      encoder_info->frame_info.frame_type = (num_encoded_frames == 0 ? I_FRAME : P_FRAME);
+  } else {
+    if (params->intra_period > 0)
+      encoder_info->frame_info.frame_type = ((encoder_info->frame_info.frame_num%params->intra_period) == 0 ? I_FRAME :
+          ((encoder_info->frame_info.frame_num%sub_gop)==0 ? P_FRAME : B_FRAME));
+    else
+      encoder_info->frame_info.frame_type = (encoder_info->frame_info.frame_num == 0 ? I_FRAME :
+          ((encoder_info->frame_info.frame_num%sub_gop)==0 ? P_FRAME : B_FRAME));
+  }
+
+  int coded_phase = (num_encoded_frames + sub_gop - 2) % sub_gop + 1;
+  int b_level = log2i(coded_phase);
+  encoder_info->frame_info.b_level = b_level;
+
+  encoder_info->frame_info.phase = encoder_info->frame_info.frame_num % (encoder_info->params->num_reorder_pics + 1);
+
+  /* Top level B frames are only used for prediction if more than two reference frames are allowed */
+  encoder_info->frame_info.non_ref = params->num_reorder_pics > 0 && params->dyadic_coding && !last_sub_gop &&
+    encoder_info->frame_info.frame_type == B_FRAME && b_level == log2i(sub_gop) - 1 && params->max_num_ref <= 2;
+
+  if (encoder_info->frame_info.frame_type == I_FRAME){
+    encoder_info->frame_info.qp = params->qp + params->dqpI;
+    enc->last_intra_frame_num = encoder_info->frame_info.frame_num;
+  }
+  else if (params->num_reorder_pics==0) {
+    if (num_encoded_frames % params->HQperiod)
+      encoder_info->frame_info.qp = (int)(params->mqpP*(float)params->qp) + params->dqpP;
+    else
+      encoder_info->frame_info.qp = params->qp;
+  } else {
+    if (encoder_info->frame_info.frame_num % sub_gop) {
+      if (params->dyadic_coding){
+        if (b_level == 0)
+          encoder_info->frame_info.qp = (int)(params->mqpB0*(float)params->qp) + params->dqpB0;
+        else if (b_level == 1)
+          encoder_info->frame_info.qp = (int)(params->mqpB1*(float)params->qp) + params->dqpB1;
+        else if (b_level == 2)
+          encoder_info->frame_info.qp = (int)(params->mqpB2*(float)params->qp) + params->dqpB2;
+        else if (b_level == 3)
+          encoder_info->frame_info.qp = (int)(params->mqpB3*(float)params->qp) + params->dqpB3;
+        else
+          encoder_info->frame_info.qp = (int)(params->mqpB*(float)params->qp) + params->dqpB;
+      }
+      else {
+        encoder_info->frame_info.qp = (int)(params->mqpB*(float)params->qp) + params->dqpB;
+      }
+    }  else {
+      if (encoder_info->frame_info.frame_num % params->HQperiod) {
+        encoder_info->frame_info.qp = (int)(params->mqpP*(float)params->qp) + params->dqpP;
+      } else
+        encoder_info->frame_info.qp = params->qp;
+    }
+  }
+  encoder_info->frame_info.qp = clip(encoder_info->frame_info.qp, 0, MAX_QP);
+
+  encoder_info->frame_info.num_ref = encoder_info->frame_info.frame_type == I_FRAME ? 0 : min(num_encoded_frames,params->max_num_ref);
+  encoder_info->frame_info.interp_ref = 0;
+
+  if (encoder_info->frame_info.num_ref > 0) {
+    if (params->num_reorder_pics > 0) {
+      if (params->dyadic_coding) {
+        /* if we have a P frame then use the previous P frame as a reference */
+        if ((num_encoded_frames-1) % sub_gop == 0) {
+          if (num_encoded_frames==1)
+            encoder_info->frame_info.ref_array[0] = 0;
+          else
+            encoder_info->frame_info.ref_array[0] = sub_gop-1;
+          if (encoder_info->frame_info.num_ref>1 )
+            encoder_info->frame_info.ref_array[1] = min(MAX_REF_FRAMES-1,min(num_encoded_frames-1,2*sub_gop-1));
+
+          for (r=2;r<encoder_info->frame_info.num_ref;r++){
+            encoder_info->frame_info.ref_array[r] = r-2;
+          }
+
+        } else if (encoder_info->frame_info.num_ref>0){
+
+          int display_phase =  (encoder_info->frame_info.frame_num-1) % sub_gop;
+          int ref_offset=sub_gop>>(b_level+1);
+          if (b_level >= min_interp_depth && params->interp_ref == 1) {
+            // Need to add another reference if we are at the beginning
+            if (encoder_info->frame_info.num_ref==2) encoder_info->frame_info.num_ref++;
+
+            encoder_info->frame_info.interp_ref = params->interp_ref;
+
+            encoder_info->frame_info.ref_array[1]=min(num_encoded_frames-1,coded_phase-dyadic_reorder_display_to_code[log2i(sub_gop)][display_phase-ref_offset+1]-1);
+            encoder_info->frame_info.ref_array[2]=min(num_encoded_frames-1,coded_phase-dyadic_reorder_display_to_code[log2i(sub_gop)][display_phase+ref_offset+1]-1);
+
+            // Interpolate these two reference frames to make a new frame
+            encoder_info->frame_info.ref_array[0]=-1;
+            // Add this interpolated frame to the reference buffer and use it as the first reference
+            yuv_frame_t* ref1=encoder_info->ref[encoder_info->frame_info.ref_array[1]];
+            yuv_frame_t* ref2=encoder_info->ref[encoder_info->frame_info.ref_array[2]];
+            STAGE_BEGIN(encoder_info->timer, ENC_STAGE_INTERP);
+            TEMPLATE(interpolate_frames)(encoder_info->interp_frames[0], ref1, ref2, 2, 1, encoder_info->workers);
+            STAGE_END(encoder_info->timer);
+            TEMPLATE(pad_yuv_frame)(encoder_info->interp_frames[0]);
+            encoder_info->interp_frames[0]->frame_num = encoder_info->frame_info.frame_num;
+            /* use most recent frames for the last ref(s)*/
+            for (r=3;r<encoder_info->frame_info.num_ref;r++){
+              encoder_info->frame_info.ref_array[r] = r-3;
+            }
+          } else {
+            encoder_info->frame_info.ref_array[0]=min(num_encoded_frames-1,coded_phase-dyadic_reorder_display_to_code[log2i(sub_gop)][display_phase-ref_offset+1]-1);
+            encoder_info->frame_info.ref_array[1]=min(num_encoded_frames-1,coded_phase-dyadic_reorder_display_to_code[log2i(sub_gop)][display_phase+ref_offset+1]-1);
+
+            /* use most recent frames for the last ref(s)*/
+            for (r=2;r<encoder_info->frame_info.num_ref;r++){
+              encoder_info->frame_info.ref_array[r] = r-2;
+            }
+
+          }
+        }
+      } else {
+        /* if we have a P frame then use the previous P frame as a reference */
+        if ((num_encoded_frames-1) % sub_gop == 0) {
+          if (num_encoded_frames==1)
+            encoder_info->frame_info.ref_array[0] = 0;
+          else
+            encoder_info->frame_info.ref_array[0] = sub_gop-1;
+          if (encoder_info->frame_info.num_ref>1 )
+            encoder_info->frame_info.ref_array[1] = min(MAX_REF_FRAMES-1,min(num_encoded_frames-1,2*sub_gop-1));
+
+          for (r=2;r<encoder_info->frame_info.num_ref;r++){
+            encoder_info->frame_info.ref_array[r] = r-1;
+          }
+
+        } else {
+          if (params->interp_ref > 0 && params->interp_ref == 1) {
+            // Need to add another reference if we are at the beginning
+            if (encoder_info->frame_info.num_ref==2) encoder_info->frame_info.num_ref++;
+
+            encoder_info->frame_info.interp_ref = params->interp_ref;
+
+            // Use the last encoded frame as the first true ref
+            if (encoder_info->frame_info.num_ref>0) {
+              encoder_info->frame_info.ref_array[1] = 0;
+            }
+            /* Use the subsequent P frame as the 2nd ref */
+            int phase = (num_encoded_frames + sub_gop - 2) % sub_gop;
+            if (encoder_info->frame_info.num_ref>1) {
+              if (phase==0)
+                encoder_info->frame_info.ref_array[2] = min(sub_gop, num_encoded_frames-1);
+              else
+                encoder_info->frame_info.ref_array[2] = min(phase, num_encoded_frames-1);
+            }
+            // Interpolate these two reference frames to make a new frame
+            encoder_info->frame_info.ref_array[0]=-1;
+            // Add this interpolated frame to the reference buffer and use it as the first reference
+            yuv_frame_t* ref1=encoder_info->ref[encoder_info->frame_info.ref_array[1]];
+            yuv_frame_t* ref2=encoder_info->ref[encoder_info->frame_info.ref_array[2]];
+            STAGE_BEGIN(encoder_info->timer, ENC_STAGE_INTERP);
+            TEMPLATE(interpolate_frames)(encoder_info->interp_frames[0], ref1, ref2, sub_gop-phase,phase!=0 ? 1 : sub_gop-phase-1, encoder_info->workers);
+            STAGE_END(encoder_info->timer);
+            TEMPLATE(pad_yuv_frame)(encoder_info->interp_frames[0]);
+            encoder_info->interp_frames[0]->frame_num = encoder_info->frame_info.frame_num;
+
+            /* Use the prior P frame as the 4th ref */
+            if (encoder_info->frame_info.num_ref>2) {
+              encoder_info->frame_info.ref_array[3] = min(phase ? phase + sub_gop : 2*sub_gop, num_encoded_frames-1);
+            }
+            /* use most recent frames for the last ref(s)*/
+            for (r=4;r<encoder_info->frame_info.num_ref;r++){
+              encoder_info->frame_info.ref_array[r] = r-4+1;
+            }
+
+
+          } else {
+            // Use the last encoded frame as the first ref
+            if (encoder_info->frame_info.num_ref>0) {
+              encoder_info->frame_info.ref_array[0] = 0;
+            }
+            /* Use the subsequent P frame as the 2nd ref */
+            int phase = (num_encoded_frames + sub_gop - 2) % sub_gop;
+            if (encoder_info->frame_info.num_ref>1) {
+              if (phase==0)
+                encoder_info->frame_info.ref_array[1] = min(sub_gop, num_encoded_frames-1);
+              else
+                encoder_info->frame_info.ref_array[1] = min(phase, num_encoded_frames-1);
+            }
+            /* Use the prior P frame as the 3rd ref */
+            if (encoder_info->frame_info.num_ref>2) {
+              encoder_info->frame_info.ref_array[2] = min(phase ? phase + sub_gop : 2*sub_gop, num_encoded_frames-1);
+            }
+            /* use most recent frames for the last ref(s)*/
+            for (r=3;r<encoder_info->frame_info.num_ref;r++){
+              encoder_info->frame_info.ref_array[r] = r-3+1;
+            }
+          }
+        }
+      }
+
+      if (encoder_info->params->num_reorder_pics == 2 && encoder_info->frame_info.frame_type == B_FRAME && b_level == 0) {
+        int off = encoder_info->params->interp_ref == 1 ? 1 : 0;
+        int tmp = encoder_info->frame_info.ref_array[0 + off];
+        encoder_info->frame_info.ref_array[0 + off] = encoder_info->frame_info.ref_array[1 + off];
+        encoder_info->frame_info.ref_array[1 + off] = tmp;
+      }
+
+    } else {
+      if (encoder_info->frame_info.num_ref>=1){
+        /* If num_ref==1 always use most recent frame */
+        encoder_info->frame_info.ref_array[0] = last_PorI_frame;
+      }
+
+      if (encoder_info->frame_info.num_ref==2){
+        /* If num_ref==2 use most recent LQ frame and most recent HQ frame */
+        r1 = ((num_encoded_frames + params->HQperiod - 2) % params->HQperiod) + 1;
+        encoder_info->frame_info.ref_array[1] = r1;
+      }
+      else if (encoder_info->frame_info.num_ref==3){
+        r1 = ((num_encoded_frames + params->HQperiod - 2) % params->HQperiod) + 1;
+        r2 = r1==1 ? 2 : 1;
+        encoder_info->frame_info.ref_array[1] = r1;
+        encoder_info->frame_info.ref_array[2] = r2;
+      }
+      else if (encoder_info->frame_info.num_ref==4){
+        r1 = ((num_encoded_frames + params->HQperiod - 2) % params->HQperiod) + 1;
+        r2 = r1==1 ? 2 : 1;
+        r3 = r2+1;
+        if (r3==r1) r3 += 1;
+        encoder_info->frame_info.ref_array[1] = r1;
+        encoder_info->frame_info.ref_array[2] = r2;
+        encoder_info->frame_info.ref_array[3] = r3;
+      }
+      else{
+        for (r=1;r<encoder_info->frame_info.num_ref;r++){
+          encoder_info->frame_info.ref_array[r] = r;
+        }
+      }
+    }
+  }
+
+  // Remove duplicate reference frames
+  for (r=encoder_info->frame_info.num_ref-1; r>0; --r){
+    for (int k=r-1; k>=0; --k) {
+      if (encoder_info->frame_info.ref_array[k] == encoder_info->frame_info.ref_array[r]) {
+        // remove rth element
+        for (int s=r; s<encoder_info->frame_info.num_ref-1; ++s) {
+          encoder_info->frame_info.ref_array[s]=encoder_info->frame_info.ref_array[s+1];
+        }
+        encoder_info->frame_info.num_ref--;
+        break;
+      }
+
+    }
+  }
+
+  // Remove reference frames which break random access
+  if (encoder_info->frame_info.frame_num > enc->last_intra_frame_num) {
+    for (r=encoder_info->frame_info.num_ref-1; r>=0; --r){
+      if (encoder_info->frame_info.ref_array[r]>=0) {
+        int ref_frame_num=encoder_info->ref[encoder_info->frame_info.ref_array[r]]->frame_num;
+        if (ref_frame_num < enc->last_intra_frame_num) {
+          // remove this reference
+          for (int s=r; s<encoder_info->frame_info.num_ref-1; ++s) {
+            encoder_info->frame_info.ref_array[s]=encoder_info->frame_info.ref_array[s+1];
+          }
+          encoder_info->frame_info.num_ref--;
+        }
+      }
+    }
+  }
+
+  /* Adapt encoder effort to the real-time frame budget */
+  encoder_info->frame_info.tb_split_search = params->enable_tb_split;
+  if (encoder_info->rtc)
+    rt_control_frame_start(encoder_info->rtc, encoder_info);
+
+  if (params->intra_rdo == 0 || (encoder_info->frame_info.frame_type != I_FRAME && params->encoder_speed > 0))
+    encoder_info->frame_info.num_intra_modes = 4;
+  else
+    encoder_info->frame_info.num_intra_modes = MAX_NUM_INTRA_MODES;
+
+#if 0
+  /* To test sliding window operation */
+  int offsetx = 500;
+  int offsety = 200;
+  int offset_rec = offsety * encoder_info->rec->stride_y +  offsetx;
+  int offset_ref = offsety * encoder_info->ref[0]->stride_y +  offsetx;
+  if (encoder_info->frame_info.num_ref==2){
+    int r0 = encoder_info->frame_info.ref_array[0];
+    int r1 = encoder_info->frame_info.ref_array[1];
+    printf("ref0=%3d ref1=%3d ",encoder_info->ref[r0]->y[offset_ref],encoder_info->ref[r1]->y[offset_ref]);
+  }
+  else{
+    printf("ref0=XXX ref1=XXX ");
+  }
+#endif
+
+  /* Read input frame */
+  encoder_info->orig = &enc->orig[num_encoded_frames & 1];
+  STAGE_BEGIN(encoder_info->timer, ENC_STAGE_READ);
+  TEMPLATE(read_yuv_frame)(encoder_info->orig, enc->input[frame_num % INPUT_BUFFER_SIZE]);
+  STAGE_END(encoder_info->timer);
+  encoder_info->orig->frame_num = encoder_info->frame_info.frame_num;
+
+  queued_packet_t *queued = new_packet(enc);
+  thor_packet_t *packet = &queued->packet;
+  memset(packet, 0, sizeof(*packet));
+  packet->frame_num = frame_num;
+  packet->frame_type = encoder_info->frame_info.frame_type;
+  packet->num_ref = encoder_info->frame_info.num_ref;
+  for (r = 0; r < encoder_info->frame_info.num_ref; r++) {
+    packet->ref_array[r] = encoder_info->frame_info.ref_array[r];
+    packet->ref_frame_num[r] = packet->ref_array[r] >= 0 ? encoder_info->ref[packet->ref_array[r]]->frame_num : -1;
+  }
+  queued->offset = enc->out.size;
+
+  /* Encode frame */
+  int start_bits = get_bit_pos(stream);
+  TEMPLATE(encode_frame)(encoder_info);
+  if (encoder_info->rtc)
+    rt_control_frame_end(encoder_info->rtc, encoder_info);
+
+  enc->rec_state[rec_buffer_idx]=REC_AVAILABLE;
+  packet->bits = get_bit_pos(stream) - start_bits;
+  packet->qp = encoder_info->frame_info.qp;
+  enc->num_encoded_frames++;
+
+  /* Compute SNR in the background while the next frame is coded. The
+     input and reconstruction are left alone until then, since the input
+     frames alternate and a reconstruction buffer is only reused
+     MAX_REORDER_BUFFER frames later. */
+  if (enc->snr_task){
+    STAGE_BEGIN(encoder_info->timer, ENC_STAGE_SNR);
+    finish_snr(enc);
+    enc->snr_job.params = params;
+    enc->snr_job.orig = encoder_info->orig;
+    enc->snr_job.rec = &enc->rec[rec_buffer_idx];
+    enc->snr_job.packet = queued - enc->packets;
+    memset(&enc->snr_job.psnr, 0, sizeof(snrvals));
+    memset(&enc->snr_job.ssim, 0, sizeof(snrvals));
+    thor_task_run(enc->snr_task, snr_job_func, &enc->snr_job);
+    enc->snr_pending = 1;
+    STAGE_END(encoder_info->timer);
+  }
+  if (encoder_info->rtc) {
+    packet->rt_level = enc->rtc.row_level;
+    packet->rt_time = enc->rtc.last_time;
+  }
+
+  /* Move the compressed bits for this frame to the output buffer */
+  STAGE_BEGIN(encoder_info->timer, ENC_STAGE_OUTPUT);
+  flush_all_bits(stream, &enc->out);
+  packet->size = enc->out.size - queued->offset;
+  STAGE_END(encoder_info->timer);
+
+  if (encoder_info->timer)
+    stage_frame_end(encoder_info->timer, frame_num, encoder_info->frame_info.frame_type, packet->bits);
+
+  // Keep track of when the last anchor frame was in the sliding window
+  enc->last_PorI_frame = (encoder_info->frame_info.frame_type != B_FRAME ? 0 : last_PorI_frame+1);
+}
+
+/* Code the subgroups for which all frames and the first frame of the next
+   subgroup (or the end of the sequence) are available */
+static void encode_available_frames(thor_encoder_t *enc)
+{
+  while (enc->frame_num0 < enc->num_input) {
+    int sub_gop = enc->sub_gop;
+    // The frames of the last full subgop may be referenced by the PPP coded tail
+    int last_sub_gop = enc->frame_num0 + sub_gop >= enc->num_input;
+    if (last_sub_gop && !enc->end_of_input)
+      break;
+
+    for (int k=0; k<sub_gop; k++) {
+      int frame_num = enc->frame_num0 + reorder_frame_offset(k,sub_gop,enc->params.dyadic_coding);
+      // If there is an initial I frame and reordering need to jump to the next P frame
+      if (frame_num < 0) continue;
+      encode_frame_num(enc, frame_num, last_sub_gop);
+    }
+
+    /* Revert to PPP coding if our subgop does not fit in. Keeping track of the last anchor frame
+       should mean that the first reference is correct when we do, although subsequent references
+       may not be ideal.
+     */
+    if (last_sub_gop && sub_gop>=2) {
+      enc->params.HQperiod = sub_gop;
+      enc->sub_gop = 1;
+      enc->params.num_reorder_pics = 0;
+    }
+    enc->frame_num0 += enc->sub_gop;
+  }
+}
+
+thor_encoder_t *thor_encoder_create(const enc_params *user_params)
+{
+  thor_encoder_t *enc = calloc(1, sizeof(thor_encoder_t));
+  if (!enc)
+    fatalerror("Could not allocate encoder.");
+  enc->params = *user_params;
+
+  enc_params *params = &enc->params;
+  encoder_info_t *encoder_info = &enc->encoder_info;
+  int width = params->width;
+  int height = params->height;
+  int ysize = height * width;
+  int csize = ((ysize >> 2*(params->subsample != 444)) << (params->subsample == 422)) * (params->subsample != 400);
+  int r;
+
+  init_use_simd();
+
+  enc->frame_size = (ysize + 2*csize) * (1 + (params->input_bitdepth > 8));
+  encoder_info->params = params;
+
+  /* Create frames*/
+  for (r=0;r<2;r++){
+    TEMPLATE(create_yuv_frame)(&enc->orig[r],width,height,params->subsample,0,0,params->bitdepth,params->input_bitdepth);
+  }
+  for (r=0;r<MAX_REORDER_BUFFER+1;r++){
+    TEMPLATE(create_yuv_frame)(&enc->rec[r],width,height,params->subsample,0,0,params->bitdepth,params->input_bitdepth);
+  }
+  for (r=0;r<MAX_REF_FRAMES;r++){ //TODO: Use Long-term frame instead of a large sliding window
+    TEMPLATE(create_yuv_frame)(&enc->ref[r],width,height,params->subsample,PADDING_Y,PADDING_Y,params->bitdepth,params->input_bitdepth);
+  }
+  if (params->interp_ref) {
+    for (r=0;r<MAX_SKIP_FRAMES;r++){
+      encoder_info->interp_frames[r] = malloc(sizeof(yuv_frame_t));
+      TEMPLATE(create_yuv_frame)(encoder_info->interp_frames[r],width,height,params->subsample,PADDING_Y,PADDING_Y,params->bitdepth,params->input_bitdepth);
+    }
+  }
+
+  /* Initialize main bit stream */
+  stream_t *stream = &enc->stream;
+  stream->bitstream = (uint8_t *)malloc(MAX_BUFFER_SIZE * sizeof(uint8_t));
+  stream->bitbuf = 0;
+  stream->bitrest = 32;
+  stream->bytepos = 0;
+  stream->unit_bytes = 0;
+  stream->bytesize = MAX_BUFFER_SIZE;
+
+  /* Configure encoder */
+  encoder_info->orig = &enc->orig[0];
+  for (r=0;r<MAX_REF_FRAMES;r++){
+    encoder_info->ref[r] = &enc->ref[r];
+  }
+  encoder_info->stream = stream;
+  encoder_info->out = &enc->out;
+  encoder_info->width = width;
+  encoder_info->height = height;
+  encoder_info->frame_info.max_clpf_strength = params->max_clpf_strength;
+
+  encoder_info->deblock_data = (deblock_data_t *)malloc((height/MIN_PB_SIZE) * (width/MIN_PB_SIZE) * sizeof(deblock_data_t));
+
+#if CDEF
+  int nhfb = (height + CDEF_BLOCKSIZE - 1) >> CDEF_BLOCKSIZE_LOG2;
+  int nvfb = (width + CDEF_BLOCKSIZE - 1) >> CDEF_BLOCKSIZE_LOG2;
+  encoder_info->cdef = malloc(nhfb * nvfb * sizeof(*encoder_info->cdef));
+#endif
+
+  alloc_wmatrices(encoder_info->wmatrix, 0);
+  alloc_wmatrices(encoder_info->iwmatrix, 1);
+
+  /* Write sequence header, it is output with the first frame */
+  int start_bits = get_bit_pos(stream);
+  write_sequence_header(stream, params);
+  enc->sequence_header_bits = get_bit_pos(stream) - start_bits;
+
+  enc->sub_gop = max(1,params->num_reorder_pics+1);
+  enc->min_interp_depth = log2i(params->num_reorder_pics+1)-3;
+  if (params->frame_rate > 30) enc->min_interp_depth--;
+  enc->last_PorI_frame = -1;
+  enc->last_frame_output = -1;
+
+  encoder_info->rc = &enc->rc;
+  if (params->bitrate > 0) {
+    int target_bits = (int)(params->bitrate / params->frame_rate);
+    int sb_size = 1 << params->log2_sb_size;
+    int num_sb = ((width + sb_size - 1) / sb_size) * ((height + sb_size - 1) / sb_size);
+    init_rate_control_per_sequence(&enc->rc, target_bits, num_sb);
+  }
+
+  encoder_info->rtc = NULL;
+  if (params->target_fps > 0) {
+    init_rt_control(&enc->rtc, params);
+    encoder_info->rtc = &enc->rtc;
+  }
+
+  encoder_info->hash_me = params->hash_me ? create_hash_me() : NULL;
+  encoder_info->subpel_cache = params->subpel_cache && params->encoder_speed == 0 ? create_subpel_cache(params->subpel_cache) : NULL;
+  encoder_info->workers = thor_workers_create(params->threads ? params->threads : min(thor_num_cpus(), MAX_THREADS));
+  encoder_info->timer = params->timingfilestr ? create_stage_timer(params->timingfilestr, enc_stage_names, NUM_ENC_STAGES, params->perf) : NULL;
+  enc->snr_task = params->snrcalc || params->ssim ? thor_task_create() : NULL;
+
+  return enc;
+}
+
+void thor_encoder_close(thor_encoder_t *enc)
+{
+  encoder_info_t *encoder_info = &enc->encoder_info;
+  int r;
+
+  if (enc->snr_task) {
+    finish_snr(enc);
+    thor_task_close(enc->snr_task);
+  }
+  for (r=0;r<2;r++){
+    TEMPLATE(close_yuv_frame)(&enc->orig[r]);
+  }
+  for (r=0; r<MAX_REORDER_BUFFER+1; ++r) {
+    TEMPLATE(close_yuv_frame)(&enc->rec[r]);
+  }
+  for (r=0;r<MAX_REF_FRAMES;r++){
+    TEMPLATE(close_yuv_frame)(&enc->ref[r]);
+  }
+  if (enc->params.interp_ref) {
+    for (r=0;r<MAX_SKIP_FRAMES;r++){
+      TEMPLATE(close_yuv_frame)(encoder_info->interp_frames[r]);
+      free(encoder_info->interp_frames[r]);
+    }
+  }
+  for (r=0; r<INPUT_BUFFER_SIZE; r++)
+    free(enc->input[r]);
+
+  free(enc->stream.bitstream);
+  free(enc->out.data);
+  free(enc->packets);
+  free(encoder_info->deblock_data);
+#if CDEF
+  free(encoder_info->cdef);
+#endif
+  if (encoder_info->hash_me)
+    close_hash_me(encoder_info->hash_me);
+  if (encoder_info->subpel_cache)
+    close_subpel_cache(encoder_info->subpel_cache);
+  thor_workers_close(encoder_info->workers);
+  if (encoder_info->timer)
+    close_stage_timer(encoder_info->timer);
+  if (enc->params.bitrate > 0)
+    delete_rate_control_per_sequence(&enc->rc);
+  free(enc);
+}
+
+long thor_encoder_frame_size(const thor_encoder_t *enc)
+{
+  return enc->frame_size;
+}
+
+void thor_encoder_push_frame(thor_encoder_t *enc, const uint8_t *frame)
+{
+  /* Data of pulled packets is no longer needed */
+  if (enc->next_packet == enc->num_packets) {
+    enc->num_packets = enc->next_packet = 0;
+    enc->out.size = 0;
+  }
+
+  if (frame) {
+    uint8_t **input = &enc->input[enc->num_input % INPUT_BUFFER_SIZE];
+    if (enc->end_of_input)
+      fatalerror("Frame pushed after the end of the sequence.");
+    if (!*input && !(*input = malloc(enc->frame_size)))
+      fatalerror("Could not allocate input frame.");
+    memcpy(*input, frame, enc->frame_size);
+    enc->num_input++;
+  } else
+    enc->end_of_input = 1;
+
+  encode_available_frames(enc);
+}
+
+int thor_encoder_pull_packet(thor_encoder_t *enc, thor_packet_t *packet)
+{
+  if (enc->next_packet == enc->num_packets)
+    return 0;
+  if (enc->snr_pending && enc->snr_job.packet == enc->next_packet)
+    finish_snr(enc);
+  queued_packet_t *queued = &enc->packets[enc->next_packet++];
+  *packet = queued->packet;
+  packet->data = enc->out.data + queued->offset;
+  return 1;
+}
+
+yuv_frame_t *thor_encoder_pull_recon(thor_encoder_t *enc)
+{
+  int idx = (enc->last_frame_output+1) % MAX_REORDER_BUFFER;
+  if (enc->rec_state[idx] != REC_AVAILABLE)
+    return NULL;
+  enc->rec_state[idx] = REC_OUTPUT;
+  enc->last_frame_output++;
+  return &enc->rec[idx];
+}
+
+void thor_encoder_release_recon(thor_encoder_t *enc, const yuv_frame_t *frame)
+{
+  int idx = (int)(frame - enc->rec);
+  if (idx < 0 || idx >= MAX_REORDER_BUFFER || enc->rec_state[idx] != REC_OUTPUT)
+    fatalerror("Released a frame not returned by thor_encoder_pull_recon().");
+  enc->rec_state[idx] = REC_FREE;
+}
+
+int thor_encoder_sequence_header_bits(const thor_encoder_t *enc)
+{
+  return enc->sequence_header_bits;
+}
+
+const search_stats_t *thor_encoder_search_stats(const thor_encoder_t *enc)
+{
+  return &enc->encoder_info.search_stats;
+}
+
+const rt_control_t *thor_encoder_rt_control(const thor_encoder_t *enc)
+{
+  return enc->encoder_info.rtc;
+}
@@ -0,0 +1,93 @@
+/*
+Copyright (c) 2015, Cisco Systems
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+* Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+
+* Redistributions in binary form must reproduce the above copyright notice, this
+list of conditions and the following disclaimer in the documentation and/or
+other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#if !defined(_THORENC_H_)
+#define _THORENC_H_
+
+#include <stdint.h>
+#include "mainenc.h"
+#include "rt_control.h"
+
+/* Encoder library interface. Frames are pushed in display order and coded
+   frames are pulled in decoding order. All state is kept in the encoder
+   handle, so several encoders may be used in one process, each from one
+   thread at a time. */
+
+typedef struct thor_encoder thor_encoder_t;
+
+typedef struct
+{
+  const uint8_t *data;           //Coded frame as stored in a Thor bitstream file, including the unit sizes
+  uint32_t size;                 //Bytes in data
+  int frame_num;                 //Display order number, starting from 0 for the first frame pushed
+  frame_type_t frame_type;
+  int qp;
+  int bits;                      //Frame bits, excluding the sequence header
+  snrvals psnr;                  //PSNR against the input frame if snrcalc is set, otherwise 0
+  snrvals ssim;                  //SSIM against the input frame if ssim is set, otherwise 0
+  int num_ref;
+  int ref_array[MAX_REF_FRAMES]; //Reference buffer indices, -1 for an interpolated reference
+  int ref_frame_num[MAX_REF_FRAMES]; //Display order number of each reference, -1 for an interpolated one
+  int rt_level;                  //Effort level of the last SB row if target_fps is set
+  double rt_time;                //Encoding time in seconds if target_fps is set
+} thor_packet_t;
+
+/* The parameters are copied and must have passed check_parameters().
+   Of the file names only timingfilestr is opened. reconfilestr is only
+   tested for being set, which makes the encoder complete the reconstruction
+   of non-reference frames for thor_encoder_pull_recon(). */
+thor_encoder_t *thor_encoder_create(const enc_params *params);
+void thor_encoder_close(thor_encoder_t *enc);
+
+/* Bytes of an input frame: planar Y, U and V with two bytes per sample if input_bitdepth > 8 */
+long thor_encoder_frame_size(const thor_encoder_t *enc);
+
+/* Push the next frame in display order, or NULL at the end of the sequence.
+   The frame is copied. Coded frames become available as soon as their
+   subgroup and the first frame of the next subgroup have been pushed. */
+void thor_encoder_push_frame(thor_encoder_t *enc, const uint8_t *frame);
+
+/* Return 1 and the next coded frame in decoding order, or 0 if none is
+   ready. The data is valid until the next call to thor_encoder_push_frame(). */
+int thor_encoder_pull_packet(thor_encoder_t *enc, thor_packet_t *packet);
+
+/* Return the next reconstructed frame in display order, or NULL if none is
+   ready. Reconstructed frames not pulled before the next call to
+   thor_encoder_push_frame() may be overwritten. A pulled frame stays valid
+   and unchanged until it is given back with thor_encoder_release_recon(),
+   which may be after later frames have been coded. The encoder stops with
+   an error if it needs a frame that is still held, which does not happen
+   while frames are pulled after each thor_encoder_push_frame() and at most
+   MAX_REORDER_BUFFER/2 of them are held. */
+yuv_frame_t *thor_encoder_pull_recon(thor_encoder_t *enc);
+void thor_encoder_release_recon(thor_encoder_t *enc, const yuv_frame_t *frame);
+
+int thor_encoder_sequence_header_bits(const thor_encoder_t *enc);
+const search_stats_t *thor_encoder_search_stats(const thor_encoder_t *enc);
+/* NULL unless target_fps is set */
+const rt_control_t *thor_encoder_rt_control(const thor_encoder_t *enc);
+
+#endif
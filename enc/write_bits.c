@@ -44,7 +44,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 extern int zigzag16[16];
 extern int zigzag64[64];
 extern int zigzag256[256];
-extern int YPOS,XPOS;
 
 void write_sequence_header(stream_t *stream, enc_params *params) {
   put_flc(16, params->width, stream);
@@ -76,6 +75,9 @@ void write_sequence_header(stream_t *stream, enc_params *params) {
   put_flc(1, params->input_bitdepth != 8, stream);
   if (params->input_bitdepth != 8)
     put_flc(1, params->input_bitdepth == 12, stream);
+  put_flc(1, params->sb_rows_per_unit != 0, stream);
+  if (params->sb_rows_per_unit)
+    put_flc(6, params->sb_rows_per_unit - 1, stream);
 }
 
 #if CDEF
@@ -114,9 +116,16 @@ void write_frame_header(stream_t *stream, encoder_info_t *enc_info) {
   // 16 bit frame number for now
   put_flc(16, frame_info->frame_num, stream);
 
+  // Non-reference frames are not stored in the reference buffer
+  if (frame_info->frame_type != I_FRAME)
+    put_flc(1, frame_info->non_ref, stream);
+
 #if CDEF
-  read_stream_pos(&enc_info->cdef_header_pos, stream);
-  write_cdef_params(stream, enc_info);
+  // In low-delay mode the header is sent before the filters have been decided
+  if (!enc_info->params->sb_rows_per_unit) {
+    read_stream_pos(&enc_info->cdef_header_pos, stream);
+    write_cdef_params(stream, enc_info);
+  }
 #endif
 }
 